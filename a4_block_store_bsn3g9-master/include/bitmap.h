@@ -18,6 +18,9 @@ typedef struct bitmap bitmap_t;
 
 // But is there really such a thing as a high-performance shared library?
 
+// Counting and searching run 64 bits at a time, or 256 with AVX2, picked at runtime by what the
+// CPU supports. Set BITMAP_KERNEL to "word" or "popcnt" to use a fallback instead.
+
 ///
 /// Sets requested bit in bitmap
 /// \param bitmap The bitmap
@@ -47,6 +50,54 @@ bool bitmap_test(const bitmap_t *const bitmap, const size_t bit);
 ///
 void bitmap_flip(bitmap_t *const bitmap, const size_t bit);
 
+///
+/// Sets a run of bits in bitmap
+///  (bits past the end of the bitmap are left out)
+/// \param bitmap The bitmap
+/// \param start The first bit to set
+/// \param count The number of bits to set
+///
+void bitmap_set_range(bitmap_t *const bitmap, const size_t start, const size_t count);
+
+///
+/// Clears a run of bits in bitmap
+///  (bits past the end of the bitmap are left out)
+/// \param bitmap The bitmap
+/// \param start The first bit to clear
+/// \param count The number of bits to clear
+///
+void bitmap_reset_range(bitmap_t *const bitmap, const size_t start, const size_t count);
+
+///
+/// Tests whether every bit of a run is set
+///  (bits past the end of the bitmap are left out)
+/// \param bitmap The bitmap
+/// \param start The first bit of the run
+/// \param count The number of bits in the run
+/// \return true if none of them is zero (so also for an empty run), false on error
+///
+bool bitmap_test_range_all(const bitmap_t *const bitmap, const size_t start, const size_t count);
+
+///
+/// Tests whether any bit of a run is set
+///  (bits past the end of the bitmap are left out)
+/// \param bitmap The bitmap
+/// \param start The first bit of the run
+/// \param count The number of bits in the run
+/// \return true if at least one of them is set, false on error
+///
+bool bitmap_test_range_any(const bitmap_t *const bitmap, const size_t start, const size_t count);
+
+///
+/// Counts the bits set in a run
+///  (bits past the end of the bitmap are left out)
+/// \param bitmap The bitmap
+/// \param start The first bit of the run
+/// \param count The number of bits in the run
+/// \return The number of bits set in the run, 0 on error
+///
+size_t bitmap_count_range(const bitmap_t *const bitmap, const size_t start, const size_t count);
+
 ///
 /// Flips all bits in the bitmap
 /// \param bitmap The bitmap to invert
@@ -67,6 +118,41 @@ size_t bitmap_ffs(const bitmap_t *const bitmap);
 ///
 size_t bitmap_ffz(const bitmap_t *const bitmap);
 
+///
+/// Find next set
+/// \param bitmap The bitmap
+/// \param start The first bit address to look at
+/// \return The first one bit address at or after start, SIZE_MAX on error/not found
+///
+size_t bitmap_find_next_set(const bitmap_t *const bitmap, const size_t start);
+
+///
+/// Find next zero
+/// \param bitmap The bitmap
+/// \param start The first bit address to look at
+/// \return The first zero bit address at or after start, SIZE_MAX on error/not found
+///
+size_t bitmap_find_next_zero(const bitmap_t *const bitmap, const size_t start);
+
+///
+/// Find a run of zeros
+///  Looks from start_hint to the end, then from the start, so the first run at or after the
+///  hint wins, and the first in the bitmap if there is none there
+/// \param bitmap The bitmap
+/// \param k The length of the run
+/// \param start_hint Where to start looking (0 past the end)
+/// \return The first bit address of k consecutive zero bits, SIZE_MAX on error/not found
+///
+size_t bitmap_find_zero_run(const bitmap_t *const bitmap, const size_t k, const size_t start_hint);
+
+///
+/// Find the longest run of zeros
+/// \param bitmap The bitmap
+/// \param start Where to put its first bit address (SIZE_MAX if there is none), may be NULL
+/// \return The length of the first longest run of zero bits, 0 on error/not found
+///
+size_t bitmap_largest_zero_run(const bitmap_t *const bitmap, size_t *const start);
+
 ///
 /// Count all bits set
 /// \param bitmap the bitmap
@@ -47,6 +47,31 @@ extern "C"
 	///
 	void block_store_release(block_store_t *const bs, const size_t block_id);
 
+	///
+	/// Searches for a run of free blocks, marks them as in use, and returns the first block's id
+	/// \param bs BS device
+	/// \param count The number of blocks in the run
+	/// \return First allocated block's id, SIZE_MAX on error
+	///
+	size_t block_store_allocate_range(block_store_t *const bs, const size_t count);
+
+	///
+	/// Attempts to allocate a run of blocks, all of them or none
+	/// \param bs BS device
+	/// \param block_id The first block of the run
+	/// \param count The number of blocks in the run
+	/// \return true if every block was free and is now in use, false otherwise
+	///
+	bool block_store_request_range(block_store_t *const bs, const size_t block_id, const size_t count);
+
+	///
+	/// Frees a run of blocks
+	/// \param bs BS device
+	/// \param block_id The first block of the run
+	/// \param count The number of blocks in the run
+	///
+	void block_store_release_range(block_store_t *const bs, const size_t block_id, const size_t count);
+
 	///
 	/// Counts the number of blocks marked as in use
 	/// \param bs BS device
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitmap.h"
+
+// Times bitmap_total_set, bitmap_ffs, bitmap_ffz, a walk with bitmap_find_next_set and
+// bitmap_find_zero_run on bitmaps
+// from 2 Kbit to 1 Gbit, against the byte-at-a-time versions they replace: a 256-entry table
+// for the count, a test of every bit for the searches. Each search has to go to the end:
+// ffs on a bitmap with only its last bit set, ffz on one with only its last bit clear, and the
+// walk visits one set bit in 4096. The zero run search wants RUN bits on a bitmap with a set
+// bit every 60 but for RUN clear bits at the end. Every run repeats until it has taken MIN_SECONDS.
+// BITMAP_KERNEL=word or popcnt times a fallback instead of the best kernel the CPU has.
+// The project builds without optimization by default; configure with
+// -DCMAKE_BUILD_TYPE=Release for numbers worth comparing.
+
+#define MIN_SECONDS 0.2
+#define SPARSE 4096
+#define RUN 1000
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define B2(n) n, n + 1, n + 1, n + 2
+#define B4(n) B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
+#define B6(n) B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
+static const uint8_t bit_totals[256] = {B6(0), B6(1), B6(1), B6(2)};
+#undef B6
+#undef B4
+#undef B2
+
+// the loops bitmap.c had, over the exported bytes so a bit test is not a library call
+static size_t byte_count(const bitmap_t *bitmap)
+{
+    const uint8_t *data = bitmap_export(bitmap);
+    size_t bytes = bitmap_get_bytes(bitmap);
+    size_t total = 0;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        total += bit_totals[data[i]];
+    }
+    return total;
+}
+
+static inline bool byte_test(const uint8_t *data, size_t bit)
+{
+    return data[bit >> 3] & (1 << (bit & 0x07));
+}
+
+static size_t byte_ffs(const bitmap_t *bitmap)
+{
+    const uint8_t *data = bitmap_export(bitmap);
+    size_t bits = bitmap_get_bits(bitmap);
+    size_t bit = 0;
+    for (; bit < bits && !byte_test(data, bit); ++bit)
+    {
+    }
+    return bit;
+}
+
+static size_t byte_ffz(const bitmap_t *bitmap)
+{
+    const uint8_t *data = bitmap_export(bitmap);
+    size_t bits = bitmap_get_bits(bitmap);
+    size_t bit = 0;
+    for (; bit < bits && byte_test(data, bit); ++bit)
+    {
+    }
+    return bit;
+}
+
+static size_t byte_walk(const bitmap_t *bitmap)
+{
+    const uint8_t *data = bitmap_export(bitmap);
+    size_t bits = bitmap_get_bits(bitmap);
+    size_t found = 0;
+    for (size_t bit = 0; bit < bits; ++bit)
+    {
+        found += byte_test(data, bit);
+    }
+    return found;
+}
+
+static size_t byte_zrun(const bitmap_t *bitmap)
+{
+    const uint8_t *data = bitmap_export(bitmap);
+    size_t bits = bitmap_get_bits(bitmap);
+    size_t run = 0;
+    for (size_t bit = 0; bit < bits; ++bit)
+    {
+        run = byte_test(data, bit) ? 0 : run + 1;
+        if (run == RUN)
+        {
+            return bit + 1 - RUN;
+        }
+    }
+    return SIZE_MAX;
+}
+
+static size_t word_count(const bitmap_t *bitmap)
+{
+    return bitmap_total_set(bitmap);
+}
+
+static size_t word_ffs(const bitmap_t *bitmap)
+{
+    return bitmap_ffs(bitmap);
+}
+
+static size_t word_ffz(const bitmap_t *bitmap)
+{
+    return bitmap_ffz(bitmap);
+}
+
+static size_t word_walk(const bitmap_t *bitmap)
+{
+    size_t found = 0;
+    for (size_t bit = bitmap_ffs(bitmap); bit != SIZE_MAX; bit = bitmap_find_next_set(bitmap, bit + 1))
+    {
+        ++found;
+    }
+    return found;
+}
+
+static size_t word_zrun(const bitmap_t *bitmap)
+{
+    return bitmap_find_zero_run(bitmap, RUN, 0);
+}
+
+// seconds per call, and its result
+static double time_op(size_t (*op)(const bitmap_t *), const bitmap_t *bitmap, size_t *result)
+{
+    size_t calls = 0;
+    double start = now_seconds();
+    double elapsed;
+    do
+    {
+        *result = op(bitmap);
+        ++calls;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    return elapsed / calls;
+}
+
+static const struct
+{
+    const char *name;
+    size_t (*byte)(const bitmap_t *);
+    size_t (*word)(const bitmap_t *);
+} ops[] = {
+    {"count", byte_count, word_count},
+    {"ffs", byte_ffs, word_ffs},
+    {"ffz", byte_ffz, word_ffz},
+    {"walk", byte_walk, word_walk},
+    {"zrun", byte_zrun, word_zrun},
+};
+
+#define OPS (sizeof(ops) / sizeof(ops[0]))
+
+// what each op runs on
+static void fill(bitmap_t *bitmap, size_t op)
+{
+    size_t bits = bitmap_get_bits(bitmap);
+    switch (op)
+    {
+        case 0:
+            srand(48);
+            for (size_t bit = 0; bit < bits; ++bit)
+            {
+                if (rand() & 1)
+                {
+                    bitmap_set(bitmap, bit);
+                }
+            }
+            break;
+        case 1:
+            bitmap_set(bitmap, bits - 1);
+            break;
+        case 2:
+            bitmap_format(bitmap, 0xFF);
+            bitmap_reset(bitmap, bits - 1);
+            break;
+        case 3:
+            for (size_t bit = SPARSE - 1; bit < bits; bit += SPARSE)
+            {
+                bitmap_set(bitmap, bit);
+            }
+            break;
+        default:
+            for (size_t bit = 0; bit < bits - RUN; bit += 60)
+            {
+                bitmap_set(bitmap, bit);
+            }
+            break;
+    }
+}
+
+int main(void)
+{
+    const size_t sizes[] = {2048, 65536, 2097152, 67108864, 1073741824};
+    const char *kernel = getenv("BITMAP_KERNEL");
+    printf("kernel: %s\n", kernel ? kernel : "best");
+    printf("%12s %-6s %12s %12s %10s %10s\n", "bits", "op", "byte us", "word us", "word GB/s", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        for (size_t op = 0; op < OPS; ++op)
+        {
+            bitmap_t *bitmap = bitmap_create(sizes[s]);
+            if (!bitmap)
+            {
+                printf("Could not allocate %zu bits\n", sizes[s]);
+                return 1;
+            }
+            fill(bitmap, op);
+            size_t byte_result, word_result;
+            double byte = time_op(ops[op].byte, bitmap, &byte_result);
+            double word = time_op(ops[op].word, bitmap, &word_result);
+            bitmap_destroy(bitmap);
+            if (byte_result != word_result)
+            {
+                printf("%s on %zu bits gave %zu, not %zu\n", ops[op].name, sizes[s], word_result, byte_result);
+                return 1;
+            }
+            printf("%12zu %-6s %12.2f %12.2f %10.2f %9.1fx\n", sizes[s], ops[op].name, byte * 1e6, word * 1e6,
+                   sizes[s] / 8 / word / 1e9, byte / word);
+        }
+    }
+    return 0;
+}
@@ -23,38 +23,220 @@ struct bitmap
 //  Won't help until bitmap uses native width for the array
 static const uint8_t mask[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
 
-// Mask for all bits at index i and lower
-static const uint8_t mask_down_inclusive[8] = {0x01, 0x03, 0x07, 0x0F, 0x1F, 0x3F, 0x7F, 0xFF};
-
 // Inverted mask
 static const uint8_t invert_mask[8] = {0xFE, 0xFD, 0xFB, 0xF7, 0xEF, 0xDF, 0xBF, 0x7F};
 
-// Way more testing than I should waste my time on suggested uint8_t was faster
-// but it may still be negligible/indeterminate.
-// Since the data store is uint8_t, we already get punished for our bad alignment
-// so this doesn't really matter until everything gets moved to generic int
-
-// Total bits set in the given byte in a handy lookup table
-// Macros, man...
-// http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetTable
-#define B2(n) n, n + 1, n + 1, n + 2
-#define B4(n) B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
-#define B6(n) B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
-static const uint8_t bit_totals[256] = {B6(0), B6(1), B6(1), B6(2)};
-#undef B6
-#undef B4
-#undef B2
-// There is an alternative for getting bit count that only loops as many times as there are bits set
-// but that's still a loop and this table is 256B.
-/*
-   unsigned int v; // count the number of bits set in v
-   unsigned int c; // c accumulates the total bits set in v
-
-   for (c = 0; v; v >>= 1)
-   {
-   c += v & 1;
-   }
- */
+// Counting and searching go 64 bits at a time instead of through a byte lookup table.
+// The data is a byte array that can sit anywhere (see bitmap_overlay), so words are loaded with
+// memcpy, which compiles to a plain unaligned load. Bit i is then bit i % 64 of word i / 64,
+// once a big-endian machine swaps the bytes. The last word may be short; it is loaded byte by
+// byte so we never read past byte_count, and anything past bit_count in it is undetermined.
+static inline uint64_t load_word(const uint8_t *const data)
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+static inline uint64_t load_word_at(const bitmap_t *const bitmap, const size_t word)
+{
+    size_t byte = word << 3;
+    if (byte + 8 <= bitmap->byte_count)
+    {
+        return load_word(bitmap->data + byte);
+    }
+    uint8_t tail[8] = {0};
+    memcpy(tail, bitmap->data + byte, bitmap->byte_count - byte);
+    return load_word(tail);
+}
+
+// The loops over whole words, picked once per process by what the CPU can do (see kernels()):
+//  count  bits set in words 64-bit words from data
+//  skip   first word in [word, end) that is not equal to invert (has a set bit when invert is 0,
+//         a zero bit when it is all ones), end if none
+typedef struct
+{
+    const char *name;
+    size_t (*count)(const uint8_t *data, size_t words);
+    size_t (*skip)(const uint8_t *data, size_t word, size_t end, uint64_t invert);
+} bitmap_kernels_t;
+
+static inline __attribute__((always_inline)) size_t count_words(const uint8_t *data, size_t words)
+{
+    size_t total = 0;
+    for (size_t word = 0; word < words; ++word)
+    {
+        total += __builtin_popcountll(load_word(data + (word << 3)));
+    }
+    return total;
+}
+
+static size_t skip_words(const uint8_t *data, size_t word, size_t end, uint64_t invert)
+{
+    // four words to a test, the reads overlap and one branch covers 32 bytes
+    for (; word + 4 <= end; word += 4)
+    {
+        const uint8_t *from = data + (word << 3);
+        if ((load_word(from) ^ invert) | (load_word(from + 8) ^ invert) | (load_word(from + 16) ^ invert) | (load_word(from + 24) ^ invert))
+        {
+            break;
+        }
+    }
+    for (; word < end && load_word(data + (word << 3)) == invert; ++word)
+    {
+    }
+    return word;
+}
+
+static size_t count_words_portable(const uint8_t *data, size_t words)
+{
+    return count_words(data, words);
+}
+
+static const bitmap_kernels_t kernels_word = {"word", count_words_portable, skip_words};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+// the same loop, with popcount in one instruction instead of a bit trick
+__attribute__((target("popcnt"))) static size_t count_words_popcnt(const uint8_t *data, size_t words)
+{
+    return count_words(data, words);
+}
+
+static const bitmap_kernels_t kernels_popcnt = {"popcnt", count_words_popcnt, skip_words};
+
+// Nibble lookup with vpshufb (Mula, Kurz, Lemire: "Faster Population Counts Using AVX2
+// Instructions"). Each byte's count is the sum of the table entries of its two nibbles; byte
+// counts add up for up to 8 vectors (at most 64 per byte) before vpsadbw folds them into the
+// four 64-bit totals.
+__attribute__((target("avx2,popcnt"))) static size_t count_words_avx2(const uint8_t *data, size_t words)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i totals = _mm256_setzero_si256();
+    size_t vectors = words >> 2;
+    size_t vector = 0;
+    while (vector < vectors)
+    {
+        size_t stop = vector + 8 < vectors ? vector + 8 : vectors;
+        __m256i bytes = _mm256_setzero_si256();
+        for (; vector < stop; ++vector)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (data + (vector << 5)));
+            __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+            __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+            bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(lo, hi));
+        }
+        totals = _mm256_add_epi64(totals, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, totals);
+    size_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return total + count_words(data + (vectors << 5), words & 3);
+}
+
+// 32 bytes to a test: vptest against zero for a set bit, against all ones (its carry flag) for a zero bit
+__attribute__((target("avx2"))) static size_t skip_words_avx2(const uint8_t *data, size_t word, size_t end, uint64_t invert)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+    if (invert)
+    {
+        for (; word + 4 <= end && _mm256_testc_si256(_mm256_loadu_si256((const __m256i *) (data + (word << 3))), ones); word += 4)
+        {
+        }
+    }
+    else
+    {
+        for (; word + 4 <= end; word += 4)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (data + (word << 3)));
+            if (!_mm256_testz_si256(v, v))
+            {
+                break;
+            }
+        }
+    }
+    for (; word < end && load_word(data + (word << 3)) == invert; ++word)
+    {
+    }
+    return word;
+}
+
+static const bitmap_kernels_t kernels_avx2 = {"avx2", count_words_avx2, skip_words_avx2};
+#endif
+
+// The best the CPU has, or what BITMAP_KERNEL names ("word", "popcnt", "avx2") when the CPU
+// has it, to measure the fallbacks. Racing callers pick the same one.
+static const bitmap_kernels_t *kernels(void)
+{
+    static const bitmap_kernels_t *chosen = NULL;
+    const bitmap_kernels_t *picked = __atomic_load_n(&chosen, __ATOMIC_ACQUIRE);
+    if (picked)
+    {
+        return picked;
+    }
+    const bitmap_kernels_t *supported[3];
+    size_t count = 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    {
+        supported[count++] = &kernels_avx2;
+    }
+    if (__builtin_cpu_supports("popcnt"))
+    {
+        supported[count++] = &kernels_popcnt;
+    }
+#endif
+    supported[count++] = &kernels_word;
+    picked = supported[0];
+    const char *name = getenv("BITMAP_KERNEL");
+    for (size_t i = 0; name && i < count; ++i)
+    {
+        if (strcmp(name, supported[i]->name) == 0)
+        {
+            picked = supported[i];
+        }
+    }
+    __atomic_store_n(&chosen, picked, __ATOMIC_RELEASE);
+    return picked;
+}
+
+// first bit at or after start that is set (invert 0) or zero (invert all ones), SIZE_MAX if none
+static size_t bitmap_find_next(const bitmap_t *const bitmap, const size_t start, const uint64_t invert)
+{
+    if (!bitmap || start >= bitmap->bit_count)
+    {
+        return SIZE_MAX;
+    }
+    size_t words = (bitmap->byte_count + 7) >> 3;
+    size_t full = bitmap->byte_count >> 3;
+    size_t word = start >> 6;
+    uint64_t found = (load_word_at(bitmap, word) ^ invert) & (~UINT64_C(0) << (start & 63));
+    while (!found)
+    {
+        if (++word >= words)
+        {
+            return SIZE_MAX;
+        }
+        if (word < full)
+        {
+            word = kernels()->skip(bitmap->data, word, full, invert);
+        }
+        if (word < words)
+        {
+            found = load_word_at(bitmap, word) ^ invert;
+        }
+    }
+    // a hit in the undetermined bits past the end is no hit
+    size_t bit = (word << 6) + __builtin_ctzll(found);
+    return bit < bitmap->bit_count ? bit : SIZE_MAX;
+}
 
 // A place to generalize the creation process and setup
 bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags);
@@ -89,63 +271,238 @@ void bitmap_invert(bitmap_t *const bitmap)
 
 size_t bitmap_ffs(const bitmap_t *const bitmap) 
 {
+    return bitmap_find_next(bitmap, 0, 0);
+}
+
+size_t bitmap_ffz(const bitmap_t *const bitmap) 
+{
+    return bitmap_find_next(bitmap, 0, ~UINT64_C(0));
+}
+
+size_t bitmap_find_next_set(const bitmap_t *const bitmap, const size_t start) 
+{
+    return bitmap_find_next(bitmap, start, 0);
+}
+
+size_t bitmap_find_next_zero(const bitmap_t *const bitmap, const size_t start) 
+{
+    return bitmap_find_next(bitmap, start, ~UINT64_C(0));
+}
+
+size_t bitmap_total_set(const bitmap_t *const bitmap) 
+{
+    size_t total = 0;
     if (bitmap) 
     {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && !bitmap_test(bitmap, result); ++result) 
+        // whole words in the kernel, then what is left, masked so we don't count the bits past
+        // our bit total (which would be considered undetermined)
+        size_t full = bitmap->bit_count >> 6;
+        total = kernels()->count(bitmap->data, full);
+        if (bitmap->bit_count & 63) 
         {
+            total += __builtin_popcountll(load_word_at(bitmap, full) & ((UINT64_C(1) << (bitmap->bit_count & 63)) - 1));
         }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
     }
-    return SIZE_MAX;
+    return total;
 }
 
-size_t bitmap_ffz(const bitmap_t *const bitmap) 
+// Ranges are [start, end) once count is cut down to the bits there are. Setting and clearing
+// go a byte at a time at the two ends and memset the bytes between; tests and counts use the
+// word kernels above.
+static inline size_t bitmap_range_end(const bitmap_t *const bitmap, const size_t start, const size_t count)
 {
-    if (bitmap) 
+    return count < bitmap->bit_count - start ? start + count : bitmap->bit_count;
+}
+
+static void bitmap_fill_range(bitmap_t *const bitmap, const size_t start, const size_t end, const uint8_t pattern)
+{
+    size_t first = start >> 3, last = end >> 3;
+    uint8_t head = (uint8_t) (0xFF << (start & 0x07));      // bits from start on in its byte
+    uint8_t tail = (uint8_t) ((1 << (end & 0x07)) - 1);     // bits before end in its byte
+    if (first == last)
     {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && bitmap_test(bitmap, result); ++result) 
-        {
-        }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
+        head &= tail;
+        bitmap->data[first] = (bitmap->data[first] & ~head) | (pattern & head);
+        return;
+    }
+    bitmap->data[first] = (bitmap->data[first] & ~head) | (pattern & head);
+    memset(bitmap->data + first + 1, pattern, last - first - 1);
+    if (tail)
+    {
+        bitmap->data[last] = (bitmap->data[last] & ~tail) | (pattern & tail);
     }
-    return SIZE_MAX;
 }
 
-size_t bitmap_total_set(const bitmap_t *const bitmap) 
+void bitmap_set_range(bitmap_t *const bitmap, const size_t start, const size_t count) 
+{
+    if (bitmap && count && start < bitmap->bit_count) 
+    {
+        bitmap_fill_range(bitmap, start, bitmap_range_end(bitmap, start, count), 0xFF);
+    }
+}
+
+void bitmap_reset_range(bitmap_t *const bitmap, const size_t start, const size_t count) 
+{
+    if (bitmap && count && start < bitmap->bit_count) 
+    {
+        bitmap_fill_range(bitmap, start, bitmap_range_end(bitmap, start, count), 0x00);
+    }
+}
+
+bool bitmap_test_range_all(const bitmap_t *const bitmap, const size_t start, const size_t count) 
+{
+    if (bitmap && count && start < bitmap->bit_count) 
+    {
+        return bitmap_find_next_zero(bitmap, start) >= bitmap_range_end(bitmap, start, count);
+    }
+    return bitmap != NULL;
+}
+
+bool bitmap_test_range_any(const bitmap_t *const bitmap, const size_t start, const size_t count) 
+{
+    if (bitmap && count && start < bitmap->bit_count) 
+    {
+        size_t found = bitmap_find_next_set(bitmap, start);
+        return found != SIZE_MAX && found < bitmap_range_end(bitmap, start, count);
+    }
+    return false;
+}
+
+size_t bitmap_count_range(const bitmap_t *const bitmap, const size_t start, const size_t count) 
 {
     size_t total = 0;
-    if (bitmap) 
+    if (bitmap && count && start < bitmap->bit_count) 
     {
-        // If we have leftover, stop a byte early because we have to handle it differently.
-        size_t stop = bitmap->leftover_bits ? bitmap->byte_count - 1 : bitmap->byte_count;
-        for (size_t idx = 0; idx < stop; ++idx) 
+        size_t end = bitmap_range_end(bitmap, start, count);
+        size_t first = start >> 6, last = end >> 6;
+        uint64_t head = ~UINT64_C(0) << (start & 63);
+        uint64_t tail = (UINT64_C(1) << (end & 63)) - 1;
+        if (first == last) 
         {
-            total += bit_totals[bitmap->data[idx]];
+            return __builtin_popcountll(load_word_at(bitmap, first) & head & tail);
         }
-        if (bitmap->leftover_bits) 
+        total = __builtin_popcountll(load_word_at(bitmap, first) & head);
+        total += kernels()->count(bitmap->data + ((first + 1) << 3), last - first - 1);
+        if (tail) 
         {
-            // haha, this is readable
-            // get the byte at the end of the bitmap, mask it so we're only looking at the bits in use
-            // then feed that to the bit_total lookup so we don't count the bits past our bit total
-            // (which whould be considered undetermined)
-            total += bit_totals[bitmap->data[bitmap->byte_count - 1] & mask_down_inclusive[bitmap->leftover_bits - 1]];
+            total += __builtin_popcountll(load_word_at(bitmap, last) & tail);
         }
     }
     return total;
 }
 
-void bitmap_for_each(const bitmap_t *const bitmap, void (*func)(size_t, void *), void *arg) 
+// First run of k zero bits inside [from, to), SIZE_MAX if none (0 < k, from < to <= bit_count).
+// Bits outside the range count as set. A word at a time: zeros at the top of a word carry into
+// the next, whole words of zeros or ones are skipped with the kernels, and for k <= 64 a run
+// inside one word is found by shift-and-AND, which leaves a bit set where k zeros start.
+static size_t bitmap_find_zero_run_in(const bitmap_t *const bitmap, const size_t k, const size_t from, const size_t to)
 {
-    if (bitmap && func) 
+    size_t first = from >> 6, last = (to - 1) >> 6;
+    size_t full = bitmap->byte_count >> 3;
+    size_t skip_end = last < full ? last : full;     // words the kernels may skip over, none of them partial
+    size_t run = 0, run_start = from;
+    for (size_t word = first; word <= last; ++word)
+    {
+        uint64_t bits = load_word_at(bitmap, word);
+        if (word == first)
+        {
+            bits |= (UINT64_C(1) << (from & 63)) - 1;
+        }
+        if (word == last && (to & 63))
+        {
+            bits |= ~UINT64_C(0) << (to & 63);
+        }
+        if (!bits)
+        {
+            // this and any whole words of zeros after it
+            size_t next = word + 1 < skip_end ? kernels()->skip(bitmap->data, word + 1, skip_end, 0) : word + 1;
+            run_start = run ? run_start : word << 6;
+            run += (next - word) << 6;
+            if (run >= k)
+            {
+                return run_start;
+            }
+            word = next - 1;
+            continue;
+        }
+        if (run && run + __builtin_ctzll(bits) >= k)
+        {
+            return run_start;
+        }
+        if (k <= 64)
+        {
+            uint64_t starts = ~bits;
+            for (size_t have = 1; have < k && starts;)
+            {
+                size_t shift = have < k - have ? have : k - have;
+                starts &= starts >> shift;
+                have += shift;
+            }
+            if (starts)
+            {
+                return (word << 6) + __builtin_ctzll(starts);
+            }
+        }
+        run = __builtin_clzll(bits);
+        run_start = (word << 6) + 64 - run;
+        if (!run && bits == ~UINT64_C(0) && word + 1 < skip_end)
+        {
+            // whole words of ones
+            word = kernels()->skip(bitmap->data, word + 1, skip_end, ~UINT64_C(0)) - 1;
+        }
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_find_zero_run(const bitmap_t *const bitmap, const size_t k, const size_t start_hint) 
+{
+    if (!bitmap || !k || k > bitmap->bit_count) 
+    {
+        return SIZE_MAX;
+    }
+    size_t hint = start_hint < bitmap->bit_count ? start_hint : 0;
+    size_t found = bitmap_find_zero_run_in(bitmap, k, hint, bitmap->bit_count);
+    if (found == SIZE_MAX && hint) 
+    {
+        // wrap around, runs that start before the hint and reach past it included
+        size_t to = hint < bitmap->bit_count - (k - 1) ? hint + k - 1 : bitmap->bit_count;
+        found = bitmap_find_zero_run_in(bitmap, k, 0, to);
+    }
+    return found;
+}
+
+size_t bitmap_largest_zero_run(const bitmap_t *const bitmap, size_t *const start) 
+{
+    size_t best = 0, best_start = SIZE_MAX;
+    if (bitmap) 
     {
-        for (size_t idx = 0; idx < bitmap->bit_count; ++idx) 
+        // run by run, each end found with the word kernels; stop once what is left is too short to win
+        for (size_t zero = bitmap_ffz(bitmap); zero != SIZE_MAX && bitmap->bit_count - zero > best;) 
         {
-            if (bitmap_test(bitmap, idx)) 
+            size_t set = bitmap_find_next_set(bitmap, zero);
+            size_t end = set == SIZE_MAX ? bitmap->bit_count : set;
+            if (end - zero > best) 
             {
-                func(idx, arg);
+                best = end - zero;
+                best_start = zero;
             }
+            zero = set == SIZE_MAX ? SIZE_MAX : bitmap_find_next_zero(bitmap, set);
+        }
+    }
+    if (start) 
+    {
+        *start = best_start;
+    }
+    return best;
+}
+
+void bitmap_for_each(const bitmap_t *const bitmap, void (*func)(size_t, void *), void *arg) 
+{
+    if (bitmap && func) 
+    {
+        for (size_t idx = bitmap_find_next_set(bitmap, 0); idx != SIZE_MAX; idx = bitmap_find_next_set(bitmap, idx + 1)) 
+        {
+            func(idx, arg);
         }
     }
 }
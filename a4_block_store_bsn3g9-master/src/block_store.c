@@ -65,17 +65,15 @@ size_t block_store_allocate(block_store_t *const bs) {
         return SIZE_MAX;
     }
 
-    // Look for an empty box
-    for (size_t i = 0; i < BLOCK_STORE_NUM_BLOCKS; i++) {
+    // Look for an empty box, a word at a time
+    for (size_t i = bitmap_ffz(bs->free_blocks); i != SIZE_MAX; i = bitmap_find_next_zero(bs->free_blocks, i + 1)) {
         // Skip the boxes used for our checklist
         if (i >= BITMAP_START_BLOCK && i < BITMAP_START_BLOCK + 4) {
             continue;
         }
         // Found an empty box!
-        if (!bitmap_test(bs->free_blocks, i)) {
-            bitmap_set(bs->free_blocks, i);
-            return i;
-        }
+        bitmap_set(bs->free_blocks, i);
+        return i;
     }
     return SIZE_MAX;  // No empty boxes left :(
 }
@@ -101,6 +99,48 @@ void block_store_release(block_store_t *const bs, const size_t block_id) {
     }
 }
 
+// Find a whole row of empty boxes and mark them as taken
+size_t block_store_allocate_range(block_store_t *const bs, const size_t count) {
+    if (!bs || !count) {
+        return SIZE_MAX;
+    }
+
+    // The boxes used for our checklist are marked taken, but never hand them out even if
+    // they were released: the first row was the first that fits, so look past them once
+    size_t id = bitmap_find_zero_run(bs->free_blocks, count, 0);
+    if (id != SIZE_MAX && id < BITMAP_START_BLOCK + 4 && id + count > BITMAP_START_BLOCK) {
+        id = bitmap_find_zero_run(bs->free_blocks, count, BITMAP_START_BLOCK + 4);
+        if (id < BITMAP_START_BLOCK + 4) {
+            return SIZE_MAX;  // wrapped around, nothing past them
+        }
+    }
+    if (id != SIZE_MAX) {
+        bitmap_set_range(bs->free_blocks, id, count);
+    }
+    return id;
+}
+
+// Try to get a whole row of boxes, a word of the checklist at a time
+bool block_store_request_range(block_store_t *const bs, const size_t block_id, const size_t count) {
+    if (!bs || !count || block_id >= BLOCK_STORE_NUM_BLOCKS || count > BLOCK_STORE_NUM_BLOCKS - block_id) {
+        return false;
+    }
+
+    // all of them have to be free
+    if (bitmap_test_range_any(bs->free_blocks, block_id, count)) {
+        return false;
+    }
+    bitmap_set_range(bs->free_blocks, block_id, count);
+    return true;
+}
+
+// Mark a row of boxes as empty
+void block_store_release_range(block_store_t *const bs, const size_t block_id, const size_t count) {
+    if (bs && block_id < BLOCK_STORE_NUM_BLOCKS && count <= BLOCK_STORE_NUM_BLOCKS - block_id) {
+        bitmap_reset_range(bs->free_blocks, block_id, count);
+    }
+}
+
 // Count used boxes
 size_t block_store_get_used_blocks(const block_store_t *const bs) {
     if (!bs) {
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include <sys/stat.h>
 #include "block_store.h"
+#include "bitmap.h"
 
 // The object is opaque, so we can't really test things directly....
 
@@ -519,3 +520,237 @@ TEST(block_store_deserialize, null_filename)
     score += 2;
 }
 
+
+// The bitmap searches and counts go a word (or 32 bytes) at a time; check them against bitmap_test
+// on sizes around the word and vector edges, on an overlay that is not word aligned, with the
+// undetermined bits past the end set.
+static void check_bitmap_against_bits(const bitmap_t *bitmap, size_t bits) {
+    size_t set = 0;
+    for (size_t bit = 0; bit < bits; ++bit) {
+        set += bitmap_test(bitmap, bit);
+    }
+    ASSERT_EQ(set, bitmap_total_set(bitmap)) << bits << " bits";
+    size_t next_set = SIZE_MAX, next_zero = SIZE_MAX;
+    for (size_t start = bits + 1; start-- > 0;) {
+        ASSERT_EQ(next_set, bitmap_find_next_set(bitmap, start)) << bits << " bits from " << start;
+        ASSERT_EQ(next_zero, bitmap_find_next_zero(bitmap, start)) << bits << " bits from " << start;
+        if (start > 0) {
+            next_set = bitmap_test(bitmap, start - 1) ? start - 1 : next_set;
+            next_zero = bitmap_test(bitmap, start - 1) ? next_zero : start - 1;
+        }
+    }
+    ASSERT_EQ(bitmap_find_next_set(bitmap, 0), bitmap_ffs(bitmap));
+    ASSERT_EQ(bitmap_find_next_zero(bitmap, 0), bitmap_ffz(bitmap));
+}
+
+TEST(bitmap_search, against_bits) {
+    const size_t sizes[] = {1, 7, 8, 63, 64, 65, 255, 256, 257, 511, 1000, 2048, 2051};
+    uint8_t storage[2051 / 8 + 1 + 3];
+    srand(4520);
+    for (size_t size : sizes) {
+        // sparse, dense, empty and full, the last two with one bit turned near the end
+        for (int fill = 0; fill < 4; ++fill) {
+            memset(storage, 0xFF, sizeof(storage));
+            bitmap_t *bitmap = bitmap_overlay(size, storage + 3);
+            ASSERT_NE(nullptr, bitmap);
+            for (size_t bit = 0; bit < size; ++bit) {
+                bool set = fill == 0 ? rand() % 97 == 0 : fill == 1 ? rand() % 5 != 0 : fill == 3;
+                if (set) {
+                    bitmap_set(bitmap, bit);
+                } else {
+                    bitmap_reset(bitmap, bit);
+                }
+            }
+            if (fill >= 2) {
+                bitmap_flip(bitmap, size - 1 - size / 3);
+            }
+            check_bitmap_against_bits(bitmap, size);
+            bitmap_destroy(bitmap);
+        }
+    }
+}
+
+TEST(bitmap_search, errors) {
+    bitmap_t *bitmap = bitmap_create(100);
+    ASSERT_NE(nullptr, bitmap);
+    ASSERT_EQ(SIZE_MAX, bitmap_ffs(bitmap));
+    ASSERT_EQ(0, bitmap_ffz(bitmap));
+    ASSERT_EQ(SIZE_MAX, bitmap_find_next_zero(bitmap, 100));
+    bitmap_format(bitmap, 0xFF);
+    ASSERT_EQ(SIZE_MAX, bitmap_ffz(bitmap));
+    ASSERT_EQ(100, bitmap_total_set(bitmap));
+    ASSERT_EQ(99, bitmap_find_next_set(bitmap, 99));
+    ASSERT_EQ(SIZE_MAX, bitmap_find_next_set(bitmap, SIZE_MAX));
+    ASSERT_EQ(SIZE_MAX, bitmap_find_next_set(NULL, 0));
+    ASSERT_EQ(SIZE_MAX, bitmap_find_next_zero(NULL, 0));
+    bitmap_destroy(bitmap);
+}
+
+// Range operations against the same bits done one at a time, over runs that start and end on
+// and off byte and word edges.
+TEST(bitmap_range, against_bits) {
+    const size_t bits = 1003;
+    const size_t edges[] = {0, 1, 7, 8, 9, 63, 64, 65, 127, 128, 500, 1000, 1002, 1003};
+    uint8_t storage[bits / 8 + 1 + 5];
+    bitmap_t *bitmap = bitmap_overlay(bits, storage + 5);
+    bitmap_t *expect = bitmap_create(bits);
+    ASSERT_NE(nullptr, bitmap);
+    ASSERT_NE(nullptr, expect);
+    srand(4521);
+    for (size_t start : edges) {
+        for (size_t end : edges) {
+            if (end < start) {
+                continue;
+            }
+            for (size_t bit = 0; bit < bits; ++bit) {
+                if (rand() % 3 == 0) {
+                    bitmap_set(bitmap, bit);
+                    bitmap_set(expect, bit);
+                } else {
+                    bitmap_reset(bitmap, bit);
+                    bitmap_reset(expect, bit);
+                }
+            }
+            size_t set = 0;
+            for (size_t bit = start; bit < end; ++bit) {
+                set += bitmap_test(expect, bit);
+            }
+            ASSERT_EQ(set, bitmap_count_range(bitmap, start, end - start)) << start << ".." << end;
+            ASSERT_EQ(set == end - start, bitmap_test_range_all(bitmap, start, end - start)) << start << ".." << end;
+            ASSERT_EQ(set > 0, bitmap_test_range_any(bitmap, start, end - start)) << start << ".." << end;
+
+            // set or clear the run, nothing around it may move
+            bool setting = (start + end) & 1;
+            if (setting) {
+                bitmap_set_range(bitmap, start, end - start);
+            } else {
+                bitmap_reset_range(bitmap, start, end - start);
+            }
+            for (size_t bit = start; bit < end; ++bit) {
+                if (setting) {
+                    bitmap_set(expect, bit);
+                } else {
+                    bitmap_reset(expect, bit);
+                }
+            }
+            for (size_t bit = 0; bit < bits; ++bit) {
+                ASSERT_EQ(bitmap_test(expect, bit), bitmap_test(bitmap, bit)) << start << ".." << end << " bit " << bit;
+            }
+            ASSERT_EQ(setting || start == end, bitmap_test_range_all(bitmap, start, end - start));
+            ASSERT_EQ(setting && start < end, bitmap_test_range_any(bitmap, start, end - start));
+        }
+    }
+
+    // runs past the end are cut short
+    bitmap_format(bitmap, 0x00);
+    bitmap_set_range(bitmap, 1000, SIZE_MAX);
+    ASSERT_EQ(3, bitmap_total_set(bitmap));
+    ASSERT_EQ(3, bitmap_count_range(bitmap, 990, 100));
+    ASSERT_TRUE(bitmap_test_range_all(bitmap, 1000, 100));
+    ASSERT_FALSE(bitmap_test_range_any(bitmap, bits, 1));
+    ASSERT_EQ(0, bitmap_count_range(NULL, 0, 1));
+    ASSERT_FALSE(bitmap_test_range_all(NULL, 0, 1));
+    bitmap_destroy(bitmap);
+    bitmap_destroy(expect);
+}
+
+TEST(block_store_range, request_and_release) {
+    block_store_t *bs = block_store_create();
+    ASSERT_NE(nullptr, bs);
+    size_t used = block_store_get_used_blocks(bs);
+    ASSERT_TRUE(block_store_request_range(bs, 10, 1000));
+    ASSERT_EQ(used + 1000, block_store_get_used_blocks(bs));
+    ASSERT_FALSE(block_store_request(bs, 500));
+    ASSERT_FALSE(block_store_request_range(bs, 1009, 2));   // overlaps the end of the run
+    ASSERT_TRUE(block_store_request(bs, 1010));
+    ASSERT_FALSE(block_store_request_range(bs, 1020, 4));   // the free block bitmap's own blocks
+    ASSERT_FALSE(block_store_request_range(bs, 2040, 9));
+    ASSERT_FALSE(block_store_request_range(bs, 0, 0));
+    ASSERT_FALSE(block_store_request_range(NULL, 0, 1));
+    block_store_release_range(bs, 10, 1000);
+    ASSERT_EQ(used + 1, block_store_get_used_blocks(bs));
+    ASSERT_EQ(0, block_store_allocate(bs));
+    ASSERT_EQ(1, block_store_allocate(bs));
+    block_store_destroy(bs);
+}
+
+// Zero runs against a walk over every bit, on fragmented bitmaps of several densities.
+static size_t zero_run_by_bits(const bitmap_t *bitmap, size_t bits, size_t k, size_t from, size_t to) {
+    size_t run = 0;
+    for (size_t bit = from; bit < to; ++bit) {
+        run = bitmap_test(bitmap, bit) ? 0 : run + 1;
+        if (run == k) {
+            return bit + 1 - k;
+        }
+    }
+    return bits;
+}
+
+TEST(bitmap_zero_run, against_bits) {
+    const size_t bits = 4099;
+    const size_t ks[] = {1, 2, 3, 5, 31, 32, 33, 63, 64, 65, 100, 200, 500, 4099, 4100};
+    const size_t hints[] = {0, 1, 63, 64, 1000, 4098, 4099, SIZE_MAX};
+    bitmap_t *bitmap = bitmap_create(bits);
+    ASSERT_NE(nullptr, bitmap);
+    srand(4522);
+    for (int density = 0; density < 5; ++density) {
+        // set bits become rarer, so runs get longer; every other pass keeps whole words set
+        for (size_t bit = 0; bit < bits; ++bit) {
+            bool set = rand() % (2 << (density * 2)) == 0 || (density & 1 && (bit / 64) % 7 == 3);
+            if (set) {
+                bitmap_set(bitmap, bit);
+            } else {
+                bitmap_reset(bitmap, bit);
+            }
+        }
+        for (size_t k : ks) {
+            for (size_t hint : hints) {
+                size_t from = hint < bits ? hint : 0;
+                size_t expect = zero_run_by_bits(bitmap, bits, k, from, bits);
+                if (expect == bits) {
+                    expect = zero_run_by_bits(bitmap, bits, k, 0, bits);
+                }
+                expect = expect == bits ? SIZE_MAX : expect;
+                ASSERT_EQ(expect, bitmap_find_zero_run(bitmap, k, hint)) << "density " << density << " k " << k << " hint " << hint;
+            }
+        }
+        size_t longest = 0, longest_start = SIZE_MAX, run = 0;
+        for (size_t bit = 0; bit < bits; ++bit) {
+            run = bitmap_test(bitmap, bit) ? 0 : run + 1;
+            if (run > longest) {
+                longest = run;
+                longest_start = bit + 1 - run;
+            }
+        }
+        size_t start = 0;
+        ASSERT_EQ(longest, bitmap_largest_zero_run(bitmap, &start)) << "density " << density;
+        ASSERT_EQ(longest_start, start) << "density " << density;
+    }
+    bitmap_format(bitmap, 0xFF);
+    size_t start = 0;
+    ASSERT_EQ(0, bitmap_largest_zero_run(bitmap, &start));
+    ASSERT_EQ(SIZE_MAX, start);
+    ASSERT_EQ(SIZE_MAX, bitmap_find_zero_run(bitmap, 1, 0));
+    ASSERT_EQ(SIZE_MAX, bitmap_find_zero_run(bitmap, 0, 0));
+    ASSERT_EQ(SIZE_MAX, bitmap_find_zero_run(NULL, 1, 0));
+    ASSERT_EQ(0, bitmap_largest_zero_run(NULL, NULL));
+    bitmap_destroy(bitmap);
+}
+
+TEST(block_store_range, allocate) {
+    block_store_t *bs = block_store_create();
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(0, block_store_allocate_range(bs, 100));
+    ASSERT_TRUE(block_store_request(bs, 150));
+    ASSERT_EQ(100, block_store_allocate_range(bs, 50));
+    ASSERT_EQ(151, block_store_allocate_range(bs, 800));
+    ASSERT_EQ(1026, block_store_allocate_range(bs, 100));      // 951..1021 is too short, then the bitmap's blocks
+    block_store_release_range(bs, 1020, 6);                     // even with them released
+    ASSERT_EQ(1126, block_store_allocate_range(bs, 100));
+    ASSERT_EQ(1226, block_store_allocate_range(bs, 73));       // 951..1023 would take the bitmap's blocks
+    ASSERT_EQ(951, block_store_allocate_range(bs, 71));
+    ASSERT_EQ(SIZE_MAX, block_store_allocate_range(bs, 2048));
+    ASSERT_EQ(SIZE_MAX, block_store_allocate_range(bs, 0));
+    ASSERT_EQ(SIZE_MAX, block_store_allocate_range(NULL, 1));
+    block_store_destroy(bs);
+}
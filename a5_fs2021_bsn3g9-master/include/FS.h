@@ -33,16 +33,29 @@
 
 #define folder_number_entries 31
 
+#define FS_INODE_COMPRESSED 0x01    // data is kept in compressed groups, see fs_set_compressed
+#define FS_INODE_INLINE 0x02        // data (at most FS_INLINE_MAX bytes) sits in the inline area, no data block
+#define FS_INODE_DIRENTS 0x04       // directory block holds variable-length records (see FS.c), not directoryFile_t slots
+#define FS_INODE_MODE 0x08          // mode holds the permission bits; inodes from before modes get the defaults below
+#define FS_INLINE_MAX 64
+#define FS_MODE_FILE 0644            // the mode new regular files get
+#define FS_MODE_DIRECTORY 0755       // and new directories
+
 // each inode represents a regular file or a directory file
 struct inode 
 {
-    uint32_t vacantFile;    // this parameter is only for directory. Used as a bitmap denoting availibility of entries in a directory file.
-    char owner[18];         // for alignment purpose only   
+    uint32_t vacantFile;    // this parameter is only for directory. Used as a bitmap denoting availibility of entries in a directory file (the number of entries with FS_INODE_DIRENTS).
+    uint8_t flags;          // FS_INODE_* bits
+    uint8_t reserved;
+    uint16_t mode;          // permission bits, with FS_INODE_MODE
+    uint32_t created;       // seconds since the epoch, 0 in images from before timestamps
+    uint32_t modified;      // last write to the data, or to the entries of a directory
+    char owner[6];          // for alignment purpose only   
 
     char fileType;          // 'r' denotes regular file, 'd' denotes directory file
 
     size_t inodeNumber;			// for FS, the range should be 0-255
-    size_t fileSize; 			  // the unit is in byte	
+    size_t fileSize; 			  // the unit is in byte (for a directory, bytes of entries)	
     size_t linkCount;
 
     // to realize the 16-bit addressing, pointers are acutally block numbers, rather than 'real' pointers.
@@ -55,24 +68,60 @@ struct inode
 struct fileDescriptor 
 {
     uint8_t inodeNum;	// the inode # of the fd
-
-    // usage, locate_order and locate_offset together locate the exact byte at which the cursor is 
-    uint8_t usage; 		// inode pointer usage info. Only the lower 3 digits will be used. 1 for direct, 2 for indirect, 4 for dbindirect
-    uint16_t locate_order;		// serial number or index of the block within direct, indirect, or dbindirect range
-    uint16_t locate_offset;		// offset of the cursor within a block
+    uint64_t position;	// byte offset of the R/W position from BOF, the block and its slot in the block map follow from it
+    int16_t next;		// next descriptor open on the same inode, -1 ends the chain (see the open-file table in FS.c)
 };
 
 
+// a slot of a directory block in images from before variable-length records (FS_INODE_DIRENTS)
 struct directoryFile {
     char filename[127];
     uint8_t inodeNumber;
 };
 
 
+// the fs_* calls fs_get_stats counts, see fs_call_name
+typedef enum {
+    FS_CALL_FORMAT, FS_CALL_MOUNT, FS_CALL_MOUNT_SNAPSHOT, FS_CALL_CREATE, FS_CALL_OPEN, FS_CALL_CLOSE, FS_CALL_SEEK,
+    FS_CALL_READ, FS_CALL_WRITE, FS_CALL_REMOVE, FS_CALL_GET_DIR, FS_CALL_MOVE, FS_CALL_LINK, FS_CALL_CREATE_BATCH,
+    FS_CALL_REMOVE_BATCH, FS_CALL_SNAPSHOT, FS_CALL_SNAPSHOT_DELETE, FS_CALL_SET_COMPRESSED,
+    FS_CALL_FRAGMENTATION, FS_CALL_DEFRAG, FS_CALL_CHECK, FS_CALL_OPENDIR, FS_CALL_WALK, FS_CALL_STAT, FS_CALL_FSTAT, FS_CALL_CHMOD,
+    FS_CALL_MMAP, FS_CALL_TXN_BEGIN, FS_CALL_TXN_COMMIT, FS_CALL_TXN_ABORT,
+    FS_CALL_COUNT
+} fs_call_t;
+
+// counters of one mount since it was mounted, see fs_get_stats
+typedef struct {
+    struct {
+        uint64_t calls;
+        uint64_t ns;            // wall time spent inside, summed over calls
+    } call[FS_CALL_COUNT];
+    uint64_t block_reads;       // data store blocks read
+    uint64_t block_writes;      // data store blocks written
+    uint64_t inode_reads;
+    uint64_t inode_writes;
+    uint64_t bitmap_scans;      // searches of a free block, inode or descriptor bitmap for a free entry
+    uint64_t cache_hits;        // compressed groups found decompressed in the group cache
+    uint64_t cache_misses;
+    uint64_t syncs;             // fsyncs of the image file and its journal, see fs_txn_commit
+} fs_stats_t;
+
 struct FS {
     block_store_t * BlockStore_whole;
     block_store_t * BlockStore_inode;
-    block_store_t * BlockStore_fd;
+    block_store_t * BlockStore_fd;  // which descriptors are in use, their cursors live in descriptors
+    struct fileDescriptor descriptors[number_fd];
+    bool readonly;              // mounted snapshot, every call that modifies the FS fails
+    struct dedup_index *dedup;  // content index of data blocks, NULL while dedup is off
+    struct group_cache *cache;  // decompressed groups of compressed files, NULL if it could not be allocated
+    size_t snapshotMeta;        // mounted snapshot, first block of its copy of the FS metadata
+    struct delalloc *delalloc;  // appends not given blocks yet, NULL if it could not be allocated
+    struct open_table *open;    // inodes with open descriptors, NULL if it could not be allocated (fs_open fails)
+    struct defrag *defrag;      // where fs_defrag is, NULL until it first runs
+    const struct fs_layout *layout; // how the inode and descriptor tables are kept, see fs_format_layout
+    struct fs_tables *tables;   // the tables of FS_LAYOUT_TABLE, NULL under FS_LAYOUT_BLOCK_STORE
+    struct journal *journal;    // the image file and the open transaction, NULL for a mounted snapshot or if it could not be allocated
+    fs_stats_t stats;
 };
 
 
@@ -87,9 +136,50 @@ typedef enum { FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END } seek_t;
 
 typedef enum { FS_REGULAR, FS_DIRECTORY } file_t;
 
+// how a mounted FS gets at its inode table and keeps its descriptors, see fs_format_layout
+//  Both read and write the same image, the choice is recorded in it for fs_mount
+typedef enum {
+    FS_LAYOUT_BLOCK_STORE,  // inodes and descriptors are block stores of their own, each access checked by the store
+    FS_LAYOUT_TABLE,        // the inode table is used in place with a bitmap over it, free descriptors are a dyn_array
+    FS_LAYOUT_COUNT
+} fs_layout_t;
+
 #define FS_FNAME_MAX (127)
 // INCLUDING null terminator
 
+// how a file's data blocks lie in the FS, see fs_fragmentation
+typedef struct {
+    size_t blocks;      // data blocks
+    size_t extents;     // runs of consecutive blocks they form, in file order (holes do not break a run)
+    double score;       // (extents - 1) / (blocks - 1): 0 when the data is one run, 1 when no two blocks follow each other
+} fs_frag_t;
+
+// what fs_stat and fs_fstat report
+typedef struct {
+    size_t inode;
+    file_t type;
+    size_t size;        // bytes (of its records for a directory)
+    size_t links;       // names the file has
+    uint16_t mode;      // permission bits
+    time_t created;     // 0 if the image did not record it
+    time_t modified;
+} fs_stat_t;
+
+// what fs_check found, each problem counted once
+typedef struct {
+    size_t inodes;          // inodes checked, live and in snapshots
+    size_t blocks;          // blocks in use by FS metadata, directories and files
+    size_t bad_pointers;    // block pointers past the data area or at FS metadata
+    size_t cross_links;     // directory or pointer blocks reached from more than one place
+    size_t bad_entries;     // directory entries with no name or naming a free inode
+    size_t link_counts;     // inodes whose linkCount is not the number of entries naming them
+    size_t orphans;         // inodes in use that no directory entry names
+    size_t unmarked;        // blocks in use but free in the free block bitmap
+    size_t leaked;          // blocks taken in the free block bitmap that nothing uses
+    size_t refcounts;       // blocks whose count of extra owners is wrong
+    size_t repaired;        // of the above, fixed
+} fs_check_t;
+
 typedef struct {
     // You can add more if you want
     // just don't remove or rename these
@@ -104,6 +194,22 @@ typedef struct {
 ///
 FS_t *fs_format(const char *path);
 
+///
+/// Formats (and mounts) an FS file for use, as fs_format does, with the given layout
+///   fs_mount and fs_mount_snapshot use the layout the image was formatted with
+/// \param path The file to format
+/// \param layout How the mounted FS keeps its inode and descriptor tables
+/// \return Mounted FS object, NULL on error
+///
+FS_t *fs_format_layout(const char *path, fs_layout_t layout);
+
+///
+/// Tells which layout a mounted FS uses
+/// \param fs The FS
+/// \return its layout, FS_LAYOUT_COUNT on error
+///
+fs_layout_t fs_get_layout(const FS_t *fs);
+
 ///
 /// Mounts an FS object and prepares it for use
 /// \param fname The file to mount
@@ -161,6 +267,36 @@ int fs_close(FS_t *fs, int fd);
 ///
 off_t fs_seek(FS_t *fs, int fd, off_t offset, seek_t whence);
 
+///
+/// Reports a file's size, type, link count, mode and timestamps without opening it
+///   Comes from the inode, or from the copy kept while the file is open
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param st Where to put the report
+/// \return 0 on success, < 0 on failure
+///
+int fs_stat(FS_t *fs, const char *path, fs_stat_t *st);
+
+///
+/// Reports on the file an open descriptor is on, as fs_stat does
+///   Appends not yet given blocks already count in the size
+/// \param fs The FS containing the file
+/// \param fd The descriptor
+/// \param st Where to put the report
+/// \return 0 on success, < 0 on failure
+///
+int fs_fstat(FS_t *fs, int fd, fs_stat_t *st);
+
+///
+/// Sets a file's permission bits
+///   They are kept and reported, the FS has no users to check them against
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param mode Permission bits, at most 07777
+/// \return 0 on success, < 0 on failure
+///
+int fs_chmod(FS_t *fs, const char *path, uint16_t mode);
+
 ///
 /// Reads data from the file linked to the given descriptor
 ///   Reading past EOF returns data up to EOF
@@ -173,6 +309,29 @@ off_t fs_seek(FS_t *fs, int fd, off_t offset, seek_t whence);
 ///
 ssize_t fs_read(FS_t *fs, int fd, void *dst, size_t nbyte);
 
+///
+/// Gives a read-only view of part of the file linked to the given descriptor, without reading it out
+///   A range in one run of blocks, or of a small file kept in its inode's slot, is viewed where it
+///   lies in the FS; any other range is put together in memory of its own
+///   Writes to the file while the view is held may or may not show in it
+///   The R/W position does not move, and the view outlives the descriptor but not the mount
+/// \param fs The FS containing the file
+/// \param fd The file to view
+/// \param offset Byte offset of the view from BOF
+/// \param length Bytes to view, offset + length may not pass EOF
+/// \return the view, NULL on error
+///
+const void *fs_mmap(FS_t *fs, int fd, size_t offset, size_t length);
+
+///
+/// Lets go of a view fs_mmap gave
+/// \param fs The FS the view is of
+/// \param view The view
+/// \param length The length it was asked for with
+/// \return 0 on success, < 0 on failure
+///
+int fs_munmap(FS_t *fs, const void *view, size_t length);
+
 ///
 /// Writes data from given buffer to the file linked to the descriptor
 ///   Writing past EOF extends the file
@@ -197,13 +356,94 @@ int fs_remove(FS_t *fs, const char *path);
 
 ///
 /// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 15 file_record_t structures
+///   Entries come in directory order; built with fs_readdir
 /// \param fs The FS containing the file
 /// \param path Absolute path to the directory to inspect
 /// \return dyn_array of file records, NULL on error
 ///
 dyn_array_t *fs_get_dir(FS_t *fs, const char *path);
 
+typedef struct fs_dir fs_dir_t;
+
+///
+/// Opens a directory for reading its entries one at a time
+///   The directory's block is read once here; fs_readdir hands out entries from that copy,
+///   so a listing costs one block read however many entries there are
+/// \param fs The FS containing the directory
+/// \param path Absolute path to the directory
+/// \return Open directory to pass to fs_readdir and fs_closedir, NULL on error
+///
+fs_dir_t *fs_opendir(FS_t *fs, const char *path);
+
+///
+/// Reads the next entry of an open directory
+///   Served from the copy of the block the directory holds, so fs_get_stats does not count it
+/// \param fs The FS containing the directory
+/// \param dir The open directory
+/// \param record Where to put the entry
+/// \return 1 if an entry was read, 0 at the end of the directory, < 0 on error
+///
+int fs_readdir(FS_t *fs, fs_dir_t *dir, file_record_t *record);
+
+///
+/// Tells where an open directory is, to come back to with fs_seekdir
+///   The cookie stays good across fs_closedir and changes to the directory: entries that were
+///   there all along are neither skipped nor repeated when the listing is resumed from it,
+///   unless the entries on both sides of it were removed in the meantime
+/// \param dir The open directory
+/// \return Cookie for the next entry, 0 is the start of the directory
+///
+uint64_t fs_telldir(const fs_dir_t *dir);
+
+///
+/// Moves an open directory to a cookie from fs_telldir and reads its block again
+///   A cookie from another directory, or 0, starts it over
+/// \param fs The FS containing the directory
+/// \param dir The open directory
+/// \param cookie Where to go
+/// \return 0 on success, < 0 on failure
+///
+int fs_seekdir(FS_t *fs, fs_dir_t *dir, uint64_t cookie);
+
+///
+/// Closes an open directory
+/// \param dir The open directory
+/// \return 0 on success, < 0 on failure
+///
+int fs_closedir(fs_dir_t *dir);
+
+// what fs_walk hands its callback for each entry
+typedef struct {
+    const char *path;   // absolute path of the entry, good until the callback returns
+    const char *name;   // its last component, inside path
+    size_t inode;
+    size_t parent;      // inode of the directory holding it
+    size_t depth;       // 1 for the entries of the directory walked
+    file_t type;
+    size_t size;        // bytes (of its records for a directory), only filled in with FS_WALK_SIZE
+} fs_walk_entry_t;
+
+typedef int (*fs_walk_fn)(const fs_walk_entry_t *entry, void *arg);
+
+#define FS_WALK_PARALLEL 0x01   // list directories on one thread per online CPU, stealing work from each other; the callback runs on all of them at once
+#define FS_WALK_SIZE 0x02       // read each entry's inode for its size
+#define FS_WALK_PRUNE 1         // from the callback: do not enter this directory
+
+///
+/// Walks the tree under a directory, handing every entry to a callback
+///   Directories are listed by inode number, no path is resolved after the first. A directory
+///   linked in more than one place is listed once, its other names are reported but not entered.
+///   It owns the FS for the duration of the call like fs_write
+/// \param fs The FS
+/// \param root Absolute path to the directory to walk, which is not itself reported
+/// \param callback Called for each entry: returns 0 to go on, FS_WALK_PRUNE to not enter the
+///   directory it was given, < 0 to stop the walk
+/// \param arg Passed to the callback
+/// \param flags FS_WALK_* bits
+/// \return Entries reported, < 0 on failure or if the callback stopped the walk
+///
+ssize_t fs_walk(FS_t *fs, const char *root, fs_walk_fn callback, void *arg, unsigned flags);
+
 /// Moves the file from one location to the other
 ///   Moving files does not affect open descriptors
 /// \param fs The FS containing the file
@@ -222,5 +462,176 @@ int fs_move(FS_t *fs, const char *src, const char *dst);
 ///
 int fs_link(FS_t *fs, const char *src, const char *dst);
 
+///
+/// Creates several files in one directory
+///   The parent is resolved once, the new inodes are allocated together
+///   and the directory block and parent inode are written back once
+///   Either every file is created or none is
+/// \param fs The FS containing the directory
+/// \param parent_path Absolute path to the parent directory
+/// \param names Filenames (not paths) of the files to create
+/// \param types Type of each file to create (regular/directory)
+/// \param n Number of files
+/// \return 0 on success, < 0 on failure
+///
+int fs_create_batch(FS_t *fs, const char *parent_path, const char *const *names, const file_t *types, size_t n);
+
+///
+/// Removes several files from one directory and closes their open descriptors
+///   The parent is resolved once and written back once, descriptors are scanned once
+///   Directories can only be removed when empty
+///   Either every file is removed or none is
+/// \param fs The FS containing the directory
+/// \param parent_path Absolute path to the parent directory
+/// \param names Filenames (not paths) of the files to remove
+/// \param n Number of files
+/// \return 0 on success, < 0 on failure
+///
+int fs_remove_batch(FS_t *fs, const char *parent_path, const char *const *names, size_t n);
+
+#define FS_SNAPSHOT_NAME_MAX (30)
+// INCLUDING null terminator
+
+///
+/// Takes a named, read-only snapshot of the whole FS
+///   Only metadata is copied (inode table, directory and pointer blocks);
+///   data blocks are shared with the live FS and copied on write by fs_write
+/// \param fs The FS to snapshot
+/// \param name Name of the snapshot, unique within the FS
+/// \return 0 on success, < 0 on failure
+///
+int fs_snapshot(FS_t *fs, const char *name);
+
+///
+/// Deletes a snapshot and releases the blocks only it was holding on to
+/// \param fs The FS containing the snapshot
+/// \param name Name of the snapshot
+/// \return 0 on success, < 0 on failure
+///
+int fs_snapshot_delete(FS_t *fs, const char *name);
+
+///
+/// Mounts a snapshot of an FS file read-only
+///   Release it with fs_unmount
+/// \param path The FS file to mount
+/// \param name Name of the snapshot
+/// \return Mounted FS object, NULL on error
+///
+FS_t *fs_mount_snapshot(const char *path, const char *name);
+
+///
+/// Turns on block-level deduplication for this mount
+///   Data blocks already in the FS are hashed into an in-memory index (this reads every one of them),
+///   from then on fs_write stores a block whose contents already exist by sharing the existing block
+///   Blocks that already had duplicates are left as they are. The index is not saved in the image,
+///   blocks shared through it stay shared after dedup is turned off or the FS is unmounted
+/// \param fs The FS
+/// \return 0 on success (or if it was already on), < 0 on failure
+///
+int fs_dedup_enable(FS_t *fs);
+
+///
+/// Turns block-level deduplication off and drops the index
+/// \param fs The FS
+///
+void fs_dedup_disable(FS_t *fs);
+
+///
+/// Turns compression on or off for an empty regular file
+///   fs_write stores a compressed file in groups of 8 blocks, each full group compressed into
+///   as few blocks as it takes; fs_read decompresses them through a small cache of recent groups
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param compressed true to compress the file's data, false to store it in plain blocks
+/// \return 0 on success, < 0 on failure (not a regular file, or it already holds data)
+///
+int fs_set_compressed(FS_t *fs, const char *path, bool compressed);
+
+///
+/// Reports how fragmented a file's data is
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param frag Where to put the report, all zeros for a file with no data blocks
+/// \return 0 on success, < 0 on failure
+///
+int fs_fragmentation(FS_t *fs, const char *path, fs_frag_t *frag);
+
+///
+/// Moves file data into contiguous runs, a bounded amount at a time
+///   Each call picks up where the last one stopped, going through the files in inode order and
+///   moving each fragmented one into a free run as long as its data, then rewriting its pointer
+///   blocks. Blocks shared with a snapshot or through dedup stay where they are. Call it with a
+///   small budget whenever the FS is idle; it owns the FS for the duration of the call like fs_write.
+///   A file part way through holds its unfilled run until it is finished or the FS is unmounted
+/// \param fs The FS
+/// \param budget Block reads and writes this call may spend, the block in progress can take it over by a few
+/// \return Data blocks moved, 0 once no file can be improved, < 0 on failure
+///
+ssize_t fs_defrag(FS_t *fs, size_t budget);
+
+///
+/// Checks that an FS is consistent, and optionally repairs it
+///   Cross-checks the free block bitmap, the inode bitmap, link counts, directory entries and
+///   pointer blocks of the FS and of every snapshot. The inode tables are split between threads,
+///   then so is the block range. Snapshots are only checked, repair never writes to them.
+///   Repair zeroes bad pointers, drops bad directory entries, fixes link counts and extra-owner
+///   counts, frees orphaned files and empty directories and brings the free block bitmap in line;
+///   cross-linked blocks are left alone. Leaks are never released on an image formatted before
+///   fs_check existed, since the block store's own blocks cannot be told apart there.
+///   It owns the FS for the duration of the call like fs_write
+/// \param fs The FS
+/// \param threads Threads to check with, 0 for one per online CPU
+/// \param repair Fix what can be fixed
+/// \param report Where to put what was found, may be NULL
+/// \return Problems found (0 for a consistent FS), < 0 on failure
+///
+ssize_t fs_check(FS_t *fs, size_t threads, bool repair, fs_check_t *report);
+
+///
+/// Starts a transaction: what the calls after it change in the FS is committed together
+///   by fs_txn_commit, or undone by fs_txn_abort. Other users of the mount see the changes as
+///   they are made; the image file sees them all at once or not at all
+///   One transaction at a time per mount; fs_unmount aborts one left open
+/// \param fs The FS
+/// \return 0 on success, < 0 on failure (a transaction is open already, a mounted snapshot)
+///
+int fs_txn_begin(FS_t *fs);
+
+///
+/// Commits the open transaction: the image file gets everything changed since it was last
+///   written, through a journal beside it, so a crash leaves it with all of it or none of it
+///   and fs_mount finishes a commit the crash cut short. Two syncs, however much it holds
+/// \param fs The FS
+/// \return 0 on success, < 0 on failure (no open transaction, or writing the image failed;
+///   the transaction is undone then)
+///
+int fs_txn_commit(FS_t *fs);
+
+///
+/// Undoes the open transaction, putting the FS back as it was at fs_txn_begin
+///   Descriptors opened since are closed; descriptors closed since stay closed
+/// \param fs The FS
+/// \return 0 on success, < 0 on failure (no open transaction)
+///
+int fs_txn_abort(FS_t *fs);
+
+///
+/// Copies the counters of a mount
+///   They only ever grow, take the difference of two calls to measure something.
+///   fs_format, fs_mount and fs_mount_snapshot count on the FS they return, fs_unmount is not counted.
+///   A library built with FS_NO_STATS keeps no counters at all and always fails here
+/// \param fs The FS
+/// \param stats Where to copy them
+/// \return 0 on success, < 0 on failure
+///
+int fs_get_stats(FS_t *fs, fs_stats_t *stats);
+
+///
+/// Names an fs_call_t for reports
+/// \param op The call
+/// \return Its fs_* name without the prefix ("create", "read", ...), "?" if op is out of range
+///
+const char *fs_call_name(fs_call_t op);
+
 #endif
 
@@ -0,0 +1,73 @@
+#ifndef _FS_ASYNC_H__
+#define _FS_ASYNC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FS.h"
+
+// Submission/completion queue layered on top of fs_open/fs_read/fs_write/fs_close.
+//  Requests are handed to a pool of worker threads; requests on the same descriptor
+//  always run in submission order (they share a cursor), requests on different
+//  descriptors may complete out of order. Back-to-back transfers on one descriptor
+//  are merged into a single fs_read/fs_write call.
+//  While a ring is alive, the FS should only be driven through that ring.
+
+typedef enum { FS_OP_OPEN, FS_OP_CLOSE, FS_OP_READ, FS_OP_WRITE } fs_op_t;
+
+// one submission queue entry
+typedef struct {
+    fs_op_t op;
+    int fd;                 // descriptor for CLOSE/READ/WRITE, ignored for OPEN
+    const char *path;       // path for OPEN, ignored otherwise
+    void *buf;              // READ destination / WRITE source
+    size_t nbyte;           // transfer size for READ/WRITE
+    off_t offset;           // position from BOF for READ/WRITE, < 0 to use the descriptor cursor
+    uint64_t user_data;     // handed back untouched in the completion
+} fs_sqe_t;
+
+// one completion queue entry
+typedef struct {
+    uint64_t user_data;     // copied from the submission
+    ssize_t result;         // what the matching fs_* call returned (fd for OPEN, bytes for READ/WRITE)
+} fs_cqe_t;
+
+typedef struct fs_ring fs_ring_t;
+
+///
+/// Creates a submission/completion ring and its worker pool for a mounted FS
+/// \param fs The FS to drive
+/// \param entries Max number of requests in flight (queued + running + unreaped)
+/// \param workers Number of worker threads, at least 1
+/// \return New ring, NULL on error
+///
+fs_ring_t *fs_ring_create(FS_t *fs, size_t entries, size_t workers);
+
+///
+/// Drains all outstanding requests, stops the workers and frees the ring
+///   Completions that were never reaped are discarded
+/// \param ring The ring to destroy
+///
+void fs_ring_destroy(fs_ring_t *ring);
+
+///
+/// Queues a batch of requests
+///   The batch is copied, but READ/WRITE buffers and OPEN paths must stay valid until reaped
+/// \param ring The ring
+/// \param batch Array of requests
+/// \param n Number of requests in batch
+/// \return number of requests queued (< n IFF the ring is full), < 0 on error
+///
+ssize_t fs_submit(fs_ring_t *ring, const fs_sqe_t *batch, size_t n);
+
+///
+/// Collects finished requests
+/// \param ring The ring
+/// \param completions Array to fill
+/// \param max Capacity of completions
+/// \param min_complete Block until at least this many completions are available (capped to what is in flight)
+/// \return number of completions written, < 0 on error
+///
+ssize_t fs_reap(fs_ring_t *ring, fs_cqe_t *completions, size_t max, size_t min_complete);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _FS_CLIENT_H__
+#define _FS_CLIENT_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "dyn_array.h"
+#include "FS_proto.h"
+
+// Client side of the fsd protocol (FS_proto.h). The single calls mirror FS.h and cost one
+//  round trip each; fs_client_batch sends any number of them in one message.
+//  A client is one connection and must not be used from two threads at once.
+
+typedef struct fs_client fs_client_t;
+
+// one call in a batch
+typedef struct {
+    fs_req_op_t op;
+    int fd;                 // CLOSE/READ/WRITE
+    const char *path;       // OPEN/GET_DIR
+    void *buf;              // READ destination / WRITE source
+    size_t nbyte;           // READ/WRITE size
+    ssize_t result;         // filled in: what the fs_* call returned, entry count for GET_DIR
+    dyn_array_t *entries;   // filled in for GET_DIR: file_record_t array the caller destroys, NULL on error
+} fs_client_req_t;
+
+///
+/// Connects to a running fsd
+/// \param socket_path The server's socket
+/// \return New client, NULL on error
+///
+fs_client_t *fs_client_connect(const char *socket_path);
+
+///
+/// Disconnects, the server closes every descriptor this client left open
+/// \param client The client
+///
+void fs_client_disconnect(fs_client_t *client);
+
+///
+/// Runs a batch of calls in one round trip, in order
+/// \param client The client
+/// \param batch Calls to make, results are filled in
+/// \param n Number of calls, at most FS_PROTO_MAX_BATCH
+/// \return 0 on success (individual calls can still have failed), < 0 if the batch could not be sent or answered
+///
+int fs_client_batch(fs_client_t *client, fs_client_req_t *batch, size_t n);
+
+int fs_client_open(fs_client_t *client, const char *path);
+int fs_client_close(fs_client_t *client, int fd);
+ssize_t fs_client_read(fs_client_t *client, int fd, void *dst, size_t nbyte);
+ssize_t fs_client_write(fs_client_t *client, int fd, const void *src, size_t nbyte);
+dyn_array_t *fs_client_get_dir(fs_client_t *client, const char *path);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _FS_LZ_H__
+#define _FS_LZ_H__
+
+#include <stddef.h>
+
+// LZ77 byte codec in the LZ4 block format, used by the FS for compressed files.
+//  Greedy single-probe matcher: fast and nowhere near the best ratio,
+//  which is the right trade for data that is compressed on every write.
+
+///
+/// Compresses a buffer
+/// \param src Data to compress
+/// \param n Size of src
+/// \param dst Destination buffer
+/// \param capacity Size of dst
+/// \return compressed size, 0 if it does not fit in capacity
+///
+size_t fs_lz_compress(const void *src, size_t n, void *dst, size_t capacity);
+
+///
+/// Decompresses a buffer produced by fs_lz_compress
+/// \param src Compressed data
+/// \param n Size of src
+/// \param dst Destination buffer
+/// \param capacity Size of dst
+/// \return decompressed size, SIZE_MAX if src is malformed or does not fit in capacity
+///
+size_t fs_lz_decompress(const void *src, size_t n, void *dst, size_t capacity);
+
+#endif
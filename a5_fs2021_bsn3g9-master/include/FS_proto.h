@@ -0,0 +1,51 @@
+#ifndef _FS_PROTO_H__
+#define _FS_PROTO_H__
+
+#include <stdint.h>
+
+// Wire format between fsd (FS_server.h) and its clients (FS_client.h) over a Unix domain socket.
+//  Both ends are on the same host, so everything is in host byte order.
+//  A client sends one request message and reads one reply message before sending the next.
+//  Every message is a header followed by count records, each record followed by its payload:
+//
+//   request records                 payload
+//     FS_REQ_OPEN, FS_REQ_GET_DIR   the path, nbyte bytes, no terminator
+//     FS_REQ_WRITE                  nbyte bytes of data
+//     FS_REQ_READ, FS_REQ_CLOSE     none (nbyte is the READ size)
+//
+//   reply records (same order)      payload
+//     FS_REQ_READ                   the nbyte bytes read
+//     FS_REQ_GET_DIR                nbyte bytes of entries: uint8_t type, uint8_t name length, name
+//     others                        none
+//
+//  result is what the matching fs_* call returned (fd, bytes, 0, or < 0 on error);
+//  for GET_DIR it is the number of entries. Descriptors belong to the connection that
+//  opened them and are closed when it goes away.
+
+#define FS_PROTO_MAGIC 0x46535250   // "FSRP"
+#define FS_PROTO_MAX_BATCH 256      // records per message
+#define FS_PROTO_MAX_MESSAGE (16u << 20)    // bytes after the header
+#define FS_PROTO_MAX_PATH 4096
+
+typedef enum { FS_REQ_OPEN = 1, FS_REQ_CLOSE, FS_REQ_READ, FS_REQ_WRITE, FS_REQ_GET_DIR } fs_req_op_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;         // records in this message
+    uint32_t length;        // bytes after the header
+} fs_msg_header_t;
+
+typedef struct {
+    uint8_t op;             // fs_req_op_t
+    uint8_t reserved[3];
+    int32_t fd;             // CLOSE/READ/WRITE
+    uint32_t nbyte;         // payload size, or bytes to READ
+} fs_req_record_t;
+
+typedef struct {
+    int64_t result;
+    uint32_t nbyte;         // payload size
+    uint32_t reserved;
+} fs_reply_record_t;
+
+#endif
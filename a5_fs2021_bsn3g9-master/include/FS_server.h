@@ -0,0 +1,34 @@
+#ifndef _FS_SERVER_H__
+#define _FS_SERVER_H__
+
+#include <stddef.h>
+
+#include "FS.h"
+#include "FS_proto.h"
+
+// Serves a mounted FS to other processes over a Unix domain socket (protocol in FS_proto.h).
+//  One poller thread accepts connections and watches idle ones; a pool of workers each take a
+//  connection with a message waiting, run its whole batch and send the reply. Like the ring in
+//  FS_async.h, reads share the FS while everything else has it to itself.
+//  While a server is running, the FS should only be driven through it.
+
+typedef struct fs_server fs_server_t;
+
+///
+/// Starts serving a mounted FS
+/// \param fs The FS to serve
+/// \param socket_path Where to create the socket, an existing socket file there is replaced
+/// \param workers Number of worker threads, at least 1
+/// \return New server, NULL on error
+///
+fs_server_t *fs_server_start(FS_t *fs, const char *socket_path, size_t workers);
+
+///
+/// Stops accepting, lets running batches finish, closes every connection (and the
+/// descriptors they had open), removes the socket file and frees the server
+///   The FS stays mounted
+/// \param server The server to stop
+///
+void fs_server_stop(fs_server_t *server);
+
+#endif
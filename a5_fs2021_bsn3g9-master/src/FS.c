@@ -1,7 +1,15 @@
+#define _GNU_SOURCE     // mremap, MAP_ANONYMOUS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include "dyn_array.h"
 #include "bitmap.h"
 #include "block_store.h"
 #include "FS.h"
+#include "FS_lz.h"
 
 #define BLOCK_STORE_NUM_BLOCKS 65536    // 2^16 blocks.
 #define BLOCK_STORE_AVAIL_BLOCKS 65534  // Last 2 blocks consumed by the FBM
@@ -14,2493 +22,6428 @@
 // remove it before you submit. Just allows things to compile initially.
 #define UNUSED(x) (void)(x)
 
-/// Formats (and mounts) an FS file for use
-/// \param fname The file to format
-/// \return Mounted FS object, NULL on error
-///
-FS_t *fs_format(const char *path)
+// Compressed files keep their data in groups of COMPRESS_GROUP_BLOCKS blocks (see fs_compressed_write)
+#define COMPRESS_GROUP_BLOCKS 8
+#define COMPRESS_GROUP_BYTES (COMPRESS_GROUP_BLOCKS * BLOCK_SIZE_BYTES)
+#define GROUP_CACHE_ENTRIES 8
+
+// the last few compressed groups read, decompressed, for all compressed files of one mount
+struct group_cache
 {
-    if(path != NULL && strlen(path) != 0)
+    pthread_mutex_t lock;       // filled by fs_read, and the ring and server let reads share the FS
+    size_t hand;                // next entry to evict, round robin
+    struct
     {
-        FS_t * ptr_FS = (FS_t *)calloc(1, sizeof(FS_t));	// get started
-        ptr_FS->BlockStore_whole = block_store_create(path);				// pointer to start of a large chunck of memory
+        bool valid;
+        size_t inodeNum;
+        size_t group;
+        uint8_t data[COMPRESS_GROUP_BYTES];
+    } entry[GROUP_CACHE_ENTRIES];
+};
+
+// the entries are only touched once a compressed file is read, so this costs no memory until then
+static struct group_cache *fs_cache_create(void)
+{
+    struct group_cache *cache = (struct group_cache *)calloc(1, sizeof(struct group_cache));
+    if(cache != NULL && pthread_mutex_init(&cache->lock, NULL) != 0)
+    {
+        free(cache);
+        cache = NULL;
+    }
+    return cache;
+}
 
-        // reserve the 1st block for bitmap of inode
-        size_t bitmap_ID = block_store_allocate(ptr_FS->BlockStore_whole);
-        //		printf("bitmap_ID = %zu\n", bitmap_ID);
+static void fs_cache_destroy(struct group_cache *cache)
+{
+    if(cache != NULL)
+    {
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+    }
+}
 
-        // 2rd - 5th block for inodes, 4 blocks in total
-        size_t inode_start_block = block_store_allocate(ptr_FS->BlockStore_whole);
-        //		printf("inode_start_block = %zu\n", inode_start_block);
-        for(int i = 0; i < 3; i++)
+// Appends to regular files are held here and only given blocks when they are flushed
+// (see fs_delalloc_write): on fs_close, fs_read, a write somewhere else in the file,
+// a full buffer, or anything that looks at every file
+#define DELALLOC_FILES 8
+#define DELALLOC_BLOCKS 64      // per file, 256 KiB
+#define DELALLOC_BYTES (DELALLOC_BLOCKS * BLOCK_SIZE_BYTES)
+#define DELALLOC_POINTER_BLOCKS 2   // an indirect block, or a double indirect one and its first indirect
+
+struct delalloc
+{
+    pthread_mutex_t lock;       // fs_read flushes a file's entry, so two readers can flush at once
+    size_t hand;                // next entry to flush when they are all in use
+    size_t reserved;            // blocks the entries below are sure to get when they are flushed
+    size_t next;                // where to look for the next run of free blocks
+    struct
+    {
+        size_t inodeNum;        // 0 when the entry is free, the root is never buffered
+        size_t first;           // file block the buffer starts at
+        size_t bytes;           // buffered from the start of block first
+        size_t reserved;
+        uint8_t *data;          // DELALLOC_BYTES, allocated the first time the entry is used
+    } entry[DELALLOC_FILES];
+};
+
+static struct delalloc *fs_delalloc_create(void)
+{
+    struct delalloc *delalloc = (struct delalloc *)calloc(1, sizeof(struct delalloc));
+    if(delalloc != NULL && pthread_mutex_init(&delalloc->lock, NULL) != 0)
+    {
+        free(delalloc);
+        delalloc = NULL;
+    }
+    return delalloc;
+}
+
+// callers flush first, whatever is still buffered is lost
+static void fs_delalloc_destroy(struct delalloc *delalloc)
+{
+    if(delalloc != NULL)
+    {
+        for(size_t i = 0; i < DELALLOC_FILES; i++)
         {
-            block_store_allocate(ptr_FS->BlockStore_whole);
-            //			printf("all the way with block %zu\n", block_store_allocate(ptr_FS->BlockStore_whole));
+            free(delalloc->entry[i].data);
         }
+        pthread_mutex_destroy(&delalloc->lock);
+        free(delalloc);
+    }
+}
 
-        // install inode block store inside the whole block store
-        ptr_FS->BlockStore_inode = block_store_inode_create(block_store_Data_location(ptr_FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
+#define DELALLOC_ALL SIZE_MAX
+static void fs_delalloc_flush(FS_t *fs, size_t inodeNum, inode_t *held);
+static void fs_defrag_finish(FS_t *fs);
+static void fs_superblock_record_store(FS_t *fs);
+static size_t fs_superblock_layout(FS_t *fs);
+static void fs_superblock_set_layout(FS_t *fs, fs_layout_t layout);
+static void fs_release_file_blocks(FS_t *fs, const inode_t *file_inode);
+static size_t fs_path_to_inode(FS_t *fs, const char *path);
+static struct journal *fs_journal_create(const char *image);
+static void fs_journal_destroy(struct journal *journal);
+static void fs_journal_touch(FS_t *fs, size_t block_id);
+static void fs_journal_replay(const char *image);
+static char *fs_journal_path(const char *image);
+
+// Open-file table: an entry per inode with open descriptors, shared by all of them. It keeps a
+// copy of the inode and of the pointer blocks last used to map the file's blocks, which the
+// fs_inode_write and fs_block_write below keep in step with the stores, so opening a file again
+// and fs_block_at on an open file do not go to the stores. The descriptors of one inode are
+// chained through fileDescriptor.next, so closing them all only visits those.
+#define OPEN_MAP_INDIRECT 0     // the indirect block
+#define OPEN_MAP_DOUBLE 1       // the double indirect block
+#define OPEN_MAP_UNDER_DOUBLE 2 // the indirect block under it that was used last
+#define OPEN_MAP_BLOCKS 3
+
+struct open_file
+{
+    size_t refcount;            // descriptors open on the inode
+    int16_t first_fd;           // head of their chain
+    inode_t inode;
+    struct
+    {
+        size_t block_id;        // 0 while the copy holds nothing
+        uint16_t pointers[2048];
+    } map[OPEN_MAP_BLOCKS];
+};
 
-        // the first inode is reserved for root dir
-        block_store_sub_allocate(ptr_FS->BlockStore_inode);
-        //		printf("first inode ID = %zu\n", block_store_sub_allocate(ptr_FS->BlockStore_inode));
+struct open_table
+{
+    pthread_mutex_t lock;       // concurrent reads fill map copies and mark them in mapped
+    struct open_file *file[number_inodes];
+    bitmap_t *mapped;           // blocks some map copy may hold, so most block writes skip the scan
+};
 
-        // update the root inode info.
-        uint8_t root_inode_ID = 0;	// root inode is the first one in the inode table
-        inode_t * root_inode = (inode_t *) calloc(1, sizeof(inode_t));
-        //		printf("size of inode_t = %zu\n", sizeof(inode_t));
-        root_inode->vacantFile = 0x00000000;
-        root_inode->fileType = 'd';
-        root_inode->inodeNumber = root_inode_ID;
-        root_inode->linkCount = 1;
-        //		root_inode->directPointer[0] = root_data_ID;	// not allocate date block for it until it has a sub-folder or file
-        block_store_inode_write(ptr_FS->BlockStore_inode, root_inode_ID, root_inode);
-        free(root_inode);
+static struct open_table *fs_open_table_create(void)
+{
+    struct open_table *table = (struct open_table *)calloc(1, sizeof(struct open_table));
+    if(table == NULL)
+    {
+        return NULL;
+    }
+    table->mapped = bitmap_create(BLOCK_STORE_NUM_BLOCKS);
+    if(table->mapped == NULL || pthread_mutex_init(&table->lock, NULL) != 0)
+    {
+        bitmap_destroy(table->mapped);
+        free(table);
+        return NULL;
+    }
+    return table;
+}
 
-        // now allocate space for the file descriptors
-        ptr_FS->BlockStore_fd = block_store_fd_create();
+static void fs_open_table_destroy(struct open_table *table)
+{
+    if(table != NULL)
+    {
+        for(size_t i = 0; i < number_inodes; i++)
+        {
+            free(table->file[i]);
+        }
+        bitmap_destroy(table->mapped);
+        pthread_mutex_destroy(&table->lock);
+        free(table);
+    }
+}
 
-        return ptr_FS;
+// block_id left a map copy, clear its bit unless another copy still holds it. Called with the lock held.
+static void fs_open_map_forget(struct open_table *table, size_t block_id)
+{
+    if(block_id == 0)
+    {
+        return;
+    }
+    for(size_t i = 0; i < number_inodes; i++)
+    {
+        for(size_t slot = 0; table->file[i] != NULL && slot < OPEN_MAP_BLOCKS; slot++)
+        {
+            if(table->file[i]->map[slot].block_id == block_id)
+            {
+                return;
+            }
+        }
     }
+    bitmap_reset(table->mapped, block_id);
+}
 
-    return NULL;
+// the copy of an open file's inode
+// \return false if the inode has no open descriptors
+static bool fs_open_inode_read(FS_t *fs, size_t inode_id, void *buffer)
+{
+    struct open_table *table = fs->open;
+    bool open = false;
+    if(table != NULL && inode_id < number_inodes)
+    {
+        pthread_mutex_lock(&table->lock);
+        if(table->file[inode_id] != NULL)
+        {
+            memcpy(buffer, &table->file[inode_id]->inode, sizeof(inode_t));
+            open = true;
+        }
+        pthread_mutex_unlock(&table->lock);
+    }
+    return open;
+}
+
+static void fs_open_inode_written(FS_t *fs, size_t inode_id, const void *buffer)
+{
+    struct open_table *table = fs->open;
+    if(table != NULL && inode_id < number_inodes)
+    {
+        pthread_mutex_lock(&table->lock);
+        if(table->file[inode_id] != NULL)
+        {
+            memcpy(&table->file[inode_id]->inode, buffer, sizeof(inode_t));
+        }
+        pthread_mutex_unlock(&table->lock);
+    }
 }
 
+static void fs_open_block_written(FS_t *fs, size_t block_id, const void *buffer)
+{
+    struct open_table *table = fs->open;
+    if(table == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&table->lock);
+    if(bitmap_test(table->mapped, block_id))
+    {
+        for(size_t i = 0; i < number_inodes; i++)
+        {
+            for(size_t slot = 0; table->file[i] != NULL && slot < OPEN_MAP_BLOCKS; slot++)
+            {
+                if(table->file[i]->map[slot].block_id == block_id)
+                {
+                    memcpy(table->file[i]->map[slot].pointers, buffer, BLOCK_SIZE_BYTES);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+}
 
+#ifndef FS_NO_STATS
+// counters can be bumped by reads running side by side, relaxed is all they need
+#define FS_STAT_ADD(fs, counter, n) __atomic_fetch_add(&(fs)->stats.counter, (n), __ATOMIC_RELAXED)
 
-///
-/// Mounts an FS object and prepares it for use
-/// \param fname The file to mount
+// times one fs_* call from its FS_CALL_TIMER to whichever return it leaves by
+typedef struct
+{
+    FS_t *fs;
+    fs_call_t call;
+    uint64_t start;
+} fs_call_timer_t;
 
-/// \return Mounted FS object, NULL on error
+static uint64_t fs_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
 
-///
-FS_t *fs_mount(const char *path)
+static void fs_call_timer_done(fs_call_timer_t *timer)
 {
-    if(path != NULL && strlen(path) != 0)
+    if(timer->fs != NULL)
     {
-        FS_t * ptr_FS = (FS_t *)calloc(1, sizeof(FS_t));	// get started
-        ptr_FS->BlockStore_whole = block_store_open(path);	// get the chunck of data
-
-        // the bitmap block should be the 1st one
-        size_t bitmap_ID = 0;
+        FS_STAT_ADD(timer->fs, call[timer->call].calls, 1);
+        FS_STAT_ADD(timer->fs, call[timer->call].ns, fs_now_ns() - timer->start);
+    }
+}
 
-        // the inode blocks start with the 2nd block, and goes around until the 5th block, 4 in total
-        size_t inode_start_block = 1;
+#define FS_CALL_TIMER(fs, fs_call) fs_call_timer_t fs_call_timer __attribute__((cleanup(fs_call_timer_done))) = {(fs), (fs_call), fs_now_ns()}
+// for the calls that make the FS they are counted on
+#define FS_CALL_TIMER_FOR(new_fs) (fs_call_timer.fs = (new_fs))
+#else
+#define FS_STAT_ADD(fs, counter, n) ((void)(fs))
+#define FS_CALL_TIMER(fs, fs_call) ((void)0)
+#define FS_CALL_TIMER_FOR(new_fs) ((void)0)
+#endif
+
+// every access to the data store and the inode table goes through these so fs_get_stats can count it
+static size_t fs_block_read(FS_t *fs, size_t block_id, void *buffer)
+{
+    FS_STAT_ADD(fs, block_reads, 1);
+    return block_store_read(fs->BlockStore_whole, block_id, buffer);
+}
 
-        // attach the bitmaps to their designated place
-        ptr_FS->BlockStore_inode = block_store_inode_create(block_store_Data_location(ptr_FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
+static size_t fs_block_write(FS_t *fs, size_t block_id, const void *buffer)
+{
+    FS_STAT_ADD(fs, block_writes, 1);
+    fs_journal_touch(fs, block_id);
+    fs_open_block_written(fs, block_id, buffer);
+    return block_store_write(fs->BlockStore_whole, block_id, buffer);
+}
 
-        // since file descriptors are allocated outside of the whole blocks, we can simply reallocate space for it.
-        ptr_FS->BlockStore_fd = block_store_fd_create();
+// Blocks promised to buffered appends (see fs_delalloc_reserve) have to be there when they are
+// flushed, so everything that takes blocks asks here first and leaves them alone.
+// \return true if n blocks can be taken without dipping into the reservation
+static bool fs_blocks_spare(FS_t *fs, size_t n)
+{
+    size_t reserved = fs->delalloc != NULL ? __atomic_load_n(&fs->delalloc->reserved, __ATOMIC_RELAXED) : 0;
+    return reserved == 0 || block_store_get_free_blocks(fs->BlockStore_whole) >= reserved + n;
+}
 
-        return ptr_FS;
+static size_t fs_block_allocate(FS_t *fs)
+{
+    FS_STAT_ADD(fs, bitmap_scans, 1);
+    if(!fs_blocks_spare(fs, 1))
+    {
+        return SIZE_MAX;
     }
+    return block_store_allocate(fs->BlockStore_whole);
+}
 
-    return NULL;
+// The inode table and the descriptors are reached through a layout, chosen at fs_format_layout
+//  and recorded in the superblock. Both keep the inode bitmap in block 0 and the table in
+//  blocks 1-4 (or their copy in a mounted snapshot), so fs_check, snapshots and dedup can read
+//  either image directly; they only differ in how a mount gets at them.
+struct fs_layout
+{
+    bool (*attach)(FS_t *fs, uint8_t *bitmap, uint8_t *inodes);
+    void (*detach)(FS_t *fs);
+    size_t (*inode_read)(FS_t *fs, size_t inode_id, void *buffer);
+    size_t (*inode_write)(FS_t *fs, size_t inode_id, const void *buffer);
+    size_t (*inode_allocate)(FS_t *fs);         // SIZE_MAX when all are taken
+    bool (*inode_test)(FS_t *fs, size_t inode_id);
+    void (*inode_release)(FS_t *fs, size_t inode_id);
+    size_t (*fd_allocate)(FS_t *fs);            // SIZE_MAX when all are taken
+    bool (*fd_test)(FS_t *fs, size_t fd);
+    void (*fd_release)(FS_t *fs, size_t fd);
+};
+
+// FS_LAYOUT_BLOCK_STORE: a block store over the inode table, another for the descriptors
+static bool fs_store_attach(FS_t *fs, uint8_t *bitmap, uint8_t *inodes)
+{
+    fs->BlockStore_inode = block_store_inode_create(bitmap, inodes);
+    fs->BlockStore_fd = block_store_fd_create();
+    return fs->BlockStore_inode != NULL && fs->BlockStore_fd != NULL;
 }
 
+static void fs_store_detach(FS_t *fs)
+{
+    block_store_inode_destroy(fs->BlockStore_inode);
+    block_store_fd_destroy(fs->BlockStore_fd);
+}
 
+static size_t fs_store_inode_read(FS_t *fs, size_t inode_id, void *buffer)
+{
+    return block_store_inode_read(fs->BlockStore_inode, inode_id, buffer);
+}
 
+static size_t fs_store_inode_write(FS_t *fs, size_t inode_id, const void *buffer)
+{
+    return block_store_inode_write(fs->BlockStore_inode, inode_id, buffer);
+}
 
-///
-/// Unmounts the given object and frees all related resources
-/// \param fs The FS object to unmount
-/// \return 0 on success, < 0 on failure
-///
-int fs_unmount(FS_t *fs)
+static size_t fs_store_inode_allocate(FS_t *fs)
 {
-    if(fs != NULL)
-    {
-        block_store_inode_destroy(fs->BlockStore_inode);
+    return block_store_sub_allocate(fs->BlockStore_inode);
+}
 
-        block_store_destroy(fs->BlockStore_whole);
-        block_store_fd_destroy(fs->BlockStore_fd);
+static bool fs_store_inode_test(FS_t *fs, size_t inode_id)
+{
+    return block_store_sub_test(fs->BlockStore_inode, inode_id);
+}
 
-        free(fs);
-        return 0;
-    }
-    return -1;
+static void fs_store_inode_release(FS_t *fs, size_t inode_id)
+{
+    block_store_sub_release(fs->BlockStore_inode, inode_id);
 }
 
+static size_t fs_store_fd_allocate(FS_t *fs)
+{
+    return block_store_sub_allocate(fs->BlockStore_fd);
+}
 
-// check if the input filename is valid or not
-bool isValidFileName(const char *filename)
+static bool fs_store_fd_test(FS_t *fs, size_t fd)
+{
+    return block_store_sub_test(fs->BlockStore_fd, fd);
+}
+
+static void fs_store_fd_release(FS_t *fs, size_t fd)
 {
-    if(!filename || strlen(filename) == 0 || strlen(filename) > 127 || '/'==filename[0])
+    block_store_sub_release(fs->BlockStore_fd, fd);
+}
+
+// FS_LAYOUT_TABLE: the inode table is an array where it lies, with a bitmap over block 0, and
+//  the free descriptors wait on a dyn_array, lowest on top, so taking one is a pop instead of
+//  a search. A released descriptor is the next one handed out.
+struct fs_tables
+{
+    uint8_t *inodes;            // the inode table in the data store
+    bitmap_t *inode_used;       // overlay of the inode bitmap
+    bitmap_t *fd_used;
+    dyn_array_t *fd_free;       // size_t descriptors not in use
+};
+
+static void fs_tables_detach(FS_t *fs)
+{
+    if(fs->tables != NULL)
     {
-        return false;
+        bitmap_destroy(fs->tables->inode_used);
+        bitmap_destroy(fs->tables->fd_used);
+        dyn_array_destroy(fs->tables->fd_free);
+        free(fs->tables);
+        fs->tables = NULL;
     }
+}
 
+static bool fs_tables_attach(FS_t *fs, uint8_t *bitmap, uint8_t *inodes)
+{
+    struct fs_tables *tables = (struct fs_tables *)calloc(1, sizeof(struct fs_tables));
+    if(tables == NULL)
+    {
+        return false;
+    }
+    fs->tables = tables;
+    tables->inodes = inodes;
+    tables->inode_used = bitmap_overlay(number_inodes, bitmap);
+    tables->fd_used = bitmap_create(number_fd);
+    tables->fd_free = dyn_array_create(number_fd, sizeof(size_t), NULL);
+    if(tables->inode_used == NULL || tables->fd_used == NULL || tables->fd_free == NULL)
+    {
+        return false;
+    }
+    for(size_t fd = number_fd; fd > 0; fd--)
+    {
+        size_t free_fd = fd - 1;
+        dyn_array_push_back(tables->fd_free, &free_fd);
+    }
     return true;
 }
 
+static size_t fs_tables_inode_read(FS_t *fs, size_t inode_id, void *buffer)
+{
+    if(inode_id >= number_inodes || buffer == NULL)
+    {
+        return 0;
+    }
+    memcpy(buffer, fs->tables->inodes + inode_id * inode_size, inode_size);
+    return inode_size;
+}
 
-
-// use str_split to decompose the input string into filenames along the path, '/' as delimiter
-char** str_split(char* a_str, const char a_delim, size_t * count)
+static size_t fs_tables_inode_write(FS_t *fs, size_t inode_id, const void *buffer)
 {
-    if(*a_str != '/')
+    if(inode_id >= number_inodes || buffer == NULL)
     {
-        return NULL;
+        return 0;
     }
-    char** result    = 0;
-    char* tmp        = a_str;
-    char delim[2];
-    delim[0] = a_delim;
-    delim[1] = '\0';
+    memcpy(fs->tables->inodes + inode_id * inode_size, buffer, inode_size);
+    return inode_size;
+}
 
-    /* Count how many elements will be extracted. */
-    while (*tmp)
+static size_t fs_tables_inode_allocate(FS_t *fs)
+{
+    size_t inode_id = bitmap_ffz(fs->tables->inode_used);
+    if(inode_id != SIZE_MAX)
     {
-        if (a_delim == *tmp)
-        {
-            (*count)++;
-        }
-        tmp++;
+        bitmap_set(fs->tables->inode_used, inode_id);
     }
+    return inode_id;
+}
 
-    result = (char**)calloc(1, sizeof(char*) * (*count));
-    for(size_t i = 0; i < (*count); i++)
+static bool fs_tables_inode_test(FS_t *fs, size_t inode_id)
+{
+    return inode_id < number_inodes && bitmap_test(fs->tables->inode_used, inode_id);
+}
+
+static void fs_tables_inode_release(FS_t *fs, size_t inode_id)
+{
+    if(inode_id < number_inodes)
     {
-        *(result + i) = (char*)calloc(1, 200);
+        bitmap_reset(fs->tables->inode_used, inode_id);
     }
+}
 
-    if (result)
+static size_t fs_tables_fd_allocate(FS_t *fs)
+{
+    size_t fd;
+    if(!dyn_array_extract_back(fs->tables->fd_free, &fd))
     {
-        size_t idx  = 0;
-        char* token = strtok(a_str, delim);
+        return SIZE_MAX;
+    }
+    bitmap_set(fs->tables->fd_used, fd);
+    return fd;
+}
 
-        while (token)
-        {
-            strcpy(*(result + idx++), token);
-            //    *(result + idx++) = strdup(token);
-            token = strtok(NULL, delim);
-        }
+static bool fs_tables_fd_test(FS_t *fs, size_t fd)
+{
+    return fd < number_fd && bitmap_test(fs->tables->fd_used, fd);
+}
 
+static void fs_tables_fd_release(FS_t *fs, size_t fd)
+{
+    if(fs_tables_fd_test(fs, fd))
+    {
+        bitmap_reset(fs->tables->fd_used, fd);
+        dyn_array_push_back(fs->tables->fd_free, &fd);
     }
-    return result;
 }
 
+static const struct fs_layout fs_layouts[FS_LAYOUT_COUNT] = {
+    [FS_LAYOUT_BLOCK_STORE] = {fs_store_attach, fs_store_detach, fs_store_inode_read, fs_store_inode_write,
+        fs_store_inode_allocate, fs_store_inode_test, fs_store_inode_release,
+        fs_store_fd_allocate, fs_store_fd_test, fs_store_fd_release},
+    [FS_LAYOUT_TABLE] = {fs_tables_attach, fs_tables_detach, fs_tables_inode_read, fs_tables_inode_write,
+        fs_tables_inode_allocate, fs_tables_inode_test, fs_tables_inode_release,
+        fs_tables_fd_allocate, fs_tables_fd_test, fs_tables_fd_release},
+};
+
+// set up a new FS_t on its inode bitmap and table with the given layout
+// \return false if it could not, whatever was set up is freed by fs_layout_detach
+static bool fs_layout_attach(FS_t *fs, size_t layout, uint8_t *bitmap, uint8_t *inodes)
+{
+    fs->layout = &fs_layouts[layout < FS_LAYOUT_COUNT ? layout : FS_LAYOUT_BLOCK_STORE];
+    return fs->layout->attach(fs, bitmap, inodes);
+}
 
+static void fs_layout_detach(FS_t *fs)
+{
+    if(fs->layout != NULL)
+    {
+        fs->layout->detach(fs);
+    }
+}
 
-///
-/// Creates a new file at the specified location
-///   Directories along the path that do not exist are not created
-/// \param fs The FS containing the file
-/// \param path Absolute path to file to create
-/// \param type Type of file to create (regular/directory)
-/// \return 0 on success, < 0 on failure
-///
-int fs_create(FS_t *fs, const char *path, file_t type)
+// inodes of open files come from the open-file table and do not count
+static size_t fs_inode_read(FS_t *fs, size_t inode_id, void *buffer)
 {
-    if(fs != NULL && path != NULL && strlen(path) != 0 && (type == FS_REGULAR || type == FS_DIRECTORY))
+    if(fs_open_inode_read(fs, inode_id, buffer))
     {
-        // char* copy_path = (char*)calloc(1, 65535);
-        char* copy_path = (char*)calloc(1, BLOCK_STORE_NUM_BLOCKS -1); 
-        if ( copy_path == NULL ) {
-            printf("copy_path, line: 200; failed (returned -1 ) " ); 
-            return -1; 
-        }
-       
-        if (strlen(path) >= BLOCK_STORE_NUM_BLOCKS -1) {
-            free(copy_path);
+        return inode_size;
+    }
+    FS_STAT_ADD(fs, inode_reads, 1);
+    return fs->layout->inode_read(fs, inode_id, buffer);
+}
 
-            return -1;
-        }
-        strcpy(copy_path, path); 
-        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
-        size_t count = 0;
-        tokens = str_split(copy_path, '/', &count);
-        free(copy_path);
-        if(tokens == NULL)
-        {
-            return -1;
-        }
+static size_t fs_inode_write(FS_t *fs, size_t inode_id, const void *buffer)
+{
+    FS_STAT_ADD(fs, inode_writes, 1);
+    fs_open_inode_written(fs, inode_id, buffer);
+    return fs->layout->inode_write(fs, inode_id, buffer);
+}
 
-        // let's check if the filenames are valid or not
-        for(size_t n = 0; n < count; n++)
+// seconds since the epoch as an inode keeps them
+static uint32_t fs_time_now(void)
+{
+    return (uint32_t)time(NULL);
+}
+
+// the mode and timestamps of an inode about to be written for the first time, fileType set
+static void fs_inode_stamp_new(inode_t *node)
+{
+    node->flags |= FS_INODE_MODE;
+    node->mode = node->fileType == 'd' ? FS_MODE_DIRECTORY : FS_MODE_FILE;
+    node->created = node->modified = fs_time_now();
+}
+
+// a free inode
+static size_t fs_inode_allocate(FS_t *fs)
+{
+    FS_STAT_ADD(fs, bitmap_scans, 1);
+    return fs->layout->inode_allocate(fs);
+}
+
+// a free descriptor
+static size_t fs_fd_allocate(FS_t *fs)
+{
+    FS_STAT_ADD(fs, bitmap_scans, 1);
+    return fs->layout->fd_allocate(fs);
+}
+
+// give descriptor fd, just allocated, to an inode. Its entry in the open-file table is made by
+// the first descriptor, with a copy of file_inode; the others only join the chain.
+// \return false when out of memory
+static bool fs_open_file_attach(FS_t *fs, int fd, size_t inode_id, const inode_t *file_inode)
+{
+    struct open_table *table = fs->open;
+    if(table == NULL)
+    {
+        return false;
+    }
+    pthread_mutex_lock(&table->lock);
+    struct open_file *file = table->file[inode_id];
+    if(file == NULL)
+    {
+        file = (struct open_file *)calloc(1, sizeof(struct open_file));
+        if(file == NULL)
         {
-            if(isValidFileName(*(tokens + n)) == false)
-            {
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);
-                //printf("invalid filename\n");
-                return -1;
-            }
+            pthread_mutex_unlock(&table->lock);
+            return false;
         }
+        file->first_fd = -1;
+        memcpy(&file->inode, file_inode, sizeof(inode_t));
+        table->file[inode_id] = file;
+    }
+    file->refcount++;
+    fs->descriptors[fd].inodeNum = inode_id;
+    fs->descriptors[fd].position = 0;   // R/W position is set to the beginning of the file (BOF)
+    fs->descriptors[fd].next = file->first_fd;
+    file->first_fd = fd;
+    pthread_mutex_unlock(&table->lock);
+    return true;
+}
 
-        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
-        // first, let's find the parent dir
-        size_t indicator = 0;
+// drop an inode's entry once its last descriptor is gone. Called with the lock held.
+static void fs_open_file_drop(struct open_table *table, size_t inode_id)
+{
+    struct open_file *file = table->file[inode_id];
+    table->file[inode_id] = NULL;
+    for(size_t slot = 0; slot < OPEN_MAP_BLOCKS; slot++)
+    {
+        fs_open_map_forget(table, file->map[slot].block_id);
+    }
+    free(file);
+}
 
-        // we declare parent_inode and parent_data here since it will still be used after the for loop
-        directoryFile_t * parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));
+// take open descriptor fd off its inode, the caller releases it
+static void fs_open_file_detach(FS_t *fs, int fd)
+{
+    struct open_table *table = fs->open;
+    size_t inode_id = fs->descriptors[fd].inodeNum;
+    pthread_mutex_lock(&table->lock);
+    struct open_file *file = table->file[inode_id];
+    int16_t *link = &file->first_fd;
+    while(*link != fd)
+    {
+        link = &fs->descriptors[*link].next;
+    }
+    *link = fs->descriptors[fd].next;
+    if(--file->refcount == 0)
+    {
+        fs_open_file_drop(table, inode_id);
+    }
+    pthread_mutex_unlock(&table->lock);
+}
 
-        for(size_t i = 0; i < count - 1; i++)
+// close every descriptor open on an inode that is going away
+static void fs_open_file_close_all(FS_t *fs, size_t inode_id)
+{
+    struct open_table *table = fs->open;
+    if(table == NULL || inode_id >= number_inodes)
+    {
+        return;
+    }
+    pthread_mutex_lock(&table->lock);
+    struct open_file *file = table->file[inode_id];
+    if(file != NULL)
+    {
+        for(int fd = file->first_fd; fd >= 0; fd = fs->descriptors[fd].next)
         {
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);	// read out the parent inode
-            // in case file and dir has the same name
-            if(parent_inode->fileType == 'd')
-            {
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    if( ((parent_inode->vacantFile >> j) & 1) == 1 && strcmp((parent_data + j) -> filename, *(tokens + i)) == 0 )
-                    {
-                        parent_inode_ID = (parent_data + j) -> inodeNumber;
-                        indicator++;
-                    }
-                }
-            }
+            fs->layout->fd_release(fs, fd);
         }
-        //		printf("indicator = %zu\n", indicator);
-        //		printf("parent_inode_ID = %lu\n", parent_inode_ID);
+        fs_open_file_drop(table, inode_id);
+    }
+    pthread_mutex_unlock(&table->lock);
+}
 
-        // read out the parent inode
-        block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);
-        if(indicator == count - 1 && parent_inode->fileType == 'd')
+// entry index of pointer block block_id, which sits at slot of a file's block map. An open file
+//  answers from its copy of the block, loading it first if the copy holds another block.
+static size_t fs_pointer_at(FS_t *fs, size_t inode_id, size_t slot, size_t block_id, size_t index)
+{
+    struct open_table *table = fs->open;
+    if(table != NULL && inode_id < number_inodes)
+    {
+        pthread_mutex_lock(&table->lock);
+        struct open_file *file = table->file[inode_id];
+        if(file != NULL)
         {
-            // same file or dir name in the same path is intolerable
-            for(int m = 0; m < folder_number_entries; m++)
-            {
-                // rid out the case of existing same file or dir name
-                if( ((parent_inode->vacantFile >> m) & 1) == 1)
-                {
-                    // before read out parent_data, we need to make sure it does exist!
-                    block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                    if( strcmp((parent_data + m) -> filename, *(tokens + count - 1)) == 0 )
-                    {
-                        free(parent_data);
-                        free(parent_inode);
-                        // before any return, we need to free tokens, otherwise memory leakage
-                        for (size_t i = 0; i < count; i++)
-                        {
-                            free(*(tokens + i));
-                        }
-                        free(tokens);
-                        //printf("filename already exists\n");
-                        return -1;
-                    }
-                }
-            }
-
-            // cannot declare k inside for loop, since it will be used later.
-            int k = 0;
-            for( ; k < folder_number_entries; k++)
-            {
-                if( ((parent_inode->vacantFile >> k) & 1) == 0 )
-                    break;
-            }
-
-            // if k == 0, then we have to declare a new parent data block
-            //			printf("k = %d\n", k);
-            if(k == 0)
+            if(file->map[slot].block_id != block_id)
             {
-                size_t parent_data_ID = block_store_allocate(fs->BlockStore_whole);
-                //					printf("parent_data_ID = %zu\n", parent_data_ID);
-                if(parent_data_ID < BLOCK_STORE_AVAIL_BLOCKS)
-                {
-                    parent_inode->directPointer[0] = parent_data_ID;
-                }
-                else
-                {
-                    free(parent_inode);
-                    free(parent_data);
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);
-                    //printf("No available blocks\n");
-                    return -1;
-                }
+                size_t old_id = file->map[slot].block_id;
+                fs_block_read(fs, block_id, file->map[slot].pointers);
+                file->map[slot].block_id = block_id;
+                bitmap_set(table->mapped, block_id);
+                fs_open_map_forget(table, old_id);
             }
+            size_t pointer = file->map[slot].pointers[index];
+            pthread_mutex_unlock(&table->lock);
+            return pointer;
+        }
+        pthread_mutex_unlock(&table->lock);
+    }
+    uint16_t pointers[2048];
+    fs_block_read(fs, block_id, pointers);
+    return pointers[index];
+}
 
-            if(k < folder_number_entries)	// k == folder_number_entries means this directory is full
-            {
-                size_t child_inode_ID = block_store_sub_allocate(fs->BlockStore_inode);
-                //printf("new child_inode_ID = %zu\n", child_inode_ID);
-                // ugh, inodes are used up
-                if(child_inode_ID == SIZE_MAX)
-                {
-                    free(parent_data);
-                    free(parent_inode);
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);
-                    //printf("could not allocate block for child\n");
-                    return -1;
-                }
-
-                // wow, at last, we make it!
-                // update the parent inode
-                parent_inode->vacantFile |= (1 << k);
-                // in the following cases, we should allocate parent data first:
-                // 1)the parent dir is not the root dir;
-                // 2)the file or dir to create is to be the 1st in the parent dir
+/// Formats (and mounts) an FS file for use
+/// \param fname The file to format
+/// \return Mounted FS object, NULL on error
+///
+FS_t *fs_format(const char *path)
+{
+    return fs_format_layout(path, FS_LAYOUT_BLOCK_STORE);
+}
 
-                block_store_inode_write(fs->BlockStore_inode, parent_inode_ID, parent_inode);
+///
+/// Formats (and mounts) an FS file for use, as fs_format does, with the given layout
+///   fs_mount and fs_mount_snapshot use the layout the image was formatted with
+/// \param path The file to format
+/// \param layout How the mounted FS keeps its inode and descriptor tables
+/// \return Mounted FS object, NULL on error
+///
+FS_t *fs_format_layout(const char *path, fs_layout_t layout)
+{
+    FS_CALL_TIMER(NULL, FS_CALL_FORMAT);
+    if(path != NULL && strlen(path) != 0 && layout < FS_LAYOUT_COUNT)
+    {
+        FS_t * ptr_FS = (FS_t *)calloc(1, sizeof(FS_t));	// get started
+        char *journal = fs_journal_path(path);	// a journal left for the image this one replaces
+        if(journal != NULL)
+        {
+            unlink(journal);
+            free(journal);
+        }
+        ptr_FS->BlockStore_whole = block_store_create(path);				// pointer to start of a large chunck of memory
+        fs_superblock_record_store(ptr_FS);
+        fs_superblock_set_layout(ptr_FS, layout);
 
-                // update the parent directory file block
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                strcpy((parent_data + k)->filename, *(tokens + count - 1));
-                //printf("the newly created file's name is: %s\n", (parent_data + k)->filename);
-                (parent_data + k)->inodeNumber = child_inode_ID;
-                block_store_write(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
+        // reserve the 1st block for bitmap of inode
+        size_t bitmap_ID = fs_block_allocate(ptr_FS);
+        //		printf("bitmap_ID = %zu\n", bitmap_ID);
 
-                // update the newly created inode
-                inode_t * child_inode = (inode_t *) calloc(1, sizeof(inode_t));
-                child_inode->vacantFile = 0;
-                if(type == FS_REGULAR)
-                {
-                    child_inode->fileType = 'r';
-                }
-                else if(type == FS_DIRECTORY)
-                {
-                    child_inode->fileType = 'd';
-                }
+        // 2rd - 5th block for inodes, 4 blocks in total
+        size_t inode_start_block = fs_block_allocate(ptr_FS);
+        //		printf("inode_start_block = %zu\n", inode_start_block);
+        for(int i = 0; i < 3; i++)
+        {
+            fs_block_allocate(ptr_FS);
+            //			printf("all the way with block %zu\n", fs_block_allocate(ptr_FS));
+        }
 
-                child_inode->inodeNumber = child_inode_ID;
-                child_inode->fileSize = 0;
-                child_inode->linkCount = 1;
-                block_store_inode_write(fs->BlockStore_inode, child_inode_ID, child_inode);
+        // install the inode table and the descriptors inside the whole block store
+        fs_layout_attach(ptr_FS, layout, block_store_Data_location(ptr_FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
 
-                //printf("after creation, parent_inode->vacantFile = %d\n", parent_inode->vacantFile);
+        // the first inode is reserved for root dir
+        fs_inode_allocate(ptr_FS);
+        //		printf("first inode ID = %zu\n", fs_inode_allocate(ptr_FS));
 
+        // update the root inode info.
+        uint8_t root_inode_ID = 0;	// root inode is the first one in the inode table
+        inode_t * root_inode = (inode_t *) calloc(1, sizeof(inode_t));
+        //		printf("size of inode_t = %zu\n", sizeof(inode_t));
+        root_inode->vacantFile = 0x00000000;
+        root_inode->flags = FS_INODE_DIRENTS;
+        root_inode->fileType = 'd';
+        root_inode->inodeNumber = root_inode_ID;
+        root_inode->linkCount = 1;
+        fs_inode_stamp_new(root_inode);
+        //		root_inode->directPointer[0] = root_data_ID;	// not allocate date block for it until it has a sub-folder or file
+        fs_inode_write(ptr_FS, root_inode_ID, root_inode);
+        free(root_inode);
 
+        ptr_FS->cache = fs_cache_create();
+        ptr_FS->delalloc = fs_delalloc_create();
+        ptr_FS->open = fs_open_table_create();
+        ptr_FS->journal = fs_journal_create(path);
 
-                // free the temp space
-                free(parent_inode);
-                free(parent_data);
-                free(child_inode);
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);
-                return 0;
-            }
-        }
-        // before any return, we need to free tokens, otherwise memory leakage
-        for (size_t i = 0; i < count; i++)
-        {
-            free(*(tokens + i));
-        }
-        free(tokens);
-        free(parent_inode);
-        free(parent_data);
+        FS_CALL_TIMER_FOR(ptr_FS);
+        return ptr_FS;
     }
-    return -1;
+
+    return NULL;
 }
 
 
 
 ///
-/// Opens the specified file for use
-///   R/W position is set to the beginning of the file (BOF)
-///   Directories cannot be opened
-/// \param fs The FS containing the file
-/// \param path path to the requested file
-/// \return file descriptor to the requested file, < 0 on error
+/// Mounts an FS object and prepares it for use
+/// \param fname The file to mount
+
+/// \return Mounted FS object, NULL on error
+
 ///
-int fs_open(FS_t *fs, const char *path)
+FS_t *fs_mount(const char *path)
 {
-    if(fs != NULL && path != NULL && strlen(path) != 0)
+    FS_CALL_TIMER(NULL, FS_CALL_MOUNT);
+    if(path != NULL && strlen(path) != 0)
     {
-         // char* copy_path = (char*)calloc(1, 65535);
-         char* copy_path = (char*)calloc(1, BLOCK_STORE_NUM_BLOCKS -1); 
-         if ( copy_path == NULL ) {
-             printf("copy_path, line: 200; failed (returned -1 ) " ); 
-             return -1; 
-         }
-        
-         if (strlen(path) >= BLOCK_STORE_NUM_BLOCKS -1) {
-             free(copy_path);
- 
-             return -1;
-         }
-         strcpy(copy_path, path); 
-        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
-        size_t count = 0;
-        tokens = str_split(copy_path, '/', &count);
-        free(copy_path);
-        if(tokens == NULL)
+        FS_t * ptr_FS = (FS_t *)calloc(1, sizeof(FS_t));	// get started
+        if(ptr_FS == NULL)
         {
-            return -1;
+            return NULL;
         }
-
-        // let's check if the filenames are valid or not
-        for(size_t n = 0; n < count; n++)
+        fs_journal_replay(path);	// finish a commit a crash cut short
+        ptr_FS->BlockStore_whole = block_store_open(path);	// get the chunck of data
+        if(ptr_FS->BlockStore_whole == NULL)
         {
-            if(isValidFileName(*(tokens + n)) == false)
-            {
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);
-                return -1;
-            }
+            free(ptr_FS);	// no image there, or not one we can read
+            return NULL;
         }
 
-        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
-        // first, let's find the parent dir
-        size_t indicator = 0;
+        // the bitmap block should be the 1st one
+        size_t bitmap_ID = 0;
 
-        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));
-        directoryFile_t * parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
+        // the inode blocks start with the 2nd block, and goes around until the 5th block, 4 in total
+        size_t inode_start_block = 1;
 
-        // locate the file
-        for(size_t i = 0; i < count; i++)
-        {
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);	// read out the parent inode
-            if(parent_inode->fileType == 'd')
-            {
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                //printf("parent_inode->vacantFile = %d\n", parent_inode->vacantFile);
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    //printf("(parent_data + j) -> filename = %s\n", (parent_data + j) -> filename);
-                    if( ((parent_inode->vacantFile >> j) & 1) == 1 && strcmp((parent_data + j) -> filename, *(tokens + i)) == 0 )
-                    {
-                        parent_inode_ID = (parent_data + j) -> inodeNumber;
-                        indicator++;
-                    }
-                }
-            }
-        }
-        free(parent_data);
-        free(parent_inode);
-        //printf("indicator = %zu\n", indicator);
-        //printf("count = %zu\n", count);
-        // now let's open the file
-        if(indicator == count)
-        {
-            size_t fd_ID = block_store_sub_allocate(fs->BlockStore_fd);
-            //printf("fd_ID = %zu\n", fd_ID);
-            // it could be possible that fd runs out
-            if(fd_ID < number_fd)
-            {
-                size_t file_inode_ID = parent_inode_ID;
-                inode_t * file_inode = (inode_t *) calloc(1, sizeof(inode_t));
-                block_store_inode_read(fs->BlockStore_inode, file_inode_ID, file_inode);	// read out the file inode
-
-                // it's too bad if file to be opened is a dir
-                if(file_inode->fileType == 'd')
-                {
-                    free(file_inode);
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);
-                    return -1;
-                }
+        // attach the bitmaps to their designated place, in the layout the image was formatted with;
+        // since file descriptors are allocated outside of the whole blocks, we can simply reallocate space for them.
+        fs_layout_attach(ptr_FS, fs_superblock_layout(ptr_FS), block_store_Data_location(ptr_FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
+        ptr_FS->cache = fs_cache_create();
+        ptr_FS->delalloc = fs_delalloc_create();
+        ptr_FS->open = fs_open_table_create();
+        ptr_FS->journal = fs_journal_create(path);
 
-                // assign a file descriptor ID to the open behavior
-                fileDescriptor_t * fd = (fileDescriptor_t *)calloc(1, sizeof(fileDescriptor_t));
-                fd->inodeNum = file_inode_ID;
-                fd->usage = 1;
-                fd->locate_order = 0; // R/W position is set to the beginning of the file (BOF)
-                fd->locate_offset = 0;
-                block_store_fd_write(fs->BlockStore_fd, fd_ID, fd);
-
-                free(file_inode);
-                free(fd);
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);
-                return fd_ID;
-            }
-        }
-        // before any return, we need to free tokens, otherwise memory leakage
-        for (size_t i = 0; i < count; i++)
-        {
-            free(*(tokens + i));
-        }
-        free(tokens);
+        FS_CALL_TIMER_FOR(ptr_FS);
+        return ptr_FS;
     }
-    return -1;
+
+    return NULL;
 }
 
 
+
+
 ///
-/// Closes the given file descriptor
-/// \param fs The FS containing the file
-/// \param fd The file to close
+/// Unmounts the given object and frees all related resources
+/// \param fs The FS object to unmount
 /// \return 0 on success, < 0 on failure
 ///
-int fs_close(FS_t *fs, int fd)
+int fs_unmount(FS_t *fs)
 {
-    if(fs != NULL && fd >=0 && fd < number_fd)
+    if(fs != NULL)
     {
-        // first, make sure this fd is in use
-        if(block_store_sub_test(fs->BlockStore_fd, fd))
-        {
-            block_store_sub_release(fs->BlockStore_fd, fd);
-            return 0;
-        }
+        fs_txn_abort(fs);	// a transaction left open was never committed
+        fs_delalloc_flush(fs, DELALLOC_ALL, NULL);
+        fs_delalloc_destroy(fs->delalloc);
+        fs_defrag_finish(fs);
+        free(fs->defrag);
+        fs_layout_detach(fs);
+        block_store_destroy(fs->BlockStore_whole);
+        fs_dedup_disable(fs);
+        fs_cache_destroy(fs->cache);
+        fs_open_table_destroy(fs->open);
+        fs_journal_destroy(fs->journal);
+
+        free(fs);
+        return 0;
     }
     return -1;
 }
 
 
-
-///
-/// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 31 file_record_t structures
-/// \param fs The FS containing the file
-/// \param path Absolute path to the directory to inspect
-/// \return dyn_array of file records, NULL on error
-///
-dyn_array_t *fs_get_dir(FS_t *fs, const char *path)
+// check if the input filename is valid or not
+bool isValidFileName(const char *filename)
 {
-    if(fs != NULL && path != NULL && strlen(path) != 0)
+    if(!filename || strlen(filename) == 0 || strlen(filename) >= FS_FNAME_MAX || '/'==filename[0])
     {
-        // char* copy_path = (char*)calloc(1, 65535);
-        char* copy_path = (char*)calloc(1, BLOCK_STORE_NUM_BLOCKS -1); 
-        if ( copy_path == NULL ) {
-            printf("copy_path, line: 200; failed (returned -1 ) " ); 
-            return NULL; 
-        }
-       
-        if (strlen(path) >= BLOCK_STORE_NUM_BLOCKS -1) {
-            free(copy_path);
+        return false;
+    }
 
-            return NULL;
-        }
-        strcpy(copy_path, path); 
-        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
-        size_t count = 0;
-        tokens = str_split(copy_path, '/', &count);
-        free(copy_path);
+    return true;
+}
 
-        if(strlen(*tokens) == 0)
-        {
-            // a spcial case: only a slash, no dir names
-            count -= 1;
-        }
-        else
+
+
+// use str_split to decompose the input string into filenames along the path, '/' as delimiter
+char** str_split(char* a_str, const char a_delim, size_t * count)
+{
+    if(*a_str != '/')
+    {
+        return NULL;
+    }
+    char** result    = 0;
+    char* tmp        = a_str;
+    char delim[2];
+    delim[0] = a_delim;
+    delim[1] = '\0';
+
+    /* Count how many elements will be extracted. */
+    while (*tmp)
+    {
+        if (a_delim == *tmp)
         {
-            for(size_t n = 0; n < count; n++)
-            {
-                if(isValidFileName(*(tokens + n)) == false)
-                {
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);
-                    return NULL;
-                }
-            }
+            (*count)++;
         }
+        tmp++;
+    }
 
-        // search along the path and find the deepest dir
-        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
-        // first, let's find the parent dir
-        size_t indicator = 0;
+    result = (char**)calloc(1, sizeof(char*) * (*count));
+    for(size_t i = 0; i < (*count); i++)
+    {
+        *(result + i) = (char*)calloc(1, 200);
+    }
 
-        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));
-        directoryFile_t * parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-        for(size_t i = 0; i < count; i++)
+    if (result)
+    {
+        size_t idx  = 0;
+        char* token = strtok(a_str, delim);
+
+        while (token)
         {
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);	// read out the parent inode
-            // in case file and dir has the same name. But from the test cases we can see, this case would not happen
-            if(parent_inode->fileType == 'd')
-            {
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    if( ((parent_inode->vacantFile >> j) & 1) == 1 && strcmp((parent_data + j) -> filename, *(tokens + i)) == 0 )
-                    {
-                        parent_inode_ID = (parent_data + j) -> inodeNumber;
-                        indicator++;
-                    }
-                }
-            }
+            strcpy(*(result + idx++), token);
+            //    *(result + idx++) = strdup(token);
+            token = strtok(NULL, delim);
         }
-        free(parent_data);
-        free(parent_inode);
 
-        // now let's enumerate the files/dir in it
-        if(indicator == count)
-        {
-            inode_t * dir_inode = (inode_t *) calloc(1, sizeof(inode_t));
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, dir_inode);	// read out the file inode
-            if(dir_inode->fileType == 'd')
-            {
-                // prepare the data to be read out
-                directoryFile_t * dir_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-                block_store_read(fs->BlockStore_whole, dir_inode->directPointer[0], dir_data);
+    }
+    return result;
+}
 
-                // prepare the dyn_array to hold the data
-                dyn_array_t * dynArray = dyn_array_create(folder_number_entries, sizeof(file_record_t), NULL);
 
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    if( ((dir_inode->vacantFile >> j) & 1) == 1 )
-                    {
-                        file_record_t* fileRec = (file_record_t *)calloc(1, sizeof(file_record_t));
-                        strcpy(fileRec->name, (dir_data + j) -> filename);
 
-                        // to know fileType of the member in this dir, we have to refer to its inode
-                        inode_t * member_inode = (inode_t *) calloc(1, sizeof(inode_t));
-                        block_store_inode_read(fs->BlockStore_inode, (dir_data + j) -> inodeNumber, member_inode);
-                        if(member_inode->fileType == 'd')
-                        {
-                            fileRec->type = FS_DIRECTORY;
-                        }
-                        else if(member_inode->fileType == 'f')
-                        {
-                            fileRec->type = FS_REGULAR;
-                        }
+// Blocks of FS_INODE_DIRENTS directories hold variable-length records packed from the start of
+// the block, in no particular order: DIRENT_HEADER bytes (name length, file type, inode number)
+// then the name without its terminator. The directory's vacantFile counts the records and its
+// fileSize is the bytes they take. Removing a record moves the ones after it down, so the free
+// space is always in one piece at the end of the block.
+// Directories of older images keep directoryFile_t slots picked by vacantFile bits instead;
+// fs_dir_load turns those into records and fs_dir_store writes them back as records.
+#define DIRENT_HEADER 6
+#define DIRENT_TYPE 1
+#define DIRENT_INODE 2
+#define DIR_ENTRIES_MAX (BLOCK_SIZE_BYTES / (DIRENT_HEADER + 1))
 
-                        // now insert the file record into the dyn_array
-                        dyn_array_push_front(dynArray, fileRec);
-                        free(fileRec);
-                        free(member_inode);
-                    }
-                }
-                free(dir_data);
-                free(dir_inode);
-                // before any return, we need to free tokens, otherwise memory leakage
-                if(strlen(*tokens) == 0)
-                {
-                    // a spcial case: only a slash, no dir names
-                    count += 1;
-                }
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);
-                return(dynArray);
-            }
-            free(dir_inode);
-        }
-        // before any return, we need to free tokens, otherwise memory leakage
-        if(strlen(*tokens) == 0)
-        {
-            // a spcial case: only a slash, no dir names
-            count += 1;
-        }
-        for (size_t i = 0; i < count; i++)
+// a directory's block in memory, as records whatever its format on disk
+typedef struct
+{
+    size_t used;            // bytes of records
+    size_t count;           // records
+    uint8_t data[BLOCK_SIZE_BYTES];
+} dir_block_t;
+
+static inline size_t fs_dirent_next(const dir_block_t *dir, size_t offset)
+{
+    return offset + DIRENT_HEADER + dir->data[offset];
+}
+
+static inline size_t fs_dirent_inode(const dir_block_t *dir, size_t offset)
+{
+    uint32_t inode_id;
+    memcpy(&inode_id, dir->data + offset + DIRENT_INODE, sizeof(inode_id));
+    return inode_id;
+}
+
+static inline char fs_dirent_type(const dir_block_t *dir, size_t offset)
+{
+    return (char)dir->data[offset + DIRENT_TYPE];
+}
+
+static inline const char *fs_dirent_name(const dir_block_t *dir, size_t offset, size_t *length)
+{
+    *length = dir->data[offset];
+    return (const char *)dir->data + offset + DIRENT_HEADER;
+}
+
+// append a record, \return false if it does not fit in the block
+static bool fs_dir_add(dir_block_t *dir, const char *name, size_t length, size_t inode_id, char type)
+{
+    if(length == 0 || length > UINT8_MAX || dir->used + DIRENT_HEADER + length > BLOCK_SIZE_BYTES)
+    {
+        return false;
+    }
+    uint8_t *record = dir->data + dir->used;
+    uint32_t inode_number = inode_id;
+    record[0] = length;
+    record[DIRENT_TYPE] = type;
+    memcpy(record + DIRENT_INODE, &inode_number, sizeof(inode_number));
+    memcpy(record + DIRENT_HEADER, name, length);
+    dir->used += DIRENT_HEADER + length;
+    dir->count++;
+    return true;
+}
+
+// drop the record at offset, closing the gap it leaves
+static void fs_dir_remove(dir_block_t *dir, size_t offset)
+{
+    size_t next = fs_dirent_next(dir, offset);
+    memmove(dir->data + offset, dir->data + next, dir->used - next);
+    dir->used -= next - offset;
+    dir->count--;
+}
+
+// give the record at offset another name where it is, moving the records after it if the length changes
+// \return false if the new name does not fit
+static bool fs_dir_rename(dir_block_t *dir, size_t offset, const char *name, size_t length)
+{
+    size_t old_length = dir->data[offset];
+    size_t next = fs_dirent_next(dir, offset);
+    if(length == 0 || length > UINT8_MAX || dir->used - old_length + length > BLOCK_SIZE_BYTES)
+    {
+        return false;
+    }
+    memmove(dir->data + offset + DIRENT_HEADER + length, dir->data + next, dir->used - next);
+    dir->used = dir->used - old_length + length;
+    dir->data[offset] = length;
+    memcpy(dir->data + offset + DIRENT_HEADER, name, length);
+    return true;
+}
+
+// \return offset of the record for name, SIZE_MAX if there is none
+static size_t fs_dir_find_name(const dir_block_t *dir, const char *name)
+{
+    size_t length = strlen(name);
+    for(size_t offset = 0; offset < dir->used; offset = fs_dirent_next(dir, offset))
+    {
+        if(dir->data[offset] == length && memcmp(dir->data + offset + DIRENT_HEADER, name, length) == 0)
         {
-            free(*(tokens + i));
+            return offset;
         }
-        free(tokens);
     }
-    return NULL;
+    return SIZE_MAX;
 }
-off_t fs_seek(FS_t *fs, int fd, off_t offset, seek_t whence) 
+
+// read a directory's entries into dir
+static void fs_dir_load(FS_t *fs, const inode_t *dir_inode, dir_block_t *dir)
 {
-    if(fs == NULL){
-        return -1;
+    dir->used = 0;
+    dir->count = 0;
+    if(dir_inode->directPointer[0] == 0 || dir_inode->vacantFile == 0)
+    {
+        return;
     }
-    //make sure we have valid fd
-    if(!block_store_sub_test(fs->BlockStore_fd, fd))
+    if(dir_inode->flags & FS_INODE_DIRENTS)
     {
-        return -1;
+        fs_block_read(fs, dir_inode->directPointer[0], dir->data);
+        dir->used = dir_inode->fileSize < BLOCK_SIZE_BYTES ? dir_inode->fileSize : BLOCK_SIZE_BYTES;
+        dir->count = dir_inode->vacantFile;
+        return;
+    }
+    // old slots never hold more than fits as records, but their types live in the inodes
+    directoryFile_t *slots = (directoryFile_t *)malloc(BLOCK_SIZE_BYTES);
+    if(slots == NULL)
+    {
+        return;
     }
-    //pull down file descriptor based on num given
-    fileDescriptor_t* fileDescr = calloc(1,sizeof(fileDescriptor_t));
-    if(fileDescr == NULL ) {
-        return -1;
+    fs_block_read(fs, dir_inode->directPointer[0], slots);
+    for(int j = 0; j < folder_number_entries; j++)
+    {
+        if((dir_inode->vacantFile >> j) & 1)
+        {
+            inode_t member;
+            fs_inode_read(fs, slots[j].inodeNumber, &member);
+            fs_dir_add(dir, slots[j].filename, strnlen(slots[j].filename, FS_FNAME_MAX - 1), slots[j].inodeNumber, member.fileType);
+        }
     }
-    size_t fd_bytes_read = block_store_fd_read(fs->BlockStore_fd,fd,fileDescr);
-    if(fd_bytes_read != sizeof(fileDescriptor_t) || fileDescr->inodeNum == 0) {
-        //if we read less than the # of bytes or the inode # is 0 (which should never happen), then we must have been given invalid fd.
-        free(fileDescr);
-        return -1;
+    free(slots);
+}
+
+// write dir back as the directory's block, giving the directory one first if it has none
+// \return false if it needed a block and there was none
+static bool fs_dir_store(FS_t *fs, size_t dir_inode_id, inode_t *dir_inode, dir_block_t *dir)
+{
+    if(dir_inode->directPointer[0] == 0)
+    {
+        size_t block_id = fs_block_allocate(fs);
+        if(block_id >= BLOCK_STORE_AVAIL_BLOCKS)
+        {
+            return false;
+        }
+        dir_inode->directPointer[0] = block_id;
+    }
+    memset(dir->data + dir->used, 0, BLOCK_SIZE_BYTES - dir->used);
+    fs_block_write(fs, dir_inode->directPointer[0], dir->data);
+    dir_inode->flags |= FS_INODE_DIRENTS;
+    dir_inode->vacantFile = dir->count;
+    dir_inode->fileSize = dir->used;
+    dir_inode->modified = fs_time_now();
+    fs_inode_write(fs, dir_inode_id, dir_inode);
+    return true;
+}
+
+// \return inode ID of name in the directory, SIZE_MAX if it is not there or dir_inode is no directory
+static size_t fs_dir_lookup(FS_t *fs, const inode_t *dir_inode, const char *name)
+{
+    if(dir_inode->fileType != 'd' || dir_inode->vacantFile == 0)
+    {
+        return SIZE_MAX;
     }
-    inode_t* fileInode = calloc(1, sizeof(inode_t));
-    if(fileInode == NULL) {
-        free(fileDescr);
-        return -1;
+    dir_block_t *dir = (dir_block_t *)malloc(sizeof(dir_block_t));
+    if(dir == NULL)
+    {
+        return SIZE_MAX;
     }
-    //get inode we are writing to.
-    block_store_inode_read(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-    if(offset == 0 && whence == FS_SEEK_CUR) {
-        //if no offset, just get current offset to return.
-        off_t current = fileDescr->locate_order*BLOCK_SIZE_BYTES + fileDescr->locate_offset;
-        free(fileDescr);
-        free(fileInode);
-        return current;
+    fs_dir_load(fs, dir_inode, dir);
+    size_t offset = fs_dir_find_name(dir, name);
+    size_t inode_id = offset == SIZE_MAX ? SIZE_MAX : fs_dirent_inode(dir, offset);
+    free(dir);
+    return inode_id;
+}
+
+// one step down a path: the inode dir_id's entry name names
+// \return SIZE_MAX if dir_id is SIZE_MAX or not a directory, or name is not in it
+static size_t fs_dir_child(FS_t *fs, size_t dir_id, const char *name)
+{
+    if(dir_id == SIZE_MAX || !isValidFileName(name))
+    {
+        return SIZE_MAX;
     }
-    if(whence == FS_SEEK_CUR) {
-        if(offset < 0) {
-            //we need to make sure we are not going before BOF if this is the case.
-            off_t pos_offset = offset * -1;
-            uint16_t numblocks = pos_offset / BLOCK_SIZE_BYTES;
-            if(fileDescr->usage == 1) {
-                if(numblocks - fileDescr->locate_order < 0) {
-                    //going past beginning so set to 0 for each
-                    fileDescr->usage = 1;
-                    fileDescr->locate_order = 0;
-                    fileDescr->locate_offset = 0;
-                    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                    free(fileDescr);
-                    free(fileInode);
-                    return 0;
-                }
-                else if(fileDescr->locate_order == 0 && fileDescr->locate_offset - (pos_offset % BLOCK_SIZE_BYTES) < 0) {
-                    //going past beginning
-                    fileDescr->usage = 1;
-                    fileDescr->locate_order = 0;
-                    fileDescr->locate_offset = 0;
-                    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                    free(fileDescr);
-                    free(fileInode);
-                    return 0;
-                }
-            }
-            else if(fileDescr->usage == 2) {
-                if(numblocks - (fileDescr->locate_order + 6) < 0) {
-                    fileDescr->usage = 1;
-                    fileDescr->locate_order = 0;
-                    fileDescr->locate_offset = 0;
-                    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                    free(fileDescr);
-                    free(fileInode);
-                    return 0;
-                }
-            }
-            else {
-                if(numblocks - (fileDescr->locate_order + 6) < 0) {
-                    fileDescr->usage = 1;
-                    fileDescr->locate_order = 0;
-                    fileDescr->locate_offset = 0;
-                    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                    free(fileDescr);
-                    free(fileInode);
-                    return 0;
-                }
-            }
-            fileDescr->locate_order -= numblocks;
-            fileDescr->locate_offset -= (pos_offset % BLOCK_SIZE_BYTES);
-            if(fileDescr->locate_order > UINT16_MAX - BLOCK_SIZE_BYTES && fileDescr->usage > 1) {
-                if(fileDescr->usage == 2) {
-                    fileDescr->usage = 1;
-                }
-                else {
-                    fileDescr->usage = 2;
-                }
-                fileDescr->locate_order = 2048;
-            }
-            //if we wrap around due to negative overflow, then...
-            if(fileDescr->locate_offset > UINT16_MAX - BLOCK_SIZE_BYTES) {
-                //smaller than a block, so decrease block count by one and set to end of that block.
-                uint16_t offset_to_subtract = fileDescr->locate_offset * -1;
-                fileDescr->locate_order--;
-                fileDescr->locate_offset = BLOCK_SIZE_BYTES - offset_to_subtract;
-            }
-        }
-        else {
-            //going forward in file from current pos.
-            uint16_t numblocks = offset / BLOCK_SIZE_BYTES;
-            fileDescr->locate_order += numblocks;
-            fileDescr->locate_offset += (offset % BLOCK_SIZE_BYTES);
-            if(fileDescr->locate_order > 2048 && fileDescr->usage < 4) {
-                if(fileDescr->usage == 2) {
-                    fileDescr->usage = 4;
-                    fileDescr->locate_order -= 2048 + 6;
-                }
-                else {
-                    fileDescr->usage = 2;
-                    fileDescr->locate_order -= 6;
-                }
-                if(fileDescr->locate_order > 2048 + 6  && fileDescr->usage == 2) {
-                    fileDescr->usage = 4;
-                    fileDescr->locate_order -= 2048;
-                }
-            }
-            if(fileDescr->locate_offset > BLOCK_SIZE_BYTES) {
-                fileDescr->locate_order++;
-                fileDescr->locate_offset -= BLOCK_SIZE_BYTES;
-            }
-        }
-    }
-    else if(whence == FS_SEEK_SET) {
-        if(offset < 0) {
-            //can't have negative offset when setting, as we will go before BOF.
-            free(fileDescr);
-            free(fileInode);
-            return 0;
-        }
-        fileDescr->locate_offset = offset%BLOCK_SIZE_BYTES;
-        if(offset / BLOCK_SIZE_BYTES < 6) {
-            //we are within direct pointer
-            fileDescr->usage = 1;
-            fileDescr->locate_order = offset/BLOCK_SIZE_BYTES;
-        }
-        else if(offset / BLOCK_SIZE_BYTES < 2048 + 6) {
-            //within indirect
-            fileDescr->usage = 2;
-            fileDescr->locate_order = (offset/BLOCK_SIZE_BYTES) - 6;
-        }
-        else {
-            //within double indirect
-            fileDescr->usage = 4;
-            fileDescr->locate_order = (offset/BLOCK_SIZE_BYTES) - 6;
+    inode_t dir_inode;
+    fs_inode_read(fs, dir_id, &dir_inode);
+    return fs_dir_lookup(fs, &dir_inode, name);
+}
 
-        }
+
+// FS-wide settings live in the otherwise unused tail of the inode bitmap block (block 0).
+// Images formatted before it existed read back all zeros, which simply means no optional
+// feature has been set up yet; everything it points at is created on first use.
+#define FS_SUPER_MAGIC 0x46535342	// "FSSB"
+#define FS_SUPER_OFFSET (BLOCK_SIZE_BYTES / 2)
+
+#define REFCOUNT_BLOCKS (BLOCK_STORE_NUM_BLOCKS / BLOCK_SIZE_BYTES)	// one byte per block
+#define REFCOUNT_MAX UINT8_MAX
+
+#define FS_META_BLOCKS 5    // the inode bitmap block and the inode table
+#define INLINE_BLOCKS (number_inodes * FS_INLINE_MAX / BLOCK_SIZE_BYTES)	// FS_INLINE_MAX bytes per inode
+#define FS_STORE_BLOCKS 8
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t refcountBlock;     // first of REFCOUNT_BLOCKS contiguous blocks of extra reference counts, 0 if none
+    uint16_t snapshotBlock;     // the snapshot table, 0 if none
+    uint16_t inlineBlock;       // first of INLINE_BLOCKS contiguous blocks of inline file data, 0 if none
+    uint16_t storeRecorded;     // 1 if storeBlocks lists every block the block store keeps for itself
+    uint16_t storeBlocks[FS_STORE_BLOCKS];     // those blocks (its FBM at the end aside), 0 past the last
+    uint16_t layout;            // fs_layout_t it was formatted with, 0 (FS_LAYOUT_BLOCK_STORE) in older images
+} superblock_t;
+
+static superblock_t *fs_superblock(FS_t *fs)
+{
+    superblock_t *super = (superblock_t *)(block_store_Data_location(fs->BlockStore_whole) + FS_SUPER_OFFSET);
+    if(super->magic != FS_SUPER_MAGIC)
+    {
+        memset(super, 0, sizeof(superblock_t));
+        super->magic = FS_SUPER_MAGIC;
     }
-    else if(whence == FS_SEEK_END) {
-        if(offset > 0) {
-            //can't go past eof
-            free(fileDescr);
-            free(fileInode);
-            return 0;
-        }
-        off_t pos_offset = offset * -1;
-        uint16_t numblocks = pos_offset / BLOCK_SIZE_BYTES;
-        fileDescr->locate_order -= numblocks;
-        fileDescr->locate_offset -= (pos_offset % BLOCK_SIZE_BYTES);
-        if(fileDescr->locate_order > UINT16_MAX - BLOCK_SIZE_BYTES && fileDescr->usage > 1) {
-            if(fileDescr->usage == 2) {
-                fileDescr->usage = 1;
-            }
-            else {
-                fileDescr->usage = 2;
+    return super;
+}
+
+// fs_format, before the FS takes any block: whatever a fresh block store has in use is its own,
+// and fs_check must not mistake it for a leak. Images formatted before this, or by a store that
+// keeps more than FS_STORE_BLOCKS, are left unrecorded and fs_check never releases leaks on them.
+static void fs_superblock_record_store(FS_t *fs)
+{
+    superblock_t *super = fs_superblock(fs);
+    size_t count = 0;
+    for(size_t i = 0; i < BLOCK_STORE_AVAIL_BLOCKS; i++)
+    {
+        if(block_store_sub_test(fs->BlockStore_whole, i))
+        {
+            if(count == FS_STORE_BLOCKS)
+            {
+                return;
             }
-            fileDescr->locate_order = 2048;
+            super->storeBlocks[count++] = i;
         }
-        //if we wrap around due to negative overflow, then...
-        if(fileDescr->locate_offset > UINT16_MAX - BLOCK_SIZE_BYTES) {
-            //smaller than a block, so decrease block count by one and set to end of that block.
-            uint16_t offset_to_subtract = fileDescr->locate_offset * -1;
-            fileDescr->locate_order--;
-            fileDescr->locate_offset = BLOCK_SIZE_BYTES - offset_to_subtract;
-        }
-    }
-    else {
-        //invalid whence, free & return error.
-        free(fileDescr);
-        free(fileInode);
-        return -1;
-    }
-    //need to see if we went past EOF so set the offset to -1 to the most recent writable bit
-    if(fileDescr->usage == 4 && (fileDescr->locate_order+6+2048) > 65000) {
-        //very close to EOF, so decreement by 1.
-        fileDescr->locate_order--;
-        fileDescr->locate_offset = BLOCK_SIZE_BYTES - 1;
-    }
-    //write back file descr when done
-    off_t from_beginning = 0;
-    if(fileDescr->usage == 1){
-        from_beginning = fileDescr->locate_order*BLOCK_SIZE_BYTES + fileDescr->locate_offset;
     }
-    else if(fileDescr->usage == 2) {
-        from_beginning = (fileDescr->locate_order+6)*BLOCK_SIZE_BYTES + fileDescr->locate_offset;
-    }
-    else {
-        from_beginning = (fileDescr->locate_order+6+2048)*BLOCK_SIZE_BYTES + fileDescr->locate_offset;
-    }
-    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-    free(fileDescr);
-    free(fileInode);
-    return from_beginning;
+    super->storeRecorded = 1;
 }
-ssize_t fs_read(FS_t *fs, int fd, void *dst, size_t nbyte)
+
+// the layout the image was formatted with
+static size_t fs_superblock_layout(FS_t *fs)
 {
-    // Check for valid parameters
-    if (fs == NULL || fd < 0 || fd >= number_fd || dst == NULL || !nbyte ) {
-        return -1;
-    }
+    return fs_superblock(fs)->layout;
+}
 
-    if ( nbyte == 0 ) {
-        // empty read byte req
-        return 0; 
-    }
+static void fs_superblock_set_layout(FS_t *fs, fs_layout_t layout)
+{
+    fs_superblock(fs)->layout = layout;
+}
 
-    // Check if the file descriptor is in use
-    if (!block_store_sub_test(fs->BlockStore_fd, fd)) {
-        return -1;
+///
+/// Tells which layout a mounted FS uses
+/// \param fs The FS
+/// \return its layout, FS_LAYOUT_COUNT on error
+///
+fs_layout_t fs_get_layout(const FS_t *fs)
+{
+    if(fs == NULL || fs->layout == NULL)
+    {
+        return FS_LAYOUT_COUNT;
     }
+    return (fs_layout_t)(fs->layout - fs_layouts);
+}
 
-    // Get the file descriptor
-    fileDescriptor_t *file_desc = (fileDescriptor_t *)calloc(1, sizeof(fileDescriptor_t));
-    if (file_desc == NULL) {
-        return -1;
+// grab n blocks in a row, looking from block from onwards and then from the start
+// \return first block of the run, SIZE_MAX if there is no such run
+static size_t fs_allocate_run_from(FS_t *fs, size_t n, size_t from)
+{
+    FS_STAT_ADD(fs, bitmap_scans, 1);
+    if(!fs_blocks_spare(fs, n))
+    {
+        return SIZE_MAX;
     }
-    block_store_fd_read(fs->BlockStore_fd, fd, file_desc);
-
-    // Get the inode for this file
-    inode_t *inode = (inode_t *)calloc(1, sizeof(inode_t));
-    if (inode == NULL) {
-        free(file_desc);
-        return -1;
+    if(from < 1 || from >= BLOCK_STORE_AVAIL_BLOCKS)
+    {
+        from = 1;
     }
-    block_store_inode_read(fs->BlockStore_inode, file_desc->inodeNum, inode);
-
-    // Calculate current position
-    off_t current_pos = 0;
-    if (file_desc->usage == 1) { // Direct pointer
-        current_pos = file_desc->locate_order * BLOCK_SIZE_BYTES + file_desc->locate_offset;
-    } else if (file_desc->usage == 2) { // Indirect pointer
-        current_pos = 6 * BLOCK_SIZE_BYTES + file_desc->locate_order * BLOCK_SIZE_BYTES + file_desc->locate_offset;
-    } else if (file_desc->usage == 4) { // Double indirect pointer
-        current_pos = 6 * BLOCK_SIZE_BYTES + 1024 * BLOCK_SIZE_BYTES +
-                      file_desc->locate_order * BLOCK_SIZE_BYTES + file_desc->locate_offset;
+    for(int pass = 0; pass < 2; pass++)
+    {
+        size_t end = pass == 0 ? BLOCK_STORE_AVAIL_BLOCKS : from + n - 1;
+        for(size_t start = pass == 0 ? from : 1; start + n <= end && start + n <= BLOCK_STORE_AVAIL_BLOCKS; start++)
+        {
+            size_t got = 0;
+            while(got < n && block_store_request(fs->BlockStore_whole, start + got))
+            {
+                got++;
+            }
+            if(got == n)
+            {
+                return start;
+            }
+            for(size_t i = 0; i < got; i++)
+            {
+                block_store_release(fs->BlockStore_whole, start + i);
+            }
+            start += got;	// start + got is taken, skip past it
+        }
     }
+    return SIZE_MAX;
+}
 
-    // Limit read to file size
-    ssize_t bytes_to_read = nbyte;
-    if (current_pos + bytes_to_read > inode->fileSize) {
-        bytes_to_read = inode->fileSize - current_pos;
-        if (bytes_to_read <= 0) {
-            free(file_desc);
-            free(inode);
-            return 0; // At or past EOF, nothing to read
+// grab n blocks in a row
+// \return first block of the run, SIZE_MAX if there is no such run
+static size_t fs_allocate_run(FS_t *fs, size_t n)
+{
+    return fs_allocate_run_from(fs, n, 1);
+}
+
+// Data blocks can have more than one owner (a snapshot, another file). The table keeps the
+// number of *extra* owners per block, so a block that was never shared reads 0 and the
+// table does not need to exist until the first time something is shared.
+// \param create allocate the table if this image does not have one yet
+// \return the table, NULL if there is none
+static uint8_t *fs_refcounts(FS_t *fs, bool create)
+{
+    superblock_t *super = fs_superblock(fs);
+    if(super->refcountBlock == 0 && create)
+    {
+        size_t start = fs_allocate_run(fs, REFCOUNT_BLOCKS);
+        if(start == SIZE_MAX)
+        {
+            return NULL;
         }
+        memset(block_store_Data_location(fs->BlockStore_whole) + start * BLOCK_SIZE_BYTES, 0, REFCOUNT_BLOCKS * BLOCK_SIZE_BYTES);
+        super->refcountBlock = start;
+    }
+    if(super->refcountBlock == 0)
+    {
+        return NULL;
     }
+    return block_store_Data_location(fs->BlockStore_whole) + super->refcountBlock * BLOCK_SIZE_BYTES;
+}
 
-    // Prepare for reading
-    ssize_t bytes_read = 0;
-    uint8_t *dst_ptr = (uint8_t *)dst;
-    size_t entries_per_indirect = BLOCK_SIZE_BYTES / sizeof(uint16_t);
-    printf( "size of entries_per_indirect %zu", entries_per_indirect); 
+// Files of up to FS_INLINE_MAX bytes keep their data in a slot of the inline area instead of a
+// block of their own (FS_INODE_INLINE). The area has one slot per inode, indexed by inode number.
+// A mounted snapshot reads the copy of the area that was taken with it.
+// \param create allocate the area if this image does not have one yet
+// \return the inode's slot, NULL if there is no area
+static uint8_t *fs_inline_data(FS_t *fs, size_t inode_number, bool create)
+{
+    uint8_t *blocks = block_store_Data_location(fs->BlockStore_whole);
+    if(fs->readonly)
+    {
+        return blocks + (fs->snapshotMeta + FS_META_BLOCKS) * BLOCK_SIZE_BYTES + inode_number * FS_INLINE_MAX;
+    }
+    superblock_t *super = fs_superblock(fs);
+    if(super->inlineBlock == 0 && create)
+    {
+        size_t start = fs_allocate_run(fs, INLINE_BLOCKS);
+        if(start == SIZE_MAX)
+        {
+            return NULL;
+        }
+        memset(blocks + start * BLOCK_SIZE_BYTES, 0, INLINE_BLOCKS * BLOCK_SIZE_BYTES);
+        super->inlineBlock = start;
+    }
+    if(super->inlineBlock == 0)
+    {
+        return NULL;
+    }
+    return blocks + super->inlineBlock * BLOCK_SIZE_BYTES + inode_number * FS_INLINE_MAX;
+}
 
+// Content hash of one block, XXH64 (seed 0) specialised for BLOCK_SIZE_BYTES input
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
 
-    // Read data from blocks
-    while (bytes_read < bytes_to_read) {
-        uint16_t block_id = 0;
+static inline uint64_t fs_hash_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
 
-        // Determine which block to read from
-        if (file_desc->usage == 1) { // Direct pointer
-            if (file_desc->locate_order >= 6) {
-                break; // Beyond direct pointers
-            }
-            block_id = inode->directPointer[file_desc->locate_order];
+static inline uint64_t fs_hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    return fs_hash_rotl(acc, 31) * XXH_PRIME64_1;
+}
 
-        } else if (file_desc->usage == 2) { // Indirect pointer
-            uint16_t *indirect_data = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
-            if (indirect_data == NULL) {
-                free(file_desc);
-                free(inode);
-                return -1;
-            }
-            block_store_read(fs->BlockStore_whole, inode->indirectPointer[0], indirect_data);
+static inline uint64_t fs_hash_merge(uint64_t hash, uint64_t acc)
+{
+    hash ^= fs_hash_round(0, acc);
+    return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
 
- \
-             // Check if block exists, allocate if needed
-            if (indirect_data[file_desc->locate_order] == 0) {
-                size_t new_block = block_store_allocate(fs->BlockStore_whole);
-                if (new_block == SIZE_MAX) {
-                    free(indirect_data);
-                    free(file_desc);
-                    free(inode);
-                    return -1;
-                }
-                indirect_data[file_desc->locate_order] = new_block;
-                block_store_write(fs->BlockStore_whole, inode->indirectPointer[0], indirect_data);
-            }
-            block_id = indirect_data[file_desc->locate_order];
-            free(indirect_data);
+static uint64_t fs_hash_block(const void *data)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = XXH_PRIME64_2;
+    uint64_t v3 = 0;
+    uint64_t v4 = -XXH_PRIME64_1;
+    for(size_t i = 0; i < BLOCK_SIZE_BYTES; i += 32)
+    {
+        uint64_t lane[4];
+        memcpy(lane, p + i, sizeof(lane));
+        v1 = fs_hash_round(v1, lane[0]);
+        v2 = fs_hash_round(v2, lane[1]);
+        v3 = fs_hash_round(v3, lane[2]);
+        v4 = fs_hash_round(v4, lane[3]);
+    }
+    uint64_t hash = fs_hash_rotl(v1, 1) + fs_hash_rotl(v2, 7) + fs_hash_rotl(v3, 12) + fs_hash_rotl(v4, 18);
+    hash = fs_hash_merge(hash, v1);
+    hash = fs_hash_merge(hash, v2);
+    hash = fs_hash_merge(hash, v3);
+    hash = fs_hash_merge(hash, v4);
+    hash += BLOCK_SIZE_BYTES;
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
 
-            
-            // FIX: Read correct block size
-            // block_store_read(fs->BlockStore_whole, inode->indirectPointer[0], indirect_data);
+// In-memory dedup index, only there while dedup is on (see fs_dedup_enable).
+//  Open addressing over (hash, block) pairs, a block has at most one slot. Every indexed
+//  block also remembers its hash so its slot can be found again when the block is
+//  rewritten in place or freed. Nothing here is stored in the image, the index is
+//  rebuilt from the files on the next fs_dedup_enable.
+#define DEDUP_SLOTS (BLOCK_STORE_NUM_BLOCKS * 2)	// at least half empty
+#define DEDUP_EMPTY 0                       // block 0 is the inode bitmap, never data
+#define DEDUP_TOMBSTONE UINT16_MAX          // the last block belongs to the FBM, never data
 
+struct dedup_index
+{
+    uint64_t slot_hash[DEDUP_SLOTS];
+    uint16_t slot_block[DEDUP_SLOTS];
+    uint64_t block_hash[BLOCK_STORE_NUM_BLOCKS];
+    bitmap_t *indexed;          // blocks that have a slot
+    size_t used;                // slots that are not DEDUP_EMPTY, tombstones included
+};
+
+static void fs_dedup_place(struct dedup_index *index, uint64_t hash, size_t block_id)
+{
+    size_t slot = hash & (DEDUP_SLOTS - 1);
+    while(index->slot_block[slot] != DEDUP_EMPTY && index->slot_block[slot] != DEDUP_TOMBSTONE)
+    {
+        slot = (slot + 1) & (DEDUP_SLOTS - 1);
+    }
+    if(index->slot_block[slot] == DEDUP_EMPTY)
+    {
+        index->used++;
+    }
+    index->slot_hash[slot] = hash;
+    index->slot_block[slot] = block_id;
+}
 
-        } else {
-            // Double indirect not implemented
-            break;
-        }
+static void fs_dedup_replace(size_t block_id, void *arg)
+{
+    struct dedup_index *index = (struct dedup_index *)arg;
+    fs_dedup_place(index, index->block_hash[block_id], block_id);
+}
 
-        // If block doesn't exist, we're done
-        if (block_id == 0) {
-            break;
-        }
+// record that block_id holds data hashing to hash
+static void fs_dedup_insert(struct dedup_index *index, uint64_t hash, size_t block_id)
+{
+    if(bitmap_test(index->indexed, block_id))
+    {
+        return;
+    }
+    if(index->used + 1 > DEDUP_SLOTS / 4 * 3)
+    {
+        // mostly tombstones by now, lay the live entries out again
+        memset(index->slot_block, 0, sizeof(index->slot_block));
+        index->used = 0;
+        bitmap_for_each(index->indexed, fs_dedup_replace, index);
+    }
+    fs_dedup_place(index, hash, block_id);
+    index->block_hash[block_id] = hash;
+    bitmap_set(index->indexed, block_id);
+}
 
-        // Read the block
-        uint8_t *block_data = (uint8_t *)calloc(1, BLOCK_SIZE_BYTES);
-        block_store_read(fs->BlockStore_whole, block_id, block_data);
+// block_id is about to be freed or rewritten, nobody may be pointed at it for its old contents
+static void fs_dedup_forget(struct dedup_index *index, size_t block_id)
+{
+    if(index == NULL || !bitmap_test(index->indexed, block_id))
+    {
+        return;
+    }
+    size_t slot = index->block_hash[block_id] & (DEDUP_SLOTS - 1);
+    while(index->slot_block[slot] != block_id)
+    {
+        slot = (slot + 1) & (DEDUP_SLOTS - 1);
+    }
+    index->slot_block[slot] = DEDUP_TOMBSTONE;
+    bitmap_reset(index->indexed, block_id);
+}
 
-        // Calculate how much to read from this block
-        size_t block_bytes_to_read = BLOCK_SIZE_BYTES - file_desc->locate_offset;
-        if (bytes_read + block_bytes_to_read > bytes_to_read) {
-            block_bytes_to_read = bytes_to_read - bytes_read;
+// look for an indexed block holding exactly data and take one more reference to it
+//  Hash hits are confirmed byte by byte, a block that already has REFCOUNT_MAX extra
+//  owners is passed over.
+// \return the shared block, 0 if there is none
+static size_t fs_dedup_share(FS_t *fs, uint64_t hash, const void *data)
+{
+    struct dedup_index *index = fs->dedup;
+    const uint8_t *blocks = block_store_Data_location(fs->BlockStore_whole);
+    uint8_t *refcounts = NULL;
+    for(size_t slot = hash & (DEDUP_SLOTS - 1); index->slot_block[slot] != DEDUP_EMPTY; slot = (slot + 1) & (DEDUP_SLOTS - 1))
+    {
+        size_t block_id = index->slot_block[slot];
+        if(block_id == DEDUP_TOMBSTONE || index->slot_hash[slot] != hash || memcmp(blocks + block_id * BLOCK_SIZE_BYTES, data, BLOCK_SIZE_BYTES) != 0)
+        {
+            continue;
         }
-
-        // Copy data from block to destination
-        memcpy(dst_ptr + bytes_read, block_data + file_desc->locate_offset, block_bytes_to_read);
-        bytes_read += block_bytes_to_read;
-
-        // Update file position
-        file_desc->locate_offset += block_bytes_to_read;
-        if (file_desc->locate_offset >= BLOCK_SIZE_BYTES) {
-            file_desc->locate_order++;
-            file_desc->locate_offset = 0;
-
-            // Check if we need to move to indirect pointers
-            if (file_desc->usage == 1 && file_desc->locate_order >= 6) {
-                file_desc->usage = 2;
-                file_desc->locate_order = 0;
+        if(refcounts == NULL)
+        {
+            refcounts = fs_refcounts(fs, true);
+            if(refcounts == NULL)
+            {
+                return 0;
             }
         }
-
-        free(block_data);
+        if(refcounts[block_id] < REFCOUNT_MAX)
+        {
+            refcounts[block_id]++;
+            return block_id;
+        }
     }
+    return 0;
+}
 
-    // Update file descriptor
-    block_store_fd_write(fs->BlockStore_fd, fd, file_desc);
-
-    // Clean up
-    free(file_desc);
-    free(inode);
+static bool fs_block_shared(FS_t *fs, size_t block_id)
+{
+    uint8_t *refcounts = fs_refcounts(fs, false);
+    return refcounts != NULL && refcounts[block_id] != 0;
+}
 
-    return bytes_read;
+// drop one owner of a data block, the block is only freed once nobody owns it
+static void fs_block_put(FS_t *fs, size_t block_id)
+{
+    uint8_t *refcounts = fs_refcounts(fs, false);
+    if(refcounts != NULL && refcounts[block_id] != 0)
+    {
+        refcounts[block_id]--;
+        return;
+    }
+    fs_dedup_forget(fs->dedup, block_id);
+    block_store_release(fs->BlockStore_whole, block_id);
 }
 
-ssize_t fs_write(FS_t *fs, int fd, const void *src, size_t nbyte)
+// \return the block in the (usage, order) slot of a file's block map, 0 if there is none
+static size_t fs_block_at(FS_t *fs, const inode_t *fileInode, uint8_t usage, size_t order)
 {
-    //PSEUDOCODE:
-    /*
-    first, error check all parameters to ensure all not null or invalid
-    next, check to make sure the file descriptor is valid, and that it points to a valid file
-    At this point, writing can commence. We start at the start at the given block/offset indicated by the fd.
-    We write nbytes into the given block starting at the given offset using the given src. If we run to the end of a block, we ask for another block, update the inode and continue writing.
-    If we run out of blocks return an error, we stop and return what we have. We finally return what was how many bytes were written.
-    */
-    //error check parameters
-    if(fs == NULL || src == NULL) {
-        return -1;
+    if(usage == 1)
+    {
+        return order < 6 ? fileInode->directPointer[order] : 0;
     }
-    //check and make sure the fd is valid
-    if(!block_store_sub_test(fs->BlockStore_fd, fd))
+    size_t pointer_block = fileInode->indirectPointer[0];
+    size_t slot = OPEN_MAP_INDIRECT;
+    if(usage == 4)
     {
-        return -1;
+        if(fileInode->doubleIndirectPointer == 0)
+        {
+            return 0;
+        }
+        pointer_block = fs_pointer_at(fs, fileInode->inodeNumber, OPEN_MAP_DOUBLE, fileInode->doubleIndirectPointer, (order / 2048) % 2048);
+        slot = OPEN_MAP_UNDER_DOUBLE;
+        order %= 2048;
     }
-    //pull down file descriptor based on num given
-    fileDescriptor_t* fileDescr = calloc(1,sizeof(fileDescriptor_t));
-    if(fileDescr == NULL ) {
-        return -1;
+    if(pointer_block == 0 || order >= 2048)
+    {
+        return 0;
     }
-    size_t fd_bytes_read = block_store_fd_read(fs->BlockStore_fd,fd,fileDescr);
-    if(fd_bytes_read != sizeof(fileDescriptor_t) || fileDescr->inodeNum == 0) {
-        //if we read less than the # of bytes or the inode # is 0 (which should never happen), then we must have been given invalid fd.
-        free(fileDescr);
-        return -1;
+    return fs_pointer_at(fs, fileInode->inodeNumber, slot, pointer_block, order);
+}
+
+// point the (usage, order) slot of a file's block map at block_id
+static void fs_set_block_pointer(FS_t *fs, inode_t *fileInode, uint8_t usage, size_t order, size_t block_id)
+{
+    if(usage == 1)
+    {
+        fileInode->directPointer[order] = block_id;
+        return;
     }
-    inode_t* fileInode = calloc(1, sizeof(inode_t));
-    if(fileInode == NULL) {
-        free(fileDescr);
-        return -1;
+    uint16_t pointers[2048];
+    size_t pointer_block = fileInode->indirectPointer[0];
+    if(usage == 4)
+    {
+        fs_block_read(fs, fileInode->doubleIndirectPointer, pointers);
+        pointer_block = pointers[order / 2048];
+        order %= 2048;
     }
-    //get inode we are writing to.
-    block_store_inode_read(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
+    fs_block_read(fs, pointer_block, pointers);
+    pointers[order] = block_id;
+    fs_block_write(fs, pointer_block, pointers);
+}
 
-    //array for double indirect, holding pointers to indirect block & indirect array
-    //uint16_t doubleIndirectPtrArr[2048] = {0};
-    uint16_t indirectPtrArr[2048] = {0};
-    if(nbyte == 0) {
-        //if we aren't writing at all, just return at this point. Don't need to update anything but overwrite inode just in case.
-        block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-        free(fileInode);
-        free(fileDescr);
-        return 0;
+// copy-on-write: give the file a private block in place of the shared one at (usage, order)
+//  Callers rewrite the whole block afterwards, so the old contents are not copied over
+// \return the new block, SIZE_MAX when out of space
+static size_t fs_block_unshare(FS_t *fs, inode_t *fileInode, uint8_t usage, size_t order)
+{
+    size_t shared_id = fs_block_at(fs, fileInode, usage, order);
+    size_t copy_id = fs_block_allocate(fs);
+    if(copy_id == SIZE_MAX)
+    {
+        return SIZE_MAX;
     }
-    //get temp buffer that allows each block's data to be written individually
-    void* tempBuffer = calloc(1, BLOCK_SIZE_BYTES);
-    //pointer blocks setup now if needed, now we just loop through data and write to it
-    //at this point, we passed all error checking, so if we allocate a block and it fails, we are out of space, so return bytes written.
-    size_t bytes_written = 0;
-    for(bytes_written = 0; bytes_written != nbyte;) {
-        //if offset is already advanced into current block, then we might not need another block
-        if(fileDescr->locate_offset == 0) {
-            //need new block allocated since offset is 0
-            size_t block_num = 0;
-            if(fileDescr->usage ==1) {
-                //we know we are still using direct ptr blocks, so find open block.
-                int count;
-                for(count = 0; count < 6; count++) {
-                    if(fileInode->directPointer[count] == 0) {
-                        break;
-                    }
-                }
-                //found space in direct ptr
-                block_num = block_store_allocate(fs->BlockStore_whole);
-                fileInode->directPointer[count] = block_num;
-                if (block_num == SIZE_MAX) {
-                    //uh oh error, ran out of blocks, so free everything, and write back what was done so far.
-                    //write updated inode back to bs
-                    block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-                    free(fileInode);
-                    fileInode = NULL;
-                    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                    free(fileDescr);
-                    free(tempBuffer);
-                    return bytes_written;
-                }
-
-            }
-            else if(fileDescr->usage == 2) {
-                //using indirect
-                block_store_read(fs->BlockStore_whole,fileInode->indirectPointer[0],indirectPtrArr);
-                int indirect_block_array_num = 0;
-                for(indirect_block_array_num = 0; indirect_block_array_num < 2048; indirect_block_array_num++) {
-                    //look for open spot in indirectArr
-                    if(indirectPtrArr[indirect_block_array_num] == 0) {
-                        break;
-                    }
-                }
-                    block_num = block_store_allocate(fs->BlockStore_whole);
-                    if(block_num == SIZE_MAX) {
-                        //write updated inode back to bs
-                        //uh oh error, ran out of blocks, so free everything, and write back what was done so far.
-                        block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-                        free(fileInode);
-                        fileInode = NULL;
-                        block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                        free(fileDescr);
-                        free(tempBuffer);
-                        return bytes_written;
-                    }
-                    //set pointer in array, write back to block
-                    indirectPtrArr[indirect_block_array_num] = block_num;
-                    block_store_write(fs->BlockStore_whole,fileInode->indirectPointer[0],indirectPtrArr);
-            }
-            else {
-                //writing to double indirect
-                uint16_t doubleIndirectArr[2048];
-                block_store_read(fs->BlockStore_whole,fileInode->doubleIndirectPointer,doubleIndirectArr);
-                int double_indirect_block_array_num = 0;
-                for(double_indirect_block_array_num = 0; double_indirect_block_array_num < 2048; double_indirect_block_array_num++) {
-                    //look for edge occupied spot in double_indirectArr
-                    if(doubleIndirectArr[double_indirect_block_array_num] != 0 && doubleIndirectArr[double_indirect_block_array_num+1] == 0) {
-                        break;
-                    }
-                }
-                //now read given indirect at block num
-                block_store_read(fs->BlockStore_whole,doubleIndirectArr[double_indirect_block_array_num],indirectPtrArr);
-                int indirect_block_array_num = 0;
-                for(indirect_block_array_num = 0; indirect_block_array_num < 2048; indirect_block_array_num++) {
-                    //look for open spot in indirectArr
-                    if(indirectPtrArr[indirect_block_array_num] == 0) {
-                        break;
-                    }
-                }
-                if(indirect_block_array_num == 2048) {
-                    //out of space in given block, so let's allocate space in the next
-                    size_t next_block = block_store_allocate(fs->BlockStore_whole);
-                    uint16_t* blank_indirect = calloc(2048,sizeof(uint16_t));
-                    if(next_block == SIZE_MAX) {
-                        //write updated inode back to bs
-                        //uh oh error, ran out of blocks, so free everything, and write back what was done so far.
-                        block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-                        free(fileInode);
-                        fileInode = NULL;
-                        block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                        free(fileDescr);
-                        free(tempBuffer);
-                        return bytes_written;
-                    }
-                    doubleIndirectArr[double_indirect_block_array_num+1] = next_block;
-                    //write back changes
-                    block_store_write(fs->BlockStore_whole,fileInode->doubleIndirectPointer,doubleIndirectArr);
-                    block_store_write(fs->BlockStore_whole,next_block,blank_indirect);
-                    free(blank_indirect);
-                    //restart this loop iteration
-                    continue;
-                }
-                //we found space, so lets allocate it.
-                block_num = block_store_allocate(fs->BlockStore_whole);
-                if(block_num == SIZE_MAX) {
-                    //write updated inode back to bs
-                    //uh oh error, ran out of blocks, so free everything, and write back what was done so far.
-                    block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-                    free(fileInode);
-                    fileInode = NULL;
-                    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                    free(fileDescr);
-                    free(tempBuffer);
-                    return bytes_written;
-                }
-                //set pointer in array, write back to block
-                indirectPtrArr[indirect_block_array_num] = block_num;
-                block_store_write(fs->BlockStore_whole,doubleIndirectArr[double_indirect_block_array_num],indirectPtrArr);
-            }
-            //actually write to block
-            if(nbyte - bytes_written < BLOCK_SIZE_BYTES) {
-                //writing to less than block
-                memcpy(tempBuffer,(src+bytes_written),nbyte-bytes_written);
-                //now update fd
-                fileDescr->locate_offset += nbyte-bytes_written;
-                bytes_written += nbyte-bytes_written;
-            }
-            else {
-                //writing to whole block
-                memcpy(tempBuffer,(src+bytes_written),BLOCK_SIZE_BYTES);
-                fileDescr->locate_order++;
-                bytes_written += BLOCK_SIZE_BYTES;
-            }
-            //actually physically write to given block
-            block_store_write(fs->BlockStore_whole, block_num, tempBuffer);
-        }
-        else {
-            //lets just write as much as we can to this existing block based on offset
-            void* current_block = calloc(1,BLOCK_SIZE_BYTES);
-            uint16_t block_index = 0;
-            uint16_t block_id = 0;
-            block_index = fileDescr->locate_order;
-            if(fileDescr->usage == 1) {
-                //using direct
-                if(fileInode->directPointer[block_index] == 0) {
-                    //can't read empty block, error somewhere, so indicate that.
-                    free(fileDescr);
-                    free(fileInode);
-                    free(current_block);
-                    return -1;
-                }
-                block_id = fileInode->directPointer[block_index];
-                block_store_read(fs->BlockStore_whole,fileInode->directPointer[block_index],current_block);
-            }
-            else if(fileDescr->usage == 2) {
-                if(fileInode->indirectPointer[0] == 0) {
-                    //can't read empty block, error somewhere, so indicate that.
-                    free(fileDescr);
-                    free(fileInode);
-                    free(current_block);
-                    return -1;
-                }
-                uint16_t indirectArr[2048] = {0};
-                block_store_read(fs->BlockStore_whole,fileInode->indirectPointer[0],indirectArr);
-                block_id = indirectArr[block_index];
-                block_store_read(fs->BlockStore_whole,indirectArr[block_index],current_block);
-            }
-            else {
-                //double indirect
-                if(fileInode->doubleIndirectPointer == 0) {
-                    //can't read empty block, error somewhere, so indicate that.
-                    free(fileDescr);
-                    free(fileInode);
-                    free(current_block);
-                    return -1;
-                }
-                uint16_t doubleIndirectArr[2048] = {0};
-                block_store_read(fs->BlockStore_whole,fileInode->indirectPointer[0],doubleIndirectArr);
-                uint16_t indirectArr[2048] = {0};
-                block_store_read(fs->BlockStore_whole,block_index / 2048,indirectArr);
-                block_id = indirectArr[block_index % 2048];
-                block_store_read(fs->BlockStore_whole,indirectArr[block_index % 2048], current_block);
-            }
-            //we have current block, lets just write data all the way to the end of it.
-            uint16_t loc = nbyte - bytes_written;
-            if(loc < (BLOCK_SIZE_BYTES - fileDescr->locate_offset)) {
-                //staying within current block this write.
-                memcpy( (current_block + fileDescr->locate_offset),(bytes_written + src),nbyte-bytes_written);
-                fileDescr->locate_offset = nbyte-bytes_written;
-                bytes_written += nbyte-bytes_written;
-            }
-            else {
-                //writing to end of block
-                size_t bytes_to_write_this_iter = BLOCK_SIZE_BYTES - fileDescr->locate_offset;
-                memcpy( (current_block + fileDescr->locate_offset),(bytes_written + src),bytes_to_write_this_iter);
-                bytes_written += bytes_to_write_this_iter;
-                //now need to increment locate_order & set locate_offset to 0
-                fileDescr->locate_order++;
-                fileDescr->locate_offset = 0;
-            }
-            //write back block
-            block_store_write(fs->BlockStore_whole,block_id,current_block);
-            free(current_block);
-        }
-        if(fileDescr->locate_order == 6 && fileDescr->usage == 1) {
-            //need to go up to indirect blocks, so let's allocate space for indirect
-            uint16_t blank_indirect[2048] = {0};
-            size_t indirect_block = block_store_allocate(fs->BlockStore_whole);
-            if(indirect_block == SIZE_MAX) {
-                //write updated inode back to bs
-                //uh oh error, ran out of blocks, so free everything, and write back what was done so far.
-                block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-                free(fileInode);
-                fileInode = NULL;
-                block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                free(fileDescr);
-                free(tempBuffer);
-                return bytes_written;
-            }
-            fileInode->indirectPointer[0] = indirect_block;
-            block_store_write(fs->BlockStore_whole,indirect_block,blank_indirect);
-            fileDescr->locate_order = 0;
-            fileDescr->usage = 2;
-        }
-        else if(fileDescr->locate_order == 2048 && fileDescr->usage == 2) {
-            //go up to double indirect
-            //need to go up to indirect blocks, so let's allocate space for indirect
-            uint16_t blank_double_indirect[2048] = {0};
-            size_t double_indirect_block = block_store_allocate(fs->BlockStore_whole);
-            if(double_indirect_block == SIZE_MAX) {
-                //write updated inode back to bs
-                //uh oh error, ran out of blocks, so free everything, and write back what was done so far.
-                block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-                free(fileInode);
-                fileInode = NULL;
-                block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                free(fileDescr);
-                free(tempBuffer);
-                return bytes_written;
-            }
-            fileInode->doubleIndirectPointer = double_indirect_block;
-            //allocate space for indirect block as well
-            uint16_t blank_indirect[2048] = {0};
-            size_t indirect_block = block_store_allocate(fs->BlockStore_whole);
-            if(indirect_block == SIZE_MAX) {
-                //write updated inode back to bs
-                //uh oh error, ran out of blocks, so free everything, and write back what was done so far.
-                block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-                free(fileInode);
-                fileInode = NULL;
-                block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-                free(fileDescr);
-                free(tempBuffer);
-                return bytes_written;
-            }
-            blank_double_indirect[0] = indirect_block;
-            block_store_write(fs->BlockStore_whole,indirect_block,blank_indirect);
-            block_store_write(fs->BlockStore_whole,double_indirect_block,blank_double_indirect);
-            fileDescr->locate_order = 0;
-            fileDescr->usage = 4;
-        }
-    }
-
-    //wrote everything back, so we can update everything and return how many bytes we wrote.
-    //write updated inode back to bs
-    block_store_inode_write(fs->BlockStore_inode,fileDescr->inodeNum,fileInode);
-    free(fileInode);
-    fileInode = NULL;
-    //fileDescr->locate_order = numOfBlocksToWrite;
-    //fileDescr->locate_offset = nbyte % BLOCK_SIZE_BYTES;
-    block_store_fd_write(fs->BlockStore_fd,fd,fileDescr);
-    free(fileDescr);
-    free(tempBuffer);
-    return bytes_written;
+    fs_set_block_pointer(fs, fileInode, usage, order, copy_id);
+    fs_block_put(fs, shared_id);
+    return copy_id;
 }
 
-
-int fs_remove(FS_t *fs, const char *path)
+// a home for one block of new file data
+//  With dedup on, a block that already holds the same bytes gets one more owner and
+//  nothing needs to be written; otherwise a fresh block is allocated (and indexed).
+// \param data the full block that is going to be stored
+// \param deduped set when an existing block was shared
+// \return the block, SIZE_MAX when out of space
+static size_t fs_data_block_get(FS_t *fs, const void *data, bool *deduped)
 {
-    // Check for valid parameters
-    if (fs == NULL || path == NULL || strlen(path) == 0) {
-        return -1;
+    *deduped = false;
+    if(fs->dedup == NULL)
+    {
+        return fs_block_allocate(fs);
     }
-
-    // Parse the path
-    char* copy_path = (char*)calloc(1, 65535);
-    if (copy_path == NULL) {
-        return -1;
+    uint64_t hash = fs_hash_block(data);
+    size_t block_id = fs_dedup_share(fs, hash, data);
+    if(block_id != 0)
+    {
+        *deduped = true;
+        return block_id;
     }
-    strcpy(copy_path, path);
+    block_id = fs_block_allocate(fs);
+    if(block_id != SIZE_MAX)
+    {
+        fs_dedup_insert(fs->dedup, hash, block_id);
+    }
+    return block_id;
+}
 
-    char** tokens;
-    size_t count = 0;
-    tokens = str_split(copy_path, '/', &count);
-    free(copy_path);
-
-    if (tokens == NULL) {
-        return -1;
+// a private block of a file, (usage, order) in its block map, now has new contents
+//  With dedup on the file is pointed at an identical block if there is one and its own is dropped
+// \return true if that happened and data does not need to be written, false to write it to block_id
+static bool fs_data_block_rewrite(FS_t *fs, inode_t *fileInode, uint8_t usage, size_t order, size_t block_id, const void *data)
+{
+    if(fs->dedup == NULL)
+    {
+        return false;
     }
-
-    // Validate filenames
-    for (size_t n = 0; n < count; n++) {
-        if (!isValidFileName(*(tokens + n))) {
-            // Free tokens before returning
-            for (size_t i = 0; i < count; i++) {
-                free(*(tokens + i));
-            }
-            free(tokens);
-            return -1;
-        }
+    fs_dedup_forget(fs->dedup, block_id);
+    uint64_t hash = fs_hash_block(data);
+    size_t match = fs_dedup_share(fs, hash, data);
+    if(match == 0)
+    {
+        fs_dedup_insert(fs->dedup, hash, block_id);
+        return false;
     }
+    fs_set_block_pointer(fs, fileInode, usage, order, match);
+    fs_block_put(fs, block_id);
+    return true;
+}
 
-    // Find the parent directory and the file/directory to remove
-    size_t parent_inode_ID = 0; // Start from root directory
-    size_t indicator = 0;
-    size_t target_parent_inode_ID = 0;
-    int target_entry_index = -1;
 
-    // Navigate to the parent directory
-    for (size_t i = 0; i < count - 1; i++) {
-        inode_t *parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
-        if (parent_inode == NULL) {
-            // Free tokens before returning
-            for (size_t j_idx = 0; j_idx < count; j_idx++) {
-                free(*(tokens + j_idx));
-            }
-            free(tokens);
-            return -1;
+
+///
+/// Creates a new file at the specified location
+///   Directories along the path that do not exist are not created
+/// \param fs The FS containing the file
+/// \param path Absolute path to file to create
+/// \param type Type of file to create (regular/directory)
+/// \return 0 on success, < 0 on failure
+///
+int fs_create(FS_t *fs, const char *path, file_t type)
+{
+    FS_CALL_TIMER(fs, FS_CALL_CREATE);
+    if(fs != NULL && !fs->readonly && path != NULL && strlen(path) != 0 && (type == FS_REGULAR || type == FS_DIRECTORY))
+    {
+        // char* copy_path = (char*)calloc(1, 65535);
+        char* copy_path = (char*)calloc(1, BLOCK_STORE_NUM_BLOCKS -1); 
+        if ( copy_path == NULL ) {
+            printf("copy_path, line: 200; failed (returned -1 ) " ); 
+            return -1; 
         }
+       
+        if (strlen(path) >= BLOCK_STORE_NUM_BLOCKS -1) {
+            free(copy_path);
 
-        block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);
+            return -1;
+        }
+        strcpy(copy_path, path); 
+        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
+        size_t count = 0;
+        tokens = str_split(copy_path, '/', &count);
+        free(copy_path);
+        if(tokens == NULL)
+        {
+            return -1;
+        }
 
-        if (parent_inode->fileType == 'd') {
-            directoryFile_t *parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-            if (parent_data == NULL) {
-                free(parent_inode);
-                // Free tokens before returning
-                for (size_t j_idx = 0; j_idx < count; j_idx++) {
-                    free(*(tokens + j_idx));
+        // let's check if the filenames are valid or not
+        for(size_t n = 0; n < count; n++)
+        {
+            if(isValidFileName(*(tokens + n)) == false)
+            {
+                // before any return, we need to free tokens, otherwise memory leakage
+                for (size_t i = 0; i < count; i++)
+                {
+                    free(*(tokens + i));
                 }
                 free(tokens);
+                //printf("invalid filename\n");
                 return -1;
             }
+        }
+
+        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
+        // first, let's find the parent dir
+        size_t indicator = 0;
 
-            block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
+        // we declare parent_inode and parent_data here since it will still be used after the for loop
+        dir_block_t * parent_data = (dir_block_t *)malloc(sizeof(dir_block_t));
+        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));
 
-            bool found = false;
-            for (int j = 0; j < folder_number_entries; j++) {
-                if (((parent_inode->vacantFile >> j) & 1) == 1 &&
-                    strcmp((parent_data + j)->filename, *(tokens + i)) == 0) {
-                    parent_inode_ID = (parent_data + j)->inodeNumber;
-                    indicator++;
-                    found = true;
-                    break;
-                }
+        for(size_t i = 0; i < count - 1; i++)
+        {
+            fs_inode_read(fs, parent_inode_ID, parent_inode);	// read out the parent inode
+            // in case file and dir has the same name
+            size_t child_inode_ID = fs_dir_lookup(fs, parent_inode, *(tokens + i));
+            if(child_inode_ID != SIZE_MAX)
+            {
+                parent_inode_ID = child_inode_ID;
+                indicator++;
             }
+        }
+        //		printf("indicator = %zu\n", indicator);
+        //		printf("parent_inode_ID = %lu\n", parent_inode_ID);
 
-            free(parent_data);
+        // read out the parent inode
+        fs_inode_read(fs, parent_inode_ID, parent_inode);
+        if(indicator == count - 1 && parent_inode->fileType == 'd' && parent_data != NULL)
+        {
+            // same file or dir name in the same path is intolerable
+            fs_dir_load(fs, parent_inode, parent_data);
+            const char *name = *(tokens + count - 1);
+            char fileType = type == FS_DIRECTORY ? 'd' : 'r';
+            size_t child_inode_ID = SIZE_MAX;
+
+            if(fs_dir_find_name(parent_data, name) == SIZE_MAX)
+            {
+                child_inode_ID = fs_inode_allocate(fs);
+            }
+            // the directory may be full, and it gets its data block with its first entry and keeps it
+            if(child_inode_ID != SIZE_MAX && (!fs_dir_add(parent_data, name, strlen(name), child_inode_ID, fileType)
+                    || !fs_dir_store(fs, parent_inode_ID, parent_inode, parent_data)))
+            {
+                fs->layout->inode_release(fs, child_inode_ID);
+                child_inode_ID = SIZE_MAX;
+            }
+            if(child_inode_ID != SIZE_MAX)
+            {
+                // update the newly created inode
+                inode_t * child_inode = (inode_t *) calloc(1, sizeof(inode_t));
+                child_inode->vacantFile = 0;
+                child_inode->fileType = fileType;
+                if(type == FS_DIRECTORY)
+                {
+                    child_inode->flags = FS_INODE_DIRENTS;
+                }
+
+                child_inode->inodeNumber = child_inode_ID;
+                child_inode->fileSize = 0;
+                child_inode->linkCount = 1;
+                fs_inode_stamp_new(child_inode);
+                fs_inode_write(fs, child_inode_ID, child_inode);
 
-            if (!found) {
+                // free the temp space
                 free(parent_inode);
-                // Free tokens before returning
-                for (size_t j_idx = 0; j_idx < count; j_idx++) {
-                    free(*(tokens + j_idx));
+                free(parent_data);
+                free(child_inode);
+                // before any return, we need to free tokens, otherwise memory leakage
+                for (size_t i = 0; i < count; i++)
+                {
+                    free(*(tokens + i));
                 }
                 free(tokens);
-                return -1; // Path component not found
-            }
-        } else {
-            free(parent_inode);
-            // Free tokens before returning
-            for (size_t j_idx = 0; j_idx < count; j_idx++) {
-                free(*(tokens + j_idx));
+                return 0;
             }
-            free(tokens);
-            return -1; // Not a directory
         }
-
-        free(parent_inode);
-    }
-
-    // At this point, parent_inode_ID is the inode of the parent directory
-    target_parent_inode_ID = parent_inode_ID;
-
-    // Find the file/directory to remove in the parent directory
-    inode_t *parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
-    if (parent_inode == NULL) {
-        // Free tokens before returning
-        for (size_t j_idx = 0; j_idx < count; j_idx++) {
-            free(*(tokens + j_idx));
+        // before any return, we need to free tokens, otherwise memory leakage
+        for (size_t i = 0; i < count; i++)
+        {
+            free(*(tokens + i));
         }
         free(tokens);
-        return -1;
-    }
-
-    block_store_inode_read(fs->BlockStore_inode, target_parent_inode_ID, parent_inode);
-
-    if (parent_inode->fileType != 'd') {
         free(parent_inode);
-        // Free tokens before returning
-        for (size_t j_idx = 0; j_idx < count; j_idx++) {
-            free(*(tokens + j_idx));
-        }
-        free(tokens);
-        return -1; // Parent is not a directory
+        free(parent_data);
     }
+    return -1;
+}
 
-    directoryFile_t *parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    if (parent_data == NULL) {
-        free(parent_inode);
-        // Free tokens before returning
-        for (size_t j_idx = 0; j_idx < count; j_idx++) {
-            free(*(tokens + j_idx));
-        }
-        free(tokens);
-        return -1;
-    }
 
-    block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
 
-    size_t target_inode_ID = 0;
-    for (int j = 0; j < folder_number_entries; j++) {
-        if (((parent_inode->vacantFile >> j) & 1) == 1 &&
-            strcmp((parent_data + j)->filename, *(tokens + count - 1)) == 0) {
-            target_inode_ID = (parent_data + j)->inodeNumber;
-            target_entry_index = j;
-            break;
+///
+/// Opens the specified file for use
+///   R/W position is set to the beginning of the file (BOF)
+///   Directories cannot be opened
+/// \param fs The FS containing the file
+/// \param path path to the requested file
+/// \return file descriptor to the requested file, < 0 on error
+///
+int fs_open(FS_t *fs, const char *path)
+{
+    FS_CALL_TIMER(fs, FS_CALL_OPEN);
+    if(fs != NULL && path != NULL && strlen(path) != 0)
+    {
+         // char* copy_path = (char*)calloc(1, 65535);
+         char* copy_path = (char*)calloc(1, BLOCK_STORE_NUM_BLOCKS -1); 
+         if ( copy_path == NULL ) {
+             printf("copy_path, line: 200; failed (returned -1 ) " ); 
+             return -1; 
+         }
+        
+         if (strlen(path) >= BLOCK_STORE_NUM_BLOCKS -1) {
+             free(copy_path);
+ 
+             return -1;
+         }
+         strcpy(copy_path, path); 
+        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
+        size_t count = 0;
+        tokens = str_split(copy_path, '/', &count);
+        free(copy_path);
+        if(tokens == NULL)
+        {
+            return -1;
         }
-    }
 
-    if (target_entry_index == -1) {
-        free(parent_data);
-        free(parent_inode);
-        // Free tokens before returning
-        for (size_t j_idx = 0; j_idx < count; j_idx++) {
-            free(*(tokens + j_idx));
+        // let's check if the filenames are valid or not
+        for(size_t n = 0; n < count; n++)
+        {
+            if(isValidFileName(*(tokens + n)) == false)
+            {
+                // before any return, we need to free tokens, otherwise memory leakage
+                for (size_t i = 0; i < count; i++)
+                {
+                    free(*(tokens + i));
+                }
+                free(tokens);
+                return -1;
+            }
         }
-        free(tokens);
-        return -1; // File/directory not found
-    }
 
-    // Get the inode of the file/directory to remove
-    inode_t *target_inode = (inode_t *)calloc(1, sizeof(inode_t));
-    if (target_inode == NULL) {
-        free(parent_data);
-        free(parent_inode);
-        // Free tokens before returning
-        for (size_t j_idx = 0; j_idx < count; j_idx++) {
-            free(*(tokens + j_idx));
-        }
-        free(tokens);
-        return -1;
-    }
+        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
+        // first, let's find the parent dir
+        size_t indicator = 0;
 
-    block_store_inode_read(fs->BlockStore_inode, target_inode_ID, target_inode);
+        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));
 
-    // Check if it's a directory and if it's empty
-    if (target_inode->fileType == 'd') {
-        // Check if directory is empty
-        if (target_inode->vacantFile != 0) {
-            free(target_inode);
-            free(parent_data);
-            free(parent_inode);
-            // Free tokens before returning
-            for (size_t j_idx = 0; j_idx < count; j_idx++) {
-                free(*(tokens + j_idx));
+        // locate the file
+        for(size_t i = 0; i < count; i++)
+        {
+            fs_inode_read(fs, parent_inode_ID, parent_inode);	// read out the parent inode
+            size_t child_inode_ID = fs_dir_lookup(fs, parent_inode, *(tokens + i));
+            if(child_inode_ID != SIZE_MAX)
+            {
+                parent_inode_ID = child_inode_ID;
+                indicator++;
             }
-            free(tokens);
-            return -1; // Directory not empty
-        }
-
-        // Free the directory's data block if it exists
-        if (target_inode->directPointer[0] != 0) {
-            block_store_release(fs->BlockStore_whole, target_inode->directPointer[0]);
         }
-    } else {
-        // It's a regular file, free all its data blocks
-
-        // Free direct blocks
-        for (int i = 0; i < 6; i++) {
-            if (target_inode->directPointer[i] != 0) {
-                block_store_release(fs->BlockStore_whole, target_inode->directPointer[i]);
-            }
-        }
-
-        // Free indirect blocks
-        if (target_inode->indirectPointer[0] != 0) {
-            uint16_t *indirect_data = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
-            if (indirect_data != NULL) {
-                block_store_read(fs->BlockStore_whole, target_inode->indirectPointer[0], indirect_data);
+        free(parent_inode);
+        //printf("indicator = %zu\n", indicator);
+        //printf("count = %zu\n", count);
+        // now let's open the file
+        if(indicator == count)
+        {
+            size_t fd_ID = fs_fd_allocate(fs);
+            //printf("fd_ID = %zu\n", fd_ID);
+            // it could be possible that fd runs out
+            if(fd_ID < number_fd)
+            {
+                size_t file_inode_ID = parent_inode_ID;
+                inode_t file_inode;
+                fs_inode_read(fs, file_inode_ID, &file_inode);	// read out the file inode, a copy if it is open already
 
-                // Free all blocks pointed to by the indirect block
-                for (size_t i = 0; i < BLOCK_SIZE_BYTES / sizeof(uint16_t); i++) {
-                    if (indirect_data[i] != 0) {
-                        block_store_release(fs->BlockStore_whole, indirect_data[i]);
+                // it's too bad if file to be opened is a dir
+                // assign a file descriptor ID to the open behavior, shared state lives in the open-file table
+                if(file_inode.fileType == 'd' || !fs_open_file_attach(fs, fd_ID, file_inode_ID, &file_inode))
+                {
+                    fs->layout->fd_release(fs, fd_ID);
+                    // before any return, we need to free tokens, otherwise memory leakage
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        free(*(tokens + i));
                     }
+                    free(tokens);
+                    return -1;
                 }
 
-                free(indirect_data);
+                // before any return, we need to free tokens, otherwise memory leakage
+                for (size_t i = 0; i < count; i++)
+                {
+                    free(*(tokens + i));
+                }
+                free(tokens);
+                return fd_ID;
             }
-
-            // Free the indirect block itself
-            block_store_release(fs->BlockStore_whole, target_inode->indirectPointer[0]);
         }
+        // before any return, we need to free tokens, otherwise memory leakage
+        for (size_t i = 0; i < count; i++)
+        {
+            free(*(tokens + i));
+        }
+        free(tokens);
+    }
+    return -1;
+}
 
-        // Close any open file descriptors for this file
-        for (int fd = 0; fd < number_fd; fd++) {
-            if (block_store_sub_test(fs->BlockStore_fd, fd)) {
-                fileDescriptor_t *fd_data = (fileDescriptor_t *)calloc(1, sizeof(fileDescriptor_t));
-                if (fd_data != NULL) {
-                    block_store_fd_read(fs->BlockStore_fd, fd, fd_data);
-
-                    if (fd_data->inodeNum == target_inode_ID) {
-                        block_store_sub_release(fs->BlockStore_fd, fd);
-                    }
 
-                    free(fd_data);
-                }
-            }
+///
+/// Closes the given file descriptor
+/// \param fs The FS containing the file
+/// \param fd The file to close
+/// \return 0 on success, < 0 on failure
+///
+int fs_close(FS_t *fs, int fd)
+{
+    FS_CALL_TIMER(fs, FS_CALL_CLOSE);
+    if(fs != NULL && fd >=0 && fd < number_fd)
+    {
+        // first, make sure this fd is in use
+        if(fs->layout->fd_test(fs, fd))
+        {
+            fs_delalloc_flush(fs, fs->descriptors[fd].inodeNum, NULL);
+            fs_open_file_detach(fs, fd);
+            fs->layout->fd_release(fs, fd);
+            return 0;
         }
     }
+    return -1;
+}
 
-    // Update parent directory
-    parent_inode->vacantFile &= ~(1 << target_entry_index); // Clear the bit
-    block_store_inode_write(fs->BlockStore_inode, target_parent_inode_ID, parent_inode);
 
-    // Free the inode
-    block_store_sub_release(fs->BlockStore_inode, target_inode_ID);
 
-    // Clean up
-    free(target_inode);
-    free(parent_data);
-    free(parent_inode);
+// A cookie is the offset of the next record in its low 16 bits, then hashes of the names
+// either side of it, 24 bits each: the one read last, then the one to be read next (0 at
+// the end). Records ahead of it can be compacted away before the listing is resumed, one of
+// its two neighbours is enough to find the place again. 0 is the start of the directory.
+#define DIR_COOKIE_OFFSET(cookie) ((size_t)((cookie) & 0xffff))
+#define DIR_COOKIE_LAST(cookie) ((uint32_t)((cookie) >> 16) & 0xffffff)
+#define DIR_COOKIE_NEXT(cookie) ((uint32_t)((cookie) >> 40) & 0xffffff)
 
-    // Free tokens
-    for (size_t j_idx = 0; j_idx < count; j_idx++) {
-        free(*(tokens + j_idx));
+// an open directory, holding a copy of its block taken by fs_opendir or fs_seekdir
+struct fs_dir
+{
+    size_t inode;           // the directory's inode ID
+    size_t offset;          // of the next record in block
+    size_t last;            // of the record read last, SIZE_MAX at the start
+    dir_block_t block;
+};
+
+// FNV-1a of a record's name folded to 24 bits, never 0 so a cookie can tell "no record" apart
+static uint32_t fs_dirent_hash(const dir_block_t *dir, size_t offset)
+{
+    size_t length;
+    const uint8_t *name = (const uint8_t *)fs_dirent_name(dir, offset, &length);
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ name[i]) * 16777619u;
     }
-    free(tokens);
+    hash = (hash >> 24) ^ (hash & 0xffffff);
+    return hash == 0 ? 1 : hash;
+}
 
-    return 0;
+// put a directory's position back where a cookie says, in its current block
+static void fs_dir_resume(fs_dir_t *dir, uint64_t cookie)
+{
+    size_t offset = DIR_COOKIE_OFFSET(cookie);
+    uint32_t last = DIR_COOKIE_LAST(cookie);
+    uint32_t next = DIR_COOKIE_NEXT(cookie);
+    dir->offset = 0;
+    dir->last = SIZE_MAX;
+    if(last == 0)
+    {
+        return;
+    }
+    // after the record read last, else at the one that was next, else where the cookie pointed;
+    // a record that has not moved beats one that only has the same hash
+    size_t after_last = SIZE_MAX;
+    size_t at_next = SIZE_MAX;
+    size_t at_offset = dir->block.used;
+    for(size_t at = 0; at < dir->block.used; at = fs_dirent_next(&dir->block, at))
+    {
+        uint32_t hash = fs_dirent_hash(&dir->block, at);
+        size_t end = fs_dirent_next(&dir->block, at);
+        if(hash == last && (after_last == SIZE_MAX || end == offset))
+        {
+            after_last = end;
+        }
+        if(hash == next && (at_next == SIZE_MAX || at == offset))
+        {
+            at_next = at;
+        }
+        if(at_offset == dir->block.used && at >= offset)
+        {
+            at_offset = at;
+        }
+    }
+    dir->offset = after_last != SIZE_MAX ? after_last : at_next != SIZE_MAX ? at_next : at_offset;
+    dir->last = SIZE_MAX;
+    for(size_t at = 0; at < dir->offset; at = fs_dirent_next(&dir->block, at))
+    {
+        dir->last = at;
+    }
 }
 
-int fs_move(FS_t *fs, const char *src, const char *dst)
+// fs_opendir, fs_readdir and fs_get_dir share these so that only the call made is timed
+static fs_dir_t *fs_dir_open(FS_t *fs, const char *path)
 {
-    // Check for valid parameters
-    if (fs == NULL || src == NULL || dst == NULL || strlen(src) == 0 || strlen(dst) == 0) {
-        return -1;
+    size_t inode_ID = fs_path_to_inode(fs, path);
+    if(inode_ID == SIZE_MAX)
+    {
+        return NULL;
+    }
+    inode_t dir_inode;
+    fs_inode_read(fs, inode_ID, &dir_inode);
+    if(dir_inode.fileType != 'd')
+    {
+        return NULL;
+    }
+    fs_dir_t *dir = (fs_dir_t *)malloc(sizeof(fs_dir_t));
+    if(dir == NULL)
+    {
+        return NULL;
     }
+    dir->inode = inode_ID;
+    dir->offset = 0;
+    dir->last = SIZE_MAX;
+    fs_dir_load(fs, &dir_inode, &dir->block);
+    return dir;
+}
 
-    // Parse the source path
-    char* copy_src = (char*)calloc(1, 65535);
-    if (copy_src == NULL) {
-        return -1;
+static int fs_dir_read(fs_dir_t *dir, file_record_t *record)
+{
+    if(dir->offset >= dir->block.used)
+    {
+        return 0;
     }
-    strcpy(copy_src, src);
+    size_t length;
+    const char *name = fs_dirent_name(&dir->block, dir->offset, &length);
+    memset(record, 0, sizeof(*record));
+    memcpy(record->name, name, length < FS_FNAME_MAX - 1 ? length : FS_FNAME_MAX - 1);
+    record->type = fs_dirent_type(&dir->block, dir->offset) == 'd' ? FS_DIRECTORY : FS_REGULAR;
+    dir->last = dir->offset;
+    dir->offset = fs_dirent_next(&dir->block, dir->offset);
+    return 1;
+}
 
-    char** src_tokens;
-    size_t src_count = 0;
-    src_tokens = str_split(copy_src, '/', &src_count);
-    free(copy_src);
+///
+/// Opens a directory for reading its entries one at a time
+///   The directory's block is read once here; fs_readdir hands out entries from that copy,
+///   so a listing costs one block read however many entries there are
+/// \param fs The FS containing the directory
+/// \param path Absolute path to the directory
+/// \return Open directory to pass to fs_readdir and fs_closedir, NULL on error
+///
+fs_dir_t *fs_opendir(FS_t *fs, const char *path)
+{
+    FS_CALL_TIMER(fs, FS_CALL_OPENDIR);
+    return fs_dir_open(fs, path);
+}
 
-    if (src_tokens == NULL) {
+///
+/// Reads the next entry of an open directory
+///   Served from the copy of the block the directory holds, so fs_get_stats does not count it
+/// \param fs The FS containing the directory
+/// \param dir The open directory
+/// \param record Where to put the entry
+/// \return 1 if an entry was read, 0 at the end of the directory, < 0 on error
+///
+int fs_readdir(FS_t *fs, fs_dir_t *dir, file_record_t *record)
+{
+    if(fs == NULL || dir == NULL || record == NULL)
+    {
         return -1;
     }
+    return fs_dir_read(dir, record);
+}
 
-    // Parse the destination path
-    char* copy_dst = (char*)calloc(1, 65535);
-    if (copy_dst == NULL) {
-        // Free src_tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
-        return -1;
+///
+/// Tells where an open directory is, to come back to with fs_seekdir
+///   The cookie stays good across fs_closedir and changes to the directory: entries that were
+///   there all along are neither skipped nor repeated when the listing is resumed from it,
+///   unless the entries on both sides of it were removed in the meantime
+/// \param dir The open directory
+/// \return Cookie for the next entry, 0 is the start of the directory
+///
+uint64_t fs_telldir(const fs_dir_t *dir)
+{
+    if(dir == NULL || dir->last == SIZE_MAX)
+    {
+        return 0;
     }
-    strcpy(copy_dst, dst);
-
-    char** dst_tokens;
-    size_t dst_count = 0;
-    dst_tokens = str_split(copy_dst, '/', &dst_count);
-    free(copy_dst);
+    uint64_t last = fs_dirent_hash(&dir->block, dir->last);
+    uint64_t next = dir->offset < dir->block.used ? fs_dirent_hash(&dir->block, dir->offset) : 0;
+    return (next << 40) | (last << 16) | dir->offset;
+}
 
-    if (dst_tokens == NULL) {
-        // Free src_tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
+///
+/// Moves an open directory to a cookie from fs_telldir and reads its block again
+///   A cookie from another directory, or 0, starts it over
+/// \param fs The FS containing the directory
+/// \param dir The open directory
+/// \param cookie Where to go
+/// \return 0 on success, < 0 on failure
+///
+int fs_seekdir(FS_t *fs, fs_dir_t *dir, uint64_t cookie)
+{
+    if(fs == NULL || dir == NULL)
+    {
         return -1;
     }
-
-    // Validate filenames
-    for (size_t n = 0; n < src_count; n++) {
-        if (!isValidFileName(*(src_tokens + n))) {
-            // Free tokens before returning
-            for (size_t i = 0; i < src_count; i++) {
-                free(*(src_tokens + i));
-            }
-            free(src_tokens);
-            for (size_t i = 0; i < dst_count; i++) {
-                free(*(dst_tokens + i));
-            }
-            free(dst_tokens);
-            return -1;
-        }
+    inode_t dir_inode;
+    fs_inode_read(fs, dir->inode, &dir_inode);
+    if(dir_inode.fileType != 'd')
+    {
+        return -1;  // removed, and the inode has been used for something else
     }
+    fs_dir_load(fs, &dir_inode, &dir->block);
+    fs_dir_resume(dir, cookie);
+    return 0;
+}
 
-    for (size_t n = 0; n < dst_count; n++) {
-        if (!isValidFileName(*(dst_tokens + n))) {
-            // Free tokens before returning
-            for (size_t i = 0; i < src_count; i++) {
-                free(*(src_tokens + i));
-            }
-            free(src_tokens);
-            for (size_t i = 0; i < dst_count; i++) {
-                free(*(dst_tokens + i));
-            }
-            free(dst_tokens);
-            return -1;
-        }
+///
+/// Closes an open directory
+/// \param dir The open directory
+/// \return 0 on success, < 0 on failure
+///
+int fs_closedir(fs_dir_t *dir)
+{
+    if(dir == NULL)
+    {
+        return -1;
     }
+    free(dir);
+    return 0;
+}
 
-    // Find the source file/directory
-    size_t src_parent_inode_ID = 0; // Start from root directory
-    size_t src_indicator = 0;
-    int src_entry_index = -1;
+///
+/// Populates a dyn_array with information about the files in a directory
+///   Entries come in directory order; built with fs_readdir
+/// \param fs The FS containing the file
+/// \param path Absolute path to the directory to inspect
+/// \return dyn_array of file records, NULL on error
+///
+dyn_array_t *fs_get_dir(FS_t *fs, const char *path)
+{
+    FS_CALL_TIMER(fs, FS_CALL_GET_DIR);
+    fs_dir_t *dir = fs_dir_open(fs, path);
+    if(dir == NULL)
+    {
+        return NULL;
+    }
+    dyn_array_t *dynArray = dyn_array_create(dir->block.count, sizeof(file_record_t), NULL);
+    file_record_t fileRec;
+    while(dynArray != NULL && fs_dir_read(dir, &fileRec) > 0)
+    {
+        dyn_array_push_back(dynArray, &fileRec);
+    }
+    fs_closedir(dir);
+    return dynArray;
+}
 
-    // Navigate to the source parent directory
-    for (size_t i = 0; i < src_count - 1; i++) {
-        inode_t *parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
-        if (parent_inode == NULL) {
-            // Free tokens before returning
-            for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                free(*(src_tokens + j_idx));
-            }
-            free(src_tokens);
-            for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                free(*(dst_tokens + k_idx));
-            }
-            free(dst_tokens);
-            return -1;
+// a directory fs_walk has still to list, with the path it was reached by
+typedef struct walk_item
+{
+    size_t inode;
+    size_t depth;           // of the directory, its entries are one deeper
+    char path[];            // "" for the root, so that an entry's path is path + "/" + name
+} walk_item_t;
+
+// One worker's directories. The owner pushes and pops at the tail, depth first, and the
+// others steal from the head, where the directories nearest the top of its part of the tree are.
+typedef struct
+{
+    pthread_mutex_t lock;
+    walk_item_t **items;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} walk_deque_t;
+
+// one fs_walk, shared by its threads
+typedef struct
+{
+    FS_t *fs;
+    fs_walk_fn callback;
+    void *arg;
+    unsigned flags;
+    size_t threads;
+    size_t next_worker;         // handed out atomically, one per thread
+    walk_deque_t deques[64];
+    size_t pending;             // directories pushed and not yet listed
+    size_t entries;
+    bool stopped;               // by the callback, or a failed allocation
+    size_t root_length;
+    uint8_t seen[number_inodes];    // directories already queued, so a linked directory is listed once
+} walk_run_t;
+
+static bool fs_walk_push(walk_run_t *run, walk_deque_t *deque, walk_item_t *item)
+{
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail == deque->capacity)
+    {
+        if(deque->head > 0)
+        {
+            memmove(deque->items, deque->items + deque->head, (deque->tail - deque->head) * sizeof(walk_item_t *));
+            deque->tail -= deque->head;
+            deque->head = 0;
         }
-
-        block_store_inode_read(fs->BlockStore_inode, src_parent_inode_ID, parent_inode);
-
-        if (parent_inode->fileType == 'd') {
-            directoryFile_t *parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-            if (parent_data == NULL) {
-                free(parent_inode);
-                // Free tokens before returning
-                for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                    free(*(src_tokens + j_idx));
-                }
-                free(src_tokens);
-                for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                    free(*(dst_tokens + k_idx));
-                }
-                free(dst_tokens);
-                return -1;
-            }
-
-            block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-
-            bool found = false;
-            for (int j = 0; j < folder_number_entries; j++) {
-                if (((parent_inode->vacantFile >> j) & 1) == 1 &&
-                    strcmp((parent_data + j)->filename, *(src_tokens + i)) == 0) {
-                    src_parent_inode_ID = (parent_data + j)->inodeNumber;
-                    src_indicator++;
-                    found = true;
-                    break;
-                }
-            }
-
-            free(parent_data);
-
-            if (!found) {
-                free(parent_inode);
-                // Free tokens before returning
-                for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                    free(*(src_tokens + j_idx));
-                }
-                free(src_tokens);
-                for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                    free(*(dst_tokens + k_idx));
-                }
-                free(dst_tokens);
-                return -1; // Path component not found
-            }
-        } else {
-            free(parent_inode);
-            // Free tokens before returning
-            for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                free(*(src_tokens + j_idx));
-            }
-            free(src_tokens);
-            for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                free(*(dst_tokens + k_idx));
+        else
+        {
+            size_t capacity = deque->capacity == 0 ? 64 : deque->capacity * 2;
+            walk_item_t **items = (walk_item_t **)realloc(deque->items, capacity * sizeof(walk_item_t *));
+            if(items == NULL)
+            {
+                pthread_mutex_unlock(&deque->lock);
+                return false;
             }
-            free(dst_tokens);
-            return -1; // Not a directory
+            deque->items = items;
+            deque->capacity = capacity;
         }
-
-        free(parent_inode);
     }
+    deque->items[deque->tail++] = item;
+    __atomic_fetch_add(&run->pending, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
 
-    // Find the source file/directory in the parent directory
-    inode_t *src_parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
-    if (src_parent_inode == NULL) {
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
+// \return the owner's newest directory, or the oldest of a deque it steals from, NULL if it is empty
+static walk_item_t *fs_walk_take(walk_deque_t *deque, bool steal)
+{
+    walk_item_t *item = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->head < deque->tail)
+    {
+        item = steal ? deque->items[deque->head++] : deque->items[--deque->tail];
+        if(deque->head == deque->tail)
+        {
+            deque->head = deque->tail = 0;
         }
-        free(dst_tokens);
-        return -1;
     }
+    pthread_mutex_unlock(&deque->lock);
+    return item;
+}
 
-    block_store_inode_read(fs->BlockStore_inode, src_parent_inode_ID, src_parent_inode);
+// list one directory, handing each entry to the callback and queueing the directories among them
+static void fs_walk_list(walk_run_t *run, walk_deque_t *own, const walk_item_t *item, dir_block_t *dir, char *path)
+{
+    inode_t node;
+    fs_inode_read(run->fs, item->inode, &node);
+    fs_dir_load(run->fs, &node, dir);
+    size_t path_length = strlen(item->path);
+    memcpy(path, item->path, path_length);
+    path[path_length] = '/';
+
+    fs_walk_entry_t entry;
+    entry.path = path;
+    entry.name = path + path_length + 1;
+    entry.parent = item->inode;
+    entry.depth = item->depth + 1;
+    for(size_t offset = 0; offset < dir->used && !__atomic_load_n(&run->stopped, __ATOMIC_RELAXED); offset = fs_dirent_next(dir, offset))
+    {
+        size_t length;
+        const char *name = fs_dirent_name(dir, offset, &length);
+        memcpy(path + path_length + 1, name, length);
+        path[path_length + 1 + length] = '\0';
+        entry.inode = fs_dirent_inode(dir, offset);
+        entry.type = fs_dirent_type(dir, offset) == 'd' ? FS_DIRECTORY : FS_REGULAR;
+        entry.size = 0;
+        if(run->flags & FS_WALK_SIZE)
+        {
+            fs_inode_read(run->fs, entry.inode, &node);
+            entry.size = node.fileSize;
+        }
+        __atomic_fetch_add(&run->entries, 1, __ATOMIC_RELAXED);
 
-    if (src_parent_inode->fileType != 'd') {
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
+        int verdict = run->callback(&entry, run->arg);
+        if(verdict < 0)
+        {
+            __atomic_store_n(&run->stopped, true, __ATOMIC_RELAXED);
+            break;
         }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
+        if(entry.type != FS_DIRECTORY || verdict == FS_WALK_PRUNE || entry.inode >= number_inodes
+                || __atomic_exchange_n(&run->seen[entry.inode], 1, __ATOMIC_RELAXED) != 0)
+        {
+            continue;
         }
-        free(dst_tokens);
-        return -1; // Parent is not a directory
-    }
-
-    directoryFile_t *src_parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    if (src_parent_data == NULL) {
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
+        walk_item_t *child = (walk_item_t *)malloc(sizeof(walk_item_t) + path_length + 1 + length + 1);
+        if(child != NULL)
+        {
+            child->inode = entry.inode;
+            child->depth = entry.depth;
+            memcpy(child->path, path, path_length + 1 + length + 1);
         }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
+        if(child == NULL || !fs_walk_push(run, own, child))
+        {
+            free(child);
+            __atomic_store_n(&run->stopped, true, __ATOMIC_RELAXED);
         }
-        free(dst_tokens);
-        return -1;
     }
+}
 
-    block_store_read(fs->BlockStore_whole, src_parent_inode->directPointer[0], src_parent_data);
-
-    size_t src_inode_ID = 0;
-    for (int j = 0; j < folder_number_entries; j++) {
-        if (((src_parent_inode->vacantFile >> j) & 1) == 1 &&
-            strcmp((src_parent_data + j)->filename, *(src_tokens + src_count - 1)) == 0) {
-            src_inode_ID = (src_parent_data + j)->inodeNumber;
-            src_entry_index = j;
-            break;
-        }
+// one thread of fs_walk: its own directories first, then ones stolen from the others, until none are left
+static void *fs_walk_work(void *arg)
+{
+    walk_run_t *run = (walk_run_t *)arg;
+    size_t self = __atomic_fetch_add(&run->next_worker, 1, __ATOMIC_RELAXED);
+    walk_deque_t *own = &run->deques[self];
+    // below the root a path is at most a name per level, and no directory is entered twice
+    dir_block_t *dir = (dir_block_t *)malloc(sizeof(dir_block_t));
+    char *path = (char *)malloc(run->root_length + (size_t)number_inodes * FS_FNAME_MAX + 1);
+    if(dir == NULL || path == NULL)
+    {
+        __atomic_store_n(&run->stopped, true, __ATOMIC_RELAXED);
     }
-
-    if (src_entry_index == -1) {
-        free(src_parent_data);
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
+    while(__atomic_load_n(&run->pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        walk_item_t *item = fs_walk_take(own, false);
+        for(size_t i = 1; item == NULL && i < run->threads; i++)
+        {
+            item = fs_walk_take(&run->deques[(self + i) % run->threads], true);
+        }
+        if(item == NULL)
+        {
+            sched_yield();  // the rest are being listed, and may yet turn up more
+            continue;
         }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
+        if(!__atomic_load_n(&run->stopped, __ATOMIC_RELAXED))
+        {
+            fs_walk_list(run, own, item, dir, path);
         }
-        free(dst_tokens);
-        return -1; // Source file/directory not found
+        free(item);
+        __atomic_fetch_sub(&run->pending, 1, __ATOMIC_RELEASE);
     }
+    free(dir);
+    free(path);
+    return NULL;
+}
 
-    // Get the source inode
-    inode_t *src_inode = (inode_t *)calloc(1, sizeof(inode_t));
-    if (src_inode == NULL) {
-        free(src_parent_data);
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
-        }
-        free(dst_tokens);
+///
+/// Walks the tree under a directory, handing every entry to a callback
+///   Directories are listed by inode number, no path is resolved after the first. A directory
+///   linked in more than one place is listed once, its other names are reported but not entered.
+///   It owns the FS for the duration of the call like fs_write
+/// \param fs The FS
+/// \param root Absolute path to the directory to walk, which is not itself reported
+/// \param callback Called for each entry: returns 0 to go on, FS_WALK_PRUNE to not enter the
+///   directory it was given, < 0 to stop the walk
+/// \param arg Passed to the callback
+/// \param flags FS_WALK_* bits
+/// \return Entries reported, < 0 on failure or if the callback stopped the walk
+///
+ssize_t fs_walk(FS_t *fs, const char *root, fs_walk_fn callback, void *arg, unsigned flags)
+{
+    FS_CALL_TIMER(fs, FS_CALL_WALK);
+    if(callback == NULL)
+    {
         return -1;
     }
+    size_t root_ID = fs_path_to_inode(fs, root);
+    if(root_ID == SIZE_MAX)
+    {
+        return -1;
+    }
+    inode_t root_inode;
+    fs_inode_read(fs, root_ID, &root_inode);
+    if(root_inode.fileType != 'd')
+    {
+        return -1;
+    }
+    walk_run_t *run = (walk_run_t *)calloc(1, sizeof(walk_run_t));
+    walk_item_t *first = (walk_item_t *)malloc(sizeof(walk_item_t) + strlen(root) + 1);
+    if(run == NULL || first == NULL)
+    {
+        free(run);
+        free(first);
+        return -1;
+    }
+    run->fs = fs;
+    run->callback = callback;
+    run->arg = arg;
+    run->flags = flags;
+    run->threads = 1;
+    if(flags & FS_WALK_PARALLEL)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        run->threads = online > 1 ? (online < 64 ? (size_t)online : 64) : 1;
+    }
+    for(size_t i = 0; i < run->threads; i++)
+    {
+        pthread_mutex_init(&run->deques[i].lock, NULL);
+    }
 
-    block_store_inode_read(fs->BlockStore_inode, src_inode_ID, src_inode);
-
-    // Find the destination parent directory
-    size_t dst_parent_inode_ID = 0; // Start from root directory
-    size_t dst_indicator = 0;
-
-    // Navigate to the destination parent directory
-    for (size_t i = 0; i < dst_count - 1; i++) {
-        inode_t *parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
-        if (parent_inode == NULL) {
-            free(src_inode);
-            free(src_parent_data);
-            free(src_parent_inode);
-            // Free tokens before returning
-            for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                free(*(src_tokens + j_idx));
-            }
-            free(src_tokens);
-            for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                free(*(dst_tokens + k_idx));
-            }
-            free(dst_tokens);
-            return -1;
-        }
- 
-        block_store_inode_read(fs->BlockStore_inode, dst_parent_inode_ID, parent_inode);
-
-        if (parent_inode->fileType == 'd') {
-            directoryFile_t *parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-            if (parent_data == NULL) {
-                free(parent_inode);
-                free(src_inode);
-                free(src_parent_data);
-                free(src_parent_inode);
-                // Free tokens before returning
-                for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                    free(*(src_tokens + j_idx));
-                }
-                free(src_tokens);
-                for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                    free(*(dst_tokens + k_idx));
-                }
-                free(dst_tokens);
-                return -1;
-            }
+    // the root's path without its trailing slashes, so entries under "/" come out as "/name"
+    size_t root_length = strlen(root);
+    while(root_length > 0 && root[root_length - 1] == '/')
+    {
+        root_length--;
+    }
+    memcpy(first->path, root, root_length);
+    first->path[root_length] = '\0';
+    first->inode = root_ID;
+    first->depth = 0;
+    run->seen[root_ID] = 1;
+    run->root_length = root_length;
+    if(!fs_walk_push(run, &run->deques[0], first))
+    {
+        free(first);
+        run->stopped = true;
+    }
 
-            block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
+    pthread_t threads[64];
+    size_t started = 0;
+    while(started + 1 < run->threads && pthread_create(threads + started, NULL, fs_walk_work, run) == 0)
+    {
+        started++;
+    }
+    fs_walk_work(run);  // if a thread did not start, its deque stays empty
+    for(size_t i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
 
-            bool found = false;
-            for (int j = 0; j < folder_number_entries; j++) {
-                if (((parent_inode->vacantFile >> j) & 1) == 1 &&
-                    strcmp((parent_data + j)->filename, *(dst_tokens + i)) == 0) {
-                    dst_parent_inode_ID = (parent_data + j)->inodeNumber;
-                    dst_indicator++;
-                    found = true;
-                    break;
-                }
-            }
+    ssize_t entries = run->stopped ? -1 : (ssize_t)run->entries;
+    for(size_t i = 0; i < run->threads; i++)
+    {
+        pthread_mutex_destroy(&run->deques[i].lock);
+        free(run->deques[i].items);
+    }
+    free(run);
+    return entries;
+}
 
-            free(parent_data);
+// the (usage, order) slot of the n-th block of a file
+static uint8_t fs_logical_slot(size_t n, size_t *order)
+{
+    if(n < 6)
+    {
+        *order = n;
+        return 1;
+    }
+    if(n < 6 + 2048)
+    {
+        *order = n - 6;
+        return 2;
+    }
+    *order = n - 6 - 2048;
+    return 4;
+}
 
-            if (!found) {
-                free(parent_inode);
-                free(src_inode);
-                free(src_parent_data);
-                free(src_parent_inode);
-                // Free tokens before returning
-                for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                    free(*(src_tokens + j_idx));
-                }
-                free(src_tokens);
-                for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                    free(*(dst_tokens + k_idx));
-                }
-                free(dst_tokens);
-                return -1; // Path component not found
-            }
-        } else {
-            free(parent_inode);
-            free(src_inode);
-            free(src_parent_data);
-            free(src_parent_inode);
-            // Free tokens before returning
-            for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-                free(*(src_tokens + j_idx));
-            }
-            free(src_tokens);
-            for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-                free(*(dst_tokens + k_idx));
-            }
-            free(dst_tokens);
-            return -1; // Not a directory
-        }
+// writing past EOF extends the file, so grow fileSize up to the cursor
+static void fs_update_size(inode_t *fileInode, const fileDescriptor_t *fileDescr)
+{
+    if(fileDescr->position > fileInode->fileSize) {
+        fileInode->fileSize = fileDescr->position;
+    }
+}
 
-        free(parent_inode);
+// the descriptor behind fd, NULL if fd is not open
+static fileDescriptor_t *fs_descriptor(FS_t *fs, int fd)
+{
+    if(fd < 0 || fd >= number_fd || !fs->layout->fd_test(fs, fd)) {
+        return NULL;
     }
+    return &fs->descriptors[fd];
+}
 
-    // Check if the destination parent directory exists and is a directory
-    inode_t *dst_parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
-    if (dst_parent_inode == NULL) {
-        free(src_inode);
-        free(src_parent_data);
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
-        }
-        free(dst_tokens);
+// cursors stop at the last byte of the largest file an empty image could hold, 65483 blocks
+//  once the bitmaps, the inode table, the root directory and the file's pointer blocks are taken
+#define FS_SEEK_MAX ((off_t)65483 * BLOCK_SIZE_BYTES - 1)
+
+off_t fs_seek(FS_t *fs, int fd, off_t offset, seek_t whence) 
+{
+    FS_CALL_TIMER(fs, FS_CALL_SEEK);
+    if(fs == NULL){
+        return -1;
+    }
+    //make sure we have valid fd
+    fileDescriptor_t *fileDescr = fs_descriptor(fs, fd);
+    if(fileDescr == NULL) {
         return -1;
     }
-    if (src_inode->fileType == 'd' && src_inode_ID == dst_parent_inode_ID) {
-        free(src_inode);
-        free(dst_parent_inode);
-        free(src_parent_data);
-        free(src_parent_inode);
-        // Free tokens and return error
+    off_t from = 0;
+    if(whence == FS_SEEK_CUR) {
+        from = fileDescr->position;
+    }
+    else if(whence == FS_SEEK_END) {
+        //buffered appends already count in fileSize, see fs_delalloc_write
+        inode_t fileInode;
+        fs_inode_read(fs, fileDescr->inodeNum, &fileInode);
+        from = fileInode.fileSize;
+    }
+    else if(whence != FS_SEEK_SET) {
         return -1;
     }
+    //clamp to BOF and to FS_SEEK_MAX rather than fail
+    if(offset < -from) {
+        fileDescr->position = 0;
+    }
+    else if(offset > FS_SEEK_MAX - from) {
+        fileDescr->position = FS_SEEK_MAX;
+    }
+    else {
+        fileDescr->position = from + offset;
+    }
+    return fileDescr->position;
+}
 
-    block_store_inode_read(fs->BlockStore_inode, dst_parent_inode_ID, dst_parent_inode);
+static void fs_stat_fill(size_t inode_id, const inode_t *node, fs_stat_t *st)
+{
+    st->inode = inode_id;
+    st->type = node->fileType == 'd' ? FS_DIRECTORY : FS_REGULAR;
+    st->size = node->fileSize;
+    st->links = node->linkCount;
+    st->mode = (node->flags & FS_INODE_MODE) ? node->mode : (node->fileType == 'd' ? FS_MODE_DIRECTORY : FS_MODE_FILE);
+    st->created = node->created;
+    st->modified = node->modified;
+}
 
-    if (dst_parent_inode->fileType != 'd') {
-        free(dst_parent_inode);
-        free(src_inode);
-        free(src_parent_data);
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
-        }
-        free(dst_tokens);
-        return -1; // Destination parent is not a directory
+///
+/// Reports a file's size, type, link count, mode and timestamps without opening it
+///   Comes from the inode, or from the copy kept while the file is open
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param st Where to put the report
+/// \return 0 on success, < 0 on failure
+///
+int fs_stat(FS_t *fs, const char *path, fs_stat_t *st)
+{
+    FS_CALL_TIMER(fs, FS_CALL_STAT);
+    size_t inode_ID = fs_path_to_inode(fs, path);
+    if(inode_ID == SIZE_MAX || st == NULL)
+    {
+        return -1;
     }
+    inode_t node;
+    fs_inode_read(fs, inode_ID, &node);
+    fs_stat_fill(inode_ID, &node, st);
+    return 0;
+}
 
-    // Check if destination directory has space for a new entry
-    directoryFile_t *dst_parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    if (dst_parent_data == NULL) {
-        free(dst_parent_inode);
-        free(src_inode);
-        free(src_parent_data);
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
-        }
-        free(dst_tokens);
+///
+/// Reports on the file an open descriptor is on, as fs_stat does
+///   Appends not yet given blocks already count in the size
+/// \param fs The FS containing the file
+/// \param fd The descriptor
+/// \param st Where to put the report
+/// \return 0 on success, < 0 on failure
+///
+int fs_fstat(FS_t *fs, int fd, fs_stat_t *st)
+{
+    FS_CALL_TIMER(fs, FS_CALL_FSTAT);
+    if(fs == NULL || st == NULL)
+    {
         return -1;
     }
+    fileDescriptor_t *fileDescr = fs_descriptor(fs, fd);
+    if(fileDescr == NULL)
+    {
+        return -1;
+    }
+    inode_t node;
+    fs_inode_read(fs, fileDescr->inodeNum, &node);     // the open-file copy, no store access
+    fs_stat_fill(fileDescr->inodeNum, &node, st);
+    return 0;
+}
 
-    // Allocate data block for destination parent if needed
-    if (dst_parent_inode->directPointer[0] == 0) {
-        size_t dst_parent_data_ID = block_store_allocate(fs->BlockStore_whole);
-        if (dst_parent_data_ID == SIZE_MAX) {
-            free(dst_parent_data);
-            free(dst_parent_inode);
-            free(src_inode);
-            free(src_parent_data);
-            free(src_parent_inode);
-            // Free tokens before returning
-            for (size_t i = 0; i < src_count; i++) {
-                free(*(src_tokens + i));
-            }
-            free(src_tokens);
-            for (size_t i = 0; i < dst_count; i++) {
-                free(*(dst_tokens + i));
-            }
-            free(dst_tokens);
-            return -1; // No space for data block
-        }
-        dst_parent_inode->directPointer[0] = dst_parent_data_ID;
-        block_store_inode_write(fs->BlockStore_inode, dst_parent_inode_ID, dst_parent_inode);
+///
+/// Sets a file's permission bits
+///   They are kept and reported, the FS has no users to check them against
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param mode Permission bits, at most 07777
+/// \return 0 on success, < 0 on failure
+///
+int fs_chmod(FS_t *fs, const char *path, uint16_t mode)
+{
+    FS_CALL_TIMER(fs, FS_CALL_CHMOD);
+    if(fs == NULL || fs->readonly || mode > 07777)
+    {
+        return -1;
     }
+    size_t inode_ID = fs_path_to_inode(fs, path);
+    if(inode_ID == SIZE_MAX)
+    {
+        return -1;
+    }
+    inode_t node;
+    fs_inode_read(fs, inode_ID, &node);
+    node.flags |= FS_INODE_MODE;
+    node.mode = mode;
+    fs_inode_write(fs, inode_ID, &node);
+    return 0;
+}
 
-    block_store_read(fs->BlockStore_whole, dst_parent_inode->directPointer[0], dst_parent_data);
+// Compressed files (fs_set_compressed) split their data into groups of COMPRESS_GROUP_BLOCKS
+//  blocks. A full group is compressed into an extent of as few blocks as it takes, which sit
+//  in the group's first slots of the block map while the rest of its slots stay 0. A full
+//  group that does not shrink, and the partial group at the end of the file, are stored as
+//  plain blocks. So a group is compressed exactly when it is full and its last slot is empty.
+//  Every extent block still has a slot of its own, so refcounts, snapshots and fs_remove
+//  treat them like any other data block. An extent starts with its compressed length.
+#define COMPRESS_HEADER_BYTES sizeof(uint32_t)
+#define COMPRESS_EXTENT_MAX (COMPRESS_GROUP_BYTES - BLOCK_SIZE_BYTES)	// must save at least one block
+
+// a zeroed block for the block map
+// \return the block, SIZE_MAX when out of space
+static size_t fs_pointer_block_new(FS_t *fs)
+{
+    uint16_t blank[2048] = {0};
+    size_t block_id = fs_block_allocate(fs);
+    if(block_id != SIZE_MAX)
+    {
+        fs_block_write(fs, block_id, blank);
+    }
+    return block_id;
+}
 
-    // Check if a file/directory with the same name already exists in the destination
-    for (int j = 0; j < folder_number_entries; j++) {
-        if (((dst_parent_inode->vacantFile >> j) & 1) == 1 &&
-            strcmp((dst_parent_data + j)->filename, *(dst_tokens + dst_count - 1)) == 0) {
-            free(dst_parent_data);
-            free(dst_parent_inode);
-            free(src_inode);
-            free(src_parent_data);
-            free(src_parent_inode);
-            // Free tokens before returning
-            for (size_t i = 0; i < src_count; i++) {
-                free(*(src_tokens + i));
-            }
-            free(src_tokens);
-            for (size_t i = 0; i < dst_count; i++) {
-                free(*(dst_tokens + i));
+// allocate the pointer blocks the (usage, order) slot lives in, if the file does not have them yet
+// \return false when out of space
+static bool fs_map_slot(FS_t *fs, inode_t *fileInode, uint8_t usage, size_t order)
+{
+    if(usage == 1)
+    {
+        return true;
+    }
+    if(usage == 2)
+    {
+        if(fileInode->indirectPointer[0] == 0)
+        {
+            size_t block_id = fs_pointer_block_new(fs);
+            if(block_id == SIZE_MAX)
+            {
+                return false;
             }
-            free(dst_tokens);
-            return -1; // File/directory with same name already exists
+            fileInode->indirectPointer[0] = block_id;
         }
+        return true;
     }
-
-    // Find an empty slot in the destination directory
-    int dst_entry_index = -1;
-    for (int j = 0; j < folder_number_entries; j++) {
-        if (((dst_parent_inode->vacantFile >> j) & 1) == 0) {
-            dst_entry_index = j;
-            break;
+    if(fileInode->doubleIndirectPointer == 0)
+    {
+        size_t block_id = fs_pointer_block_new(fs);
+        if(block_id == SIZE_MAX)
+        {
+            return false;
         }
+        fileInode->doubleIndirectPointer = block_id;
     }
-
-    if (dst_entry_index == -1) {
-        free(dst_parent_data);
-        free(dst_parent_inode);
-        free(src_inode);
-        free(src_parent_data);
-        free(src_parent_inode);
-        // Free tokens before returning
-        for (size_t i = 0; i < src_count; i++) {
-            free(*(src_tokens + i));
-        }
-        free(src_tokens);
-        for (size_t i = 0; i < dst_count; i++) {
-            free(*(dst_tokens + i));
+    uint16_t pointers[2048];
+    fs_block_read(fs, fileInode->doubleIndirectPointer, pointers);
+    if(pointers[order / 2048] == 0)
+    {
+        size_t block_id = fs_pointer_block_new(fs);
+        if(block_id == SIZE_MAX)
+        {
+            return false;
         }
-        free(dst_tokens);
-        return -1; // Destination directory is full
+        pointers[order / 2048] = block_id;
+        fs_block_write(fs, fileInode->doubleIndirectPointer, pointers);
     }
+    return true;
+}
 
-    // Add the file/directory to the destination directory
-    dst_parent_inode->vacantFile |= (1 << dst_entry_index);
-    strcpy((dst_parent_data + dst_entry_index)->filename, *(dst_tokens + dst_count - 1));
-    (dst_parent_data + dst_entry_index)->inodeNumber = src_inode_ID;
-
-    // Remove the file/directory from the source directory
-    src_parent_inode->vacantFile &= ~(1 << src_entry_index);
-
-    // Write the changes back
-    block_store_write(fs->BlockStore_whole, dst_parent_inode->directPointer[0], dst_parent_data);
-    block_store_inode_write(fs->BlockStore_inode, dst_parent_inode_ID, dst_parent_inode);
-
-    block_store_write(fs->BlockStore_whole, src_parent_inode->directPointer[0], src_parent_data);
-    block_store_inode_write(fs->BlockStore_inode, src_parent_inode_ID, src_parent_inode);
-
-    // Clean up
-    free(dst_parent_data);
-    free(dst_parent_inode);
-    free(src_inode);
-    free(src_parent_data);
-    free(src_parent_inode);
-
-    // Free tokens
-    for (size_t j_idx = 0; j_idx < src_count; j_idx++) {
-        free(*(src_tokens + j_idx));
-    }
-    free(src_tokens);
-    for (size_t k_idx = 0; k_idx < dst_count; k_idx++) {
-        free(*(dst_tokens + k_idx));
+// the blocks in the slots of one group, 0 for empty slots
+static void fs_group_blocks(FS_t *fs, const inode_t *fileInode, size_t group, size_t *block_ids)
+{
+    for(size_t i = 0; i < COMPRESS_GROUP_BLOCKS; i++)
+    {
+        size_t order;
+        uint8_t usage = fs_logical_slot(group * COMPRESS_GROUP_BLOCKS + i, &order);
+        block_ids[i] = fs_block_at(fs, fileInode, usage, order);
     }
-    free(dst_tokens);
+}
 
-    return 0;
+// a full group short of its last block is an extent; one with no first block is a hole left by
+// seeking past EOF (an extent always starts in its first slot), and reads as zeros
+static bool fs_group_compressed(const inode_t *fileInode, const size_t *block_ids, size_t group)
+{
+    return (group + 1) * COMPRESS_GROUP_BYTES <= fileInode->fileSize && block_ids[0] != 0
+        && block_ids[COMPRESS_GROUP_BLOCKS - 1] == 0;
 }
-int fs_link(FS_t *fs, const char *src, const char *dst) {
-    // Step 1: Parameter validation
-    if (fs == NULL || src == NULL || dst == NULL || strlen(src) == 0 || strlen(dst) == 0) {
-    return -1;
+
+// decompress the extent in block_ids into a whole group
+// \return false if the extent is damaged or memory ran out
+static bool fs_group_inflate(FS_t *fs, const size_t *block_ids, uint8_t *group_data)
+{
+    if(block_ids[0] == 0)
+    {
+        return false;	// no block to hold the header
     }
-    
-    // Check if destination is root (cannot create a hardlink to root)
-    if (strcmp(dst, "/") == 0) {
-    return -1;
+    uint8_t *extent = (uint8_t *)malloc(COMPRESS_EXTENT_MAX);
+    if(extent == NULL)
+    {
+        return false;
     }
-    
-    // Step 2: Parse paths and find inodes
-    char* src_copy = (char*)calloc(1, 65535);
-    char* dst_copy = (char*)calloc(1, 65535);
-    if (!src_copy || !dst_copy) {
-    free(src_copy);
-    free(dst_copy);
-    return -1;
+    size_t blocks = 0;
+    while(blocks < COMPRESS_GROUP_BLOCKS - 1 && block_ids[blocks] != 0)
+    {
+        fs_block_read(fs, block_ids[blocks], extent + blocks * BLOCK_SIZE_BYTES);
+        blocks++;
+    }
+    uint32_t length;
+    memcpy(&length, extent, COMPRESS_HEADER_BYTES);
+    bool ok = length <= blocks * BLOCK_SIZE_BYTES - COMPRESS_HEADER_BYTES
+        && fs_lz_decompress(extent + COMPRESS_HEADER_BYTES, length, group_data, COMPRESS_GROUP_BYTES) == COMPRESS_GROUP_BYTES;
+    free(extent);
+    return ok;
+}
+
+// copy n bytes from offset from of a compressed group, decompressing it only if it is not cached
+// \return false if the extent is damaged or memory ran out
+static bool fs_group_read_cached(FS_t *fs, const inode_t *fileInode, size_t group, const size_t *block_ids, size_t from, size_t n, uint8_t *dst)
+{
+    struct group_cache *cache = fs->cache;
+    if(cache == NULL)
+    {
+        FS_STAT_ADD(fs, cache_misses, 1);
+        uint8_t *group_data = (uint8_t *)malloc(COMPRESS_GROUP_BYTES);
+        bool ok = group_data != NULL && fs_group_inflate(fs, block_ids, group_data);
+        if(ok)
+        {
+            memcpy(dst, group_data + from, n);
+        }
+        free(group_data);
+        return ok;
     }
-    strcpy(src_copy, src);
-    strcpy(dst_copy, dst);
-    char** src_tokens;
-    char** dst_tokens;
-    size_t src_count = 0, dst_count = 0;
-    // Split paths into components
-    src_tokens = str_split(src_copy, '/', &src_count);
-    dst_tokens = str_split(dst_copy, '/', &dst_count);
-    free(src_copy);
-    free(dst_copy);
-    if (!src_tokens || !dst_tokens) {
-    if (src_tokens) {
-    for (size_t i = 0; i < src_count; i++) {
-    free(*(src_tokens + i));
+
+    pthread_mutex_lock(&cache->lock);
+    size_t i;
+    for(i = 0; i < GROUP_CACHE_ENTRIES; i++)
+    {
+        if(cache->entry[i].valid && cache->entry[i].inodeNum == fileInode->inodeNumber && cache->entry[i].group == group)
+        {
+            break;
+        }
     }
-    free(src_tokens);
+    if(i == GROUP_CACHE_ENTRIES)
+    {
+        FS_STAT_ADD(fs, cache_misses, 1);
+        i = cache->hand;
+        cache->hand = (cache->hand + 1) % GROUP_CACHE_ENTRIES;
+        cache->entry[i].valid = fs_group_inflate(fs, block_ids, cache->entry[i].data);
+        cache->entry[i].inodeNum = fileInode->inodeNumber;
+        cache->entry[i].group = group;
+    }
+    else
+    {
+        FS_STAT_ADD(fs, cache_hits, 1);
     }
-    if (dst_tokens) {
-    for (size_t i = 0; i < dst_count; i++) {
-    free(*(dst_tokens + i));
+    bool ok = cache->entry[i].valid;
+    if(ok)
+    {
+        memcpy(dst, cache->entry[i].data + from, n);
     }
-    free(dst_tokens);
+    pthread_mutex_unlock(&cache->lock);
+    return ok;
+}
+
+static void fs_group_forget_cached(FS_t *fs, const inode_t *fileInode, size_t group)
+{
+    struct group_cache *cache = fs->cache;
+    if(cache == NULL)
+    {
+        return;
     }
-    return -1;
+    pthread_mutex_lock(&cache->lock);
+    for(size_t i = 0; i < GROUP_CACHE_ENTRIES; i++)
+    {
+        if(cache->entry[i].inodeNum == fileInode->inodeNumber && cache->entry[i].group == group)
+        {
+            cache->entry[i].valid = false;
+        }
     }
-    // Validate path components
-    for (size_t i = 0; i < src_count; i++) {
-    if (!isValidFileName(*(src_tokens + i))) {
-    // Free memory and return error
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// read n bytes from offset from of a group, whichever way it is stored
+// \return false if the group is damaged or memory ran out
+static bool fs_group_read(FS_t *fs, const inode_t *fileInode, size_t group, size_t from, size_t n, uint8_t *dst)
+{
+    size_t block_ids[COMPRESS_GROUP_BLOCKS];
+    fs_group_blocks(fs, fileInode, group, block_ids);
+    if(fs_group_compressed(fileInode, block_ids, group))
+    {
+        return fs_group_read_cached(fs, fileInode, group, block_ids, from, n, dst);
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    uint8_t block[BLOCK_SIZE_BYTES];
+    while(n > 0)
+    {
+        size_t i = from / BLOCK_SIZE_BYTES;
+        size_t offset = from % BLOCK_SIZE_BYTES;
+        size_t chunk = BLOCK_SIZE_BYTES - offset < n ? BLOCK_SIZE_BYTES - offset : n;
+        if(block_ids[i] == 0)
+        {
+            memset(dst, 0, chunk);
+        }
+        else
+        {
+            fs_block_read(fs, block_ids[i], block);
+            memcpy(dst, block + offset, chunk);
+        }
+        dst += chunk;
+        from += chunk;
+        n -= chunk;
     }
-    free(dst_tokens);
-    return -1;
+    return true;
+}
+
+// store the first length bytes of a group, compressed if it is full and that saves a block
+//  New blocks are all in hand before anything is changed, so running out of space leaves the
+//  group as it was. Private blocks the group already has are overwritten in place.
+// \return false when out of space
+static bool fs_group_write(FS_t *fs, inode_t *fileInode, size_t group, const uint8_t *group_data, size_t length)
+{
+    uint8_t *extent = (uint8_t *)malloc(COMPRESS_EXTENT_MAX);
+    if(extent == NULL)
+    {
+        return false;
     }
+    const uint8_t *image = group_data;
+    size_t blocks = (length + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+    if(length == COMPRESS_GROUP_BYTES)
+    {
+        size_t packed = fs_lz_compress(group_data, COMPRESS_GROUP_BYTES, extent + COMPRESS_HEADER_BYTES, COMPRESS_EXTENT_MAX - COMPRESS_HEADER_BYTES);
+        if(packed != 0)
+        {
+            uint32_t header = packed;
+            memcpy(extent, &header, COMPRESS_HEADER_BYTES);
+            image = extent;
+            blocks = (packed + COMPRESS_HEADER_BYTES + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+        }
     }
-    for (size_t i = 0; i < dst_count; i++) {
-    if (!isValidFileName(*(dst_tokens + i) )) {
-    // Free memory and return error
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
-    }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+
+    size_t old_ids[COMPRESS_GROUP_BLOCKS];
+    size_t new_ids[COMPRESS_GROUP_BLOCKS] = {0};
+    fs_group_blocks(fs, fileInode, group, old_ids);
+    for(size_t i = 0; i < blocks; i++)
+    {
+        if(old_ids[i] != 0 && !fs_block_shared(fs, old_ids[i]))
+        {
+            new_ids[i] = old_ids[i];
+            continue;
+        }
+        size_t order;
+        uint8_t usage = fs_logical_slot(group * COMPRESS_GROUP_BLOCKS + i, &order);
+        new_ids[i] = fs_map_slot(fs, fileInode, usage, order) ? fs_block_allocate(fs) : SIZE_MAX;
+        if(new_ids[i] == SIZE_MAX)
+        {
+            for(size_t j = 0; j < i; j++)
+            {
+                if(new_ids[j] != old_ids[j])
+                {
+                    block_store_release(fs->BlockStore_whole, new_ids[j]);
+                }
+            }
+            free(extent);
+            return false;
+        }
     }
-    free(dst_tokens);
-    return -1;
+
+    for(size_t i = 0; i < COMPRESS_GROUP_BLOCKS; i++)
+    {
+        if(i < blocks)
+        {
+            fs_block_write(fs, new_ids[i], image + i * BLOCK_SIZE_BYTES);
+        }
+        if(new_ids[i] != old_ids[i])
+        {
+            size_t order;
+            uint8_t usage = fs_logical_slot(group * COMPRESS_GROUP_BLOCKS + i, &order);
+            fs_set_block_pointer(fs, fileInode, usage, order, new_ids[i]);
+            if(old_ids[i] != 0)
+            {
+                fs_block_put(fs, old_ids[i]);
+            }
+        }
     }
+    fs_group_forget_cached(fs, fileInode, group);
+    free(extent);
+    return true;
+}
+
+// fs_write for compressed files: every group the write touches is read, patched and stored again
+// \return bytes written, stops early when out of space
+static ssize_t fs_compressed_write(FS_t *fs, fileDescriptor_t *fileDescr, inode_t *fileInode, const uint8_t *src, size_t nbyte)
+{
+    uint8_t *group_data = (uint8_t *)malloc(COMPRESS_GROUP_BYTES);
+    if(group_data == NULL)
+    {
+        return -1;
     }
-    // Step 3: Locate Source File/Directory
-    size_t src_parent_inode_id = 0; // Start from the root
-    size_t src_inode_id = 0;
-    bool src_found = false;
-    inode_t current_inode;
-    directoryFile_t *dir_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    if (!dir_data) {
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    size_t position = fileDescr->position;
+    size_t written = 0;
+
+    // writing past EOF leaves the last group behind; store it whole now, or once the file is
+    // longer its missing last block would make it look like an extent
+    size_t tail = fileInode->fileSize / COMPRESS_GROUP_BYTES;
+    size_t tail_length = fileInode->fileSize % COMPRESS_GROUP_BYTES;
+    if(nbyte > 0 && tail_length != 0 && position / COMPRESS_GROUP_BYTES > tail)
+    {
+        memset(group_data, 0, COMPRESS_GROUP_BYTES);
+        if(!fs_group_read(fs, fileInode, tail, 0, tail_length, group_data)
+                || !fs_group_write(fs, fileInode, tail, group_data, COMPRESS_GROUP_BYTES))
+        {
+            free(group_data);
+            return 0;
+        }
+        fileInode->fileSize = (tail + 1) * COMPRESS_GROUP_BYTES;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+
+    while(written < nbyte)
+    {
+        size_t group = (position + written) / COMPRESS_GROUP_BYTES;
+        size_t from = (position + written) % COMPRESS_GROUP_BYTES;
+        size_t n = nbyte - written < COMPRESS_GROUP_BYTES - from ? nbyte - written : COMPRESS_GROUP_BYTES - from;
+        size_t group_start = group * COMPRESS_GROUP_BYTES;
+        size_t old_length = fileInode->fileSize > group_start ? fileInode->fileSize - group_start : 0;
+        if(old_length > COMPRESS_GROUP_BYTES)
+        {
+            old_length = COMPRESS_GROUP_BYTES;
+        }
+        size_t length = from + n > old_length ? from + n : old_length;
+
+        // only the part of the group this write does not cover has to be read back
+        memset(group_data, 0, COMPRESS_GROUP_BYTES);
+        if((from > 0 || from + n < old_length) && !fs_group_read(fs, fileInode, group, 0, old_length, group_data))
+        {
+            break;
+        }
+        memcpy(group_data + from, src + written, n);
+        if(!fs_group_write(fs, fileInode, group, group_data, length))
+        {
+            break;
+        }
+        if(group_start + length > fileInode->fileSize)
+        {
+            fileInode->fileSize = group_start + length;
+        }
+        written += n;
     }
-    free(dst_tokens);
-    return -1;
+    fileDescr->position = position + written;
+    free(group_data);
+    return written;
+}
+
+// fs_read for compressed files
+// \return bytes read, -1 if the file is damaged
+static ssize_t fs_compressed_read(FS_t *fs, fileDescriptor_t *fileDescr, const inode_t *fileInode, uint8_t *dst, size_t nbyte)
+{
+    size_t position = fileDescr->position;
+    if(position >= fileInode->fileSize)
+    {
+        return 0;
     }
-    // Traverse path to find the source inode
-    for (size_t i = 0; i < src_count; i++) {
-    block_store_inode_read(fs->BlockStore_inode, src_parent_inode_id, &current_inode);
-    if (current_inode.fileType != 'd') {
-    // Not a dir, can't navigate further
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    if(nbyte > fileInode->fileSize - position)
+    {
+        nbyte = fileInode->fileSize - position;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    size_t done = 0;
+    while(done < nbyte)
+    {
+        size_t group = (position + done) / COMPRESS_GROUP_BYTES;
+        size_t from = (position + done) % COMPRESS_GROUP_BYTES;
+        size_t n = nbyte - done < COMPRESS_GROUP_BYTES - from ? nbyte - done : COMPRESS_GROUP_BYTES - from;
+        if(!fs_group_read(fs, fileInode, group, from, n, dst + done))
+        {
+            return -1;
+        }
+        done += n;
     }
-    free(dst_tokens);
-    return -1;
+    fileDescr->position = position + done;
+    return done;
+}
+
+// fs_write for a file that stays within FS_INLINE_MAX bytes: the data goes to its inline slot
+// \return false if there is no inline area and none can be made, the write has to take a block
+static bool fs_inline_write(FS_t *fs, fileDescriptor_t *fileDescr, inode_t *fileInode, const void *src, size_t nbyte)
+{
+    uint8_t *slot = fs_inline_data(fs, fileDescr->inodeNum, true);
+    if(slot == NULL)
+    {
+        return false;
     }
-    block_store_read(fs->BlockStore_whole, current_inode.directPointer[0], dir_data);
-    bool found_component = false;
-    for (int j = 0; j < folder_number_entries; j++) {
-    if (((current_inode.vacantFile >> j) & 1) &&
-    strcmp((dir_data + j)->filename, *(src_tokens + i)) == 0) {
-    src_parent_inode_id = (dir_data + j)->inodeNumber;
-    found_component = true;
-    break;
+    if(!(fileInode->flags & FS_INODE_INLINE))
+    {
+        memset(slot, 0, FS_INLINE_MAX);
+        fileInode->flags |= FS_INODE_INLINE;
     }
+    size_t position = fileDescr->position;
+    memcpy(slot + position, src, nbyte);
+    fileDescr->position = position + nbyte;
+    fs_update_size(fileInode, fileDescr);
+    return true;
+}
+
+// an inline file is about to outgrow its slot: move the data to a block of its own,
+// after which it is an ordinary file
+// \return false when out of space
+static bool fs_inline_spill(FS_t *fs, const fileDescriptor_t *fileDescr, inode_t *fileInode)
+{
+    uint8_t block[BLOCK_SIZE_BYTES] = {0};
+    size_t block_id = fs_block_allocate(fs);
+    if(block_id == SIZE_MAX)
+    {
+        return false;
     }
-    if (!found_component) {
-    // Path component not found
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    memcpy(block, fs_inline_data(fs, fileDescr->inodeNum, false), fileInode->fileSize);
+    fs_block_write(fs, block_id, block);
+    fileInode->directPointer[0] = block_id;
+    fileInode->flags &= ~FS_INODE_INLINE;
+    return true;
+}
+
+// fs_read for inline files
+// \return bytes read, -1 if the inline area is missing
+static ssize_t fs_inline_read(FS_t *fs, fileDescriptor_t *fileDescr, const inode_t *fileInode, void *dst, size_t nbyte)
+{
+    const uint8_t *slot = fs_inline_data(fs, fileDescr->inodeNum, false);
+    if(slot == NULL)
+    {
+        return -1;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    size_t position = fileDescr->position;
+    if(position >= fileInode->fileSize)
+    {
+        return 0;
     }
-    free(dst_tokens);
-    return -1;
+    if(nbyte > fileInode->fileSize - position)
+    {
+        nbyte = fileInode->fileSize - position;
     }
+    memcpy(dst, slot + position, nbyte);
+    fileDescr->position = position + nbyte;
+    return nbyte;
+}
+
+// give the buffered data of entry i its blocks, one run of free blocks if there is one,
+// writing each pointer block it touches once; the entry then starts after that data
+//  held is an inode the caller has in memory and writes back itself, it is updated in
+//  place of the inode table if it is the one being flushed
+// called with the lock held
+static void fs_delalloc_flush_entry(FS_t *fs, struct delalloc *delalloc, size_t i, inode_t *held)
+{
+    size_t inodeNum = delalloc->entry[i].inodeNum;
+    size_t first = delalloc->entry[i].first;
+    size_t bytes = delalloc->entry[i].bytes;
+    size_t blocks = (bytes + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+    uint8_t *data = delalloc->entry[i].data;
+    inode_t stored;
+    inode_t *fileInode = held != NULL && held->inodeNumber == inodeNum ? held : &stored;
+    if(fileInode == &stored)
+    {
+        fs_inode_read(fs, inodeNum, &stored);
     }
-    // Source file found!!
-    src_inode_id = src_parent_inode_id;
-    src_found = true;
-    // If source not found, return error :(
-    if (!src_found) {
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    // the rest of a partly filled last block reads back as zeros
+    memset(data + bytes, 0, blocks * BLOCK_SIZE_BYTES - bytes);
+
+    // the blocks kept for this entry are its to take now, the other entries' stay kept
+    __atomic_store_n(&delalloc->reserved, delalloc->reserved - delalloc->entry[i].reserved, __ATOMIC_RELAXED);
+    delalloc->entry[i].reserved = 0;
+
+    size_t run = blocks > 0 ? fs_allocate_run_from(fs, blocks, delalloc->next) : SIZE_MAX;
+    if(run != SIZE_MAX)
+    {
+        delalloc->next = run + blocks;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    uint16_t pointers[2048];
+    size_t pointer_block = 0;	// the pointer block in pointers, 0 if none
+    size_t k;
+    for(k = 0; k < blocks; k++)
+    {
+        size_t order;
+        uint8_t usage = fs_logical_slot(first + k, &order);
+        size_t block_id = run != SIZE_MAX ? run + k : fs_block_allocate(fs);
+        if(block_id == SIZE_MAX || !fs_map_slot(fs, fileInode, usage, order))
+        {
+            // the reservation rules this out, but never point at a block we do not have
+            if(block_id != SIZE_MAX && run == SIZE_MAX)
+            {
+                block_store_release(fs->BlockStore_whole, block_id);
+            }
+            break;
+        }
+        fs_block_write(fs, block_id, data + k * BLOCK_SIZE_BYTES);
+        if(usage == 1)
+        {
+            fileInode->directPointer[order] = block_id;
+            continue;
+        }
+        size_t target = fileInode->indirectPointer[0];
+        if(usage == 4)
+        {
+            uint16_t outer[2048];
+            fs_block_read(fs, fileInode->doubleIndirectPointer, outer);
+            target = outer[order / 2048];
+            order %= 2048;
+        }
+        if(target != pointer_block)
+        {
+            if(pointer_block != 0)
+            {
+                fs_block_write(fs, pointer_block, pointers);
+            }
+            fs_block_read(fs, target, pointers);
+            pointer_block = target;
+        }
+        pointers[order] = block_id;
     }
-    free(dst_tokens);
-    return -1;
+    if(pointer_block != 0)
+    {
+        fs_block_write(fs, pointer_block, pointers);
     }
-    // Read source inode
-    inode_t src_inode;
-    block_store_inode_read(fs->BlockStore_inode, src_inode_id, &src_inode);
-    // Step 4: Locate Destination Parent Directory
-    size_t dst_parent_inode_id = 0; // Start from root
-    bool dst_parent_found = false;
-    // Traverse path to find parent dir of destination
-    for (size_t i = 0; i < dst_count - 1; i++) {
-    block_store_inode_read(fs->BlockStore_inode, dst_parent_inode_id, &current_inode);
-    if (current_inode.fileType != 'd') {
-    // Not a directory, can't navigate more :(
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    for(size_t j = k; run != SIZE_MAX && j < blocks; j++)
+    {
+        block_store_release(fs->BlockStore_whole, run + j);
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    if(fileInode == &stored)
+    {
+        fs_inode_write(fs, inodeNum, &stored);
     }
-    free(dst_tokens);
-    return -1;
+
+    delalloc->entry[i].first += blocks;
+    delalloc->entry[i].bytes = 0;
+}
+
+// make sure entry i will get blocks for what it holds plus pending more bytes
+// called with the lock held
+// \return false if the FS does not have them
+static bool fs_delalloc_reserve(FS_t *fs, struct delalloc *delalloc, size_t i, size_t pending)
+{
+    size_t blocks = (delalloc->entry[i].bytes + pending + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+    size_t need = blocks + blocks / 2048 + DELALLOC_POINTER_BLOCKS;
+    if(need <= delalloc->entry[i].reserved)
+    {
+        return true;
     }
-    block_store_read(fs->BlockStore_whole, current_inode.directPointer[0], dir_data);
-    bool found_component = false;
-    for (int j = 0; j < folder_number_entries; j++) {
-    if (((current_inode.vacantFile >> j) & 1) &&
-    strcmp((dir_data + j)->filename, *(dst_tokens + i)) == 0) {
-    dst_parent_inode_id = (dir_data + j)->inodeNumber;
-    found_component = true;
-    break;
+    size_t extra = need - delalloc->entry[i].reserved;
+    if(block_store_get_free_blocks(fs->BlockStore_whole) < delalloc->reserved + extra)
+    {
+        return false;
     }
+    __atomic_store_n(&delalloc->reserved, delalloc->reserved + extra, __ATOMIC_RELAXED);
+    delalloc->entry[i].reserved = need;
+    return true;
+}
+
+// flush what is buffered for one file, or for every file with DELALLOC_ALL
+//  held as for fs_delalloc_flush_entry, may be NULL
+static void fs_delalloc_flush(FS_t *fs, size_t inodeNum, inode_t *held)
+{
+    struct delalloc *delalloc = fs->delalloc;
+    if(delalloc == NULL)
+    {
+        return;
     }
-    if (!found_component) {
-    // Path component not found :/
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    // only fs_write adds entries and it never runs beside anything, so a file with nothing
+    // buffered can be told without the lock; that is every fs_read of a file not being written
+    size_t i = 0;
+    while(inodeNum != DELALLOC_ALL && i < DELALLOC_FILES && __atomic_load_n(&delalloc->entry[i].inodeNum, __ATOMIC_RELAXED) != inodeNum)
+    {
+        i++;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    if(i == DELALLOC_FILES)
+    {
+        return;
     }
-    free(dst_tokens);
-    return -1;
+    pthread_mutex_lock(&delalloc->lock);
+    for(i = 0; i < DELALLOC_FILES; i++)
+    {
+        if(delalloc->entry[i].inodeNum != 0 && (inodeNum == DELALLOC_ALL || delalloc->entry[i].inodeNum == inodeNum))
+        {
+            fs_delalloc_flush_entry(fs, delalloc, i, held);
+            delalloc->entry[i].inodeNum = 0;
+        }
     }
+    pthread_mutex_unlock(&delalloc->lock);
+}
+
+// fs_write for appends: the data is only copied into the file's buffer, and its blocks
+// are picked when the buffer is flushed, all at once and next to each other
+//  A write is buffered if it carries on where the file's buffered data ends, or starts a
+//  block at EOF. Anything else flushes the file's buffer and is left to the usual path,
+//  as are writes the FS might not have room for and files kept by dedup.
+// \return bytes written, -1 if the write was not buffered
+static ssize_t fs_delalloc_write(FS_t *fs, fileDescriptor_t *fileDescr, inode_t *fileInode, const void *src, size_t nbyte)
+{
+    struct delalloc *delalloc = fs->delalloc;
+    if(delalloc == NULL || fs->dedup != NULL || nbyte == 0)
+    {
+        return -1;
     }
-    dst_parent_found = true;
-    // If destination parent not found, return error
-    if (!dst_parent_found) {
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    size_t position = fileDescr->position;
+    pthread_mutex_lock(&delalloc->lock);
+    size_t i;
+    for(i = 0; i < DELALLOC_FILES && delalloc->entry[i].inodeNum != fileDescr->inodeNum; i++)
+    {
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    if(i < DELALLOC_FILES && position != delalloc->entry[i].first * BLOCK_SIZE_BYTES + delalloc->entry[i].bytes)
+    {
+        fs_delalloc_flush_entry(fs, delalloc, i, fileInode);
+        delalloc->entry[i].inodeNum = 0;
+        pthread_mutex_unlock(&delalloc->lock);
+        return -1;
     }
-    free(dst_tokens);
-    return -1;
+    if(i == DELALLOC_FILES)
+    {
+        size_t order;
+        uint8_t usage = fs_logical_slot(position / BLOCK_SIZE_BYTES, &order);
+        if(position % BLOCK_SIZE_BYTES != 0 || position != fileInode->fileSize || fs_block_at(fs, fileInode, usage, order) != 0)
+        {
+            pthread_mutex_unlock(&delalloc->lock);
+            return -1;
+        }
+        for(i = 0; i < DELALLOC_FILES && delalloc->entry[i].inodeNum != 0; i++)
+        {
+        }
+        if(i == DELALLOC_FILES)
+        {
+            i = delalloc->hand;
+            delalloc->hand = (delalloc->hand + 1) % DELALLOC_FILES;
+            fs_delalloc_flush_entry(fs, delalloc, i, fileInode);
+        }
+        if(delalloc->entry[i].data == NULL)
+        {
+            delalloc->entry[i].data = (uint8_t *)malloc(DELALLOC_BYTES);
+        }
+        delalloc->entry[i].inodeNum = delalloc->entry[i].data != NULL ? fileDescr->inodeNum : 0;
+        delalloc->entry[i].first = position / BLOCK_SIZE_BYTES;
+        delalloc->entry[i].bytes = 0;
+        if(delalloc->entry[i].data == NULL)
+        {
+            pthread_mutex_unlock(&delalloc->lock);
+            return -1;
+        }
     }
-    // Read destination parent inode
-    inode_t dst_parent_inode;
-    block_store_inode_read(fs->BlockStore_inode, dst_parent_inode_id, &dst_parent_inode);
-    // Check if parent is a dir
-    if (dst_parent_inode.fileType != 'd') {
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    if(!fs_delalloc_reserve(fs, delalloc, i, nbyte))
+    {
+        fs_delalloc_flush_entry(fs, delalloc, i, fileInode);
+        delalloc->entry[i].inodeNum = 0;
+        pthread_mutex_unlock(&delalloc->lock);
+        return -1;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+
+    size_t written = 0;
+    while(written < nbyte)
+    {
+        if(delalloc->entry[i].bytes == DELALLOC_BYTES)
+        {
+            fs_delalloc_flush_entry(fs, delalloc, i, fileInode);
+            if(!fs_delalloc_reserve(fs, delalloc, i, nbyte - written))
+            {
+                break;
+            }
+        }
+        size_t chunk = DELALLOC_BYTES - delalloc->entry[i].bytes;
+        if(chunk > nbyte - written)
+        {
+            chunk = nbyte - written;
+        }
+        memcpy(delalloc->entry[i].data + delalloc->entry[i].bytes, (const uint8_t *)src + written, chunk);
+        delalloc->entry[i].bytes += chunk;
+        written += chunk;
+    }
+    pthread_mutex_unlock(&delalloc->lock);
+    fileDescr->position = position + written;
+    fs_update_size(fileInode, fileDescr);
+    return written;
+}
+
+ssize_t fs_read(FS_t *fs, int fd, void *dst, size_t nbyte)
+{
+    FS_CALL_TIMER(fs, FS_CALL_READ);
+    // Check for valid parameters
+    if (fs == NULL || dst == NULL) {
+        return -1;
     }
-    free(dst_tokens);
+
+    // Check if the file descriptor is in use
+    fileDescriptor_t *file_desc = fs_descriptor(fs, fd);
+    if (file_desc == NULL) {
+        return -1;
+    }
+
+    if ( nbyte == 0 ) {
+        // empty read byte req
+        return 0; 
+    }
+
+    // buffered appends to this file have to be in their blocks before we look
+    fs_delalloc_flush(fs, file_desc->inodeNum, NULL);
+
+    // Get the inode for this file
+    inode_t inode;
+    fs_inode_read(fs, file_desc->inodeNum, &inode);
+
+    // Compressed files are read group by group through the cache, inline files straight from their slot
+    if (inode.flags & FS_INODE_COMPRESSED) {
+        return fs_compressed_read(fs, file_desc, &inode, (uint8_t *)dst, nbyte);
+    }
+    if (inode.flags & FS_INODE_INLINE) {
+        return fs_inline_read(fs, file_desc, &inode, dst, nbyte);
+    }
+
+    // Limit read to file size
+    if (file_desc->position >= inode.fileSize) {
+        return 0; // At or past EOF, nothing to read
+    }
+    size_t bytes_to_read = nbyte;
+    if (bytes_to_read > inode.fileSize - file_desc->position) {
+        bytes_to_read = inode.fileSize - file_desc->position;
+    }
+
+    uint8_t *block_data = (uint8_t *)malloc(BLOCK_SIZE_BYTES);
+    if (block_data == NULL) {
+        return -1;
+    }
+
+    // Read data from blocks, the cursor says which block and where in it
+    uint8_t *dst_ptr = (uint8_t *)dst;
+    size_t bytes_read = 0;
+    while (bytes_read < bytes_to_read) {
+        size_t order;
+        uint8_t usage = fs_logical_slot(file_desc->position / BLOCK_SIZE_BYTES, &order);
+        size_t offset = file_desc->position % BLOCK_SIZE_BYTES;
+        size_t chunk = BLOCK_SIZE_BYTES - offset;
+        if (chunk > bytes_to_read - bytes_read) {
+            chunk = bytes_to_read - bytes_read;
+        }
+
+        // a hole left by seeking past EOF reads as zeros; nothing here allocates, the
+        // flush above was the last change this read could make
+        size_t block_id = fs_block_at(fs, &inode, usage, order);
+        if (block_id == 0) {
+            memset(dst_ptr + bytes_read, 0, chunk);
+        } else {
+            fs_block_read(fs, block_id, block_data);
+            memcpy(dst_ptr + bytes_read, block_data + offset, chunk);
+        }
+        bytes_read += chunk;
+        file_desc->position += chunk;
+    }
+
+    free(block_data);
+    return bytes_read;
+}
+
+// Views of fs_mmap that are not straight into the data store are anonymous memory the
+//  blocks are put together in, laid out as the blocks are: the view starts offset %
+//  BLOCK_SIZE_BYTES into it, so fs_munmap finds the start again by rounding down.
+//  Where the data store is a shared mapping of the image, a run of blocks is mapped into
+//  the view a second time with mremap instead of copied; otherwise (and for holes, zeros
+//  already) it is copied once.
+// \param first the view's first logical block
+// \param blocks the logical blocks it spans
+// \return the memory, already read-only, NULL on error
+static uint8_t *fs_mmap_assemble(FS_t *fs, const inode_t *fileInode, size_t first, size_t blocks)
+{
+    size_t span = blocks * BLOCK_SIZE_BYTES;
+    uint8_t *base = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if(base == MAP_FAILED)
+    {
+        return NULL;
+    }
+    uint8_t *data = block_store_Data_location(fs->BlockStore_whole);
+    bool remap = sysconf(_SC_PAGESIZE) == BLOCK_SIZE_BYTES && (uintptr_t)data % BLOCK_SIZE_BYTES == 0;
+    for(size_t i = 0; i < blocks;)
+    {
+        size_t order;
+        uint8_t usage = fs_logical_slot(first + i, &order);
+        size_t block_id = fs_block_at(fs, fileInode, usage, order);
+        size_t run = 1;
+        while(block_id != 0 && i + run < blocks)
+        {
+            usage = fs_logical_slot(first + i + run, &order);
+            if(fs_block_at(fs, fileInode, usage, order) != block_id + run)
+            {
+                break;
+            }
+            run++;
+        }
+        if(block_id != 0)
+        {
+            // old size 0 asks for a second mapping of the same pages, which only shared mappings have
+            if(!remap || mremap(data + block_id * BLOCK_SIZE_BYTES, 0, run * BLOCK_SIZE_BYTES, MREMAP_MAYMOVE | MREMAP_FIXED,
+                                base + i * BLOCK_SIZE_BYTES) == MAP_FAILED)
+            {
+                remap = false;
+                memcpy(base + i * BLOCK_SIZE_BYTES, data + block_id * BLOCK_SIZE_BYTES, run * BLOCK_SIZE_BYTES);
+                FS_STAT_ADD(fs, block_reads, run);
+            }
+        }
+        i += run;
+    }
+    mprotect(base, span, PROT_READ);
+    return base;
+}
+
+///
+/// Gives a read-only view of part of the file linked to the given descriptor, without reading it out
+///   A range in one run of blocks, or of a small file kept in its inode's slot, is viewed where it
+///   lies in the FS; any other range is put together in memory of its own
+///   Writes to the file while the view is held may or may not show in it
+///   The R/W position does not move, and the view outlives the descriptor but not the mount
+/// \param fs The FS containing the file
+/// \param fd The file to view
+/// \param offset Byte offset of the view from BOF
+/// \param length Bytes to view, offset + length may not pass EOF
+/// \return the view, NULL on error
+///
+const void *fs_mmap(FS_t *fs, int fd, size_t offset, size_t length)
+{
+    FS_CALL_TIMER(fs, FS_CALL_MMAP);
+    if(fs == NULL || length == 0)
+    {
+        return NULL;
+    }
+    fileDescriptor_t *fileDescr = fs_descriptor(fs, fd);
+    if(fileDescr == NULL)
+    {
+        return NULL;
+    }
+    fs_delalloc_flush(fs, fileDescr->inodeNum, NULL);
+    inode_t fileInode;
+    fs_inode_read(fs, fileDescr->inodeNum, &fileInode);
+    if(offset > fileInode.fileSize || length > fileInode.fileSize - offset)
+    {
+        return NULL;
+    }
+    if(fileInode.flags & FS_INODE_INLINE)
+    {
+        uint8_t *slot = fs_inline_data(fs, fileDescr->inodeNum, false);
+        return slot == NULL ? NULL : slot + offset;
+    }
+
+    size_t first = offset / BLOCK_SIZE_BYTES;
+    size_t blocks = (offset % BLOCK_SIZE_BYTES + length + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+    if(fileInode.flags & FS_INODE_COMPRESSED)
+    {
+        // the data has to be inflated somewhere, so it goes where a view of its blocks would
+        uint8_t *base = mmap(NULL, blocks * BLOCK_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if(base == MAP_FAILED)
+        {
+            return NULL;
+        }
+        fileDescriptor_t cursor = *fileDescr;
+        cursor.position = offset;
+        if(fs_compressed_read(fs, &cursor, &fileInode, base + offset % BLOCK_SIZE_BYTES, length) != (ssize_t)length)
+        {
+            munmap(base, blocks * BLOCK_SIZE_BYTES);
+            return NULL;
+        }
+        mprotect(base, blocks * BLOCK_SIZE_BYTES, PROT_READ);
+        return base + offset % BLOCK_SIZE_BYTES;
+    }
+
+    // one run of blocks is viewed in place
+    size_t order;
+    uint8_t usage = fs_logical_slot(first, &order);
+    size_t block_id = fs_block_at(fs, &fileInode, usage, order);
+    size_t i = 1;
+    while(block_id != 0 && i < blocks)
+    {
+        usage = fs_logical_slot(first + i, &order);
+        if(fs_block_at(fs, &fileInode, usage, order) != block_id + i)
+        {
+            break;
+        }
+        i++;
+    }
+    if(block_id != 0 && i == blocks)
+    {
+        return block_store_Data_location(fs->BlockStore_whole) + block_id * BLOCK_SIZE_BYTES + offset % BLOCK_SIZE_BYTES;
+    }
+    uint8_t *base = fs_mmap_assemble(fs, &fileInode, first, blocks);
+    return base == NULL ? NULL : base + offset % BLOCK_SIZE_BYTES;
+}
+
+///
+/// Lets go of a view fs_mmap gave
+/// \param fs The FS the view is of
+/// \param view The view
+/// \param length The length it was asked for with
+/// \return 0 on success, < 0 on failure
+///
+int fs_munmap(FS_t *fs, const void *view, size_t length)
+{
+    if(fs == NULL || view == NULL || length == 0)
+    {
+        return -1;
+    }
+    const uint8_t *data = block_store_Data_location(fs->BlockStore_whole);
+    const uint8_t *at = (const uint8_t *)view;
+    if(at >= data && at < data + BLOCK_STORE_NUM_BYTES)
+    {
+        return 0;   // a view in place, nothing was made for it
+    }
+    uint8_t *base = (uint8_t *)((uintptr_t)at - (uintptr_t)at % BLOCK_SIZE_BYTES);
+    return munmap(base, at - base + length) == 0 ? 0 : -1;
+}
+
+ssize_t fs_write(FS_t *fs, int fd, const void *src, size_t nbyte)
+{
+    FS_CALL_TIMER(fs, FS_CALL_WRITE);
+    //PSEUDOCODE:
+    /*
+    first, error check all parameters to ensure all not null or invalid
+    next, check to make sure the file descriptor is valid, and that it points to a valid file
+    At this point, writing can commence. We start at the start at the given block/offset indicated by the fd.
+    We write nbytes into the given block starting at the given offset using the given src. If we run to the end of a block, we ask for another block, update the inode and continue writing.
+    If we run out of blocks return an error, we stop and return what we have. We finally return what was how many bytes were written.
+    */
+    //error check parameters
+    if(fs == NULL || fs->readonly || src == NULL) {
+        return -1;
+    }
+    //check and make sure the fd is valid
+    fileDescriptor_t *fileDescr = fs_descriptor(fs, fd);
+    if(fileDescr == NULL || fileDescr->inodeNum == 0) {
+        //the inode # is 0 (which should never happen), then we must have been given invalid fd.
+        return -1;
+    }
+    //get inode we are writing to.
+    inode_t inode;
+    inode_t *fileInode = &inode;
+    fs_inode_read(fs,fileDescr->inodeNum,fileInode);
+    if(nbyte > 0) {
+        fileInode->modified = fs_time_now();
+    }
+    //compressed files are rewritten a group at a time instead
+    if(fileInode->flags & FS_INODE_COMPRESSED) {
+        ssize_t written = fs_compressed_write(fs, fileDescr, fileInode, src, nbyte);
+        fs_inode_write(fs,fileDescr->inodeNum,fileInode);
+        return written;
+    }
+    //tiny files stay in the inode's inline slot until a write takes them past FS_INLINE_MAX
+    if((fileInode->flags & FS_INODE_INLINE) || (fileInode->fileSize == 0 && nbyte > 0)) {
+        if(fileDescr->position + nbyte <= FS_INLINE_MAX && fs_inline_write(fs, fileDescr, fileInode, src, nbyte)) {
+            fs_inode_write(fs,fileDescr->inodeNum,fileInode);
+            return nbyte;
+        }
+        if((fileInode->flags & FS_INODE_INLINE) && !fs_inline_spill(fs, fileDescr, fileInode)) {
+            return -1;
+        }
+    }
+
+    //appends are buffered and get their blocks in one go later, see fs_delalloc_write
+    ssize_t buffered = fs_delalloc_write(fs, fileDescr, fileInode, src, nbyte);
+    if(buffered >= 0) {
+        fs_inode_write(fs,fileDescr->inodeNum,fileInode);
+        return buffered;
+    }
+
+    if(nbyte == 0) {
+        //if we aren't writing at all, just return at this point.
+        return 0;
+    }
+    //blocks kept for buffered appends are not ours to take; when they leave too little, flushing
+    //gives back what the reservations kept for pointer blocks they did not need
+    if(!fs_blocks_spare(fs, nbyte / BLOCK_SIZE_BYTES + 2 + DELALLOC_POINTER_BLOCKS)) {
+        fs_delalloc_flush(fs, DELALLOC_ALL, fileInode);
+    }
+    //get temp buffer that allows each block's data to be written individually
+    uint8_t *tempBuffer = malloc(BLOCK_SIZE_BYTES);
+    if(tempBuffer == NULL) {
+        return -1;
+    }
+    //at this point, we passed all error checking, so if we allocate a block and it fails, we are out of space, so return bytes written.
+    size_t bytes_written = 0;
+    while(bytes_written != nbyte) {
+        //the cursor gives the block, its slot in the block map and where in the block we are
+        size_t order;
+        uint8_t usage = fs_logical_slot(fileDescr->position / BLOCK_SIZE_BYTES, &order);
+        size_t offset = fileDescr->position % BLOCK_SIZE_BYTES;
+        size_t chunk = BLOCK_SIZE_BYTES - offset;
+        if(chunk > nbyte - bytes_written) {
+            chunk = nbyte - bytes_written;
+        }
+        size_t block_id = fs_block_at(fs, fileInode, usage, order);
+        if(block_id == 0) {
+            //need a new block. Stage its data first, with dedup on the data decides which block we get;
+            //whatever the write does not cover (a hole left by seeking past EOF) is zeros
+            memset(tempBuffer, 0, BLOCK_SIZE_BYTES);
+            memcpy(tempBuffer + offset, (const uint8_t *)src + bytes_written, chunk);
+            bool deduped = false;
+            //the pointer blocks of the slot come first, then the block itself
+            if(!fs_map_slot(fs, fileInode, usage, order)) {
+                break;
+            }
+            block_id = fs_data_block_get(fs, tempBuffer, &deduped);
+            if(block_id == SIZE_MAX) {
+                //uh oh error, ran out of blocks, so write back what was done so far.
+                break;
+            }
+            fs_set_block_pointer(fs, fileInode, usage, order, block_id);
+            //actually physically write to given block, unless it already holds exactly this data
+            if(!deduped) {
+                fs_block_write(fs, block_id, tempBuffer);
+            }
+        }
+        else {
+            //lets just write as much as we can to this existing block based on offset
+            fs_block_read(fs, block_id, tempBuffer);
+            //a block still shared with a snapshot gets copied before we modify it
+            if(fs_block_shared(fs, block_id)) {
+                block_id = fs_block_unshare(fs, fileInode, usage, order);
+                if(block_id == SIZE_MAX) {
+                    //out of space for the copy, so write back what was done so far.
+                    break;
+                }
+            }
+            memcpy(tempBuffer + offset, (const uint8_t *)src + bytes_written, chunk);
+            //write back block, unless dedup found the same data elsewhere
+            if(!fs_data_block_rewrite(fs, fileInode, usage, order, block_id, tempBuffer)) {
+                fs_block_write(fs, block_id, tempBuffer);
+            }
+        }
+        bytes_written += chunk;
+        fileDescr->position += chunk;
+    }
+
+    //wrote everything back, so we can update the inode and return how many bytes we wrote.
+    fs_update_size(fileInode, fileDescr);
+    fs_inode_write(fs,fileDescr->inodeNum,fileInode);
+    free(tempBuffer);
+    return bytes_written;
+}
+
+int fs_remove(FS_t *fs, const char *path)
+{
+    FS_CALL_TIMER(fs, FS_CALL_REMOVE);
+    // Check for valid parameters
+    if (fs == NULL || fs->readonly || path == NULL || strlen(path) == 0) {
+        return -1;
+    }
+
+    // Parse the path
+    char* copy_path = (char*)calloc(1, 65535);
+    if (copy_path == NULL) {
+        return -1;
+    }
+    strcpy(copy_path, path);
+
+    char** tokens;
+    size_t count = 0;
+    tokens = str_split(copy_path, '/', &count);
+    free(copy_path);
+
+    if (tokens == NULL) {
+        return -1;
+    }
+
+    // Validate filenames
+    for (size_t n = 0; n < count; n++) {
+        if (!isValidFileName(*(tokens + n))) {
+            // Free tokens before returning
+            for (size_t i = 0; i < count; i++) {
+                free(*(tokens + i));
+            }
+            free(tokens);
+            return -1;
+        }
+    }
+
+    // Find the parent directory and the file/directory to remove
+    size_t parent_inode_ID = 0; // Start from root directory
+    size_t indicator = 0;
+    size_t target_parent_inode_ID = 0;
+
+    // Navigate to the parent directory
+    for (size_t i = 0; i < count - 1; i++) {
+        inode_t *parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
+        if (parent_inode == NULL) {
+            // Free tokens before returning
+            for (size_t j_idx = 0; j_idx < count; j_idx++) {
+                free(*(tokens + j_idx));
+            }
+            free(tokens);
+            return -1;
+        }
+
+        fs_inode_read(fs, parent_inode_ID, parent_inode);
+
+        size_t child_inode_ID = fs_dir_lookup(fs, parent_inode, *(tokens + i));
+        if (child_inode_ID == SIZE_MAX) {
+            free(parent_inode);
+            // Free tokens before returning
+            for (size_t j_idx = 0; j_idx < count; j_idx++) {
+                free(*(tokens + j_idx));
+            }
+            free(tokens);
+            return -1; // Path component not found, or not a directory
+        }
+        parent_inode_ID = child_inode_ID;
+        indicator++;
+
+        free(parent_inode);
+    }
+
+    // At this point, parent_inode_ID is the inode of the parent directory
+    target_parent_inode_ID = parent_inode_ID;
+
+    // Find the file/directory to remove in the parent directory
+    inode_t *parent_inode = (inode_t *)calloc(1, sizeof(inode_t));
+    if (parent_inode == NULL) {
+        // Free tokens before returning
+        for (size_t j_idx = 0; j_idx < count; j_idx++) {
+            free(*(tokens + j_idx));
+        }
+        free(tokens);
+        return -1;
+    }
+
+    fs_inode_read(fs, target_parent_inode_ID, parent_inode);
+
+    if (parent_inode->fileType != 'd') {
+        free(parent_inode);
+        // Free tokens before returning
+        for (size_t j_idx = 0; j_idx < count; j_idx++) {
+            free(*(tokens + j_idx));
+        }
+        free(tokens);
+        return -1; // Parent is not a directory
+    }
+
+    dir_block_t *parent_data = (dir_block_t *)malloc(sizeof(dir_block_t));
+    if (parent_data == NULL) {
+        free(parent_inode);
+        // Free tokens before returning
+        for (size_t j_idx = 0; j_idx < count; j_idx++) {
+            free(*(tokens + j_idx));
+        }
+        free(tokens);
+        return -1;
+    }
+
+    fs_dir_load(fs, parent_inode, parent_data);
+
+    size_t target_inode_ID = 0;
+    size_t target_entry_index = fs_dir_find_name(parent_data, *(tokens + count - 1));
+    if (target_entry_index != SIZE_MAX) {
+        target_inode_ID = fs_dirent_inode(parent_data, target_entry_index);
+    }
+
+    if (target_entry_index == SIZE_MAX) {
+        free(parent_data);
+        free(parent_inode);
+        // Free tokens before returning
+        for (size_t j_idx = 0; j_idx < count; j_idx++) {
+            free(*(tokens + j_idx));
+        }
+        free(tokens);
+        return -1; // File/directory not found
+    }
+
+    // Get the inode of the file/directory to remove
+    inode_t *target_inode = (inode_t *)calloc(1, sizeof(inode_t));
+    if (target_inode == NULL) {
+        free(parent_data);
+        free(parent_inode);
+        // Free tokens before returning
+        for (size_t j_idx = 0; j_idx < count; j_idx++) {
+            free(*(tokens + j_idx));
+        }
+        free(tokens);
+        return -1;
+    }
+
+    fs_delalloc_flush(fs, target_inode_ID, NULL);	// with other links the data lives on
+    fs_inode_read(fs, target_inode_ID, target_inode);
+
+    // Check if it's a directory and if it's empty
+    if (target_inode->fileType == 'd' && target_inode->vacantFile != 0) {
+        free(target_inode);
+        free(parent_data);
+        free(parent_inode);
+        // Free tokens before returning
+        for (size_t j_idx = 0; j_idx < count; j_idx++) {
+            free(*(tokens + j_idx));
+        }
+        free(tokens);
+        return -1; // Directory not empty
+    }
+
+    bool last_name = target_inode->linkCount <= 1;
+    if (!last_name) {
+        // other names still reach it, just drop this one
+        target_inode->linkCount--;
+        fs_inode_write(fs, target_inode_ID, target_inode);
+    } else if (target_inode->fileType == 'd') {
+        // Free the directory's data block if it exists
+        if (target_inode->directPointer[0] != 0) {
+            block_store_release(fs->BlockStore_whole, target_inode->directPointer[0]);
+        }
+    } else {
+        // It's a regular file, free all its data and pointer blocks
+        fs_release_file_blocks(fs, target_inode);
+
+        // Close any open file descriptors for this file
+        fs_open_file_close_all(fs, target_inode_ID);
+    }
+
+    // Update parent directory
+    fs_dir_remove(parent_data, target_entry_index);
+    fs_dir_store(fs, target_parent_inode_ID, parent_inode, parent_data);
+
+    // Free the inode, unless another name kept it
+    if (last_name) {
+        fs->layout->inode_release(fs, target_inode_ID);
+    }
+
+    // Clean up
+    free(target_inode);
+    free(parent_data);
+    free(parent_inode);
+
+    // Free tokens
+    for (size_t j_idx = 0; j_idx < count; j_idx++) {
+        free(*(tokens + j_idx));
+    }
+    free(tokens);
+
+    return 0;
+}
+
+// split a copy of an absolute path into its parent's path ("" for the root) and its last name, in place
+// \return false if the path is not absolute or is the root
+static bool fs_path_split(char *path, char **parent, char **name)
+{
+    if(path[0] != '/')
+    {
+        return false;
+    }
+    size_t length = strlen(path);
+    while(length > 1 && path[length - 1] == '/')
+    {
+        path[--length] = '\0';
+    }
+    char *slash = strrchr(path, '/');
+    if(slash[1] == '\0')
+    {
+        return false;
+    }
+    *name = slash + 1;
+    *slash = '\0';
+    *parent = path;
+    return true;
+}
+
+// fs_move once both paths are split; src_dir and dst_dir are room for the directories' blocks
+static int fs_move_entry(FS_t *fs, char *src_parent, const char *src_name, char *dst_parent, const char *dst_name,
+        dir_block_t *src_dir, dir_block_t *dst_dir)
+{
+    // the directories both parents go through are looked up once
+    char *src_save = NULL;
+    char *dst_save = NULL;
+    char *src_token = strtok_r(src_parent, "/", &src_save);
+    char *dst_token = strtok_r(dst_parent, "/", &dst_save);
+    size_t shared_ID = 0;
+    while(src_token != NULL && dst_token != NULL && strcmp(src_token, dst_token) == 0)
+    {
+        shared_ID = fs_dir_child(fs, shared_ID, src_token);
+        src_token = strtok_r(NULL, "/", &src_save);
+        dst_token = strtok_r(NULL, "/", &dst_save);
+    }
+    size_t src_parent_ID = shared_ID;
+    for(; src_token != NULL; src_token = strtok_r(NULL, "/", &src_save))
+    {
+        src_parent_ID = fs_dir_child(fs, src_parent_ID, src_token);
+    }
+    if(src_parent_ID == SIZE_MAX)
+    {
+        return -1;
+    }
+    inode_t src_parent_inode;
+    fs_inode_read(fs, src_parent_ID, &src_parent_inode);
+    if(src_parent_inode.fileType != 'd')
+    {
+        return -1;
+    }
+    fs_dir_load(fs, &src_parent_inode, src_dir);
+    size_t src_offset = fs_dir_find_name(src_dir, src_name);
+    if(src_offset == SIZE_MAX)
+    {
+        return -1;
+    }
+    size_t src_ID = fs_dirent_inode(src_dir, src_offset);
+    char src_type = fs_dirent_type(src_dir, src_offset);
+
+    // a directory cannot be moved below itself
+    size_t dst_parent_ID = shared_ID;
+    bool below = src_type == 'd' && dst_parent_ID == src_ID;
+    for(; dst_token != NULL && dst_parent_ID != SIZE_MAX; dst_token = strtok_r(NULL, "/", &dst_save))
+    {
+        dst_parent_ID = fs_dir_child(fs, dst_parent_ID, dst_token);
+        below = below || (src_type == 'd' && dst_parent_ID == src_ID);
+    }
+    if(dst_parent_ID == SIZE_MAX || below)
+    {
+        return -1;
+    }
+
+    if(dst_parent_ID == src_parent_ID)
+    {
+        // a rename: the record takes the new name where it is, one block write
+        if(fs_dir_find_name(src_dir, dst_name) != SIZE_MAX || !fs_dir_rename(src_dir, src_offset, dst_name, strlen(dst_name)))
+        {
+            return -1;
+        }
+        return fs_dir_store(fs, src_parent_ID, &src_parent_inode, src_dir) ? 0 : -1;
+    }
+
+    inode_t dst_parent_inode;
+    fs_inode_read(fs, dst_parent_ID, &dst_parent_inode);
+    if(dst_parent_inode.fileType != 'd')
+    {
+        return -1;
+    }
+    fs_dir_load(fs, &dst_parent_inode, dst_dir);
+    // the new name goes in before the old one comes out, so a failure leaves the file where it was
+    if(fs_dir_find_name(dst_dir, dst_name) != SIZE_MAX || !fs_dir_add(dst_dir, dst_name, strlen(dst_name), src_ID, src_type)
+            || !fs_dir_store(fs, dst_parent_ID, &dst_parent_inode, dst_dir))
+    {
+        return -1;
+    }
+    fs_dir_remove(src_dir, src_offset);
+    fs_dir_store(fs, src_parent_ID, &src_parent_inode, src_dir);   // it has its block, so this cannot fail
+    return 0;
+}
+
+int fs_move(FS_t *fs, const char *src, const char *dst)
+{
+    FS_CALL_TIMER(fs, FS_CALL_MOVE);
+    if(fs == NULL || fs->readonly || src == NULL || dst == NULL)
+    {
+        return -1;
+    }
+    char *src_copy = strdup(src);
+    char *dst_copy = strdup(dst);
+    dir_block_t *src_dir = (dir_block_t *)malloc(sizeof(dir_block_t));
+    dir_block_t *dst_dir = (dir_block_t *)malloc(sizeof(dir_block_t));
+    char *src_parent;
+    char *src_name;
+    char *dst_parent;
+    char *dst_name;
+    int result = -1;
+    if(src_copy != NULL && dst_copy != NULL && src_dir != NULL && dst_dir != NULL
+            && fs_path_split(src_copy, &src_parent, &src_name) && fs_path_split(dst_copy, &dst_parent, &dst_name)
+            && isValidFileName(src_name) && isValidFileName(dst_name))
+    {
+        result = fs_move_entry(fs, src_parent, src_name, dst_parent, dst_name, src_dir, dst_dir);
+    }
+    free(src_copy);
+    free(dst_copy);
+    free(src_dir);
+    free(dst_dir);
+    return result;
+}
+
+int fs_link(FS_t *fs, const char *src, const char *dst) {
+    FS_CALL_TIMER(fs, FS_CALL_LINK);
+    // Step 1: Parameter validation
+    if (fs == NULL || fs->readonly || src == NULL || dst == NULL || strlen(src) == 0 || strlen(dst) == 0) {
+    return -1;
+    }
+    
+    // Check if destination is root (cannot create a hardlink to root)
+    if (strcmp(dst, "/") == 0) {
+    return -1;
+    }
+    
+    // Step 2: Parse paths and find inodes
+    char* src_copy = (char*)calloc(1, 65535);
+    char* dst_copy = (char*)calloc(1, 65535);
+    if (!src_copy || !dst_copy) {
+    free(src_copy);
+    free(dst_copy);
+    return -1;
+    }
+    strcpy(src_copy, src);
+    strcpy(dst_copy, dst);
+    char** src_tokens;
+    char** dst_tokens;
+    size_t src_count = 0, dst_count = 0;
+    // Split paths into components
+    src_tokens = str_split(src_copy, '/', &src_count);
+    dst_tokens = str_split(dst_copy, '/', &dst_count);
+    free(src_copy);
+    free(dst_copy);
+    if (!src_tokens || !dst_tokens) {
+    if (src_tokens) {
+    for (size_t i = 0; i < src_count; i++) {
+    free(*(src_tokens + i));
+    }
+    free(src_tokens);
+    }
+    if (dst_tokens) {
+    for (size_t i = 0; i < dst_count; i++) {
+    free(*(dst_tokens + i));
+    }
+    free(dst_tokens);
+    }
+    return -1;
+    }
+    // Validate path components
+    for (size_t i = 0; i < src_count; i++) {
+    if (!isValidFileName(*(src_tokens + i))) {
+    // Free memory and return error
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    }
+    for (size_t i = 0; i < dst_count; i++) {
+    if (!isValidFileName(*(dst_tokens + i) )) {
+    // Free memory and return error
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    }
+    // Step 3: Locate Source File/Directory
+    size_t src_parent_inode_id = 0; // Start from the root
+    size_t src_inode_id = 0;
+    bool src_found = false;
+    inode_t current_inode;
+    dir_block_t *dir_data = (dir_block_t *)malloc(sizeof(dir_block_t));
+    if (!dir_data) {
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    // Traverse path to find the source inode
+    for (size_t i = 0; i < src_count; i++) {
+    fs_inode_read(fs, src_parent_inode_id, &current_inode);
+    if (current_inode.fileType != 'd') {
+    // Not a dir, can't navigate further
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    size_t component_id = fs_dir_lookup(fs, &current_inode, *(src_tokens + i));
+    if (component_id != SIZE_MAX) {
+    src_parent_inode_id = component_id;
+    }
+    if (component_id == SIZE_MAX) {
+    // Path component not found
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    }
+    // Source file found!!
+    src_inode_id = src_parent_inode_id;
+    src_found = true;
+    // If source not found, return error :(
+    if (!src_found) {
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    // Read source inode
+    inode_t src_inode;
+    fs_inode_read(fs, src_inode_id, &src_inode);
+    // Step 4: Locate Destination Parent Directory
+    size_t dst_parent_inode_id = 0; // Start from root
+    bool dst_parent_found = false;
+    // Traverse path to find parent dir of destination
+    for (size_t i = 0; i < dst_count - 1; i++) {
+    fs_inode_read(fs, dst_parent_inode_id, &current_inode);
+    if (current_inode.fileType != 'd') {
+    // Not a directory, can't navigate more :(
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    size_t component_id = fs_dir_lookup(fs, &current_inode, *(dst_tokens + i));
+    if (component_id != SIZE_MAX) {
+    dst_parent_inode_id = component_id;
+    }
+    if (component_id == SIZE_MAX) {
+    // Path component not found :/
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    }
+    dst_parent_found = true;
+    // If destination parent not found, return error
+    if (!dst_parent_found) {
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    // Read destination parent inode
+    inode_t dst_parent_inode;
+    fs_inode_read(fs, dst_parent_inode_id, &dst_parent_inode);
+    // Check if parent is a dir
+    if (dst_parent_inode.fileType != 'd') {
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    // Step 5: Check Destination Doesn't Exist and Parent Directory Has Space
+    fs_dir_load(fs, &dst_parent_inode, dir_data);
+    const char *dst_name = *(dst_tokens + dst_count - 1);
+    // Ensure destination doesn't already exist and its record fits
+    if (fs_dir_find_name(dir_data, dst_name) != SIZE_MAX ||
+    !fs_dir_add(dir_data, dst_name, strlen(dst_name), src_inode_id, src_inode.fileType)) {
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    // Step 6: Check Link Count and Create Link
+    if (src_inode.linkCount >= 255) {
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return -1;
+    }
+    // Increment link count in source inode
+    src_inode.linkCount++;
+    fs_inode_write(fs, src_inode_id, &src_inode);
+    // Write the parent directory with the new entry, allocating its block if needed
+    if (src_inode_id == dst_parent_inode_id) {
+    dst_parent_inode.linkCount = src_inode.linkCount;	// a directory linked into itself
+    }
+    if (!fs_dir_store(fs, dst_parent_inode_id, &dst_parent_inode, dir_data)) {
+    src_inode.linkCount--;
+    fs_inode_write(fs, src_inode_id, &src_inode);
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
     return -1;
     }
-    // Step 5: Check Destination Doesn't Exist and Parent Directory Has Space
-    block_store_read(fs->BlockStore_whole, dst_parent_inode.directPointer[0], dir_data);
-    // Ensure destination doesn't already exist
-    for (int i = 0; i < folder_number_entries; i++) {
-    if (((dst_parent_inode.vacantFile >> i) & 1) &&
-    strcmp((dir_data + i)->filename, *(dst_tokens + dst_count - 1)) == 0) {
-    // Destination already exists :0
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    // Free the memory, oy vey, this function was totally so fun ;(
+    free(dir_data);
+    for (size_t j = 0; j < src_count; j++) {
+    free(*(src_tokens + j));
+    }
+    free(src_tokens);
+    for (size_t j = 0; j < dst_count; j++) {
+    free(*(dst_tokens + j));
+    }
+    free(dst_tokens);
+    return 0;
+    }
+
+// walk an absolute path from the root directory
+// \return inode ID the path names, SIZE_MAX if it does not exist
+static size_t fs_path_to_inode(FS_t *fs, const char *path)
+{
+    if(fs == NULL || path == NULL || path[0] != '/')
+    {
+        return SIZE_MAX;
+    }
+
+    char *copy_path = strdup(path);
+    if(copy_path == NULL)
+    {
+        return SIZE_MAX;
+    }
+
+    size_t inode_ID = 0;	// start from the root directory
+    char *save = NULL;
+    for(char *token = strtok_r(copy_path, "/", &save); token != NULL && inode_ID != SIZE_MAX; token = strtok_r(NULL, "/", &save))
+    {
+        inode_ID = fs_dir_child(fs, inode_ID, token);
+    }
+
+    free(copy_path);
+    return inode_ID;
+}
+
+// give every data and pointer block of a regular file back to the block store
+static void fs_release_file_blocks(FS_t *fs, const inode_t *file_inode)
+{
+    for(int i = 0; i < 6; i++)
+    {
+        if(file_inode->directPointer[i] != 0)
+        {
+            fs_block_put(fs, file_inode->directPointer[i]);
+        }
+    }
+
+    uint16_t *indirect_data = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
+    uint16_t *double_data = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
+    if(indirect_data != NULL && double_data != NULL)
+    {
+        if(file_inode->indirectPointer[0] != 0)
+        {
+            fs_block_read(fs, file_inode->indirectPointer[0], indirect_data);
+            for(size_t i = 0; i < BLOCK_SIZE_BYTES / sizeof(uint16_t); i++)
+            {
+                if(indirect_data[i] != 0)
+                {
+                    fs_block_put(fs, indirect_data[i]);
+                }
+            }
+            block_store_release(fs->BlockStore_whole, file_inode->indirectPointer[0]);
+        }
+        if(file_inode->doubleIndirectPointer != 0)
+        {
+            fs_block_read(fs, file_inode->doubleIndirectPointer, double_data);
+            for(size_t i = 0; i < BLOCK_SIZE_BYTES / sizeof(uint16_t); i++)
+            {
+                if(double_data[i] == 0)
+                {
+                    continue;
+                }
+                fs_block_read(fs, double_data[i], indirect_data);
+                for(size_t j = 0; j < BLOCK_SIZE_BYTES / sizeof(uint16_t); j++)
+                {
+                    if(indirect_data[j] != 0)
+                    {
+                        fs_block_put(fs, indirect_data[j]);
+                    }
+                }
+                block_store_release(fs->BlockStore_whole, double_data[i]);
+            }
+            block_store_release(fs->BlockStore_whole, file_inode->doubleIndirectPointer);
+        }
+    }
+    free(double_data);
+    free(indirect_data);
+}
+
+
+///
+/// Creates several files in one directory
+///   The parent is resolved once, the new inodes are allocated together
+///   and the directory block and parent inode are written back once
+///   Either every file is created or none is
+/// \param fs The FS containing the directory
+/// \param parent_path Absolute path to the parent directory
+/// \param names Filenames (not paths) of the files to create
+/// \param types Type of each file to create (regular/directory)
+/// \param n Number of files
+/// \return 0 on success, < 0 on failure
+///
+int fs_create_batch(FS_t *fs, const char *parent_path, const char *const *names, const file_t *types, size_t n)
+{
+    FS_CALL_TIMER(fs, FS_CALL_CREATE_BATCH);
+    if(fs == NULL || fs->readonly || names == NULL || types == NULL || n == 0 || n > DIR_ENTRIES_MAX)
+    {
+        return -1;
+    }
+
+    size_t parent_inode_ID = fs_path_to_inode(fs, parent_path);
+    if(parent_inode_ID == SIZE_MAX)
+    {
+        return -1;
+    }
+    inode_t parent_inode;
+    fs_inode_read(fs, parent_inode_ID, &parent_inode);
+    if(parent_inode.fileType != 'd')
+    {
+        return -1;
+    }
+
+    dir_block_t *parent_data = (dir_block_t *)malloc(sizeof(dir_block_t));
+    size_t *child_inode_IDs = (size_t *)calloc(n, sizeof(size_t));
+    size_t *records = (size_t *)calloc(n, sizeof(size_t));
+    if(parent_data == NULL || child_inode_IDs == NULL || records == NULL)
+    {
+        free(parent_data);
+        free(child_inode_IDs);
+        free(records);
+        return -1;
+    }
+    fs_dir_load(fs, &parent_inode, parent_data);
+
+    // check everything up front so a failure leaves the FS untouched; the records are added to
+    // the copy in memory as we go, which also catches a name given twice
+    int result = 0;
+    for(size_t i = 0; i < n && result == 0; i++)
+    {
+        records[i] = parent_data->used;
+        if(!isValidFileName(names[i]) || strchr(names[i], '/') != NULL || (types[i] != FS_REGULAR && types[i] != FS_DIRECTORY)
+                || fs_dir_find_name(parent_data, names[i]) != SIZE_MAX
+                || !fs_dir_add(parent_data, names[i], strlen(names[i]), 0, types[i] == FS_DIRECTORY ? 'd' : 'r'))	// directory would overflow
+        {
+            result = -1;
+        }
+    }
+
+    // grab all the inodes, give them back if we run out part way
+    size_t allocated = 0;
+    for( ; result == 0 && allocated < n; allocated++)
+    {
+        child_inode_IDs[allocated] = fs_inode_allocate(fs);
+        if(child_inode_IDs[allocated] == SIZE_MAX)
+        {
+            result = -1;
+            break;
+        }
+        uint32_t inode_number = child_inode_IDs[allocated];
+        memcpy(parent_data->data + records[allocated] + DIRENT_INODE, &inode_number, sizeof(inode_number));
+    }
+
+    if(result != 0 || !fs_dir_store(fs, parent_inode_ID, &parent_inode, parent_data))
+    {
+        for(size_t i = 0; i < allocated; i++)
+        {
+            fs->layout->inode_release(fs, child_inode_IDs[i]);
+        }
+        free(parent_data);
+        free(child_inode_IDs);
+        free(records);
+        return -1;
+    }
+
+    inode_t child_inode;
+    for(size_t i = 0; i < n; i++)
+    {
+        memset(&child_inode, 0, sizeof(inode_t));
+        child_inode.fileType = types[i] == FS_DIRECTORY ? 'd' : 'r';
+        child_inode.flags = types[i] == FS_DIRECTORY ? FS_INODE_DIRENTS : 0;
+        child_inode.inodeNumber = child_inode_IDs[i];
+        child_inode.linkCount = 1;
+        fs_inode_stamp_new(&child_inode);
+        fs_inode_write(fs, child_inode_IDs[i], &child_inode);
+    }
+
+    free(parent_data);
+    free(child_inode_IDs);
+    free(records);
+    return 0;
+}
+
+///
+/// Removes several files from one directory and closes their open descriptors
+///   The parent is resolved once and written back once, descriptors are scanned once
+///   Directories can only be removed when empty
+///   Either every file is removed or none is
+/// \param fs The FS containing the directory
+/// \param parent_path Absolute path to the parent directory
+/// \param names Filenames (not paths) of the files to remove
+/// \param n Number of files
+/// \return 0 on success, < 0 on failure
+///
+int fs_remove_batch(FS_t *fs, const char *parent_path, const char *const *names, size_t n)
+{
+    FS_CALL_TIMER(fs, FS_CALL_REMOVE_BATCH);
+    if(fs == NULL || fs->readonly || names == NULL || n == 0 || n > DIR_ENTRIES_MAX)
+    {
+        return -1;
+    }
+    fs_delalloc_flush(fs, DELALLOC_ALL, NULL);
+
+    size_t parent_inode_ID = fs_path_to_inode(fs, parent_path);
+    if(parent_inode_ID == SIZE_MAX)
+    {
+        return -1;
+    }
+    inode_t parent_inode;
+    fs_inode_read(fs, parent_inode_ID, &parent_inode);
+    if(parent_inode.fileType != 'd' || parent_inode.vacantFile == 0)
+    {
+        return -1;
+    }
+
+    dir_block_t *parent_data = (dir_block_t *)malloc(sizeof(dir_block_t));
+    inode_t *targets = (inode_t *)calloc(n, sizeof(inode_t));
+    if(parent_data == NULL || targets == NULL)
+    {
+        free(parent_data);
+        free(targets);
+        return -1;
+    }
+    fs_dir_load(fs, &parent_inode, parent_data);
+
+    // check everything up front so a failure leaves the FS untouched; dropping each record from
+    // the copy in memory as we go also catches a name given twice
+    for(size_t i = 0; i < n; i++)
+    {
+        size_t entry = names[i] == NULL ? SIZE_MAX : fs_dir_find_name(parent_data, names[i]);
+        if(entry == SIZE_MAX)
+        {
+            free(parent_data);
+            free(targets);
+            return -1;
+        }
+        fs_inode_read(fs, fs_dirent_inode(parent_data, entry), targets + i);
+        if(targets[i].fileType == 'd' && targets[i].vacantFile != 0)
+        {
+            free(parent_data);
+            free(targets);
+            return -1;	// directory not empty
+        }
+        fs_dir_remove(parent_data, entry);
+    }
+
+    for(size_t i = 0; i < n; i++)
+    {
+        // read it again: two names in the batch may be links to the same inode
+        size_t target_inode_ID = targets[i].inodeNumber;
+        fs_inode_read(fs, target_inode_ID, targets + i);
+        if(targets[i].linkCount > 1)
+        {
+            // other names still reach it, just drop this one
+            targets[i].linkCount--;
+            fs_inode_write(fs, target_inode_ID, targets + i);
+            continue;
+        }
+        if(targets[i].fileType == 'd')
+        {
+            if(targets[i].directPointer[0] != 0)
+            {
+                block_store_release(fs->BlockStore_whole, targets[i].directPointer[0]);
+            }
+        }
+        else
+        {
+            fs_release_file_blocks(fs, targets + i);
+            fs_open_file_close_all(fs, target_inode_ID);
+        }
+        fs->layout->inode_release(fs, target_inode_ID);
+    }
+
+    fs_dir_store(fs, parent_inode_ID, &parent_inode, parent_data);
+
+    free(parent_data);
+    free(targets);
+    return 0;
+}
+
+
+// The snapshot table is one block of fixed-size entries. Each snapshot owns SNAPSHOT_META_BLOCKS
+// blocks in a row: a copy of the inode bitmap block followed by a copy of the inode table, laid
+// out exactly like blocks 0-4 so block_store_inode_create can mount it as is, then a copy of the
+// inline area (zeros if the FS had none).
+#define SNAPSHOT_META_BLOCKS (FS_META_BLOCKS + INLINE_BLOCKS)
+
+typedef struct
+{
+    char name[FS_SNAPSHOT_NAME_MAX];
+    uint16_t metaBlock;         // first block of the snapshot's metadata, 0 if the slot is free
+} snapshotEntry_t;
+
+#define SNAPSHOT_MAX (BLOCK_SIZE_BYTES / sizeof(snapshotEntry_t))
+
+// \return the snapshot table of a mounted FS, NULL if no snapshot was ever taken
+static snapshotEntry_t *fs_snapshot_table(FS_t *fs)
+{
+    superblock_t *super = (superblock_t *)(block_store_Data_location(fs->BlockStore_whole) + FS_SUPER_OFFSET);
+    if(super->magic != FS_SUPER_MAGIC || super->snapshotBlock == 0)
+    {
+        return NULL;
+    }
+    return (snapshotEntry_t *)(block_store_Data_location(fs->BlockStore_whole) + super->snapshotBlock * BLOCK_SIZE_BYTES);
+}
+
+static snapshotEntry_t *fs_snapshot_find(FS_t *fs, const char *name)
+{
+    snapshotEntry_t *table = fs_snapshot_table(fs);
+    for(size_t i = 0; table != NULL && i < SNAPSHOT_MAX; i++)
+    {
+        if(table[i].metaBlock != 0 && strncmp(table[i].name, name, FS_SNAPSHOT_NAME_MAX) == 0)
+        {
+            return table + i;
+        }
+    }
+    return NULL;
+}
+
+// copy a block somewhere new, \return where it went (the caller made sure there is room)
+static uint16_t fs_block_clone(FS_t *fs, size_t block_id, void *buffer)
+{
+    size_t clone_id = fs_block_allocate(fs);
+    fs_block_read(fs, block_id, buffer);
+    fs_block_write(fs, clone_id, buffer);
+    return clone_id;
+}
+
+// one more owner for every data block in a list of block pointers
+// \return false if some block already has the most owners a refcount can hold
+static bool fs_snapshot_share(uint8_t *refcounts, const uint16_t *block_list, size_t count)
+{
+    for(size_t p = 0; p < count; p++)
+    {
+        if(block_list[p] == 0)
+        {
+            continue;
+        }
+        if(refcounts[block_list[p]] == REFCOUNT_MAX)
+        {
+            return false;
+        }
+        refcounts[block_list[p]]++;
+    }
+    return true;
+}
+
+// One pass over an inode table, either counting what a snapshot of it would cost (clone == false)
+// or doing it: directory and pointer blocks get private copies, data blocks one more owner.
+//  Dedup lets one table point at a data block many times, so the counting pass adds the owners
+//  up on a copy of the refcounts; the cloning pass then makes exactly the same increments and
+//  cannot run out of room part way. It only fails before it has changed anything.
+// \return blocks needed for the copies, SIZE_MAX if some data block would get too many owners
+static size_t fs_snapshot_walk(FS_t *fs, uint8_t *meta, bool clone)
+{
+    bitmap_t *used = bitmap_overlay(number_inodes, meta);
+    inode_t *inodes = (inode_t *)(meta + BLOCK_SIZE_BYTES);
+    uint8_t *refcounts = clone ? fs_refcounts(fs, true) : (uint8_t *)calloc(BLOCK_STORE_NUM_BLOCKS, 1);
+    uint16_t *pointers = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
+    uint16_t *double_pointers = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
+    if(used == NULL || pointers == NULL || double_pointers == NULL || refcounts == NULL)
+    {
+        bitmap_destroy(used);
+        free(pointers);
+        free(double_pointers);
+        if(!clone)
+        {
+            free(refcounts);
+        }
+        return SIZE_MAX;
+    }
+    if(!clone && fs_refcounts(fs, false) != NULL)
+    {
+        memcpy(refcounts, fs_refcounts(fs, false), BLOCK_STORE_NUM_BLOCKS);
+    }
+
+    size_t copies = 0;
+    bool overflow = false;
+    for(size_t i = 0; i < number_inodes && !overflow; i++)
+    {
+        if(!bitmap_test(used, i))
+        {
+            continue;
+        }
+        inode_t *node = inodes + i;
+        if(node->fileType == 'd')
+        {
+            if(node->directPointer[0] != 0)
+            {
+                copies++;
+                if(clone)
+                {
+                    node->directPointer[0] = fs_block_clone(fs, node->directPointer[0], pointers);
+                }
+            }
+            continue;
+        }
+
+        overflow |= !fs_snapshot_share(refcounts, node->directPointer, 6);
+        if(node->indirectPointer[0] != 0)
+        {
+            copies++;
+            fs_block_read(fs, node->indirectPointer[0], pointers);
+            overflow |= !fs_snapshot_share(refcounts, pointers, 2048);
+            if(clone)
+            {
+                node->indirectPointer[0] = fs_block_clone(fs, node->indirectPointer[0], pointers);
+            }
+        }
+        if(node->doubleIndirectPointer != 0)
+        {
+            copies++;
+            fs_block_read(fs, node->doubleIndirectPointer, double_pointers);
+            for(size_t j = 0; j < 2048; j++)
+            {
+                if(double_pointers[j] == 0)
+                {
+                    continue;
+                }
+                copies++;
+                fs_block_read(fs, double_pointers[j], pointers);
+                overflow |= !fs_snapshot_share(refcounts, pointers, 2048);
+                if(clone)
+                {
+                    double_pointers[j] = fs_block_clone(fs, double_pointers[j], pointers);
+                }
+            }
+            if(clone)
+            {
+                size_t clone_id = fs_block_allocate(fs);
+                fs_block_write(fs, clone_id, double_pointers);
+                node->doubleIndirectPointer = clone_id;
+            }
+        }
+    }
+    bitmap_destroy(used);
+    free(pointers);
+    free(double_pointers);
+    if(!clone)
+    {
+        free(refcounts);
+    }
+    return overflow ? SIZE_MAX : copies;
+}
+
+///
+/// Takes a named, read-only snapshot of the whole FS
+///   Only metadata is copied (inode table, directory and pointer blocks);
+///   data blocks are shared with the live FS and copied on write by fs_write
+/// \param fs The FS to snapshot
+/// \param name Name of the snapshot, unique within the FS
+/// \return 0 on success, < 0 on failure
+///
+int fs_snapshot(FS_t *fs, const char *name)
+{
+    FS_CALL_TIMER(fs, FS_CALL_SNAPSHOT);
+    if(fs == NULL || fs->readonly || name == NULL || strlen(name) == 0 || strlen(name) >= FS_SNAPSHOT_NAME_MAX
+            || fs_snapshot_find(fs, name) != NULL)
+    {
+        return -1;
+    }
+    fs_delalloc_flush(fs, DELALLOC_ALL, NULL);	// the snapshot shares blocks, buffered data has none yet
+    fs_defrag_finish(fs);	// nor does the unfilled part of a defrag run
+
+    // the inode bitmap block and the inode table, as they are right now
+    uint8_t *meta = (uint8_t *)calloc(SNAPSHOT_META_BLOCKS, BLOCK_SIZE_BYTES);
+    if(meta == NULL)
+    {
+        return -1;
+    }
+    for(size_t i = 0; i < FS_META_BLOCKS; i++)
+    {
+        fs_block_read(fs, i, meta + i * BLOCK_SIZE_BYTES);
+    }
+    uint8_t *inline_area = fs_inline_data(fs, 0, false);
+    if(inline_area != NULL)
+    {
+        memcpy(meta + FS_META_BLOCKS * BLOCK_SIZE_BYTES, inline_area, INLINE_BLOCKS * BLOCK_SIZE_BYTES);
+    }
+
+    // work out the cost first, so we never stop half way through
+    size_t needed = fs_snapshot_walk(fs, meta, false);
+    superblock_t *super = fs_superblock(fs);
+    if(needed != SIZE_MAX)
+    {
+        needed += SNAPSHOT_META_BLOCKS + (super->snapshotBlock == 0 ? 1 : 0) + (super->refcountBlock == 0 ? REFCOUNT_BLOCKS : 0);
+    }
+    if(needed == SIZE_MAX || needed > block_store_get_free_blocks(fs->BlockStore_whole))
+    {
+        free(meta);
+        return -1;
+    }
+
+    // set up the tables (the refcount one has to be a single run, so it goes first)
+    size_t meta_block = SIZE_MAX;
+    if(fs_refcounts(fs, true) != NULL)
+    {
+        if(super->snapshotBlock == 0)
+        {
+            size_t table_block = fs_block_allocate(fs);
+            if(table_block != SIZE_MAX)
+            {
+                memset(block_store_Data_location(fs->BlockStore_whole) + table_block * BLOCK_SIZE_BYTES, 0, BLOCK_SIZE_BYTES);
+                super->snapshotBlock = table_block;
+            }
+        }
+        meta_block = super->snapshotBlock == 0 ? SIZE_MAX : fs_allocate_run(fs, SNAPSHOT_META_BLOCKS);
+    }
+    snapshotEntry_t *entry = NULL;
+    snapshotEntry_t *table = fs_snapshot_table(fs);
+    for(size_t i = 0; table != NULL && i < SNAPSHOT_MAX && entry == NULL; i++)
+    {
+        if(table[i].metaBlock == 0)
+        {
+            entry = table + i;
+        }
+    }
+    if(meta_block == SIZE_MAX || entry == NULL)
+    {
+        if(meta_block != SIZE_MAX)
+        {
+            for(size_t i = 0; i < SNAPSHOT_META_BLOCKS; i++)
+            {
+                block_store_release(fs->BlockStore_whole, meta_block + i);
+            }
+        }
+        free(meta);
+        return -1;
+    }
+
+    if(fs_snapshot_walk(fs, meta, true) == SIZE_MAX)
+    {
+        // out of memory before it touched anything, only the metadata run is ours to give back
+        for(size_t i = 0; i < SNAPSHOT_META_BLOCKS; i++)
+        {
+            block_store_release(fs->BlockStore_whole, meta_block + i);
+        }
+        free(meta);
+        return -1;
+    }
+    for(size_t i = 0; i < SNAPSHOT_META_BLOCKS; i++)
+    {
+        fs_block_write(fs, meta_block + i, meta + i * BLOCK_SIZE_BYTES);
+    }
+    memset(entry, 0, sizeof(snapshotEntry_t));
+    strcpy(entry->name, name);
+    entry->metaBlock = meta_block;
+
+    free(meta);
+    return 0;
+}
+
+///
+/// Deletes a snapshot and releases the blocks only it was holding on to
+/// \param fs The FS containing the snapshot
+/// \param name Name of the snapshot
+/// \return 0 on success, < 0 on failure
+///
+int fs_snapshot_delete(FS_t *fs, const char *name)
+{
+    FS_CALL_TIMER(fs, FS_CALL_SNAPSHOT_DELETE);
+    if(fs == NULL || fs->readonly || name == NULL)
+    {
+        return -1;
+    }
+    snapshotEntry_t *entry = fs_snapshot_find(fs, name);
+    if(entry == NULL)
+    {
+        return -1;
+    }
+
+    uint8_t *meta = (uint8_t *)calloc(SNAPSHOT_META_BLOCKS, BLOCK_SIZE_BYTES);
+    bitmap_t *used = meta == NULL ? NULL : bitmap_overlay(number_inodes, meta);
+    if(used == NULL)
+    {
+        free(meta);
+        return -1;
+    }
+    for(size_t i = 0; i < SNAPSHOT_META_BLOCKS; i++)
+    {
+        fs_block_read(fs, entry->metaBlock + i, meta + i * BLOCK_SIZE_BYTES);
+    }
+
+    // the copies of directory and pointer blocks were private, data blocks lose an owner
+    inode_t *inodes = (inode_t *)(meta + BLOCK_SIZE_BYTES);
+    for(size_t i = 0; i < number_inodes; i++)
+    {
+        if(!bitmap_test(used, i))
+        {
+            continue;
+        }
+        inode_t *node = inodes + i;
+        if(node->fileType == 'd')
+        {
+            if(node->directPointer[0] != 0)
+            {
+                block_store_release(fs->BlockStore_whole, node->directPointer[0]);
+            }
+            continue;
+        }
+        fs_release_file_blocks(fs, node);
+    }
+
+    for(size_t i = 0; i < SNAPSHOT_META_BLOCKS; i++)
+    {
+        block_store_release(fs->BlockStore_whole, entry->metaBlock + i);
+    }
+    memset(entry, 0, sizeof(snapshotEntry_t));
+
+    bitmap_destroy(used);
+    free(meta);
+    return 0;
+}
+
+///
+/// Mounts a snapshot of an FS file read-only
+///   Release it with fs_unmount
+/// \param path The FS file to mount
+/// \param name Name of the snapshot
+/// \return Mounted FS object, NULL on error
+///
+FS_t *fs_mount_snapshot(const char *path, const char *name)
+{
+    FS_CALL_TIMER(NULL, FS_CALL_MOUNT_SNAPSHOT);
+    if(path == NULL || strlen(path) == 0 || name == NULL)
+    {
+        return NULL;
+    }
+
+    FS_t * ptr_FS = (FS_t *)calloc(1, sizeof(FS_t));
+    if(ptr_FS == NULL)
+    {
+        return NULL;
+    }
+    ptr_FS->BlockStore_whole = block_store_open(path);
+    if(ptr_FS->BlockStore_whole == NULL)
+    {
+        free(ptr_FS);
+        return NULL;
+    }
+    snapshotEntry_t *entry = fs_snapshot_find(ptr_FS, name);
+    if(entry == NULL)
+    {
+        block_store_destroy(ptr_FS->BlockStore_whole);
+        free(ptr_FS);
+        return NULL;
+    }
+
+    // same as fs_mount, but the inode table is the snapshot's copy of blocks 0-4
+    uint8_t *data = block_store_Data_location(ptr_FS->BlockStore_whole);
+    fs_layout_attach(ptr_FS, fs_superblock_layout(ptr_FS), data + entry->metaBlock * BLOCK_SIZE_BYTES, data + (entry->metaBlock + 1) * BLOCK_SIZE_BYTES);
+    ptr_FS->cache = fs_cache_create();
+    ptr_FS->open = fs_open_table_create();
+    ptr_FS->snapshotMeta = entry->metaBlock;
+    ptr_FS->readonly = true;
+    FS_CALL_TIMER_FOR(ptr_FS);
+    return ptr_FS;
+}
+
+
+
+// Transactions and the journal.
+//  The image file is only brought up to date at fs_unmount, or by fs_txn_commit, which writes
+//  every block changed since the file last matched the mount: the blocks fs_block_write wrote
+//  (the dirty bits below) and all FS metadata, which is written in place and so always goes.
+//  They go to a journal file beside the image first, <image>.journal: a header, the block
+//  numbers and the blocks, with a checksum over all of it. Once the journal is synced the
+//  blocks are written into the image and it is synced; the journal is removed after. A crash
+//  before the journal is complete leaves the image as it was, its checksum fails and fs_mount
+//  drops it. A crash after leaves a whole journal, which fs_mount writes into the image again.
+//  Two syncs per commit, whatever the transaction holds.
+//  Until then a transaction can be undone: the first time fs_block_write changes a block, and
+//  for the metadata at fs_txn_begin, the block's contents are kept; so is which blocks were in
+//  use. fs_txn_abort puts all of it back.
+//  The journal writes blocks at their offset in the image, so it needs an image file of
+//  BLOCK_STORE_NUM_BYTES, which is what the block store serializes to. Any other (no file
+//  yet after fs_format) is written whole, to a new file renamed over it.
+#define JOURNAL_MAGIC 0x314a5346	// "FSJ1"
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_META_MAX (FS_META_BLOCKS + REFCOUNT_BLOCKS + INLINE_BLOCKS + 1 + FS_STORE_BLOCKS + 2)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t count;         // blocks
+    uint64_t check;         // fs_hash_round over every block's number and hash
+} journal_header_t;
+
+// a block as it was before the transaction changed it
+typedef struct
+{
+    size_t block_id;
+    uint8_t data[BLOCK_SIZE_BYTES];
+} journal_undo_t;
+
+struct journal
+{
+    pthread_mutex_t lock;       // fs_read only holds the shared engine lock and its delalloc flush
+                                // reaches fs_block_write, so dirty and undo can change in two threads
+    char *image;
+    uint8_t dirty[BLOCK_STORE_NUM_BLOCKS / 8];  // blocks fs_block_write changed since the image file matched
+    bool active;                // a transaction is open
+    uint8_t saved[BLOCK_STORE_NUM_BLOCKS / 8];  // blocks with their contents in undo
+    dyn_array_t *undo;          // journal_undo_t
+    bitmap_t *allocated;        // blocks in use at fs_txn_begin
+    bool fd_open[number_fd];    // descriptors open at fs_txn_begin
+};
+
+static char *fs_journal_path(const char *image)
+{
+    char *path = (char *)malloc(strlen(image) + sizeof(JOURNAL_SUFFIX));
+    if(path != NULL)
+    {
+        strcpy(path, image);
+        strcat(path, JOURNAL_SUFFIX);
+    }
+    return path;
+}
+
+static struct journal *fs_journal_create(const char *image)
+{
+    struct journal *journal = (struct journal *)calloc(1, sizeof(struct journal));
+    if(journal == NULL)
+    {
+        return NULL;
+    }
+    journal->image = strdup(image);
+    if(journal->image == NULL || pthread_mutex_init(&journal->lock, NULL) != 0)
+    {
+        free(journal->image);
+        free(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+static void fs_journal_end(struct journal *journal)
+{
+    dyn_array_destroy(journal->undo);
+    bitmap_destroy(journal->allocated);
+    journal->undo = NULL;
+    journal->allocated = NULL;
+    memset(journal->saved, 0, sizeof(journal->saved));
+    journal->active = false;
+}
+
+// at fs_unmount, once the image file is written whole
+static void fs_journal_destroy(struct journal *journal)
+{
+    if(journal != NULL)
+    {
+        char *path = fs_journal_path(journal->image);	// a journal a failed commit left is older now
+        if(path != NULL)
+        {
+            unlink(path);
+            free(path);
+        }
+        fs_journal_end(journal);
+        pthread_mutex_destroy(&journal->lock);
+        free(journal->image);
+        free(journal);
+    }
+}
+
+// the FS metadata blocks there are right now, each of which can change without fs_block_write
+// \param store also the blocks the block store keeps for itself, its FBM at the end included
+// \return how many went into blocks, at most JOURNAL_META_MAX
+static size_t fs_journal_meta(FS_t *fs, size_t *blocks, bool store)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < FS_META_BLOCKS; i++)
+    {
+        blocks[count++] = i;
+    }
+    superblock_t *super = fs_superblock(fs);
+    for(size_t i = 0; super->refcountBlock != 0 && i < REFCOUNT_BLOCKS; i++)
+    {
+        blocks[count++] = super->refcountBlock + i;
+    }
+    for(size_t i = 0; super->inlineBlock != 0 && i < INLINE_BLOCKS; i++)
+    {
+        blocks[count++] = super->inlineBlock + i;
+    }
+    if(super->snapshotBlock != 0)
+    {
+        blocks[count++] = super->snapshotBlock;
+    }
+    for(size_t i = 0; store && i < FS_STORE_BLOCKS && super->storeBlocks[i] != 0; i++)
+    {
+        blocks[count++] = super->storeBlocks[i];
+    }
+    for(size_t i = BLOCK_STORE_AVAIL_BLOCKS; store && i < BLOCK_STORE_NUM_BLOCKS; i++)
+    {
+        blocks[count++] = i;
+    }
+    return count;
+}
+
+// keep a block's contents for fs_txn_abort, unless they are kept already. Called with the lock held.
+static void fs_journal_save(FS_t *fs, struct journal *journal, size_t block_id)
+{
+    if(journal->saved[block_id / 8] & (1 << (block_id % 8)))
+    {
+        return;
+    }
+    journal_undo_t *undo = (journal_undo_t *)malloc(sizeof(journal_undo_t));
+    if(undo != NULL)
+    {
+        undo->block_id = block_id;
+        block_store_read(fs->BlockStore_whole, block_id, undo->data);
+        if(dyn_array_push_back(journal->undo, undo))
+        {
+            journal->saved[block_id / 8] |= 1 << (block_id % 8);
+        }
+        free(undo);
+    }
+}
+
+// fs_block_write is about to change block_id
+static void fs_journal_touch(FS_t *fs, size_t block_id)
+{
+    struct journal *journal = fs->journal;
+    if(journal == NULL || block_id >= BLOCK_STORE_NUM_BLOCKS)
+    {
+        return;
+    }
+    __atomic_fetch_or(&journal->dirty[block_id / 8], (uint8_t)(1 << (block_id % 8)), __ATOMIC_RELAXED);
+    if(journal->active)
+    {
+        pthread_mutex_lock(&journal->lock);
+        fs_journal_save(fs, journal, block_id);
+        pthread_mutex_unlock(&journal->lock);
+    }
+}
+
+static bool fs_write_all(int fd, const void *buffer, size_t length, off_t offset)
+{
+    const uint8_t *from = (const uint8_t *)buffer;
+    while(length > 0)
+    {
+        ssize_t wrote = offset < 0 ? write(fd, from, length) : pwrite(fd, from, length, offset);
+        if(wrote <= 0)
+        {
+            return false;
+        }
+        from += wrote;
+        length -= wrote;
+        offset = offset < 0 ? offset : offset + wrote;
+    }
+    return true;
+}
+
+static bool fs_read_all(int fd, void *buffer, size_t length)
+{
+    uint8_t *to = (uint8_t *)buffer;
+    while(length > 0)
+    {
+        ssize_t got = read(fd, to, length);
+        if(got <= 0)
+        {
+            return false;
+        }
+        to += got;
+        length -= got;
+    }
+    return true;
+}
+
+// write count blocks, from data, into the image at their offsets and sync it
+static bool fs_journal_apply(const char *image, const uint32_t *block_ids, const uint8_t *const *data, size_t count)
+{
+    int fd = open(image, O_WRONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+    bool ok = true;
+    for(size_t i = 0; ok && i < count; i++)
+    {
+        ok = fs_write_all(fd, data[i], BLOCK_SIZE_BYTES, (off_t)block_ids[i] * BLOCK_SIZE_BYTES);
+    }
+    ok = fsync(fd) == 0 && ok;
+    close(fd);
+    return ok;
+}
+
+// before the image is opened: a whole journal left by a crash goes into it, a torn one is dropped
+static void fs_journal_replay(const char *image)
+{
+    char *path = fs_journal_path(image);
+    int fd = path == NULL ? -1 : open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        free(path);
+        return;
+    }
+    journal_header_t header;
+    uint32_t *block_ids = NULL;
+    uint8_t *blocks = NULL;
+    uint8_t **data = NULL;
+    bool whole = fs_read_all(fd, &header, sizeof(header)) && header.magic == JOURNAL_MAGIC && header.count <= BLOCK_STORE_NUM_BLOCKS;
+    if(whole)
+    {
+        block_ids = (uint32_t *)malloc(header.count * sizeof(uint32_t));
+        blocks = (uint8_t *)malloc((size_t)header.count * BLOCK_SIZE_BYTES);
+        data = (uint8_t **)malloc(header.count * sizeof(uint8_t *));
+        whole = block_ids != NULL && blocks != NULL && data != NULL
+            && fs_read_all(fd, block_ids, header.count * sizeof(uint32_t))
+            && fs_read_all(fd, blocks, (size_t)header.count * BLOCK_SIZE_BYTES);
+    }
+    close(fd);
+    uint64_t check = 0;
+    for(size_t i = 0; whole && i < header.count; i++)
+    {
+        whole = block_ids[i] < BLOCK_STORE_NUM_BLOCKS;
+        data[i] = blocks + i * BLOCK_SIZE_BYTES;
+        check = fs_hash_round(check, fs_hash_block(data[i]) ^ block_ids[i]);
+    }
+    struct stat st;
+    if(!whole || check != header.check)
+    {
+        unlink(path);   // the commit never got as far as the image
+    }
+    else if(stat(image, &st) == 0 && st.st_size == BLOCK_STORE_NUM_BYTES && fs_journal_apply(image, block_ids, (const uint8_t *const *)data, header.count))
+    {
+        unlink(path);
+    }
+    free(block_ids);
+    free(blocks);
+    free(data);
+    free(path);
+}
+
+// bring the image file up to date with the mount, as described above
+// \return false if it is not (the image file is as it was, or the journal will finish it at fs_mount)
+static bool fs_journal_sync(FS_t *fs)
+{
+    struct journal *journal = fs->journal;
+    uint8_t *store = block_store_Data_location(fs->BlockStore_whole);
+    struct stat st;
+    if(stat(journal->image, &st) != 0 || st.st_size != BLOCK_STORE_NUM_BYTES)
+    {
+        // no image to write blocks into yet, it is written whole and swapped in
+        char *path = fs_journal_path(journal->image);
+        int fd = -1;
+        bool ok = path != NULL && block_store_serialize(fs->BlockStore_whole, path) == BLOCK_STORE_NUM_BYTES
+            && (fd = open(path, O_WRONLY)) >= 0 && fsync(fd) == 0;
+        FS_STAT_ADD(fs, syncs, 1);
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        ok = ok && rename(path, journal->image) == 0;
+        if(!ok && path != NULL)
+        {
+            unlink(path);
+        }
+        free(path);
+        return ok;
+    }
+
+    size_t meta[JOURNAL_META_MAX];
+    size_t meta_count = fs_journal_meta(fs, meta, true);
+    for(size_t i = 0; i < meta_count; i++)
+    {
+        journal->dirty[meta[i] / 8] |= 1 << (meta[i] % 8);
+    }
+    journal_header_t header = {JOURNAL_MAGIC, 0, 0};
+    uint32_t *block_ids = (uint32_t *)malloc(BLOCK_STORE_NUM_BLOCKS * sizeof(uint32_t));
+    const uint8_t **data = (const uint8_t **)malloc(BLOCK_STORE_NUM_BLOCKS * sizeof(uint8_t *));
+    char *path = fs_journal_path(journal->image);
+    int fd = block_ids == NULL || data == NULL || path == NULL ? -1 : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        free(block_ids);
+        free(data);
+        free(path);
+        return false;
+    }
+    for(size_t i = 0; i < BLOCK_STORE_NUM_BLOCKS; i++)
+    {
+        if(journal->dirty[i / 8] & (1 << (i % 8)))
+        {
+            block_ids[header.count] = i;
+            data[header.count] = store + i * BLOCK_SIZE_BYTES;
+            header.check = fs_hash_round(header.check, fs_hash_block(data[header.count]) ^ i);
+            header.count++;
+        }
+    }
+    bool ok = fs_write_all(fd, &header, sizeof(header), -1) && fs_write_all(fd, block_ids, header.count * sizeof(uint32_t), -1);
+    for(size_t i = 0; ok && i < header.count; i++)
+    {
+        ok = fs_write_all(fd, data[i], BLOCK_SIZE_BYTES, -1);
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    FS_STAT_ADD(fs, syncs, 1);
+    if(!ok)
+    {
+        unlink(path);
+    }
+    else if(fs_journal_apply(journal->image, block_ids, data, header.count))
+    {
+        unlink(path);
+        memset(journal->dirty, 0, sizeof(journal->dirty));
+    }
+    // else the journal is down and fs_mount finishes the commit, the dirty bits stay for the next one
+    FS_STAT_ADD(fs, syncs, ok ? 1 : 0);
+    free(block_ids);
+    free(data);
+    free(path);
+    return ok;
+}
+
+///
+/// Starts a transaction: what the calls after it change in the FS is committed together
+///   by fs_txn_commit, or undone by fs_txn_abort. Other users of the mount see the changes as
+///   they are made; the image file sees them all at once or not at all
+///   One transaction at a time per mount; fs_unmount aborts one left open
+/// \param fs The FS
+/// \return 0 on success, < 0 on failure (a transaction is open already, a mounted snapshot)
+///
+int fs_txn_begin(FS_t *fs)
+{
+    FS_CALL_TIMER(fs, FS_CALL_TXN_BEGIN);
+    if(fs == NULL || fs->readonly || fs->journal == NULL || fs->journal->active)
+    {
+        return -1;
+    }
+    struct journal *journal = fs->journal;
+    fs_delalloc_flush(fs, DELALLOC_ALL, NULL);	// buffered appends are from before
+    fs_defrag_finish(fs);
+    journal->undo = dyn_array_create(64, sizeof(journal_undo_t), NULL);
+    journal->allocated = bitmap_create(BLOCK_STORE_NUM_BLOCKS);
+    if(journal->undo == NULL || journal->allocated == NULL)
+    {
+        fs_journal_end(journal);
+        return -1;
+    }
+    for(size_t i = 0; i < BLOCK_STORE_NUM_BLOCKS; i++)
+    {
+        if(block_store_sub_test(fs->BlockStore_whole, i))
+        {
+            bitmap_set(journal->allocated, i);
+        }
+    }
+    for(size_t fd = 0; fd < number_fd; fd++)
+    {
+        journal->fd_open[fd] = fs->layout->fd_test(fs, fd);
+    }
+    size_t meta[JOURNAL_META_MAX];
+    size_t meta_count = fs_journal_meta(fs, meta, false);
+    pthread_mutex_lock(&journal->lock);
+    for(size_t i = 0; i < meta_count; i++)
+    {
+        fs_journal_save(fs, journal, meta[i]);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    if(dyn_array_size(journal->undo) != meta_count)
+    {
+        fs_journal_end(journal);
+        return -1;
+    }
+    journal->active = true;
+    return 0;
+}
+
+///
+/// Commits the open transaction: the image file gets everything changed since it was last
+///   written, through a journal beside it, so a crash leaves it with all of it or none of it
+///   and fs_mount finishes a commit the crash cut short. Two syncs, however much it holds
+/// \param fs The FS
+/// \return 0 on success, < 0 on failure (no open transaction, or writing the image failed;
+///   the transaction is undone then)
+///
+int fs_txn_commit(FS_t *fs)
+{
+    FS_CALL_TIMER(fs, FS_CALL_TXN_COMMIT);
+    if(fs == NULL || fs->journal == NULL || !fs->journal->active)
+    {
+        return -1;
+    }
+    fs_delalloc_flush(fs, DELALLOC_ALL, NULL);
+    fs_defrag_finish(fs);
+    if(!fs_journal_sync(fs))
+    {
+        fs_txn_abort(fs);
+        return -1;
+    }
+    fs_journal_end(fs->journal);
+    return 0;
+}
+
+///
+/// Undoes the open transaction, putting the FS back as it was at fs_txn_begin
+///   Descriptors opened since are closed; descriptors closed since stay closed
+/// \param fs The FS
+/// \return 0 on success, < 0 on failure (no open transaction)
+///
+int fs_txn_abort(FS_t *fs)
+{
+    FS_CALL_TIMER(fs, FS_CALL_TXN_ABORT);
+    if(fs == NULL || fs->journal == NULL || !fs->journal->active)
+    {
+        return -1;
+    }
+    struct journal *journal = fs->journal;
+    fs_delalloc_flush(fs, DELALLOC_ALL, NULL);	// so what it buffered is undone with the rest
+    fs_defrag_finish(fs);
+    for(size_t fd = 0; fd < number_fd; fd++)
+    {
+        if(!journal->fd_open[fd] && fs->layout->fd_test(fs, fd))
+        {
+            fs_open_file_detach(fs, fd);
+            fs->layout->fd_release(fs, fd);
+        }
+    }
+
+    // the blocks, and which of them are in use
+    journal->active = false;
+    for(size_t i = 0; i < dyn_array_size(journal->undo); i++)
+    {
+        const journal_undo_t *undo = (const journal_undo_t *)dyn_array_at(journal->undo, i);
+        block_store_write(fs->BlockStore_whole, undo->block_id, undo->data);
+        fs_open_block_written(fs, undo->block_id, undo->data);
+    }
+    for(size_t i = 0; i < BLOCK_STORE_AVAIL_BLOCKS; i++)
+    {
+        bool was = bitmap_test(journal->allocated, i);
+        if(was != block_store_sub_test(fs->BlockStore_whole, i))
+        {
+            if(was)
+            {
+                block_store_request(fs->BlockStore_whole, i);
+            }
+            else
+            {
+                block_store_release(fs->BlockStore_whole, i);
+            }
+        }
+    }
+
+    // and what is kept of them in memory
+    inode_t node;
+    for(size_t i = 0; i < number_inodes; i++)
+    {
+        fs->layout->inode_read(fs, i, &node);
+        fs_open_inode_written(fs, i, &node);
+    }
+    if(fs->cache != NULL)
+    {
+        pthread_mutex_lock(&fs->cache->lock);
+        for(size_t i = 0; i < GROUP_CACHE_ENTRIES; i++)
+        {
+            fs->cache->entry[i].valid = false;
+        }
+        pthread_mutex_unlock(&fs->cache->lock);
+    }
+    if(fs->dedup != NULL)
+    {
+        fs_dedup_disable(fs);
+        fs_dedup_enable(fs);
+    }
+    fs_journal_end(journal);
+    return 0;
+}
+
+// index every block in list that is not indexed yet
+static void fs_dedup_index_list(FS_t *fs, const uint16_t *block_list, size_t count)
+{
+    const uint8_t *blocks = block_store_Data_location(fs->BlockStore_whole);
+    for(size_t i = 0; i < count; i++)
+    {
+        if(block_list[i] != 0 && !bitmap_test(fs->dedup->indexed, block_list[i]))
+        {
+            fs_dedup_insert(fs->dedup, fs_hash_block(blocks + block_list[i] * BLOCK_SIZE_BYTES), block_list[i]);
+        }
+    }
+}
+
+// index the data blocks of one regular file
+static void fs_dedup_index_file(FS_t *fs, const inode_t *node, uint16_t *pointers, uint16_t *double_pointers)
+{
+    fs_dedup_index_list(fs, node->directPointer, 6);
+    if(node->indirectPointer[0] != 0)
+    {
+        fs_block_read(fs, node->indirectPointer[0], pointers);
+        fs_dedup_index_list(fs, pointers, 2048);
+    }
+    if(node->doubleIndirectPointer != 0)
+    {
+        fs_block_read(fs, node->doubleIndirectPointer, double_pointers);
+        for(size_t i = 0; i < 2048; i++)
+        {
+            if(double_pointers[i] != 0)
+            {
+                fs_block_read(fs, double_pointers[i], pointers);
+                fs_dedup_index_list(fs, pointers, 2048);
+            }
+        }
+    }
+}
+
+static void fs_dedup_free(struct dedup_index *index)
+{
+    if(index != NULL)
+    {
+        bitmap_destroy(index->indexed);
+        free(index);
+    }
+}
+
+///
+/// Turns on block-level deduplication for this mount
+///   Data blocks already in the FS are hashed into an in-memory index (this reads every one of them),
+///   from then on fs_write stores a block whose contents already exist by sharing the existing block
+///   Blocks that already had duplicates are left as they are. The index is not saved in the image,
+///   blocks shared through it stay shared after dedup is turned off or the FS is unmounted
+/// \param fs The FS
+/// \return 0 on success (or if it was already on), < 0 on failure
+///
+int fs_dedup_enable(FS_t *fs)
+{
+    if(fs == NULL || fs->readonly)
+    {
+        return -1;
+    }
+    if(fs->dedup != NULL)
+    {
+        return 0;
+    }
+    fs_delalloc_flush(fs, DELALLOC_ALL, NULL);	// buffered data goes in unindexed blocks
+    struct dedup_index *index = (struct dedup_index *)calloc(1, sizeof(struct dedup_index));
+    uint16_t *pointers = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
+    uint16_t *double_pointers = (uint16_t *)calloc(1, BLOCK_SIZE_BYTES);
+    bitmap_t *used = bitmap_overlay(number_inodes, block_store_Data_location(fs->BlockStore_whole));
+    if(index != NULL)
+    {
+        index->indexed = bitmap_create(BLOCK_STORE_NUM_BLOCKS);
+    }
+    if(index == NULL || index->indexed == NULL || pointers == NULL || double_pointers == NULL || used == NULL)
+    {
+        fs_dedup_free(index);
+        free(pointers);
+        free(double_pointers);
+        bitmap_destroy(used);
+        return -1;
+    }
+
+    fs->dedup = index;
+    inode_t node;
+    for(size_t i = 0; i < number_inodes; i++)
+    {
+        if(bitmap_test(used, i))
+        {
+            fs_inode_read(fs, i, &node);
+            // compressed extents are not block-aligned data, there is nothing to share there
+            if(node.fileType == 'r' && !(node.flags & FS_INODE_COMPRESSED))
+            {
+                fs_dedup_index_file(fs, &node, pointers, double_pointers);
+            }
+        }
+    }
+    free(pointers);
+    free(double_pointers);
+    bitmap_destroy(used);
+    return 0;
+}
+
+///
+/// Turns block-level deduplication off and drops the index
+/// \param fs The FS
+///
+void fs_dedup_disable(FS_t *fs)
+{
+    if(fs != NULL)
+    {
+        fs_dedup_free(fs->dedup);
+        fs->dedup = NULL;
+    }
+}
+
+///
+/// Turns compression on or off for an empty regular file
+///   fs_write stores a compressed file in groups of 8 blocks, each full group compressed into
+///   as few blocks as it takes; fs_read decompresses them through a small cache of recent groups
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param compressed true to compress the file's data, false to store it in plain blocks
+/// \return 0 on success, < 0 on failure (not a regular file, or it already holds data)
+///
+int fs_set_compressed(FS_t *fs, const char *path, bool compressed)
+{
+    FS_CALL_TIMER(fs, FS_CALL_SET_COMPRESSED);
+    if(fs == NULL || fs->readonly || path == NULL)
+    {
+        return -1;
+    }
+    size_t inode_id = fs_path_to_inode(fs, path);
+    if(inode_id == SIZE_MAX)
+    {
+        return -1;
+    }
+    inode_t file_inode;
+    fs_inode_read(fs, inode_id, &file_inode);
+    // switching an existing file over would mean rewriting all of it
+    if(file_inode.fileType != 'r' || file_inode.fileSize != 0)
+    {
+        return -1;
+    }
+    if(compressed)
+    {
+        file_inode.flags |= FS_INODE_COMPRESSED;
+    }
+    else
+    {
+        file_inode.flags &= ~FS_INODE_COMPRESSED;
+    }
+    fs_inode_write(fs, inode_id, &file_inode);
+    return 0;
+}
+
+// One step of a file's layout walk: block is the next data block in file order, 0 for a hole.
+//  movable and movable_extents count the same for the blocks fs_defrag may move (not shared).
+typedef struct
+{
+    fs_frag_t frag;
+    size_t last;
+    size_t movable;
+    size_t movable_extents;
+    size_t movable_last;
+} frag_walk_t;
+
+static void fs_frag_add(FS_t *fs, frag_walk_t *walk, size_t block)
+{
+    if(block == 0)
+    {
+        return;
+    }
+    walk->frag.blocks++;
+    if(walk->last == 0 || block != walk->last + 1)
+    {
+        walk->frag.extents++;
+    }
+    walk->last = block;
+    if(!fs_block_shared(fs, block))
+    {
+        walk->movable++;
+        if(walk->movable_last == 0 || block != walk->movable_last + 1)
+        {
+            walk->movable_extents++;
+        }
+        walk->movable_last = block;
+    }
+}
+
+// walk a regular file's block map, reading every pointer block once
+// \return pointer blocks read
+static size_t fs_frag_walk(FS_t *fs, const inode_t *fileInode, frag_walk_t *walk)
+{
+    memset(walk, 0, sizeof(frag_walk_t));
+    size_t reads = 0;
+    if(!(fileInode->flags & FS_INODE_INLINE))
+    {
+        for(size_t i = 0; i < 6; i++)
+        {
+            fs_frag_add(fs, walk, fileInode->directPointer[i]);
+        }
+        uint16_t pointers[2048];
+        if(fileInode->indirectPointer[0] != 0)
+        {
+            fs_block_read(fs, fileInode->indirectPointer[0], pointers);
+            reads++;
+            for(size_t i = 0; i < 2048; i++)
+            {
+                fs_frag_add(fs, walk, pointers[i]);
+            }
+        }
+        if(fileInode->doubleIndirectPointer != 0)
+        {
+            uint16_t under[2048];
+            fs_block_read(fs, fileInode->doubleIndirectPointer, under);
+            reads++;
+            for(size_t i = 0; i < 2048; i++)
+            {
+                if(under[i] == 0)
+                {
+                    continue;
+                }
+                fs_block_read(fs, under[i], pointers);
+                reads++;
+                for(size_t j = 0; j < 2048; j++)
+                {
+                    fs_frag_add(fs, walk, pointers[j]);
+                }
+            }
+        }
+    }
+    if(walk->frag.blocks > 1)
+    {
+        walk->frag.score = (double)(walk->frag.extents - 1) / (double)(walk->frag.blocks - 1);
+    }
+    return reads;
+}
+
+///
+/// Reports how fragmented a file's data is
+/// \param fs The FS containing the file
+/// \param path Absolute path to the file
+/// \param frag Where to put the report, all zeros for a file with no data blocks
+/// \return 0 on success, < 0 on failure
+///
+int fs_fragmentation(FS_t *fs, const char *path, fs_frag_t *frag)
+{
+    FS_CALL_TIMER(fs, FS_CALL_FRAGMENTATION);
+    if(fs == NULL || path == NULL || frag == NULL)
+    {
+        return -1;
+    }
+    size_t inode_id = fs_path_to_inode(fs, path);
+    if(inode_id == SIZE_MAX)
+    {
+        return -1;
+    }
+    inode_t file_inode;
+    fs_inode_read(fs, inode_id, &file_inode);
+    if(file_inode.fileType != 'r')
+    {
+        return -1;
+    }
+    fs_delalloc_flush(fs, inode_id, NULL);
+    fs_inode_read(fs, inode_id, &file_inode);
+    frag_walk_t walk;
+    fs_frag_walk(fs, &file_inode, &walk);
+    *frag = walk.frag;
+    return 0;
+}
+
+// The file fs_defrag is moving, kept between calls. Its new home is blocks [run, run + blocks),
+//  of which the first done are filled; slot is the next slot of its block map to look at.
+struct defrag
+{
+    size_t next_inode;          // where to look for the next file
+    size_t inodeNum;            // 0 between files
+    size_t run;
+    size_t blocks;
+    size_t done;
+    size_t slot;
+};
+
+// give back the part of the run that was not filled and move on to the next file
+static void fs_defrag_finish(FS_t *fs)
+{
+    struct defrag *defrag = fs->defrag;
+    if(defrag == NULL || defrag->inodeNum == 0)
+    {
+        return;
+    }
+    for(size_t i = defrag->done; i < defrag->blocks; i++)
+    {
+        block_store_release(fs->BlockStore_whole, defrag->run + i);
+    }
+    defrag->inodeNum = 0;
+}
+
+// the pointer block fs_defrag is rewriting, written back once it moves on to another one
+typedef struct
+{
+    size_t block_id;
+    bool dirty;
+    uint16_t pointers[2048];
+} defrag_map_t;
+
+// \return I/O spent
+static size_t fs_defrag_map_flush(FS_t *fs, defrag_map_t *map)
+{
+    if(map->block_id == 0 || !map->dirty)
+    {
+        return 0;
+    }
+    fs_block_write(fs, map->block_id, map->pointers);
+    map->dirty = false;
+    return 1;
+}
+
+// point map at the pointer block of a (usage, order) slot, NULL for a slot in the inode itself
+// \param index set to the slot's entry in the returned array
+// \param spent increased by the blocks read and written
+// \return the entries, NULL if the slot has no pointer block and so no data
+static uint16_t *fs_defrag_map_slot(FS_t *fs, inode_t *fileInode, defrag_map_t *map, uint8_t usage, size_t order, size_t *index, size_t *spent)
+{
+    if(usage == 1)
+    {
+        *index = order;
+        return fileInode->directPointer;
+    }
+    size_t pointer_block = fileInode->indirectPointer[0];
+    *index = order;
+    if(usage == 4)
+    {
+        pointer_block = fileInode->doubleIndirectPointer == 0 ? 0 : fs_pointer_at(fs, fileInode->inodeNumber, OPEN_MAP_DOUBLE, fileInode->doubleIndirectPointer, order / 2048);
+        *index = order % 2048;
+    }
+    if(pointer_block == 0)
+    {
+        return NULL;
+    }
+    if(map->block_id != pointer_block)
+    {
+        *spent += fs_defrag_map_flush(fs, map);
+        fs_block_read(fs, pointer_block, map->pointers);
+        map->block_id = pointer_block;
+        *spent += 1;
+    }
+    return map->pointers;
+}
+
+// pick the next file worth moving and give it a run
+// \return false once every file has been looked at since the last one was picked
+static bool fs_defrag_pick(FS_t *fs, size_t *spent)
+{
+    struct defrag *defrag = fs->defrag;
+    for(size_t looked = 0; looked < number_inodes; looked++)
+    {
+        size_t inode_id = defrag->next_inode;
+        defrag->next_inode = (defrag->next_inode + 1) % number_inodes;
+        if(inode_id == 0 || !fs->layout->inode_test(fs, inode_id))
+        {
+            continue;
+        }
+        inode_t file_inode;
+        fs_inode_read(fs, inode_id, &file_inode);
+        if(file_inode.fileType != 'r')
+        {
+            continue;
+        }
+        fs_delalloc_flush(fs, inode_id, NULL);
+        fs_inode_read(fs, inode_id, &file_inode);
+        frag_walk_t walk;
+        *spent += fs_frag_walk(fs, &file_inode, &walk);
+        if(walk.movable_extents <= 1)
+        {
+            continue;
+        }
+        size_t run = fs_allocate_run_from(fs, walk.movable, 1);
+        if(run == SIZE_MAX)
+        {
+            continue;   // no free run that long, leave the file as it is
+        }
+        defrag->inodeNum = inode_id;
+        defrag->run = run;
+        defrag->blocks = walk.movable;
+        defrag->done = 0;
+        defrag->slot = 0;
+        return true;
+    }
+    return false;
+}
+
+///
+/// Moves file data into contiguous runs, a bounded amount at a time
+/// \param fs The FS
+/// \param budget Block reads and writes this call may spend, the block in progress can take it over by a few
+/// \return Data blocks moved, 0 once no file can be improved, < 0 on failure
+///
+ssize_t fs_defrag(FS_t *fs, size_t budget)
+{
+    FS_CALL_TIMER(fs, FS_CALL_DEFRAG);
+    if(fs == NULL || fs->readonly)
+    {
+        return -1;
+    }
+    if(fs->defrag == NULL)
+    {
+        fs->defrag = (struct defrag *)calloc(1, sizeof(struct defrag));
+        if(fs->defrag == NULL)
+        {
+            return -1;
+        }
+    }
+    struct defrag *defrag = fs->defrag;
+    uint8_t *data = (uint8_t *)malloc(BLOCK_SIZE_BYTES);
+    defrag_map_t *map = (defrag_map_t *)malloc(sizeof(defrag_map_t));
+    if(data == NULL || map == NULL)
+    {
+        free(data);
+        free(map);
+        return -1;
+    }
+    size_t spent = 0;
+    size_t moved = 0;
+    while(spent < budget)
+    {
+        if(defrag->inodeNum == 0 && !fs_defrag_pick(fs, &spent))
+        {
+            break;
+        }
+        // the file may have been written to, removed or even replaced since the last call;
+        // all that matters is that the run is ours and the slots say where the data is now
+        size_t inode_id = defrag->inodeNum;
+        inode_t file_inode;
+        fs_inode_read(fs, inode_id, &file_inode);
+        if(!fs->layout->inode_test(fs, inode_id) || file_inode.fileType != 'r' || (file_inode.flags & FS_INODE_INLINE))
+        {
+            fs_defrag_finish(fs);
+            continue;
+        }
+        fs_delalloc_flush(fs, inode_id, &file_inode);
+        size_t slots = (file_inode.fileSize + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+        bool inode_dirty = false;
+        map->block_id = 0;
+        map->dirty = false;
+        while(spent < budget && defrag->done < defrag->blocks && defrag->slot < slots)
+        {
+            size_t order;
+            size_t index;
+            uint8_t usage = fs_logical_slot(defrag->slot, &order);
+            uint16_t *pointers = fs_defrag_map_slot(fs, &file_inode, map, usage, order, &index, &spent);
+            defrag->slot++;
+            size_t block_id = pointers == NULL ? 0 : pointers[index];
+            if(block_id == 0 || fs_block_shared(fs, block_id))
+            {
+                continue;
+            }
+            size_t target = defrag->run + defrag->done;
+            defrag->done++;
+            if(block_id == target)
+            {
+                continue;   // already where it belongs
+            }
+            fs_block_read(fs, block_id, data);
+            fs_block_write(fs, target, data);
+            spent += 2;
+            pointers[index] = target;
+            if(usage == 1)
+            {
+                inode_dirty = true;
+            }
+            else
+            {
+                map->dirty = true;
+            }
+            fs_block_put(fs, block_id);
+            if(fs->dedup != NULL)
+            {
+                fs_dedup_insert(fs->dedup, fs_hash_block(data), target);
+            }
+            moved++;
+        }
+        spent += fs_defrag_map_flush(fs, map);
+        if(inode_dirty)
+        {
+            fs_inode_write(fs, inode_id, &file_inode);
+        }
+        if(defrag->done == defrag->blocks || defrag->slot >= slots)
+        {
+            fs_defrag_finish(fs);
+        }
+    }
+    free(map);
+    free(data);
+    return moved;
+}
+
+// fs_check sorts every block before looking at any file
+enum
+{
+    CHECK_DATA,     // free, or a directory, pointer or data block
+    CHECK_META,     // FS metadata: blocks 0-4, refcount table, inline area, snapshot table and copies
+    CHECK_STORE,    // the block store's own, not compared with the free block bitmap
+};
+
+// what the block pass found a block needs, applied once all threads are done
+enum
+{
+    CHECK_FIX_NONE,
+    CHECK_FIX_TAKE,
+    CHECK_FIX_RELEASE,
+    CHECK_FIX_REFCOUNT,
+};
+
+// One fs_check. The pointer counts and report are shared by the threads and only ever added to
+// atomically; a thread writes to the FS only for the inodes or blocks of its own work item.
+typedef struct
+{
+    FS_t *fs;
+    bool repair;
+    bool release_leaks;         // the block store's own blocks are known, so a leak really is one
+    uint8_t kind[BLOCK_STORE_NUM_BLOCKS];
+    uint8_t fix[BLOCK_STORE_NUM_BLOCKS];
+    uint32_t data_refs[BLOCK_STORE_NUM_BLOCKS];     // pointers to each block from files, as data
+    uint32_t private_refs[BLOCK_STORE_NUM_BLOCKS];  // as a directory or pointer block
+    uint8_t *refcounts;         // the FS's extra-owner counts, NULL if it has none
+    size_t tables;              // inode tables: the live one, then one per snapshot
+    uint8_t *meta[SNAPSHOT_MAX + 1];    // per table, its inode bitmap block followed by the inode table
+    bitmap_t *used[SNAPSHOT_MAX + 1];
+    uint16_t names[SNAPSHOT_MAX + 1][number_inodes];    // directory entries naming each inode
+    size_t threads;
+    size_t items;
+    size_t next;                // next work item, taken atomically
+    fs_check_t report;
+} check_run_t;
+
+#define CHECK_ADD(run, field, n) __atomic_fetch_add(&(run)->report.field, (n), __ATOMIC_RELAXED)
+
+// one more pointer to block (delta -1: one less, for a file being freed)
+// \return false if block cannot be a directory, pointer or data block
+static bool fs_check_pointer(check_run_t *run, size_t block, bool data, int delta)
+{
+    if(block >= BLOCK_STORE_AVAIL_BLOCKS || run->kind[block] != CHECK_DATA)
+    {
+        return false;
+    }
+    __atomic_fetch_add(data ? run->data_refs + block : run->private_refs + block, delta, __ATOMIC_RELAXED);
+    return true;
+}
+
+// count the data pointers of a pointer block, zeroing the bad ones when fixing
+// \return whether any pointer was zeroed
+static bool fs_check_pointers(check_run_t *run, uint16_t *pointers, bool fix, int delta)
+{
+    bool zeroed = false;
+    for(size_t i = 0; i < 2048; i++)
+    {
+        if(pointers[i] != 0 && !fs_check_pointer(run, pointers[i], true, delta) && delta > 0)
+        {
+            CHECK_ADD(run, bad_pointers, 1);
+            if(fix)
+            {
+                pointers[i] = 0;
+                zeroed = true;
+                CHECK_ADD(run, repaired, 1);
+            }
+        }
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    return zeroed;
+}
+
+// Count every block an inode reaches and the names its directory entries give other inodes,
+// zeroing bad pointers and dropping bad entries when fixing. With delta -1 the inode is being
+// freed and only takes back what an earlier pass counted for it.
+static void fs_check_inode(check_run_t *run, size_t table, size_t inode_id, int delta)
+{
+    FS_t *fs = run->fs;
+    inode_t node;
+    memcpy(&node, run->meta[table] + BLOCK_SIZE_BYTES + inode_id * inode_size, sizeof(inode_t));
+    bool fix = run->repair && table == 0 && delta > 0;
+    bool count = delta > 0;
+    bool dirty = false;
+    size_t fixed = 0;
+    uint16_t *pointers = (uint16_t *)malloc(sizeof(dir_block_t));    // a directory's records use it too
+    uint16_t *under = (uint16_t *)malloc(BLOCK_SIZE_BYTES);
+    if(pointers == NULL || under == NULL)
+    {
+        free(pointers);
+        free(under);
+        return;
     }
-    free(dst_tokens);
-    return -1;
+    if(count)
+    {
+        CHECK_ADD(run, inodes, 1);
     }
+
+    if(node.fileType == 'd')
+    {
+        if(node.directPointer[0] != 0 && !fs_check_pointer(run, node.directPointer[0], false, delta) && count)
+        {
+            CHECK_ADD(run, bad_pointers, 1);
+            if(fix)
+            {
+                node.directPointer[0] = 0;
+                dirty = true;
+                fixed++;
+            }
+        }
+        size_t entries = (node.flags & FS_INODE_DIRENTS) ? node.vacantFile : (size_t)__builtin_popcount(node.vacantFile);
+        dir_block_t *dir = (dir_block_t *)pointers;
+        if(node.directPointer[0] == 0 || node.directPointer[0] >= BLOCK_STORE_AVAIL_BLOCKS || run->kind[node.directPointer[0]] != CHECK_DATA)
+        {
+            // entries with nowhere to be
+            if(entries != 0 && count)
+            {
+                CHECK_ADD(run, bad_entries, entries);
+                if(fix)
+                {
+                    node.vacantFile = 0;
+                    node.fileSize = 0;
+                    dirty = true;
+                    fixed += entries;
+                }
+            }
+        }
+        else
+        {
+            // every record must lie within the bytes the directory says it uses, name an inode in
+            // use, and together they must come to its count
+            fs_dir_load(fs, &node, dir);
+            bool dir_dirty = false;
+            size_t records = 0;
+            size_t offset = 0;
+            while(offset < dir->used)
+            {
+                if(offset + DIRENT_HEADER > dir->used || fs_dirent_next(dir, offset) > dir->used)
+                {
+                    // nothing after this can be made sense of
+                    if(count)
+                    {
+                        CHECK_ADD(run, bad_entries, 1);
+                    }
+                    if(fix)
+                    {
+                        dir->used = offset;
+                        dir_dirty = true;
+                        fixed++;
+                    }
+                    break;
+                }
+                size_t length;
+                const char *name = fs_dirent_name(dir, offset, &length);
+                size_t member = fs_dirent_inode(dir, offset);
+                if(length != 0 && memchr(name, '\0', length) == NULL && memchr(name, '/', length) == NULL
+                        && member < number_inodes && bitmap_test(run->used[table], member))
+                {
+                    __atomic_fetch_add(&run->names[table][member], delta, __ATOMIC_RELAXED);
+                }
+                else
+                {
+                    if(count)
+                    {
+                        CHECK_ADD(run, bad_entries, 1);
+                    }
+                    if(fix)
+                    {
+                        fs_dir_remove(dir, offset);
+                        dir_dirty = true;
+                        fixed++;
+                        continue;
+                    }
+                }
+                records++;
+                offset = fs_dirent_next(dir, offset);
+            }
+            if(records != dir->count && count)
+            {
+                CHECK_ADD(run, bad_entries, 1);
+                if(fix)
+                {
+                    dir->count = records;
+                    dir_dirty = true;
+                    fixed++;
+                }
+            }
+            if(dir_dirty)
+            {
+                fs_dir_store(fs, inode_id, &node, dir);
+            }
+        }
     }
-    // Find free slot in parent directory
-    int free_slot = -1;
-    for (int i = 0; i < folder_number_entries; i++) {
-    if (!((dst_parent_inode.vacantFile >> i) & 1)) {
-    free_slot = i;
-    break;
+    else
+    {
+        for(size_t i = 0; i < 6; i++)
+        {
+            if(node.directPointer[i] != 0 && !fs_check_pointer(run, node.directPointer[i], true, delta) && count)
+            {
+                CHECK_ADD(run, bad_pointers, 1);
+                if(fix)
+                {
+                    node.directPointer[i] = 0;
+                    dirty = true;
+                    fixed++;
+                }
+            }
+        }
+        if(node.indirectPointer[0] != 0)
+        {
+            if(fs_check_pointer(run, node.indirectPointer[0], false, delta))
+            {
+                fs_block_read(fs, node.indirectPointer[0], pointers);
+                if(fs_check_pointers(run, pointers, fix, delta))
+                {
+                    fs_block_write(fs, node.indirectPointer[0], pointers);
+                }
+            }
+            else if(count)
+            {
+                CHECK_ADD(run, bad_pointers, 1);
+                if(fix)
+                {
+                    node.indirectPointer[0] = 0;
+                    dirty = true;
+                    fixed++;
+                }
+            }
+        }
+        if(node.doubleIndirectPointer != 0)
+        {
+            if(fs_check_pointer(run, node.doubleIndirectPointer, false, delta))
+            {
+                fs_block_read(fs, node.doubleIndirectPointer, under);
+                bool under_dirty = false;
+                for(size_t i = 0; i < 2048; i++)
+                {
+                    if(under[i] == 0)
+                    {
+                        continue;
+                    }
+                    if(!fs_check_pointer(run, under[i], false, delta))
+                    {
+                        if(count)
+                        {
+                            CHECK_ADD(run, bad_pointers, 1);
+                            if(fix)
+                            {
+                                under[i] = 0;
+                                under_dirty = true;
+                                fixed++;
+                            }
+                        }
+                        continue;
+                    }
+                    fs_block_read(fs, under[i], pointers);
+                    if(fs_check_pointers(run, pointers, fix, delta))
+                    {
+                        fs_block_write(fs, under[i], pointers);
+                    }
+                }
+                if(under_dirty)
+                {
+                    fs_block_write(fs, node.doubleIndirectPointer, under);
+                }
+            }
+            else if(count)
+            {
+                CHECK_ADD(run, bad_pointers, 1);
+                if(fix)
+                {
+                    node.doubleIndirectPointer = 0;
+                    dirty = true;
+                    fixed++;
+                }
+            }
+        }
     }
+
+    if(dirty)
+    {
+        fs_inode_write(fs, inode_id, &node);
     }
-    // If no free slot, dir is full
-    if (free_slot == -1) {
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    if(fixed != 0)
+    {
+        CHECK_ADD(run, repaired, fixed);
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    free(pointers);
+    free(under);
+}
+
+// work items of the inode pass: each table cut into run->threads ranges of inodes
+static void *fs_check_inodes_work(void *arg)
+{
+    check_run_t *run = (check_run_t *)arg;
+    size_t per_item = (number_inodes + run->threads - 1) / run->threads;
+    for(size_t item; (item = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->items;)
+    {
+        size_t table = item / run->threads;
+        size_t first = (item % run->threads) * per_item;
+        for(size_t i = first; i < first + per_item && i < number_inodes; i++)
+        {
+            if(bitmap_test(run->used[table], i))
+            {
+                fs_check_inode(run, table, i, 1);
+            }
+        }
     }
-    free(dst_tokens);
-    return -1;
+    return NULL;
+}
+
+// work items of the block pass: run->threads ranges of blocks, compared with the free block bitmap
+static void *fs_check_blocks_work(void *arg)
+{
+    check_run_t *run = (check_run_t *)arg;
+    size_t per_item = (BLOCK_STORE_AVAIL_BLOCKS + run->items - 1) / run->items;
+    for(size_t item; (item = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->items;)
+    {
+        size_t end = (item + 1) * per_item < BLOCK_STORE_AVAIL_BLOCKS ? (item + 1) * per_item : BLOCK_STORE_AVAIL_BLOCKS;
+        for(size_t b = item * per_item; b < end; b++)
+        {
+            bool taken = block_store_sub_test(run->fs->BlockStore_whole, b);
+            uint32_t data = run->data_refs[b];
+            uint32_t private = run->private_refs[b];
+            uint8_t extra = run->refcounts == NULL ? 0 : run->refcounts[b];
+            if(run->kind[b] == CHECK_STORE)
+            {
+                continue;
+            }
+            if(run->kind[b] == CHECK_META || data + private > 0)
+            {
+                CHECK_ADD(run, blocks, 1);
+                if(!taken)
+                {
+                    CHECK_ADD(run, unmarked, 1);
+                    run->fix[b] = CHECK_FIX_TAKE;
+                }
+                if(private > 1 || (private > 0 && data > 0))
+                {
+                    CHECK_ADD(run, cross_links, 1);
+                }
+                else if(data > 0 && extra != (data - 1 < REFCOUNT_MAX ? data - 1 : REFCOUNT_MAX))
+                {
+                    CHECK_ADD(run, refcounts, 1);
+                    if(run->fix[b] == CHECK_FIX_NONE)
+                    {
+                        run->fix[b] = CHECK_FIX_REFCOUNT;
+                    }
+                }
+                continue;
+            }
+            if(taken)
+            {
+                CHECK_ADD(run, leaked, 1);
+                run->fix[b] = run->release_leaks ? CHECK_FIX_RELEASE : CHECK_FIX_NONE;
+            }
+            else if(extra != 0)
+            {
+                CHECK_ADD(run, refcounts, 1);
+                run->fix[b] = CHECK_FIX_REFCOUNT;
+            }
+        }
     }
-    // Alloc data block for parent dir if needed
-    if (dst_parent_inode.directPointer[0] == 0) {
-    size_t block_id = block_store_allocate(fs->BlockStore_whole);
-    if (block_id >= BLOCK_STORE_AVAIL_BLOCKS) {
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    return NULL;
+}
+
+// run work on run->items items with run->threads threads, the caller being one of them
+static void fs_check_parallel(check_run_t *run, size_t items, void *(*work)(void *))
+{
+    pthread_t threads[64];
+    size_t started = 0;
+    run->items = items;
+    run->next = 0;
+    while(started + 1 < run->threads && pthread_create(threads + started, NULL, work, run) == 0)
+    {
+        started++;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    work(run);  // if a thread did not start, the others take its share
+    for(size_t i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
     }
-    free(dst_tokens);
-    return -1;
+}
+
+// mark blocks [first, first + n) as kind, \return false if they are not all in the data area
+static bool fs_check_mark(check_run_t *run, size_t first, size_t n, uint8_t kind)
+{
+    if(first == 0 || first + n > BLOCK_STORE_AVAIL_BLOCKS)
+    {
+        return false;
     }
-    dst_parent_inode.directPointer[0] = block_id;
-    // init directory data
-    memset(dir_data, 0, BLOCK_SIZE_BYTES);
+    memset(run->kind + first, kind, n);
+    return true;
+}
+
+///
+/// Checks that an FS is consistent, and optionally repairs it
+/// \param fs The FS
+/// \param threads Threads to check with, 0 for one per online CPU
+/// \param repair Fix what can be fixed
+/// \param report Where to put what was found, may be NULL
+/// \return Problems found (0 for a consistent FS), < 0 on failure
+///
+ssize_t fs_check(FS_t *fs, size_t threads, bool repair, fs_check_t *report)
+{
+    FS_CALL_TIMER(fs, FS_CALL_CHECK);
+    if(fs == NULL || (repair && fs->readonly))
+    {
+        return -1;
     }
-    // Step 6: Check Link Count and Create Link
-    if (src_inode.linkCount >= 255) {
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    check_run_t *run = (check_run_t *)calloc(1, sizeof(check_run_t));
+    if(run == NULL)
+    {
+        return -1;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+    if(threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
     }
-    free(dst_tokens);
-    return -1;
+    run->threads = threads < 64 ? threads : 64;
+    run->fs = fs;
+    run->repair = repair;
+
+    // everything on its way to the store is put there first, as fs_unmount would
+    if(!fs->readonly)
+    {
+        fs_delalloc_flush(fs, DELALLOC_ALL, NULL);
+        fs_defrag_finish(fs);
+    }
+
+    // FS metadata first, then what the superblock and snapshot table say is theirs
+    uint8_t *data = block_store_Data_location(fs->BlockStore_whole);
+    const superblock_t *super = (const superblock_t *)(data + FS_SUPER_OFFSET);
+    memset(run->kind, CHECK_META, FS_META_BLOCKS);
+    memset(run->kind + BLOCK_STORE_AVAIL_BLOCKS, CHECK_STORE, BLOCK_STORE_NUM_BLOCKS - BLOCK_STORE_AVAIL_BLOCKS);
+    run->meta[0] = data;
+    run->tables = 1;
+    if(super->magic == FS_SUPER_MAGIC)
+    {
+        run->release_leaks = super->storeRecorded == 1;
+        for(size_t i = 0; i < FS_STORE_BLOCKS && super->storeBlocks[i] != 0; i++)
+        {
+            fs_check_mark(run, super->storeBlocks[i], 1, CHECK_STORE);
+        }
+        if(super->refcountBlock != 0 && fs_check_mark(run, super->refcountBlock, REFCOUNT_BLOCKS, CHECK_META))
+        {
+            run->refcounts = data + super->refcountBlock * BLOCK_SIZE_BYTES;
+        }
+        if(super->inlineBlock != 0)
+        {
+            fs_check_mark(run, super->inlineBlock, INLINE_BLOCKS, CHECK_META);
+        }
+        if(super->snapshotBlock != 0 && fs_check_mark(run, super->snapshotBlock, 1, CHECK_META))
+        {
+            const snapshotEntry_t *table = (const snapshotEntry_t *)(data + super->snapshotBlock * BLOCK_SIZE_BYTES);
+            for(size_t i = 0; i < SNAPSHOT_MAX; i++)
+            {
+                if(table[i].metaBlock != 0 && fs_check_mark(run, table[i].metaBlock, SNAPSHOT_META_BLOCKS, CHECK_META))
+                {
+                    run->meta[run->tables++] = data + table[i].metaBlock * BLOCK_SIZE_BYTES;
+                }
+            }
+        }
     }
-    // Increment link count in source inode
-    src_inode.linkCount++;
-    block_store_inode_write(fs->BlockStore_inode, src_inode_id, &src_inode);
-    // Create directory entry for the new link
-    strcpy((dir_data + free_slot)->filename, *(dst_tokens + dst_count - 1));
-    (dir_data + free_slot)->inodeNumber = src_inode_id;
-    // Update parent directory bitmap and write back to block store
-    dst_parent_inode.vacantFile |= (1 << free_slot);
-    block_store_inode_write(fs->BlockStore_inode, dst_parent_inode_id, &dst_parent_inode);
-    block_store_write(fs->BlockStore_whole, dst_parent_inode.directPointer[0], dir_data);
-    // Free the memory, oy vey, this function was totally so fun ;(
-    free(dir_data);
-    for (size_t j = 0; j < src_count; j++) {
-    free(*(src_tokens + j));
+    bool failed = false;
+    for(size_t t = 0; t < run->tables; t++)
+    {
+        run->used[t] = bitmap_overlay(number_inodes, run->meta[t]);
+        failed |= run->used[t] == NULL;
     }
-    free(src_tokens);
-    for (size_t j = 0; j < dst_count; j++) {
-    free(*(dst_tokens + j));
+
+    if(!failed)
+    {
+        fs_check_parallel(run, run->tables * run->threads, fs_check_inodes_work);
+
+        // every name is counted now: link counts and orphans, snapshots included
+        for(size_t t = 0; t < run->tables; t++)
+        {
+            for(size_t i = 1; i < number_inodes; i++)
+            {
+                if(!bitmap_test(run->used[t], i))
+                {
+                    continue;
+                }
+                inode_t node;
+                memcpy(&node, run->meta[t] + BLOCK_SIZE_BYTES + i * inode_size, sizeof(inode_t));
+                if(run->names[t][i] == 0)
+                {
+                    run->report.orphans++;
+                    // a directory with entries would orphan them in turn, and without a way to
+                    // release leaks the file's blocks would stay taken forever
+                    if(t == 0 && repair && run->release_leaks && (node.fileType != 'd' || node.vacantFile == 0))
+                    {
+                        fs_check_inode(run, t, i, -1);
+                        fs_open_file_close_all(fs, i);
+                        fs->layout->inode_release(fs, i);
+                        run->report.repaired++;
+                    }
+                }
+                else if(node.linkCount != run->names[t][i])
+                {
+                    run->report.link_counts++;
+                    if(t == 0 && repair)
+                    {
+                        node.linkCount = run->names[t][i];
+                        fs_inode_write(fs, i, &node);
+                        run->report.repaired++;
+                    }
+                }
+            }
+        }
+
+        fs_check_parallel(run, run->threads, fs_check_blocks_work);
+        for(size_t b = 0; repair && b < BLOCK_STORE_AVAIL_BLOCKS; b++)
+        {
+            switch(run->fix[b])
+            {
+            case CHECK_FIX_TAKE:
+                block_store_request(fs->BlockStore_whole, b);
+                run->report.repaired++;
+                break;
+            case CHECK_FIX_RELEASE:
+                block_store_release(fs->BlockStore_whole, b);
+                if(run->refcounts != NULL)
+                {
+                    run->refcounts[b] = 0;
+                }
+                run->report.repaired++;
+                break;
+            case CHECK_FIX_REFCOUNT:
+                // with no table to fix, a shared block stays unfixed
+                if(run->refcounts != NULL)
+                {
+                    uint32_t owners = run->data_refs[b];
+                    run->refcounts[b] = owners == 0 ? 0 : (owners - 1 < REFCOUNT_MAX ? owners - 1 : REFCOUNT_MAX);
+                    run->report.repaired++;
+                }
+                break;
+            default:
+                break;
+            }
+        }
     }
-    free(dst_tokens);
+
+    for(size_t t = 0; t < run->tables; t++)
+    {
+        bitmap_destroy(run->used[t]);
+    }
+    const fs_check_t *found = &run->report;
+    ssize_t problems = found->bad_pointers + found->cross_links + found->bad_entries + found->link_counts + found->orphans + found->unmarked + found->leaked + found->refcounts;
+    if(report != NULL)
+    {
+        *report = run->report;
+    }
+    free(run);
+    return failed ? -1 : problems;
+}
+
+///
+/// Copies the counters of a mount
+///   They only ever grow, take the difference of two calls to measure something.
+///   fs_format, fs_mount and fs_mount_snapshot count on the FS they return, fs_unmount is not counted.
+///   A library built with FS_NO_STATS keeps no counters at all and always fails here
+/// \param fs The FS
+/// \param stats Where to copy them
+/// \return 0 on success, < 0 on failure
+///
+int fs_get_stats(FS_t *fs, fs_stats_t *stats)
+{
+#ifndef FS_NO_STATS
+    if(fs == NULL || stats == NULL)
+    {
+        return -1;
+    }
+    // one counter at a time, calls running alongside can make the copy a little inconsistent
+    for(size_t i = 0; i < FS_CALL_COUNT; i++)
+    {
+        stats->call[i].calls = __atomic_load_n(&fs->stats.call[i].calls, __ATOMIC_RELAXED);
+        stats->call[i].ns = __atomic_load_n(&fs->stats.call[i].ns, __ATOMIC_RELAXED);
+    }
+    stats->block_reads = __atomic_load_n(&fs->stats.block_reads, __ATOMIC_RELAXED);
+    stats->block_writes = __atomic_load_n(&fs->stats.block_writes, __ATOMIC_RELAXED);
+    stats->inode_reads = __atomic_load_n(&fs->stats.inode_reads, __ATOMIC_RELAXED);
+    stats->inode_writes = __atomic_load_n(&fs->stats.inode_writes, __ATOMIC_RELAXED);
+    stats->bitmap_scans = __atomic_load_n(&fs->stats.bitmap_scans, __ATOMIC_RELAXED);
+    stats->cache_hits = __atomic_load_n(&fs->stats.cache_hits, __ATOMIC_RELAXED);
+    stats->cache_misses = __atomic_load_n(&fs->stats.cache_misses, __ATOMIC_RELAXED);
+    stats->syncs = __atomic_load_n(&fs->stats.syncs, __ATOMIC_RELAXED);
     return 0;
-    }
\ No newline at end of file
+#else
+    UNUSED(fs);
+    UNUSED(stats);
+    return -1;
+#endif
+}
+
+///
+/// Names an fs_call_t for reports
+/// \param op The call
+/// \return Its fs_* name without the prefix ("create", "read", ...), "?" if op is out of range
+///
+const char *fs_call_name(fs_call_t op)
+{
+    static const char *const names[FS_CALL_COUNT] = {
+        "format", "mount", "mount_snapshot", "create", "open", "close", "seek",
+        "read", "write", "remove", "get_dir", "move", "link", "create_batch",
+        "remove_batch", "snapshot", "snapshot_delete", "set_compressed",
+        "fragmentation", "defrag", "check", "opendir", "walk", "stat", "fstat", "chmod",
+        "mmap", "txn_begin", "txn_commit", "txn_abort",
+    };
+    return (int)op >= 0 && op < FS_CALL_COUNT ? names[op] : "?";
+}
@@ -0,0 +1,417 @@
+#include <pthread.h>
+
+#include "FS.h"
+#include "FS_async.h"
+
+// never merge more than this into one fs_read/fs_write call
+#define RING_MAX_MERGE_BYTES (256 * BLOCK_SIZE_BYTES)
+
+struct fs_ring
+{
+    FS_t *fs;
+
+    pthread_mutex_t lock;       // guards everything below
+    pthread_cond_t work_cv;     // workers wait here for something runnable
+    pthread_cond_t done_cv;     // fs_reap waits here for completions
+
+    // FS.c is not thread safe. Reads only touch their own descriptor slot, and requests
+    // on one descriptor never run concurrently, so reads share the engine; everything else owns it.
+    pthread_rwlock_t engine;
+
+    fs_sqe_t *pending;          // queued requests in submission order
+    size_t pending_count;
+
+    fs_cqe_t *done;             // completion ring buffer
+    size_t done_head;
+    size_t done_count;
+
+    size_t capacity;            // max in flight
+    size_t in_flight;           // pending + running + unreaped
+
+    bool busy_fd[number_fd];    // a request on this descriptor is running
+    bool stop;
+
+    pthread_t *workers;
+    size_t worker_count;
+};
+
+
+// a request can start if nothing else on its descriptor is running.
+// Scanning in submission order, the first hit for a descriptor is also its oldest request.
+static bool ring_runnable(const fs_ring_t *ring, const fs_sqe_t *sqe)
+{
+    if(sqe->op == FS_OP_OPEN || sqe->fd < 0 || sqe->fd >= number_fd)
+    {
+        return true;    // no descriptor to serialize on (bad ones fail inside the engine)
+    }
+    return !ring->busy_fd[sqe->fd];
+}
+
+static bool ring_has_fd(const fs_sqe_t *sqe)
+{
+    return sqe->op != FS_OP_OPEN && sqe->fd >= 0 && sqe->fd < number_fd;
+}
+
+// can next be folded into the transfer that currently ends with prev?
+static bool ring_mergeable(const fs_sqe_t *prev, const fs_sqe_t *next, size_t merged_bytes)
+{
+    if(next->op != prev->op || next->fd != prev->fd || merged_bytes + next->nbyte > RING_MAX_MERGE_BYTES)
+    {
+        return false;
+    }
+    if(prev->offset < 0 && next->offset < 0)
+    {
+        return true;    // both ride the cursor, so they are back-to-back by definition
+    }
+    return prev->offset >= 0 && next->offset == prev->offset + (off_t)prev->nbyte;
+}
+
+// pull the oldest runnable request plus whatever follows it contiguously on the same descriptor.
+// Called with ring->lock held. Returns the number of entries copied into batch (0 if nothing runnable).
+static size_t ring_take(fs_ring_t *ring, fs_sqe_t *batch)
+{
+    size_t first = 0;
+    for( ; first < ring->pending_count; first++)
+    {
+        if(ring_runnable(ring, &ring->pending[first]))
+        {
+            break;
+        }
+    }
+    if(first == ring->pending_count)
+    {
+        return 0;
+    }
+
+    batch[0] = ring->pending[first];
+    size_t taken = 1;
+    size_t merged_bytes = batch[0].nbyte;
+
+    // mark which pending entries leave the queue, then compact it
+    bool *take = (bool *)calloc(ring->pending_count, sizeof(bool));
+    if(take == NULL)
+    {
+        memmove(ring->pending + first, ring->pending + first + 1, (ring->pending_count - first - 1) * sizeof(fs_sqe_t));
+        ring->pending_count--;
+        return 1;
+    }
+    take[first] = true;
+
+    if((batch[0].op == FS_OP_READ || batch[0].op == FS_OP_WRITE) && ring_has_fd(&batch[0]))
+    {
+        for(size_t i = first + 1; i < ring->pending_count; i++)
+        {
+            const fs_sqe_t *next = &ring->pending[i];
+            if(!ring_has_fd(next) || next->fd != batch[0].fd)
+            {
+                continue;   // someone else's request, may run on another worker
+            }
+            if(!ring_mergeable(&batch[taken - 1], next, merged_bytes))
+            {
+                break;      // keep per-descriptor order
+            }
+            batch[taken++] = *next;
+            merged_bytes += next->nbyte;
+            take[i] = true;
+        }
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < ring->pending_count; i++)
+    {
+        if(!take[i])
+        {
+            ring->pending[kept++] = ring->pending[i];
+        }
+    }
+    ring->pending_count = kept;
+    free(take);
+    return taken;
+}
+
+// run a READ/WRITE batch as a single engine call and split the byte count back out
+static void ring_transfer(fs_ring_t *ring, const fs_sqe_t *batch, size_t count, ssize_t *results)
+{
+    bool is_read = batch[0].op == FS_OP_READ;
+    size_t total = 0;
+    bool contiguous = true;     // the callers' buffers already sit back to back
+    for(size_t i = 0; i < count; i++)
+    {
+        if(i > 0 && (uint8_t *)batch[i].buf != (uint8_t *)batch[i - 1].buf + batch[i - 1].nbyte)
+        {
+            contiguous = false;
+        }
+        total += batch[i].nbyte;
+    }
+
+    uint8_t *buffer = (uint8_t *)batch[0].buf;
+    if(!contiguous)
+    {
+        buffer = (uint8_t *)malloc(total);
+        if(buffer == NULL)
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                results[i] = -1;
+            }
+            return;
+        }
+        if(!is_read)
+        {
+            size_t at = 0;
+            for(size_t i = 0; i < count; i++)
+            {
+                memcpy(buffer + at, batch[i].buf, batch[i].nbyte);
+                at += batch[i].nbyte;
+            }
+        }
+    }
+
+    ssize_t done = 0;
+    if(is_read)
+    {
+        pthread_rwlock_rdlock(&ring->engine);
+    }
+    else
+    {
+        pthread_rwlock_wrlock(&ring->engine);
+    }
+    if(batch[0].offset >= 0 && fs_seek(ring->fs, batch[0].fd, batch[0].offset, FS_SEEK_SET) < 0)
+    {
+        done = -1;
+    }
+    else if(is_read)
+    {
+        done = fs_read(ring->fs, batch[0].fd, buffer, total);
+    }
+    else
+    {
+        done = fs_write(ring->fs, batch[0].fd, buffer, total);
+    }
+    pthread_rwlock_unlock(&ring->engine);
+
+    // hand each request its share; a short transfer starves the later ones
+    size_t left = done < 0 ? 0 : (size_t)done;
+    size_t at = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        size_t mine = left < batch[i].nbyte ? left : batch[i].nbyte;
+        results[i] = done < 0 ? -1 : (ssize_t)mine;
+        if(is_read && !contiguous)
+        {
+            memcpy(batch[i].buf, buffer + at, mine);
+        }
+        left -= mine;
+        at += batch[i].nbyte;
+    }
+
+    if(!contiguous)
+    {
+        free(buffer);
+    }
+}
+
+static void ring_execute(fs_ring_t *ring, const fs_sqe_t *batch, size_t count, ssize_t *results)
+{
+    switch(batch[0].op)
+    {
+        case FS_OP_READ:
+        case FS_OP_WRITE:
+            ring_transfer(ring, batch, count, results);
+            break;
+        case FS_OP_OPEN:
+            pthread_rwlock_wrlock(&ring->engine);
+            results[0] = fs_open(ring->fs, batch[0].path);
+            pthread_rwlock_unlock(&ring->engine);
+            break;
+        case FS_OP_CLOSE:
+            pthread_rwlock_wrlock(&ring->engine);
+            results[0] = fs_close(ring->fs, batch[0].fd);
+            pthread_rwlock_unlock(&ring->engine);
+            break;
+        default:
+            results[0] = -1;
+            break;
+    }
+}
+
+static void *ring_worker(void *arg)
+{
+    fs_ring_t *ring = (fs_ring_t *)arg;
+    fs_sqe_t *batch = (fs_sqe_t *)calloc(ring->capacity, sizeof(fs_sqe_t));
+    ssize_t *results = (ssize_t *)calloc(ring->capacity, sizeof(ssize_t));
+
+    pthread_mutex_lock(&ring->lock);
+    while(batch != NULL && results != NULL)
+    {
+        size_t count = ring_take(ring, batch);
+        if(count == 0)
+        {
+            if(ring->stop && ring->pending_count == 0)
+            {
+                break;
+            }
+            pthread_cond_wait(&ring->work_cv, &ring->lock);
+            continue;
+        }
+
+        bool owns_fd = ring_has_fd(&batch[0]);
+        if(owns_fd)
+        {
+            ring->busy_fd[batch[0].fd] = true;
+        }
+        pthread_mutex_unlock(&ring->lock);
+
+        ring_execute(ring, batch, count, results);
+
+        pthread_mutex_lock(&ring->lock);
+        for(size_t i = 0; i < count; i++)
+        {
+            fs_cqe_t *cqe = &ring->done[(ring->done_head + ring->done_count) % ring->capacity];
+            cqe->user_data = batch[i].user_data;
+            cqe->result = results[i];
+            ring->done_count++;
+        }
+        if(owns_fd)
+        {
+            ring->busy_fd[batch[0].fd] = false;
+        }
+        pthread_cond_broadcast(&ring->done_cv);
+        pthread_cond_broadcast(&ring->work_cv);    // the descriptor may have unblocked someone
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    free(batch);
+    free(results);
+    return NULL;
+}
+
+
+fs_ring_t *fs_ring_create(FS_t *fs, size_t entries, size_t workers)
+{
+    if(fs == NULL || entries == 0 || workers == 0)
+    {
+        return NULL;
+    }
+
+    fs_ring_t *ring = (fs_ring_t *)calloc(1, sizeof(fs_ring_t));
+    if(ring == NULL)
+    {
+        return NULL;
+    }
+    ring->fs = fs;
+    ring->capacity = entries;
+    ring->pending = (fs_sqe_t *)calloc(entries, sizeof(fs_sqe_t));
+    ring->done = (fs_cqe_t *)calloc(entries, sizeof(fs_cqe_t));
+    ring->workers = (pthread_t *)calloc(workers, sizeof(pthread_t));
+    if(ring->pending == NULL || ring->done == NULL || ring->workers == NULL)
+    {
+        free(ring->pending);
+        free(ring->done);
+        free(ring->workers);
+        free(ring);
+        return NULL;
+    }
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->work_cv, NULL);
+    pthread_cond_init(&ring->done_cv, NULL);
+    pthread_rwlock_init(&ring->engine, NULL);
+
+    for( ; ring->worker_count < workers; ring->worker_count++)
+    {
+        if(pthread_create(&ring->workers[ring->worker_count], NULL, ring_worker, ring) != 0)
+        {
+            break;
+        }
+    }
+    if(ring->worker_count == 0)
+    {
+        fs_ring_destroy(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void fs_ring_destroy(fs_ring_t *ring)
+{
+    if(ring == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    ring->stop = true;
+    pthread_cond_broadcast(&ring->work_cv);
+    pthread_mutex_unlock(&ring->lock);
+
+    for(size_t i = 0; i < ring->worker_count; i++)
+    {
+        pthread_join(ring->workers[i], NULL);
+    }
+
+    pthread_rwlock_destroy(&ring->engine);
+    pthread_cond_destroy(&ring->done_cv);
+    pthread_cond_destroy(&ring->work_cv);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->workers);
+    free(ring->done);
+    free(ring->pending);
+    free(ring);
+}
+
+ssize_t fs_submit(fs_ring_t *ring, const fs_sqe_t *batch, size_t n)
+{
+    if(ring == NULL || (batch == NULL && n != 0))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    size_t room = ring->capacity - ring->in_flight;
+    size_t accepted = n < room ? n : room;
+    memcpy(ring->pending + ring->pending_count, batch, accepted * sizeof(fs_sqe_t));
+    ring->pending_count += accepted;
+    ring->in_flight += accepted;
+    if(accepted)
+    {
+        pthread_cond_broadcast(&ring->work_cv);
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return accepted;
+}
+
+ssize_t fs_reap(fs_ring_t *ring, fs_cqe_t *completions, size_t max, size_t min_complete)
+{
+    if(ring == NULL || (completions == NULL && max != 0))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    if(min_complete > ring->in_flight)
+    {
+        min_complete = ring->in_flight;   // would otherwise wait forever
+    }
+    if(min_complete > max)
+    {
+        min_complete = max;
+    }
+    while(ring->done_count < min_complete)
+    {
+        pthread_cond_wait(&ring->done_cv, &ring->lock);
+    }
+
+    size_t reaped = 0;
+    for( ; reaped < max && ring->done_count > 0; reaped++)
+    {
+        completions[reaped] = ring->done[ring->done_head];
+        ring->done_head = (ring->done_head + 1) % ring->capacity;
+        ring->done_count--;
+    }
+    ring->in_flight -= reaped;
+    pthread_mutex_unlock(&ring->lock);
+
+    return reaped;
+}
@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "FS.h"
+#include "FS_client.h"
+
+struct fs_client
+{
+    int sock;
+};
+
+
+// \return false on EOF or error
+static bool client_recv_all(int sock, void *buf, size_t n)
+{
+    uint8_t *at = (uint8_t *)buf;
+    while(n > 0)
+    {
+        ssize_t got = recv(sock, at, n, 0);
+        if(got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(got <= 0)
+        {
+            return false;
+        }
+        at += got;
+        n -= got;
+    }
+    return true;
+}
+
+static bool client_send_all(int sock, const void *buf, size_t n)
+{
+    const uint8_t *at = (const uint8_t *)buf;
+    while(n > 0)
+    {
+        ssize_t sent = send(sock, at, n, MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(sent <= 0)
+        {
+            return false;
+        }
+        at += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+// bytes a call puts on the wire after its record
+static size_t client_payload(const fs_client_req_t *req)
+{
+    if(req->op == FS_REQ_OPEN || req->op == FS_REQ_GET_DIR)
+    {
+        return req->path == NULL ? 0 : strlen(req->path);
+    }
+    return req->op == FS_REQ_WRITE ? req->nbyte : 0;
+}
+
+// turn a GET_DIR payload back into what fs_get_dir returns
+static dyn_array_t *client_unpack_dir(const uint8_t *data, size_t n)
+{
+    dyn_array_t *entries = dyn_array_create(0, sizeof(file_record_t), NULL);
+    size_t at = 0;
+    while(entries != NULL && at + 2 <= n)
+    {
+        file_record_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.type = (file_t)data[at];
+        size_t name_length = data[at + 1];
+        if(name_length >= FS_FNAME_MAX || at + 2 + name_length > n)
+        {
+            break;
+        }
+        memcpy(entry.name, data + at + 2, name_length);
+        dyn_array_push_back(entries, &entry);
+        at += 2 + name_length;
+    }
+    return entries;
+}
+
+///
+/// Connects to a running fsd
+/// \param socket_path The server's socket
+/// \return New client, NULL on error
+///
+fs_client_t *fs_client_connect(const char *socket_path)
+{
+    struct sockaddr_un address;
+    if(socket_path == NULL || strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        return NULL;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    fs_client_t *client = (fs_client_t *)calloc(1, sizeof(fs_client_t));
+    if(client == NULL)
+    {
+        return NULL;
+    }
+    client->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(client->sock < 0 || connect(client->sock, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        if(client->sock >= 0)
+        {
+            close(client->sock);
+        }
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+///
+/// Disconnects, the server closes every descriptor this client left open
+/// \param client The client
+///
+void fs_client_disconnect(fs_client_t *client)
+{
+    if(client != NULL)
+    {
+        close(client->sock);
+        free(client);
+    }
+}
+
+///
+/// Runs a batch of calls in one round trip, in order
+/// \param client The client
+/// \param batch Calls to make, results are filled in
+/// \param n Number of calls, at most FS_PROTO_MAX_BATCH
+/// \return 0 on success (individual calls can still have failed), < 0 if the batch could not be sent or answered
+///
+int fs_client_batch(fs_client_t *client, fs_client_req_t *batch, size_t n)
+{
+    if(client == NULL || batch == NULL || n == 0 || n > FS_PROTO_MAX_BATCH)
+    {
+        return -1;
+    }
+    size_t length = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        if(client_payload(batch + i) >= FS_PROTO_MAX_MESSAGE)
+        {
+            return -1;
+        }
+        length += sizeof(fs_req_record_t) + client_payload(batch + i);
+    }
+    if(length > FS_PROTO_MAX_MESSAGE)
+    {
+        return -1;
+    }
+
+    uint8_t *message = (uint8_t *)malloc(sizeof(fs_msg_header_t) + length);
+    if(message == NULL)
+    {
+        return -1;
+    }
+    fs_msg_header_t header = {FS_PROTO_MAGIC, (uint32_t)n, (uint32_t)length};
+    memcpy(message, &header, sizeof(header));
+    size_t at = sizeof(header);
+    for(size_t i = 0; i < n; i++)
+    {
+        fs_req_record_t record;
+        memset(&record, 0, sizeof(record));
+        record.op = batch[i].op;
+        record.fd = batch[i].fd;
+        record.nbyte = batch[i].op == FS_REQ_READ ? batch[i].nbyte : client_payload(batch + i);
+        memcpy(message + at, &record, sizeof(record));
+        at += sizeof(record);
+        if(record.op != FS_REQ_READ && record.nbyte > 0)
+        {
+            memcpy(message + at, batch[i].op == FS_REQ_WRITE ? batch[i].buf : (const void *)batch[i].path, record.nbyte);
+            at += record.nbyte;
+        }
+    }
+    bool ok = client_send_all(client->sock, message, at);
+    free(message);
+
+    // the reply, record by record straight into the callers' buffers
+    ok = ok && client_recv_all(client->sock, &header, sizeof(header)) && header.magic == FS_PROTO_MAGIC && header.count == n;
+    for(size_t i = 0; ok && i < n; i++)
+    {
+        fs_reply_record_t record;
+        ok = client_recv_all(client->sock, &record, sizeof(record));
+        if(!ok)
+        {
+            break;
+        }
+        batch[i].result = record.result;
+        batch[i].entries = NULL;
+        if(batch[i].op == FS_REQ_READ && record.nbyte <= batch[i].nbyte)
+        {
+            ok = client_recv_all(client->sock, batch[i].buf, record.nbyte);
+        }
+        else if(batch[i].op == FS_REQ_GET_DIR || record.nbyte == 0)
+        {
+            uint8_t *data = (uint8_t *)malloc(record.nbyte + 1);
+            ok = data != NULL && client_recv_all(client->sock, data, record.nbyte);
+            if(ok && batch[i].op == FS_REQ_GET_DIR && record.result >= 0)
+            {
+                batch[i].entries = client_unpack_dir(data, record.nbyte);
+            }
+            free(data);
+        }
+        else
+        {
+            ok = false;     // more data than asked for
+        }
+    }
+    return ok ? 0 : -1;
+}
+
+// one call, one round trip
+static ssize_t client_call(fs_client_t *client, fs_client_req_t *req)
+{
+    return fs_client_batch(client, req, 1) == 0 ? req->result : -1;
+}
+
+int fs_client_open(fs_client_t *client, const char *path)
+{
+    fs_client_req_t req = {FS_REQ_OPEN, -1, path, NULL, 0, 0, NULL};
+    return path == NULL ? -1 : client_call(client, &req);
+}
+
+int fs_client_close(fs_client_t *client, int fd)
+{
+    fs_client_req_t req = {FS_REQ_CLOSE, fd, NULL, NULL, 0, 0, NULL};
+    return client_call(client, &req);
+}
+
+ssize_t fs_client_read(fs_client_t *client, int fd, void *dst, size_t nbyte)
+{
+    fs_client_req_t req = {FS_REQ_READ, fd, NULL, dst, nbyte, 0, NULL};
+    return dst == NULL ? -1 : client_call(client, &req);
+}
+
+ssize_t fs_client_write(fs_client_t *client, int fd, const void *src, size_t nbyte)
+{
+    fs_client_req_t req = {FS_REQ_WRITE, fd, NULL, (void *)src, nbyte, 0, NULL};
+    return src == NULL ? -1 : client_call(client, &req);
+}
+
+dyn_array_t *fs_client_get_dir(fs_client_t *client, const char *path)
+{
+    fs_client_req_t req = {FS_REQ_GET_DIR, -1, path, NULL, 0, 0, NULL};
+    if(path == NULL || client_call(client, &req) < 0)
+    {
+        return NULL;
+    }
+    return req.entries;
+}
@@ -0,0 +1,230 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "FS_lz.h"
+
+// A sequence is a token byte (literal length << 4 | match length - LZ_MIN_MATCH), the
+// literal length overflow, the literals, a 16-bit little endian match offset and the match
+// length overflow. Lengths of 15 or more spill into extra bytes of 255 ending in one < 255.
+// The last sequence is literals only.
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5      // the final bytes are always literals
+#define LZ_MF_LIMIT 12          // no match may start this close to the end
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_SKIP_TRIGGER 6       // after 2^6 misses in a row start skipping ahead faster
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// \return where the output continues, NULL when out of room
+static uint8_t *lz_put_length(uint8_t *op, const uint8_t *oend, size_t length)
+{
+    for(; length >= 255; length -= 255)
+    {
+        if(op >= oend)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if(op >= oend)
+    {
+        return NULL;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// one sequence: lit_len literals, then a match unless match_len is 0
+// \return where the output continues, NULL when out of room
+static uint8_t *lz_put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals, size_t lit_len, size_t offset, size_t match_len)
+{
+    if(op >= oend)
+    {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if(lit_len >= 15 && (op = lz_put_length(op, oend, lit_len - 15)) == NULL)
+    {
+        return NULL;
+    }
+    if((size_t)(oend - op) < lit_len)
+    {
+        return NULL;
+    }
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    if(match_len == 0)
+    {
+        return op;
+    }
+
+    if(oend - op < 2)
+    {
+        return NULL;
+    }
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+    match_len -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+    if(match_len >= 15 && (op = lz_put_length(op, oend, match_len - 15)) == NULL)
+    {
+        return NULL;
+    }
+    return op;
+}
+
+size_t fs_lz_compress(const void *src, size_t n, void *dst, size_t capacity)
+{
+    if(src == NULL || dst == NULL)
+    {
+        return 0;
+    }
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *iend = base + n;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;       // first byte not yet emitted
+    uint8_t *op = (uint8_t *)dst;
+    const uint8_t *oend = op + capacity;
+
+    if(n >= LZ_MF_LIMIT)
+    {
+        uint32_t table[1 << LZ_HASH_BITS];  // last position seen for each hash
+        memset(table, 0, sizeof(table));
+        const uint8_t *mf_limit = iend - LZ_MF_LIMIT;
+        const uint8_t *match_limit = iend - LZ_LAST_LITERALS;
+        size_t misses = 0;
+        while(ip <= mf_limit)
+        {
+            uint32_t sequence = lz_read32(ip);
+            uint32_t h = lz_hash(sequence);
+            const uint8_t *ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if(ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != sequence)
+            {
+                ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            size_t match_len = LZ_MIN_MATCH;
+            while(ip + match_len < match_limit && ref[match_len] == ip[match_len])
+            {
+                match_len++;
+            }
+            while(ip > anchor && ref > base && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+                match_len++;
+            }
+            op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, match_len);
+            if(op == NULL)
+            {
+                return 0;
+            }
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+    op = lz_put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    if(op == NULL)
+    {
+        return 0;
+    }
+    return op - (uint8_t *)dst;
+}
+
+size_t fs_lz_decompress(const void *src, size_t n, void *dst, size_t capacity)
+{
+    if(src == NULL || dst == NULL)
+    {
+        return SIZE_MAX;
+    }
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + n;
+    uint8_t *op = (uint8_t *)dst;
+    const uint8_t *oend = op + capacity;
+
+    while(ip < iend)
+    {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        if(lit_len == 15)
+        {
+            uint8_t extra;
+            do
+            {
+                if(ip >= iend)
+                {
+                    return SIZE_MAX;
+                }
+                extra = *ip++;
+                lit_len += extra;
+            } while(extra == 255);
+        }
+        if(lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+        {
+            return SIZE_MAX;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if(ip == iend)
+        {
+            break;  // the last sequence has no match
+        }
+
+        if(iend - ip < 2)
+        {
+            return SIZE_MAX;
+        }
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if(match_len == 15)
+        {
+            uint8_t extra;
+            do
+            {
+                if(ip >= iend)
+                {
+                    return SIZE_MAX;
+                }
+                extra = *ip++;
+                match_len += extra;
+            } while(extra == 255);
+        }
+        match_len += LZ_MIN_MATCH;
+        if(offset == 0 || offset > (size_t)(op - (uint8_t *)dst) || match_len > (size_t)(oend - op))
+        {
+            return SIZE_MAX;
+        }
+        const uint8_t *ref = op - offset;
+        if(offset >= match_len)
+        {
+            memcpy(op, ref, match_len);
+        }
+        else
+        {
+            // overlapping copy repeats the last offset bytes
+            for(size_t i = 0; i < match_len; i++)
+            {
+                op[i] = ref[i];
+            }
+        }
+        op += match_len;
+    }
+    return op - (uint8_t *)dst;
+}
@@ -0,0 +1,561 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "FS.h"
+#include "FS_server.h"
+
+#define SERVER_MAX_CONNECTIONS 64
+
+typedef struct
+{
+    int sock;
+    bool busy;                  // queued for or held by a worker, the poller leaves it alone
+    bool owned[number_fd];      // descriptors opened through this connection
+} connection_t;
+
+struct fs_server
+{
+    FS_t *fs;
+    char *socket_path;
+    int listen_fd;
+    bool bound;                 // the socket file is ours to remove
+    int wake[2];                // self-pipe to get the poller out of poll()
+
+    pthread_mutex_t lock;       // guards everything below
+    pthread_cond_t ready_cv;    // workers wait here for a connection with a message
+    connection_t *conns[SERVER_MAX_CONNECTIONS];
+    connection_t *ready[SERVER_MAX_CONNECTIONS];   // FIFO of connections with a message waiting
+    size_t ready_head;
+    size_t ready_count;
+    bool stop;
+
+    // FS.c is not thread safe, same split as FS_async.c: reads share the engine, the rest own it
+    pthread_rwlock_t engine;
+
+    pthread_t poller;
+    bool poller_running;
+    pthread_t *workers;
+    size_t worker_count;
+};
+
+// growing reply message
+typedef struct
+{
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} reply_buffer_t;
+
+
+// \return false on EOF or error
+static bool server_recv_all(int sock, void *buf, size_t n)
+{
+    uint8_t *at = (uint8_t *)buf;
+    while(n > 0)
+    {
+        ssize_t got = recv(sock, at, n, 0);
+        if(got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(got <= 0)
+        {
+            return false;
+        }
+        at += got;
+        n -= got;
+    }
+    return true;
+}
+
+static bool server_send_all(int sock, const void *buf, size_t n)
+{
+    const uint8_t *at = (const uint8_t *)buf;
+    while(n > 0)
+    {
+        ssize_t sent = send(sock, at, n, MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(sent <= 0)
+        {
+            return false;
+        }
+        at += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+// make room for n more bytes at the end of the reply
+// \return offset of the new bytes, SIZE_MAX when out of memory
+static size_t reply_reserve(reply_buffer_t *reply, size_t n)
+{
+    if(reply->length + n > reply->capacity)
+    {
+        size_t capacity = reply->capacity == 0 ? 4096 : reply->capacity;
+        while(capacity < reply->length + n)
+        {
+            capacity *= 2;
+        }
+        uint8_t *data = (uint8_t *)realloc(reply->data, capacity);
+        if(data == NULL)
+        {
+            return SIZE_MAX;
+        }
+        reply->data = data;
+        reply->capacity = capacity;
+    }
+    size_t offset = reply->length;
+    reply->length += n;
+    return offset;
+}
+
+static void server_wake_poller(fs_server_t *server)
+{
+    char byte = 0;
+    while(write(server->wake[1], &byte, 1) < 0 && errno == EINTR)
+    {
+    }
+}
+
+// run one request of a batch and append its reply record (and payload)
+// \return false when out of memory
+static bool server_run(fs_server_t *server, connection_t *conn, const fs_req_record_t *req, const uint8_t *payload, reply_buffer_t *reply)
+{
+    fs_reply_record_t record = {-1, 0, 0};
+    size_t record_at = reply_reserve(reply, sizeof(record));
+    if(record_at == SIZE_MAX)
+    {
+        return false;
+    }
+    bool has_fd = req->fd >= 0 && req->fd < number_fd && conn->owned[req->fd];
+    char path[FS_PROTO_MAX_PATH];
+    if((req->op == FS_REQ_OPEN || req->op == FS_REQ_GET_DIR) && req->nbyte < FS_PROTO_MAX_PATH)
+    {
+        memcpy(path, payload, req->nbyte);
+        path[req->nbyte] = '\0';
+    }
+    else
+    {
+        path[0] = '\0';
+    }
+
+    switch(req->op)
+    {
+        case FS_REQ_OPEN:
+        {
+            pthread_rwlock_wrlock(&server->engine);
+            int fd = fs_open(server->fs, path);
+            pthread_rwlock_unlock(&server->engine);
+            if(fd >= 0 && fd < number_fd)
+            {
+                conn->owned[fd] = true;
+            }
+            record.result = fd;
+            break;
+        }
+        case FS_REQ_CLOSE:
+            if(has_fd)
+            {
+                pthread_rwlock_wrlock(&server->engine);
+                record.result = fs_close(server->fs, req->fd);
+                pthread_rwlock_unlock(&server->engine);
+                conn->owned[req->fd] = record.result != 0;
+            }
+            break;
+        case FS_REQ_READ:
+            // the whole reply has to stay within one message
+            if(has_fd && reply->length + req->nbyte <= sizeof(fs_msg_header_t) + FS_PROTO_MAX_MESSAGE)
+            {
+                size_t data_at = reply_reserve(reply, req->nbyte);
+                if(data_at == SIZE_MAX)
+                {
+                    return false;
+                }
+                pthread_rwlock_rdlock(&server->engine);
+                record.result = fs_read(server->fs, req->fd, reply->data + data_at, req->nbyte);
+                pthread_rwlock_unlock(&server->engine);
+                record.nbyte = record.result > 0 ? record.result : 0;
+                reply->length = data_at + record.nbyte;
+            }
+            break;
+        case FS_REQ_WRITE:
+            if(has_fd)
+            {
+                pthread_rwlock_wrlock(&server->engine);
+                record.result = fs_write(server->fs, req->fd, payload, req->nbyte);
+                pthread_rwlock_unlock(&server->engine);
+            }
+            break;
+        case FS_REQ_GET_DIR:
+        {
+            // entries go straight from the directory into the reply, nothing is built up in between
+            pthread_rwlock_rdlock(&server->engine);
+            fs_dir_t *dir = fs_opendir(server->fs, path);
+            pthread_rwlock_unlock(&server->engine);
+            if(dir == NULL)
+            {
+                break;
+            }
+            size_t count = 0;
+            file_record_t entry;
+            while(fs_readdir(server->fs, dir, &entry) > 0)
+            {
+                size_t name_length = strnlen(entry.name, FS_FNAME_MAX - 1);
+                size_t entry_at = reply_reserve(reply, 2 + name_length);
+                if(entry_at == SIZE_MAX)
+                {
+                    fs_closedir(dir);
+                    return false;
+                }
+                reply->data[entry_at] = (uint8_t)entry.type;
+                reply->data[entry_at + 1] = (uint8_t)name_length;
+                memcpy(reply->data + entry_at + 2, entry.name, name_length);
+                record.nbyte += 2 + name_length;
+                count++;
+            }
+            record.result = count;
+            fs_closedir(dir);
+            break;
+        }
+        default:
+            break;
+    }
+    memcpy(reply->data + record_at, &record, sizeof(record));
+    return true;
+}
+
+// read one request message from a connection, run it and answer
+// \return false if the connection is gone or broke the protocol and has to be dropped
+static bool server_serve(fs_server_t *server, connection_t *conn)
+{
+    fs_msg_header_t header;
+    if(!server_recv_all(conn->sock, &header, sizeof(header)) || header.magic != FS_PROTO_MAGIC
+            || header.count == 0 || header.count > FS_PROTO_MAX_BATCH || header.length > FS_PROTO_MAX_MESSAGE)
+    {
+        return false;
+    }
+    uint8_t *body = (uint8_t *)malloc(header.length);
+    if(body == NULL || !server_recv_all(conn->sock, body, header.length))
+    {
+        free(body);
+        return false;
+    }
+
+    reply_buffer_t reply = {NULL, 0, 0};
+    bool ok = reply_reserve(&reply, sizeof(fs_msg_header_t)) != SIZE_MAX;
+    size_t at = 0;
+    for(uint32_t i = 0; ok && i < header.count; i++)
+    {
+        fs_req_record_t req;
+        if(header.length - at < sizeof(req))
+        {
+            ok = false;
+            break;
+        }
+        memcpy(&req, body + at, sizeof(req));
+        at += sizeof(req);
+        size_t payload = (req.op == FS_REQ_READ || req.op == FS_REQ_CLOSE) ? 0 : req.nbyte;
+        if(header.length - at < payload)
+        {
+            ok = false;
+            break;
+        }
+        ok = server_run(server, conn, &req, body + at, &reply);
+        at += payload;
+    }
+    ok = ok && at == header.length;
+    if(ok)
+    {
+        fs_msg_header_t reply_header = {FS_PROTO_MAGIC, header.count, (uint32_t)(reply.length - sizeof(fs_msg_header_t))};
+        memcpy(reply.data, &reply_header, sizeof(reply_header));
+        ok = server_send_all(conn->sock, reply.data, reply.length);
+    }
+    free(reply.data);
+    free(body);
+    return ok;
+}
+
+// close a connection and every descriptor it still had open
+static void server_drop(fs_server_t *server, connection_t *conn)
+{
+    pthread_rwlock_wrlock(&server->engine);
+    for(int fd = 0; fd < number_fd; fd++)
+    {
+        if(conn->owned[fd])
+        {
+            fs_close(server->fs, fd);
+        }
+    }
+    pthread_rwlock_unlock(&server->engine);
+    close(conn->sock);
+
+    pthread_mutex_lock(&server->lock);
+    for(size_t i = 0; i < SERVER_MAX_CONNECTIONS; i++)
+    {
+        if(server->conns[i] == conn)
+        {
+            server->conns[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    free(conn);
+}
+
+static void server_accept(fs_server_t *server)
+{
+    int sock = accept(server->listen_fd, NULL, NULL);
+    if(sock < 0)
+    {
+        return;
+    }
+    connection_t *conn = (connection_t *)calloc(1, sizeof(connection_t));
+    pthread_mutex_lock(&server->lock);
+    size_t slot = 0;
+    while(slot < SERVER_MAX_CONNECTIONS && server->conns[slot] != NULL)
+    {
+        slot++;
+    }
+    if(conn != NULL && slot < SERVER_MAX_CONNECTIONS)
+    {
+        conn->sock = sock;
+        server->conns[slot] = conn;
+        conn = NULL;
+        sock = -1;
+    }
+    pthread_mutex_unlock(&server->lock);
+    // full (or out of memory): turn it away
+    free(conn);
+    if(sock >= 0)
+    {
+        close(sock);
+    }
+}
+
+// accepts connections and hands the ones with a message waiting to the workers
+static void *server_poll(void *arg)
+{
+    fs_server_t *server = (fs_server_t *)arg;
+    struct pollfd fds[2 + SERVER_MAX_CONNECTIONS];
+    connection_t *watched[SERVER_MAX_CONNECTIONS];
+    while(true)
+    {
+        fds[0].fd = server->listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = server->wake[0];
+        fds[1].events = POLLIN;
+        size_t n = 0;
+        pthread_mutex_lock(&server->lock);
+        if(server->stop)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        for(size_t i = 0; i < SERVER_MAX_CONNECTIONS; i++)
+        {
+            if(server->conns[i] != NULL && !server->conns[i]->busy)
+            {
+                watched[n] = server->conns[i];
+                fds[2 + n].fd = server->conns[i]->sock;
+                fds[2 + n].events = POLLIN;
+                n++;
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if(poll(fds, 2 + n, -1) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if(fds[1].revents != 0)
+        {
+            char drain[64];
+            while(read(server->wake[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        pthread_mutex_lock(&server->lock);
+        for(size_t i = 0; i < n; i++)
+        {
+            // hang-ups too, the worker finds out and drops the connection
+            if(fds[2 + i].revents != 0)
+            {
+                watched[i]->busy = true;
+                server->ready[(server->ready_head + server->ready_count) % SERVER_MAX_CONNECTIONS] = watched[i];
+                server->ready_count++;
+                pthread_cond_signal(&server->ready_cv);
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+        if(fds[0].revents & POLLIN)
+        {
+            server_accept(server);
+        }
+    }
+    return NULL;
+}
+
+static void *server_work(void *arg)
+{
+    fs_server_t *server = (fs_server_t *)arg;
+    while(true)
+    {
+        pthread_mutex_lock(&server->lock);
+        while(server->ready_count == 0 && !server->stop)
+        {
+            pthread_cond_wait(&server->ready_cv, &server->lock);
+        }
+        if(server->ready_count == 0)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        connection_t *conn = server->ready[server->ready_head];
+        server->ready_head = (server->ready_head + 1) % SERVER_MAX_CONNECTIONS;
+        server->ready_count--;
+        pthread_mutex_unlock(&server->lock);
+
+        if(server_serve(server, conn))
+        {
+            pthread_mutex_lock(&server->lock);
+            conn->busy = false;
+            pthread_mutex_unlock(&server->lock);
+            server_wake_poller(server);
+        }
+        else
+        {
+            server_drop(server, conn);
+        }
+    }
+    return NULL;
+}
+
+///
+/// Starts serving a mounted FS
+/// \param fs The FS to serve
+/// \param socket_path Where to create the socket, an existing socket file there is replaced
+/// \param workers Number of worker threads, at least 1
+/// \return New server, NULL on error
+///
+fs_server_t *fs_server_start(FS_t *fs, const char *socket_path, size_t workers)
+{
+    struct sockaddr_un address;
+    if(fs == NULL || socket_path == NULL || workers == 0 || strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        return NULL;
+    }
+    fs_server_t *server = (fs_server_t *)calloc(1, sizeof(fs_server_t));
+    if(server == NULL)
+    {
+        return NULL;
+    }
+    server->fs = fs;
+    server->listen_fd = -1;
+    server->wake[0] = server->wake[1] = -1;
+    server->socket_path = strdup(socket_path);
+    server->workers = (pthread_t *)calloc(workers, sizeof(pthread_t));
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready_cv, NULL);
+    pthread_rwlock_init(&server->engine, NULL);
+
+    struct stat existing;
+    if(stat(socket_path, &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+        unlink(socket_path);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    server->bound = server->listen_fd >= 0 && bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    bool ok = server->socket_path != NULL && server->workers != NULL && server->bound
+        && listen(server->listen_fd, SOMAXCONN) == 0
+        && pipe(server->wake) == 0
+        && fcntl(server->wake[0], F_SETFL, O_NONBLOCK) == 0 && fcntl(server->wake[1], F_SETFL, O_NONBLOCK) == 0;
+    if(ok)
+    {
+        server->poller_running = pthread_create(&server->poller, NULL, server_poll, server) == 0;
+        while(server->worker_count < workers && pthread_create(&server->workers[server->worker_count], NULL, server_work, server) == 0)
+        {
+            server->worker_count++;
+        }
+        ok = server->poller_running && server->worker_count == workers;
+    }
+    if(!ok)
+    {
+        fs_server_stop(server);
+        return NULL;
+    }
+    return server;
+}
+
+///
+/// Stops accepting, lets running batches finish, closes every connection (and the
+/// descriptors they had open), removes the socket file and frees the server
+///   The FS stays mounted
+/// \param server The server to stop
+///
+void fs_server_stop(fs_server_t *server)
+{
+    if(server == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&server->lock);
+    server->stop = true;
+    pthread_cond_broadcast(&server->ready_cv);
+    pthread_mutex_unlock(&server->lock);
+    if(server->wake[1] >= 0)
+    {
+        server_wake_poller(server);
+    }
+    if(server->poller_running)
+    {
+        pthread_join(server->poller, NULL);
+    }
+    for(size_t i = 0; i < server->worker_count; i++)
+    {
+        pthread_join(server->workers[i], NULL);
+    }
+
+    for(size_t i = 0; i < SERVER_MAX_CONNECTIONS; i++)
+    {
+        if(server->conns[i] != NULL)
+        {
+            server_drop(server, server->conns[i]);
+        }
+    }
+    if(server->listen_fd >= 0)
+    {
+        close(server->listen_fd);
+    }
+    if(server->bound)
+    {
+        unlink(server->socket_path);
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        if(server->wake[i] >= 0)
+        {
+            close(server->wake[i]);
+        }
+    }
+    pthread_rwlock_destroy(&server->engine);
+    pthread_cond_destroy(&server->ready_cv);
+    pthread_mutex_destroy(&server->lock);
+    free(server->workers);
+    free(server->socket_path);
+    free(server);
+}
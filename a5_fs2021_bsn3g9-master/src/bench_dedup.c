@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FS.h"
+
+// Writes the same dedup-heavy corpus into a fresh image twice, once as is and once with
+// fs_dedup_enable, and reports the blocks each run used and what dedup costs in write throughput.
+// Every block of the corpus is either one of POOL template blocks (dup_percent of them, think
+// of vendored copies, VM images or build outputs) or unique to its file and position.
+
+#define FILES 30            // 60 MiB, fits the image even without dedup
+#define FILE_BLOCKS 512     // 2 MiB per file
+#define CHUNK_BLOCKS 16     // written 64 KiB at a time
+#define POOL 64
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void fill_block(uint8_t *block, uint64_t seed)
+{
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for(size_t i = 0; i < BLOCK_SIZE_BYTES; i += sizeof(uint64_t))
+    {
+        uint64_t word = next_random(&state);
+        memcpy(block + i, &word, sizeof(word));
+    }
+}
+
+// the whole corpus, FILES * FILE_BLOCKS blocks back to back
+static uint8_t *make_corpus(int dup_percent)
+{
+    uint8_t *corpus = (uint8_t *)malloc((size_t)FILES * FILE_BLOCKS * BLOCK_SIZE_BYTES);
+    if(corpus == NULL)
+    {
+        return NULL;
+    }
+    uint64_t state = 42;
+    for(size_t b = 0; b < (size_t)FILES * FILE_BLOCKS; b++)
+    {
+        if((int)(next_random(&state) % 100) < dup_percent)
+        {
+            fill_block(corpus + b * BLOCK_SIZE_BYTES, next_random(&state) % POOL);
+        }
+        else
+        {
+            fill_block(corpus + b * BLOCK_SIZE_BYTES, POOL + b);
+        }
+    }
+    return corpus;
+}
+
+static int run(const char *image, const uint8_t *corpus, int dedup, size_t *blocks, double *elapsed)
+{
+    FS_t *fs = fs_format(image);
+    if(fs == NULL)
+    {
+        printf("Could not format %s\n", image);
+        return 1;
+    }
+    if(dedup && fs_dedup_enable(fs) < 0)
+    {
+        printf("Could not enable dedup\n");
+        fs_unmount(fs);
+        return 1;
+    }
+
+    char path[32];
+    int fds[FILES];
+    for(int f = 0; f < FILES; f++)
+    {
+        snprintf(path, sizeof(path), "/file%02d", f);
+        if(fs_create(fs, path, FS_REGULAR) < 0 || (fds[f] = fs_open(fs, path)) < 0)
+        {
+            printf("Could not create %s\n", path);
+            fs_unmount(fs);
+            return 1;
+        }
+    }
+    size_t used_before = block_store_get_used_blocks(fs->BlockStore_whole);
+
+    double start = now_seconds();
+    for(int f = 0; f < FILES; f++)
+    {
+        const uint8_t *file = corpus + (size_t)f * FILE_BLOCKS * BLOCK_SIZE_BYTES;
+        for(size_t b = 0; b < FILE_BLOCKS; b += CHUNK_BLOCKS)
+        {
+            size_t nbyte = CHUNK_BLOCKS * BLOCK_SIZE_BYTES;
+            if(fs_write(fs, fds[f], file + b * BLOCK_SIZE_BYTES, nbyte) != (ssize_t)nbyte)
+            {
+                printf("Short write to file %d\n", f);
+                fs_unmount(fs);
+                return 1;
+            }
+        }
+    }
+    *elapsed = now_seconds() - start;
+    *blocks = block_store_get_used_blocks(fs->BlockStore_whole) - used_before;
+    fs_unmount(fs);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 3)
+    {
+        printf("Usage: %s [dup_percent] [image]\n", argv[0]);
+        return 1;
+    }
+    int dup_percent = argc > 1 ? atoi(argv[1]) : 75;
+    const char *image = argc > 2 ? argv[2] : "bench_dedup.FS";
+    if(dup_percent < 0 || dup_percent > 100)
+    {
+        printf("dup_percent must be 0-100\n");
+        return 1;
+    }
+
+    uint8_t *corpus = make_corpus(dup_percent);
+    if(corpus == NULL)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+    size_t plain_blocks, dedup_blocks;
+    double plain_time, dedup_time;
+    if(run(image, corpus, 0, &plain_blocks, &plain_time) != 0 || run(image, corpus, 1, &dedup_blocks, &dedup_time) != 0)
+    {
+        free(corpus);
+        return 1;
+    }
+    free(corpus);
+
+    // blocks include pointer blocks (and the refcount table once dedup shares something)
+    double mib = (double)FILES * FILE_BLOCKS * BLOCK_SIZE_BYTES / (1024 * 1024);
+    printf("corpus   %d files  %.0f MiB  %d%% of blocks from a pool of %d\n", FILES, mib, dup_percent, POOL);
+    printf("plain    %8zu blocks  %8.3f s  %8.1f MiB/s\n", plain_blocks, plain_time, mib / plain_time);
+    printf("dedup    %8zu blocks  %8.3f s  %8.1f MiB/s\n", dedup_blocks, dedup_time, mib / dedup_time);
+    printf("saved    %7.1f%% of blocks, throughput cost %.1f%%\n",
+            100.0 * ((double)plain_blocks - (double)dedup_blocks) / plain_blocks,
+            100.0 * (dedup_time - plain_time) / plain_time);
+    return 0;
+}
@@ -0,0 +1,581 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FS.h"
+
+// Standard workloads for tracking FS performance between changes.
+// Each one runs on a freshly formatted image with a fixed seed, so two runs of the
+// same build do the exact same calls. Only the measured calls are timed and counted;
+// setup (writing the file randread reads, filling the directories listdir lists)
+// and teardown are not. For every workload it prints ops/s, p50 and p99 latency and
+// the data store blocks read and written per op (fs_get_stats). With -v it also breaks
+// the time down by fs_* call and prints the other counters.
+//
+//   create    8 directories of 30 files created, then removed, 40 times over (creates are timed)
+//   randread  512-byte reads at random offsets of a 4 MiB file, fs_seek + fs_read per op
+//   seqwrite  an 8 MiB file written in 64 KiB calls, 8 times over
+//   listdir   fs_get_dir over 8 directories of 30 entries
+//   readdir   the same directories walked with fs_opendir/fs_readdir, nothing copied out
+//   mixed     create, remove, append, read and list on 100 files in 4 directories
+//   scan      the 4 MiB file read start to end in 64 KiB fs_read calls, one op per pass
+//   mapscan   the same passes through 64 KiB fs_mmap views, copied only where a view is not one run
+
+#define DIRS 8
+#define FILES 30        // per directory, 8 * (30 + 1) + root < 256 inodes
+#define CREATE_ROUNDS 40
+#define READ_FILE_BYTES (4 << 20)
+#define READ_BYTES 512
+#define READ_OPS 20000
+#define WRITE_FILE_BYTES (8 << 20)  // stays within the direct and indirect blocks
+#define WRITE_BYTES (64 << 10)
+#define WRITE_ROUNDS 8
+#define LIST_OPS 20000
+#define MIXED_DIRS 4
+#define MIXED_FILES 25
+#define MIXED_OPS 20000
+#define MIXED_MAX_BYTES (256 << 10)
+#define MIXED_IO_BYTES 4096
+#define SCAN_OPS 200
+
+typedef struct
+{
+    FS_t *fs;
+    uint64_t *latency;      // ns of every op so far
+    size_t ops;
+    size_t capacity;
+    fs_stats_t measured;    // counters of the measured calls only
+    // the op being timed
+    struct timespec start;
+    fs_stats_t before;
+} run_t;
+
+static uint64_t rng_state;
+
+// xorshift64, the same sequence on every platform
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// a library built without counters reports none
+static void take_stats(run_t *run, fs_stats_t *stats)
+{
+    if(fs_get_stats(run->fs, stats) < 0)
+    {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+static void op_begin(run_t *run)
+{
+    take_stats(run, &run->before);
+    clock_gettime(CLOCK_MONOTONIC, &run->start);
+}
+
+static void op_end(run_t *run)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fs_stats_t after;
+    take_stats(run, &after);
+    for(size_t i = 0; i < FS_CALL_COUNT; i++)
+    {
+        run->measured.call[i].calls += after.call[i].calls - run->before.call[i].calls;
+        run->measured.call[i].ns += after.call[i].ns - run->before.call[i].ns;
+    }
+    run->measured.block_reads += after.block_reads - run->before.block_reads;
+    run->measured.block_writes += after.block_writes - run->before.block_writes;
+    run->measured.inode_reads += after.inode_reads - run->before.inode_reads;
+    run->measured.inode_writes += after.inode_writes - run->before.inode_writes;
+    run->measured.bitmap_scans += after.bitmap_scans - run->before.bitmap_scans;
+    run->measured.cache_hits += after.cache_hits - run->before.cache_hits;
+    run->measured.cache_misses += after.cache_misses - run->before.cache_misses;
+    if(run->ops == run->capacity)
+    {
+        size_t capacity = run->capacity == 0 ? 4096 : run->capacity * 2;
+        uint64_t *latency = (uint64_t *)realloc(run->latency, capacity * sizeof(uint64_t));
+        if(latency == NULL)
+        {
+            return;     // keep the totals, lose this sample
+        }
+        run->latency = latency;
+        run->capacity = capacity;
+    }
+    run->latency[run->ops++] = (uint64_t)(end.tv_sec - run->start.tv_sec) * 1000000000u + end.tv_nsec - run->start.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(run_t *run, const char *label, bool verbose)
+{
+    if(run->ops == 0)
+    {
+        printf("%-9s no ops\n", label);
+        return;
+    }
+    uint64_t total = 0;
+    for(size_t i = 0; i < run->ops; i++)
+    {
+        total += run->latency[i];
+    }
+    qsort(run->latency, run->ops, sizeof(uint64_t), compare_u64);
+    printf("%-9s %8zu %12.0f %10.2f %10.2f %10.2f %10.2f\n", label, run->ops, run->ops / (total / 1e9),
+            run->latency[run->ops / 2] / 1e3, run->latency[run->ops * 99 / 100] / 1e3,
+            (double)run->measured.block_reads / run->ops, (double)run->measured.block_writes / run->ops);
+    if(!verbose)
+    {
+        return;
+    }
+    // where the time went, by fs_* call
+    for(size_t i = 0; i < FS_CALL_COUNT; i++)
+    {
+        if(run->measured.call[i].calls > 0)
+        {
+            printf("    %-16s %8" PRIu64 " calls %10.2f us/call %6.1f%%\n", fs_call_name((fs_call_t)i), run->measured.call[i].calls,
+                    run->measured.call[i].ns / 1e3 / run->measured.call[i].calls, 100.0 * run->measured.call[i].ns / total);
+        }
+    }
+    printf("    inode reads/op %.2f, inode writes/op %.2f, bitmap scans/op %.2f, cache hits %" PRIu64 ", misses %" PRIu64 "\n",
+            (double)run->measured.inode_reads / run->ops, (double)run->measured.inode_writes / run->ops,
+            (double)run->measured.bitmap_scans / run->ops, run->measured.cache_hits, run->measured.cache_misses);
+}
+
+// /dNN and /dNN/fNN, the layout create and listdir use
+static int make_tree(FS_t *fs, run_t *timed)
+{
+    char path[64];
+    for(int d = 0; d < DIRS; d++)
+    {
+        for(int f = -1; f < FILES; f++)
+        {
+            if(f < 0)
+            {
+                snprintf(path, sizeof(path), "/d%02d", d);
+            }
+            else
+            {
+                snprintf(path, sizeof(path), "/d%02d/f%02d", d, f);
+            }
+            if(timed != NULL)
+            {
+                op_begin(timed);
+            }
+            int created = fs_create(fs, path, f < 0 ? FS_DIRECTORY : FS_REGULAR);
+            if(timed != NULL)
+            {
+                op_end(timed);
+            }
+            if(created < 0)
+            {
+                printf("Could not create %s\n", path);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int remove_tree(FS_t *fs)
+{
+    char path[64];
+    for(int d = 0; d < DIRS; d++)
+    {
+        for(int f = 0; f <= FILES; f++)
+        {
+            if(f < FILES)
+            {
+                snprintf(path, sizeof(path), "/d%02d/f%02d", d, f);
+            }
+            else
+            {
+                snprintf(path, sizeof(path), "/d%02d", d);
+            }
+            if(fs_remove(fs, path) < 0)
+            {
+                printf("Could not remove %s\n", path);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int workload_create(run_t *run)
+{
+    for(int round = 0; round < CREATE_ROUNDS; round++)
+    {
+        if(make_tree(run->fs, run) < 0 || remove_tree(run->fs) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// fills a file with a pattern and leaves it open, returns the fd or -1
+static int make_file(FS_t *fs, const char *path, size_t bytes)
+{
+    static uint8_t chunk[WRITE_BYTES];
+    for(size_t i = 0; i < sizeof(chunk); i++)
+    {
+        chunk[i] = (uint8_t)(i * 31 + 7);
+    }
+    if(fs_create(fs, path, FS_REGULAR) < 0)
+    {
+        return -1;
+    }
+    int fd = fs_open(fs, path);
+    for(size_t done = 0; fd >= 0 && done < bytes; done += sizeof(chunk))
+    {
+        if(fs_write(fs, fd, chunk, sizeof(chunk)) != (ssize_t)sizeof(chunk))
+        {
+            fs_close(fs, fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static int workload_randread(run_t *run)
+{
+    int fd = make_file(run->fs, "/data", READ_FILE_BYTES);
+    if(fd < 0)
+    {
+        printf("Could not write /data\n");
+        return -1;
+    }
+    uint8_t buffer[READ_BYTES];
+    for(int i = 0; i < READ_OPS; i++)
+    {
+        off_t offset = rng_next() % (READ_FILE_BYTES - READ_BYTES);
+        op_begin(run);
+        off_t at = fs_seek(run->fs, fd, offset, FS_SEEK_SET);
+        ssize_t got = fs_read(run->fs, fd, buffer, sizeof(buffer));
+        op_end(run);
+        if(at != offset || got != (ssize_t)sizeof(buffer) || buffer[0] != (uint8_t)((offset % WRITE_BYTES) * 31 + 7))
+        {
+            printf("Read at %lld went wrong\n", (long long)offset);
+            return -1;
+        }
+    }
+    return fs_close(run->fs, fd);
+}
+
+static int workload_seqwrite(run_t *run)
+{
+    static uint8_t chunk[WRITE_BYTES];
+    memset(chunk, 0x5a, sizeof(chunk));
+    for(int round = 0; round < WRITE_ROUNDS; round++)
+    {
+        if(fs_create(run->fs, "/big", FS_REGULAR) < 0)
+        {
+            return -1;
+        }
+        int fd = fs_open(run->fs, "/big");
+        for(size_t done = 0; fd >= 0 && done < WRITE_FILE_BYTES; done += sizeof(chunk))
+        {
+            op_begin(run);
+            ssize_t wrote = fs_write(run->fs, fd, chunk, sizeof(chunk));
+            op_end(run);
+            if(wrote != (ssize_t)sizeof(chunk))
+            {
+                printf("Write at %zu went wrong\n", done);
+                return -1;
+            }
+        }
+        if(fd < 0 || fs_close(run->fs, fd) < 0 || fs_remove(run->fs, "/big") < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int workload_listdir(run_t *run)
+{
+    if(make_tree(run->fs, NULL) < 0)
+    {
+        return -1;
+    }
+    char path[64];
+    for(int i = 0; i < LIST_OPS; i++)
+    {
+        snprintf(path, sizeof(path), "/d%02d", i % DIRS);
+        op_begin(run);
+        dyn_array_t *entries = fs_get_dir(run->fs, path);
+        op_end(run);
+        if(entries == NULL || dyn_array_size(entries) != FILES)
+        {
+            printf("Listing %s went wrong\n", path);
+            dyn_array_destroy(entries);
+            return -1;
+        }
+        dyn_array_destroy(entries);
+    }
+    return 0;
+}
+
+static int workload_readdir(run_t *run)
+{
+    if(make_tree(run->fs, NULL) < 0)
+    {
+        return -1;
+    }
+    char path[64];
+    file_record_t entry;
+    for(int i = 0; i < LIST_OPS; i++)
+    {
+        snprintf(path, sizeof(path), "/d%02d", i % DIRS);
+        op_begin(run);
+        fs_dir_t *dir = fs_opendir(run->fs, path);
+        int entries = 0;
+        while(dir != NULL && fs_readdir(run->fs, dir, &entry) > 0)
+        {
+            entries++;
+        }
+        fs_closedir(dir);
+        op_end(run);
+        if(dir == NULL || entries != FILES)
+        {
+            printf("Reading %s went wrong\n", path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// adds up the file as the scans read it, so neither can skip the bytes
+static uint64_t scan_sum(const uint8_t *bytes, size_t n)
+{
+    uint64_t sum = 0;
+    uint64_t word;
+    size_t i = 0;
+    for(; i + sizeof(word) <= n; i += sizeof(word))
+    {
+        memcpy(&word, bytes + i, sizeof(word));
+        sum += word;
+    }
+    for(; i < n; i++)
+    {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static int workload_scan(run_t *run)
+{
+    int fd = make_file(run->fs, "/data", READ_FILE_BYTES);
+    if(fd < 0)
+    {
+        printf("Could not write /data\n");
+        return -1;
+    }
+    static uint8_t chunk[WRITE_BYTES];
+    uint64_t expect = 0;
+    for(int i = 0; i < SCAN_OPS; i++)
+    {
+        op_begin(run);
+        uint64_t sum = 0;
+        ssize_t got = fs_seek(run->fs, fd, 0, FS_SEEK_SET) == 0 ? 1 : -1;
+        while(got > 0)
+        {
+            got = fs_read(run->fs, fd, chunk, sizeof(chunk));
+            sum += scan_sum(chunk, got > 0 ? got : 0);
+        }
+        op_end(run);
+        if(got < 0 || (i > 0 && sum != expect))
+        {
+            printf("Scan %d went wrong\n", i);
+            return -1;
+        }
+        expect = sum;
+    }
+    return fs_close(run->fs, fd);
+}
+
+static int workload_mapscan(run_t *run)
+{
+    int fd = make_file(run->fs, "/data", READ_FILE_BYTES);
+    if(fd < 0)
+    {
+        printf("Could not write /data\n");
+        return -1;
+    }
+    uint64_t expect = 0;
+    for(int i = 0; i < SCAN_OPS; i++)
+    {
+        op_begin(run);
+        uint64_t sum = 0;
+        int unmapped = 0;
+        for(size_t at = 0; at < READ_FILE_BYTES && unmapped == 0; at += WRITE_BYTES)
+        {
+            const uint8_t *view = (const uint8_t *)fs_mmap(run->fs, fd, at, WRITE_BYTES);
+            sum += view == NULL ? 0 : scan_sum(view, WRITE_BYTES);
+            unmapped = view == NULL ? -1 : fs_munmap(run->fs, view, WRITE_BYTES);
+        }
+        op_end(run);
+        if(unmapped < 0 || (i > 0 && sum != expect))
+        {
+            printf("Scan %d went wrong\n", i);
+            return -1;
+        }
+        expect = sum;
+    }
+    return fs_close(run->fs, fd);
+}
+
+static int workload_mixed(run_t *run)
+{
+    FS_t *fs = run->fs;
+    char path[64];
+    size_t size[MIXED_DIRS * MIXED_FILES] = {0};
+    bool exists[MIXED_DIRS * MIXED_FILES] = {false};
+    static uint8_t buffer[MIXED_IO_BYTES];
+    for(int d = 0; d < MIXED_DIRS; d++)
+    {
+        snprintf(path, sizeof(path), "/m%d", d);
+        if(fs_create(fs, path, FS_DIRECTORY) < 0)
+        {
+            return -1;
+        }
+    }
+
+    for(int i = 0; i < MIXED_OPS; i++)
+    {
+        uint64_t r = rng_next();
+        size_t file = (r >> 8) % (MIXED_DIRS * MIXED_FILES);
+        int kind = r % 10;
+        snprintf(path, sizeof(path), "/m%zu/f%02zu", file / MIXED_FILES, file % MIXED_FILES);
+        bool ok = true;
+        op_begin(run);
+        if(!exists[file])
+        {
+            ok = fs_create(fs, path, FS_REGULAR) == 0;
+            exists[file] = true;
+            size[file] = 0;
+        }
+        else if(kind <= 1 || (kind <= 4 && size[file] >= MIXED_MAX_BYTES))
+        {
+            ok = fs_remove(fs, path) == 0;
+            exists[file] = false;
+        }
+        else if(kind <= 4)
+        {
+            // append
+            int fd = fs_open(fs, path);
+            ok = fd >= 0 && fs_seek(fs, fd, size[file], FS_SEEK_SET) == (off_t)size[file] &&
+                fs_write(fs, fd, buffer, sizeof(buffer)) == (ssize_t)sizeof(buffer);
+            ok = fs_close(fs, fd) == 0 && ok;
+            size[file] += sizeof(buffer);
+        }
+        else if(kind <= 8)
+        {
+            int fd = fs_open(fs, path);
+            ssize_t want = size[file] < sizeof(buffer) ? (ssize_t)size[file] : (ssize_t)sizeof(buffer);
+            ok = fd >= 0 && fs_read(fs, fd, buffer, sizeof(buffer)) == want;
+            ok = fs_close(fs, fd) == 0 && ok;
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "/m%zu", file / MIXED_FILES);
+            dyn_array_t *entries = fs_get_dir(fs, path);
+            ok = entries != NULL;
+            dyn_array_destroy(entries);
+        }
+        op_end(run);
+        if(!ok)
+        {
+            printf("Mixed op %d (%d on %s) went wrong\n", i, kind, path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const struct
+{
+    const char *name;
+    int (*run)(run_t *);
+} workloads[] = {
+    {"create", workload_create},
+    {"randread", workload_randread},
+    {"seqwrite", workload_seqwrite},
+    {"listdir", workload_listdir},
+    {"readdir", workload_readdir},
+    {"mixed", workload_mixed},
+    {"scan", workload_scan},
+    {"mapscan", workload_mapscan},
+};
+
+#define WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static int run_workload(size_t w, const char *image, bool verbose)
+{
+    run_t run;
+    memset(&run, 0, sizeof(run));
+    rng_state = 0x9e3779b97f4a7c15ull;
+    run.fs = fs_format(image);
+    if(run.fs == NULL)
+    {
+        printf("Could not format %s\n", image);
+        return 1;
+    }
+    int result = workloads[w].run(&run);
+    fs_unmount(run.fs);
+    if(result == 0)
+    {
+        report(&run, workloads[w].name, verbose);
+    }
+    free(run.latency);
+    return result == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *image = "bench_fs.FS";
+    bool chosen[WORKLOADS] = {false};
+    bool any = false;
+    bool verbose = false;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-v") == 0)
+        {
+            verbose = true;
+            continue;
+        }
+        size_t w = 0;
+        while(w < WORKLOADS && strcmp(argv[i], workloads[w].name) != 0)
+        {
+            w++;
+        }
+        if(w == WORKLOADS)
+        {
+            printf("Usage: %s [-v] [create|randread|seqwrite|listdir|readdir|mixed|scan|mapscan]...\n", argv[0]);
+            return 1;
+        }
+        chosen[w] = any = true;
+    }
+
+    printf("%-9s %8s %12s %10s %10s %10s %10s\n", "workload", "ops", "ops/s", "p50 us", "p99 us", "reads/op", "writes/op");
+    int failed = 0;
+    for(size_t w = 0; w < WORKLOADS; w++)
+    {
+        if(!any || chosen[w])
+        {
+            failed |= run_workload(w, image, verbose);
+        }
+    }
+    remove(image);
+    return failed;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FS.h"
+
+// Runs the same metadata-heavy workloads on an image of each layout (fs_format_layout):
+//   open    fs_open + fs_close of files three directories down, a descriptor taken and given back per op
+//   stat    fs_stat of the same files, inode reads only
+//   create  files created and removed again in one directory, inodes taken and given back
+//   fds     all descriptors opened on one file, then closed, one op per descriptor
+// Data is not touched, so the difference is the cost of getting at inodes and descriptors.
+// Each workload runs ROUNDS times and the best round counts, which keeps out most of the noise.
+
+#define FILES 64
+#define PATH_OPS 200000
+#define CREATE_ROUNDS 400
+#define FD_ROUNDS 400
+#define FDS 256
+#define ROUNDS 5
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int make_tree(FS_t *fs)
+{
+    char path[64];
+    if(fs_create(fs, "/a", FS_DIRECTORY) < 0 || fs_create(fs, "/a/b", FS_DIRECTORY) < 0 || fs_create(fs, "/a/b/c", FS_DIRECTORY) < 0
+            || fs_create(fs, "/new", FS_DIRECTORY) < 0)
+    {
+        return -1;
+    }
+    for(int f = 0; f < FILES; f++)
+    {
+        snprintf(path, sizeof(path), "/a/b/c/f%02d", f);
+        if(fs_create(fs, path, FS_REGULAR) < 0)
+        {
+            printf("Could not create %s\n", path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static long workload_open(FS_t *fs)
+{
+    char path[64];
+    for(long i = 0; i < PATH_OPS; i++)
+    {
+        snprintf(path, sizeof(path), "/a/b/c/f%02ld", i % FILES);
+        int fd = fs_open(fs, path);
+        if(fd < 0 || fs_close(fs, fd) < 0)
+        {
+            return -1;
+        }
+    }
+    return PATH_OPS;
+}
+
+static long workload_stat(FS_t *fs)
+{
+    char path[64];
+    fs_stat_t st;
+    for(long i = 0; i < PATH_OPS; i++)
+    {
+        snprintf(path, sizeof(path), "/a/b/c/f%02ld", i % FILES);
+        if(fs_stat(fs, path, &st) < 0)
+        {
+            return -1;
+        }
+    }
+    return PATH_OPS;
+}
+
+static long workload_create(FS_t *fs)
+{
+    char path[64];
+    for(int round = 0; round < CREATE_ROUNDS; round++)
+    {
+        for(int f = 0; f < FILES; f++)
+        {
+            snprintf(path, sizeof(path), "/new/f%02d", f);
+            if(fs_create(fs, path, FS_REGULAR) < 0)
+            {
+                return -1;
+            }
+        }
+        for(int f = 0; f < FILES; f++)
+        {
+            snprintf(path, sizeof(path), "/new/f%02d", f);
+            if(fs_remove(fs, path) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+    return 2L * CREATE_ROUNDS * FILES;
+}
+
+static long workload_fds(FS_t *fs)
+{
+    int fds[FDS];
+    for(int round = 0; round < FD_ROUNDS; round++)
+    {
+        for(int i = 0; i < FDS; i++)
+        {
+            fds[i] = fs_open(fs, "/a/b/c/f00");
+            if(fds[i] < 0)
+            {
+                return -1;
+            }
+        }
+        for(int i = 0; i < FDS; i++)
+        {
+            if(fs_close(fs, fds[i]) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+    return 2L * FD_ROUNDS * FDS;
+}
+
+static const struct
+{
+    const char *name;
+    long (*run)(FS_t *fs);
+} workloads[] = {
+    {"open", workload_open},
+    {"stat", workload_stat},
+    {"create", workload_create},
+    {"fds", workload_fds},
+};
+
+#define WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+int main(int argc, char **argv)
+{
+    const char *image = argc > 1 ? argv[1] : "bench_layout.FS";
+    const char *layouts[FS_LAYOUT_COUNT] = {"block_store", "table"};
+    double rate[FS_LAYOUT_COUNT][WORKLOADS];
+    int failed = 0;
+    for(int layout = 0; layout < FS_LAYOUT_COUNT && !failed; layout++)
+    {
+        FS_t *fs = fs_format_layout(image, (fs_layout_t)layout);
+        if(fs == NULL || make_tree(fs) < 0)
+        {
+            printf("Could not set up %s on %s\n", layouts[layout], image);
+            fs_unmount(fs);
+            remove(image);
+            return 1;
+        }
+        for(size_t w = 0; w < WORKLOADS && !failed; w++)
+        {
+            rate[layout][w] = 0;
+            for(int round = 0; round < ROUNDS && !failed; round++)
+            {
+                double start = now_seconds();
+                long ops = workloads[w].run(fs);
+                double elapsed = now_seconds() - start;
+                if(ops < 0)
+                {
+                    printf("%s failed on %s\n", workloads[w].name, layouts[layout]);
+                    failed = 1;
+                }
+                else if(ops / elapsed > rate[layout][w])
+                {
+                    rate[layout][w] = ops / elapsed;
+                }
+            }
+        }
+        fs_unmount(fs);
+        remove(image);
+    }
+    if(failed)
+    {
+        return 1;
+    }
+
+    printf("%-8s %14s %14s %8s\n", "workload", "block_store/s", "table/s", "speedup");
+    for(size_t w = 0; w < WORKLOADS; w++)
+    {
+        printf("%-8s %14.0f %14.0f %7.2fx\n", workloads[w].name, rate[FS_LAYOUT_BLOCK_STORE][w], rate[FS_LAYOUT_TABLE][w],
+               rate[FS_LAYOUT_TABLE][w] / rate[FS_LAYOUT_BLOCK_STORE][w]);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FS.h"
+
+// Publishes GROUPS groups of FILES files, each written under a temporary name and moved into its
+// directory, the way a group that has to show up together is put out. Once with a transaction
+// per file and once with a transaction per group: a commit costs two syncs however much it
+// holds, so the batch pays them once. The image is written out whole first, so every commit
+// goes through the journal.
+
+#define GROUPS 8
+#define FILES 16
+#define FILE_BYTES 8192
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int publish(FS_t *fs, int group, int file, const char *data)
+{
+    char tmp[64];
+    char path[64];
+    snprintf(tmp, sizeof(tmp), "/tmp%02d", file);
+    snprintf(path, sizeof(path), "/g%02d/f%02d", group, file);
+    int fd = fs_create(fs, tmp, FS_REGULAR) == 0 ? fs_open(fs, tmp) : -1;
+    if(fd < 0 || fs_write(fs, fd, data, FILE_BYTES) != FILE_BYTES || fs_close(fs, fd) < 0 || fs_move(fs, tmp, path) < 0)
+    {
+        printf("Could not publish %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// \param batch files per transaction
+static int run(FS_t *fs, int batch, const char *data)
+{
+    char path[64];
+    for(int group = 0; group < GROUPS; group++)
+    {
+        snprintf(path, sizeof(path), "/g%02d", group);
+        if(fs_create(fs, path, FS_DIRECTORY) < 0)
+        {
+            return -1;
+        }
+        for(int file = 0; file < FILES; file++)
+        {
+            if((file % batch == 0 && fs_txn_begin(fs) < 0) || publish(fs, group, file, data) < 0
+                    || ((file + 1) % batch == 0 && fs_txn_commit(fs) < 0))
+            {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *image = argc > 1 ? argv[1] : "bench_txn.FS";
+    char *data = (char *)malloc(FILE_BYTES);
+    if(data == NULL)
+    {
+        return 1;
+    }
+    memset(data, 'p', FILE_BYTES);
+
+    printf("%-8s %8s %8s %10s %10s\n", "txn", "commits", "syncs", "ms", "files/s");
+    const char *names[] = {"file", "group"};
+    const int batches[] = {1, FILES};
+    int failed = 0;
+    for(int way = 0; way < 2 && !failed; way++)
+    {
+        FS_t *fs = fs_format(image);
+        if(fs == NULL || fs_unmount(fs) < 0 || (fs = fs_mount(image)) == NULL)
+        {
+            printf("Could not set up %s\n", image);
+            free(data);
+            return 1;
+        }
+        fs_stats_t before, after;
+        fs_get_stats(fs, &before);
+        double start = now_seconds();
+        failed = run(fs, batches[way], data) < 0;
+        double elapsed = now_seconds() - start;
+        fs_get_stats(fs, &after);
+        uint64_t commits = after.call[FS_CALL_TXN_COMMIT].calls - before.call[FS_CALL_TXN_COMMIT].calls;
+        printf("%-8s %8" PRIu64 " %8" PRIu64 " %10.1f %10.0f\n", names[way], commits, after.syncs - before.syncs, elapsed * 1e3,
+               GROUPS * FILES / elapsed);
+        fs_unmount(fs);
+        remove(image);
+    }
+    free(data);
+    return failed;
+}
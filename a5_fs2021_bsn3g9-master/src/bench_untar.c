@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FS.h"
+
+// "Untars" a synthetic archive of N files into a fresh image, once through
+// fs_create/fs_remove and once through fs_create_batch/fs_remove_batch.
+// The image tops out at 256 inodes (a directory block holds many more short names
+// than that), so the archive is extracted in waves: each wave unpacks DIRS
+// directories of FILES files each, then the wave is deleted to make room for the
+// next one. Only metadata is timed.
+
+#define DIRS 8
+#define FILES 30    // per directory, as many as the inodes allow: 8 * (30 + 1) + root < 256
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one wave through the single-file API, returns files created or -1
+static int wave_single(FS_t *fs, int files)
+{
+    char path[64];
+    int made = 0;
+    for(int d = 0; d < DIRS && made < files; d++)
+    {
+        snprintf(path, sizeof(path), "/d%02d", d);
+        if(fs_create(fs, path, FS_DIRECTORY) < 0)
+        {
+            return -1;
+        }
+        for(int f = 0; f < FILES && made < files; f++, made++)
+        {
+            snprintf(path, sizeof(path), "/d%02d/f%02d", d, f);
+            if(fs_create(fs, path, FS_REGULAR) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+    int left = made;
+    for(int d = 0; d < DIRS && left > 0; d++)
+    {
+        for(int f = 0; f < FILES && left > 0; f++, left--)
+        {
+            snprintf(path, sizeof(path), "/d%02d/f%02d", d, f);
+            if(fs_remove(fs, path) < 0)
+            {
+                return -1;
+            }
+        }
+        snprintf(path, sizeof(path), "/d%02d", d);
+        if(fs_remove(fs, path) < 0)
+        {
+            return -1;
+        }
+    }
+    return made;
+}
+
+// the same wave through the batch API
+static int wave_batch(FS_t *fs, int files)
+{
+    char dir_names[DIRS][8];
+    char file_names[FILES][8];
+    const char *dir_ptrs[DIRS];
+    const char *file_ptrs[FILES];
+    file_t dir_types[DIRS];
+    file_t file_types[FILES];
+    for(int d = 0; d < DIRS; d++)
+    {
+        snprintf(dir_names[d], sizeof(dir_names[d]), "d%02d", d);
+        dir_ptrs[d] = dir_names[d];
+        dir_types[d] = FS_DIRECTORY;
+    }
+    for(int f = 0; f < FILES; f++)
+    {
+        snprintf(file_names[f], sizeof(file_names[f]), "f%02d", f);
+        file_ptrs[f] = file_names[f];
+        file_types[f] = FS_REGULAR;
+    }
+
+    int dirs = (files + FILES - 1) / FILES;
+    if(dirs > DIRS)
+    {
+        dirs = DIRS;
+    }
+    if(fs_create_batch(fs, "/", dir_ptrs, dir_types, dirs) < 0)
+    {
+        return -1;
+    }
+    char path[16];
+    int made = 0;
+    for(int d = 0; d < dirs; d++)
+    {
+        int n = files - made < FILES ? files - made : FILES;
+        snprintf(path, sizeof(path), "/%s", dir_names[d]);
+        if(fs_create_batch(fs, path, file_ptrs, file_types, n) < 0 || fs_remove_batch(fs, path, file_ptrs, n) < 0)
+        {
+            return -1;
+        }
+        made += n;
+    }
+    if(fs_remove_batch(fs, "/", dir_ptrs, dirs) < 0)
+    {
+        return -1;
+    }
+    return made;
+}
+
+static int run(const char *image, int total, int (*wave)(FS_t *, int), const char *label)
+{
+    FS_t *fs = fs_format(image);
+    if(fs == NULL)
+    {
+        printf("Could not format %s\n", image);
+        return 1;
+    }
+
+    double start = now_seconds();
+    int done = 0;
+    while(done < total)
+    {
+        int want = total - done < DIRS * FILES ? total - done : DIRS * FILES;
+        int made = wave(fs, want);
+        if(made <= 0)
+        {
+            printf("%s: failed after %d files\n", label, done);
+            fs_unmount(fs);
+            return 1;
+        }
+        done += made;
+    }
+    double elapsed = now_seconds() - start;
+    fs_unmount(fs);
+
+    // every file is created once and removed once
+    printf("%-8s %8d files  %8.3f s  %10.0f files/s  %8.2f us/op\n", label, done, elapsed,
+            done / elapsed, elapsed * 1e6 / (2.0 * done));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 3)
+    {
+        printf("Usage: %s [files] [image]\n", argv[0]);
+        return 1;
+    }
+    int total = argc > 1 ? atoi(argv[1]) : 100000;
+    const char *image = argc > 2 ? argv[2] : "bench_untar.FS";
+    if(total <= 0)
+    {
+        printf("files must be positive\n");
+        return 1;
+    }
+
+    if(run(image, total, wave_single, "single") != 0 || run(image, total, wave_batch, "batch") != 0)
+    {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FS.h"
+
+// Builds a tree of about 39k entries and walks it three ways: by hand with fs_get_dir, which
+// resolves every directory's path from the root again, then with fs_walk on one thread and with
+// FS_WALK_PARALLEL. Each walk adds up the sizes of the files it finds, so all three have to
+// read every inode; the totals must agree.
+// An image only has 256 inodes and a file at most 255 names, so no tree has more than 65k
+// entries; this one spends the inodes on TOPS * SUBS directories holding NAMES hard links each
+// to FILES files in the root, which is as big as it gets without linking directories.
+
+#define TOPS 8
+#define SUBS 11
+#define NAMES 440           // three-character names, 440 records of 9 bytes fill most of a block
+#define FILES 158           // 1 + TOPS + TOPS * SUBS + FILES = 255 inodes, about 245 names each
+#define ROUNDS 5
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int make_tree(FS_t *fs)
+{
+    char path[64];
+    char target[64];
+    char data[FILES * 64];
+    memset(data, 'b', sizeof(data));
+    for(int f = 0; f < FILES; f++)
+    {
+        snprintf(path, sizeof(path), "/f%03d", f);
+        int fd = fs_create(fs, path, FS_REGULAR) == 0 ? fs_open(fs, path) : -1;
+        if(fd < 0 || fs_write(fs, fd, data, (f + 1) * 64) != (f + 1) * 64 || fs_close(fs, fd) < 0)
+        {
+            printf("Could not create %s\n", path);
+            return -1;
+        }
+    }
+    for(int t = 0; t < TOPS; t++)
+    {
+        snprintf(path, sizeof(path), "/t%02d", t);
+        if(fs_create(fs, path, FS_DIRECTORY) < 0)
+        {
+            printf("Could not create %s\n", path);
+            return -1;
+        }
+        for(int s = 0; s < SUBS; s++)
+        {
+            snprintf(path, sizeof(path), "/t%02d/s%02d", t, s);
+            if(fs_create(fs, path, FS_DIRECTORY) < 0)
+            {
+                printf("Could not create %s\n", path);
+                return -1;
+            }
+            for(int n = 0; n < NAMES; n++)
+            {
+                snprintf(target, sizeof(target), "/f%03d", ((t * SUBS + s) * NAMES + n) % FILES);
+                snprintf(path, sizeof(path), "/t%02d/s%02d/%03d", t, s, n);
+                if(fs_link(fs, target, path) < 0)
+                {
+                    printf("Could not link %s\n", path);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+typedef struct
+{
+    size_t entries;
+    size_t bytes;
+} tally_t;
+
+// the walk fs_walk replaces: list a directory by path, open each file for its size, recurse
+static int walk_by_path(FS_t *fs, const char *dir_path, tally_t *tally)
+{
+    dyn_array_t *entries = fs_get_dir(fs, dir_path);
+    if(entries == NULL)
+    {
+        return -1;
+    }
+    char path[256];
+    int result = 0;
+    for(size_t i = 0; i < dyn_array_size(entries) && result == 0; i++)
+    {
+        const file_record_t *entry = (const file_record_t *)dyn_array_at(entries, i);
+        snprintf(path, sizeof(path), "%s/%s", strcmp(dir_path, "/") == 0 ? "" : dir_path, entry->name);
+        tally->entries++;
+        if(entry->type == FS_DIRECTORY)
+        {
+            result = walk_by_path(fs, path, tally);
+            continue;
+        }
+        int fd = fs_open(fs, path);
+        off_t size = fd < 0 ? -1 : fs_seek(fs, fd, 0, FS_SEEK_END);
+        if(fd < 0 || size < 0 || fs_close(fs, fd) < 0)
+        {
+            result = -1;
+        }
+        tally->bytes += size;
+    }
+    dyn_array_destroy(entries);
+    return result;
+}
+
+static int count_entry(const fs_walk_entry_t *entry, void *arg)
+{
+    tally_t *tally = (tally_t *)arg;
+    __atomic_fetch_add(&tally->entries, 1, __ATOMIC_RELAXED);
+    if(entry->type == FS_REGULAR)
+    {
+        __atomic_fetch_add(&tally->bytes, entry->size, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *image = argc > 1 ? argv[1] : "bench_walk.FS";
+    FS_t *fs = fs_format(image);
+    if(fs == NULL)
+    {
+        printf("Could not format %s\n", image);
+        return 1;
+    }
+    if(make_tree(fs) < 0)
+    {
+        fs_unmount(fs);
+        remove(image);
+        return 1;
+    }
+
+    printf("%-10s %10s %12s %10s %14s\n", "walk", "entries", "bytes", "ms", "entries/s");
+    const char *names[] = {"get_dir", "fs_walk", "parallel"};
+    tally_t first = {0, 0};
+    int failed = 0;
+    for(int way = 0; way < 3; way++)
+    {
+        tally_t tally = {0, 0};
+        double start = now_seconds();
+        for(int round = 0; round < ROUNDS; round++)
+        {
+            tally.entries = tally.bytes = 0;
+            int result = way == 0 ? walk_by_path(fs, "/", &tally)
+                : (int)fs_walk(fs, "/", count_entry, &tally, FS_WALK_SIZE | (way == 2 ? FS_WALK_PARALLEL : 0));
+            if(result < 0)
+            {
+                printf("%s failed\n", names[way]);
+                failed = 1;
+                break;
+            }
+        }
+        double elapsed = (now_seconds() - start) / ROUNDS;
+        if(way == 0)
+        {
+            first = tally;
+        }
+        else if(tally.entries != first.entries || tally.bytes != first.bytes)
+        {
+            printf("%s found %zu entries of %zu bytes, not %zu of %zu\n", names[way], tally.entries, tally.bytes, first.entries, first.bytes);
+            failed = 1;
+        }
+        printf("%-10s %10zu %12zu %10.1f %14.0f\n", names[way], tally.entries, tally.bytes, elapsed * 1e3, tally.entries / elapsed);
+    }
+
+    fs_unmount(fs);
+    remove(image);
+    return failed;
+}
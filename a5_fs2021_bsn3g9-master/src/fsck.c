@@ -0,0 +1,95 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "FS.h"
+
+// fsck [-r] [-j threads] <image>
+//  Checks an image and prints what it found, repairing it with -r.
+//  Exits 0 if the image was consistent, 1 if every problem was repaired,
+//  4 if problems are left and 8 if the image could not be checked (like e2fsck).
+//  A missing or unreadable image is the last case: "fsck /no/such.img" prints why and exits 8
+//  (a_tests checks that fs_mount returns NULL for it).
+
+int main(int argc, char **argv)
+{
+    bool repair = false;
+    size_t threads = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "rj:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'r':
+            repair = true;
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if(optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-r] [-j threads] <image>\n", argv[0]);
+        return 8;
+    }
+
+    FS_t *fs = fs_mount(argv[optind]);
+    if(fs == NULL)
+    {
+        fprintf(stderr, "Could not mount %s: no image there, or it cannot be read\n", argv[optind]);
+        return 8;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fs_check_t report;
+    ssize_t problems = fs_check(fs, threads, repair, &report);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if(problems < 0)
+    {
+        fprintf(stderr, "Could not check %s\n", argv[optind]);
+        fs_unmount(fs);
+        return 8;
+    }
+
+    printf("%s: %zu inodes, %zu blocks in use, checked in %.3f s\n", argv[optind], report.inodes, report.blocks,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    const struct
+    {
+        const char *what;
+        size_t count;
+    } found[] = {
+        { "bad block pointers", report.bad_pointers },
+        { "cross-linked blocks", report.cross_links },
+        { "bad directory entries", report.bad_entries },
+        { "wrong link counts", report.link_counts },
+        { "orphaned inodes", report.orphans },
+        { "blocks in use but free in the bitmap", report.unmarked },
+        { "leaked blocks", report.leaked },
+        { "wrong owner counts", report.refcounts },
+    };
+    for(size_t i = 0; i < sizeof(found) / sizeof(found[0]); i++)
+    {
+        if(found[i].count != 0)
+        {
+            printf("  %zu %s\n", found[i].count, found[i].what);
+        }
+    }
+    if(repair)
+    {
+        printf("  %zu repaired\n", report.repaired);
+    }
+
+    if(fs_unmount(fs) != 0)
+    {
+        fprintf(stderr, "Could not write %s back\n", argv[optind]);
+        return 8;
+    }
+    if(problems == 0)
+    {
+        return 0;
+    }
+    return repair && report.repaired >= (size_t)problems ? 1 : 4;
+}
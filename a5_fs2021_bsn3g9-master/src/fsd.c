@@ -0,0 +1,52 @@
+#include <signal.h>
+#include <unistd.h>
+
+#include "FS.h"
+#include "FS_server.h"
+
+// fsd <image> <socket> [workers]
+//  Mounts (or formats) an image and serves it until SIGINT/SIGTERM.
+
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 4)
+    {
+        fprintf(stderr, "usage: %s <image> <socket> [workers]\n", argv[0]);
+        return 1;
+    }
+    size_t workers = argc == 4 ? strtoul(argv[3], NULL, 10) : 4;
+    if(workers == 0)
+    {
+        fprintf(stderr, "workers must be at least 1\n");
+        return 1;
+    }
+
+    // block the signals before any thread starts so only sigwait sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    FS_t *fs = access(argv[1], F_OK) == 0 ? fs_mount(argv[1]) : fs_format(argv[1]);
+    if(fs == NULL)
+    {
+        fprintf(stderr, "Could not mount %s\n", argv[1]);
+        return 1;
+    }
+    fs_server_t *server = fs_server_start(fs, argv[2], workers);
+    if(server == NULL)
+    {
+        fprintf(stderr, "Could not serve on %s\n", argv[2]);
+        fs_unmount(fs);
+        return 1;
+    }
+    printf("serving %s on %s with %zu workers\n", argv[1], argv[2], workers);
+    fflush(stdout);
+
+    int signal_number = 0;
+    sigwait(&signals, &signal_number);
+
+    fs_server_stop(server);
+    return fs_unmount(fs) == 0 ? 0 : 1;
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <new>
@@ -8,7 +9,14 @@ using std::string;
 extern "C" 
 {
 #include "FS.h"
+#include "FS_async.h"
+#include "FS_server.h"
+#include "FS_client.h"
 }
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 extern unsigned int score;
 extern unsigned int total;
@@ -58,6 +66,7 @@ bool find_in_directory(const dyn_array_t *const record_arr, const char *fname)
    1   Normal
    2   NULL
    3   Empty string
+   4   No image at the path
    int fs_unmount(FS *fs);
    1   Normal
    2   NULL
@@ -93,6 +102,10 @@ TEST(a_tests, format_mount_unmount)
 
     // MOUNT 3
     ASSERT_EQ(fs_mount(""), nullptr);
+
+    // MOUNT 4
+    remove("a_tests.missing.FS");
+    ASSERT_EQ(fs_mount("a_tests.missing.FS"), nullptr);
 }
 
 /*
@@ -261,7 +274,9 @@ TEST(b_tests, file_creation_two)
     }
 
     // CREATE_FILE 19
-    ASSERT_LT(fs_create(fs, "/a/F", FS_DIRECTORY), 0);
+    // (directories no longer fill up at 31 short names, so this one fits and goes again)
+    ASSERT_EQ(fs_create(fs, "/a/F", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_remove(fs, "/a/F"), 0);
     
     // Start making files to use up the remaining 31 inodes
     fname[0] = '/';
@@ -1233,37 +1248,12 @@ TEST(j_tests, link) {
 
 	// 9. Error, dst parent full
 	ASSERT_EQ(fs_create(fs, "/folder1", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/1", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/2", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/3", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/4", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/5", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/6", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/7", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/8", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/9", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/10", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/11", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/12", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/13", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/14", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/15", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/16", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/17", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/18", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/19", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/20", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/21", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/22", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/23", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/24", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/25", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/26", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/27", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/28", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/29", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/30", FS_DIRECTORY), 0);
-	ASSERT_EQ(fs_create(fs, "/folder1/31", FS_DIRECTORY), 0);
+	char long_path[9 + 126 + 1];	// 31 of the longest names fill a directory's block
+	for (int i = 1; i <= 31; i++)
+	{
+		snprintf(long_path, sizeof(long_path), "/folder1/%02d%0124d", i, 0);
+		ASSERT_EQ(fs_create(fs, long_path, FS_DIRECTORY), 0);
+	}
 	ASSERT_LT(fs_link(fs, "/file", "/folder1/file"), 0);
 	score++;
 
@@ -1333,6 +1323,2037 @@ TEST(j_tests, link) {
 }
 
 
+/*
+   fs_ring_t *fs_ring_create(FS_t *fs, size_t entries, size_t workers);
+   ssize_t fs_submit(fs_ring_t *ring, const fs_sqe_t *batch, size_t n);
+   ssize_t fs_reap(fs_ring_t *ring, fs_cqe_t *completions, size_t max, size_t min_complete);
+   1. Normal, open a batch of files, completions carry the fds
+   2. Normal, back-to-back writes on one fd (merged), read back through the ring
+   3. Normal, more submissions than entries, only what fits is queued
+   4. Error, bad fd completes with an error
+   5. Error, NULL ring / batch
+ */
+TEST(k_tests, async_ring)
+{
+	vector<const char *> fnames
+	{
+		"/file_a",
+		"/file_b",
+		"/file_c",
+		"/file_d"
+	};
+
+	const char *test_fname = "k_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	for (const char *fname : fnames)
+	{
+		ASSERT_EQ(fs_create(fs, fname, FS_REGULAR), 0);
+	}
+
+	fs_ring_t *ring = fs_ring_create(fs, 16, 4);
+	ASSERT_NE(ring, nullptr);
+
+	// 1
+	fs_sqe_t sqe[16];
+	fs_cqe_t cqe[16];
+	int fds[4];
+	memset(sqe, 0, sizeof(sqe));
+	for (int i = 0; i < 4; i++)
+	{
+		sqe[i].op = FS_OP_OPEN;
+		sqe[i].path = fnames[i];
+		sqe[i].user_data = i;
+	}
+	ASSERT_EQ(fs_submit(ring, sqe, 4), 4);
+	ASSERT_EQ(fs_reap(ring, cqe, 16, 4), 4);
+	for (int i = 0; i < 4; i++)
+	{
+		ASSERT_GE(cqe[i].result, 0);
+		fds[cqe[i].user_data] = cqe[i].result;
+	}
+
+	// 2
+	uint8_t data[4][3 * 1000];
+	uint8_t check[4][3 * 1000];
+	size_t n = 0;
+	for (int f = 0; f < 4; f++)
+	{
+		memset(data[f], 0x11 * (f + 1), sizeof(data[f]));
+		for (int part = 0; part < 3; part++, n++)
+		{
+			memset(&sqe[n], 0, sizeof(fs_sqe_t));
+			sqe[n].op = FS_OP_WRITE;
+			sqe[n].fd = fds[f];
+			sqe[n].buf = data[f] + part * 1000;
+			sqe[n].nbyte = 1000;
+			sqe[n].offset = -1;
+			sqe[n].user_data = n;
+		}
+	}
+	ASSERT_EQ(fs_submit(ring, sqe, n), (ssize_t) n);
+	ASSERT_EQ(fs_reap(ring, cqe, 16, n), (ssize_t) n);
+	for (size_t i = 0; i < n; i++)
+	{
+		ASSERT_EQ(cqe[i].result, 1000);
+	}
+	n = 0;
+	for (int f = 0; f < 4; f++)
+	{
+		for (int part = 0; part < 3; part++, n++)
+		{
+			memset(&sqe[n], 0, sizeof(fs_sqe_t));
+			sqe[n].op = FS_OP_READ;
+			sqe[n].fd = fds[f];
+			sqe[n].buf = check[f] + part * 1000;
+			sqe[n].nbyte = 1000;
+			sqe[n].offset = part == 0 ? 0 : -1;
+			sqe[n].user_data = n;
+		}
+	}
+	ASSERT_EQ(fs_submit(ring, sqe, n), (ssize_t) n);
+	ASSERT_EQ(fs_reap(ring, cqe, 16, n), (ssize_t) n);
+	for (size_t i = 0; i < n; i++)
+	{
+		ASSERT_EQ(cqe[i].result, 1000);
+	}
+	ASSERT_EQ(memcmp(data, check, sizeof(data)), 0);
+
+	// 3
+	for (int i = 0; i < 16; i++)
+	{
+		memset(&sqe[i], 0, sizeof(fs_sqe_t));
+		sqe[i].op = FS_OP_OPEN;
+		sqe[i].path = fnames[0];
+	}
+	ASSERT_EQ(fs_submit(ring, sqe, 16), 16);
+	ASSERT_EQ(fs_submit(ring, sqe, 1), 0);
+	ASSERT_EQ(fs_reap(ring, cqe, 16, 16), 16);
+
+	// 4
+	memset(&sqe[0], 0, sizeof(fs_sqe_t));
+	sqe[0].op = FS_OP_CLOSE;
+	sqe[0].fd = 250;
+	ASSERT_EQ(fs_submit(ring, sqe, 1), 1);
+	ASSERT_EQ(fs_reap(ring, cqe, 16, 1), 1);
+	ASSERT_LT(cqe[0].result, 0);
+
+	// 5
+	ASSERT_LT(fs_submit(NULL, sqe, 1), 0);
+	ASSERT_LT(fs_submit(ring, NULL, 1), 0);
+	ASSERT_LT(fs_reap(NULL, cqe, 1, 0), 0);
+	ASSERT_EQ(fs_ring_create(NULL, 16, 1), nullptr);
+
+	fs_ring_destroy(ring);
+	fs_unmount(fs);
+}
+
+/*
+   int fs_create_batch(FS_t *fs, const char *parent_path, const char *const *names, const file_t *types, size_t n);
+   int fs_remove_batch(FS_t *fs, const char *parent_path, const char *const *names, size_t n);
+   1. Normal, batch into root, batch into a subdirectory
+   2. Error, name already exists (nothing created)
+   3. Error, duplicate names inside one batch
+   4. Error, directory would overflow
+   5. Normal, batch remove, open descriptors get closed
+   6. Error, non-empty directory / missing name (nothing removed)
+   7. Error, NULL fs / bad parent
+   8. Normal, both links to one file in the same batch free the file
+ */
+TEST(l_tests, batch_create_remove)
+{
+	const char *test_fname = "l_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+
+	// 1
+	const char *root_names[] = {"dir", "file_a", "file_b"};
+	file_t root_types[] = {FS_DIRECTORY, FS_REGULAR, FS_REGULAR};
+	ASSERT_EQ(fs_create_batch(fs, "/", root_names, root_types, 3), 0);
+	const char *sub_names[] = {"x", "y"};
+	file_t sub_types[] = {FS_REGULAR, FS_REGULAR};
+	ASSERT_EQ(fs_create_batch(fs, "/dir", sub_names, sub_types, 2), 0);
+	dyn_array_t *record_results = fs_get_dir(fs, "/");
+	ASSERT_NE(record_results, nullptr);
+	ASSERT_EQ(dyn_array_size(record_results), 3u);
+	ASSERT_TRUE(find_in_directory(record_results, "file_b"));
+	dyn_array_destroy(record_results);
+	record_results = fs_get_dir(fs, "/dir");
+	ASSERT_NE(record_results, nullptr);
+	ASSERT_EQ(dyn_array_size(record_results), 2u);
+	dyn_array_destroy(record_results);
+
+	// 2
+	const char *clash[] = {"fresh", "file_a"};
+	ASSERT_LT(fs_create_batch(fs, "/", clash, sub_types, 2), 0);
+	ASSERT_LT(fs_open(fs, "/fresh"), 0);
+
+	// 3
+	const char *twice[] = {"same", "same"};
+	ASSERT_LT(fs_create_batch(fs, "/", twice, sub_types, 2), 0);
+
+	// 4
+	char names[31][127];
+	const char *name_ptrs[31];
+	file_t types[31];
+	for (int i = 0; i < 31; i++)
+	{
+		snprintf(names[i], sizeof(names[i]), "n%02d%0123d", i, 0);	// the longest names, 30 fit next to the 3
+		name_ptrs[i] = names[i];
+		types[i] = FS_REGULAR;
+	}
+	ASSERT_LT(fs_create_batch(fs, "/", name_ptrs, types, 31), 0);
+	ASSERT_EQ(fs_create_batch(fs, "/", name_ptrs, types, 30), 0);
+
+	// 5
+	int fd = fs_open(fs, "/dir/x");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_remove_batch(fs, "/dir", sub_names, 2), 0);
+	ASSERT_LT(fs_close(fs, fd), 0);
+	ASSERT_LT(fs_open(fs, "/dir/y"), 0);
+	ASSERT_EQ(fs_remove_batch(fs, "/", name_ptrs, 30), 0);
+
+	// 6
+	ASSERT_EQ(fs_create(fs, "/dir/z", FS_REGULAR), 0);
+	ASSERT_LT(fs_remove_batch(fs, "/", root_names, 3), 0);
+	ASSERT_GE(fs_open(fs, "/file_a"), 0);
+	const char *missing[] = {"file_a", "nope"};
+	ASSERT_LT(fs_remove_batch(fs, "/", missing, 2), 0);
+	ASSERT_GE(fs_open(fs, "/file_a"), 0);
+
+	// 7
+	ASSERT_LT(fs_create_batch(NULL, "/", root_names, root_types, 3), 0);
+	ASSERT_LT(fs_create_batch(fs, "/nope", sub_names, sub_types, 2), 0);
+	ASSERT_LT(fs_create_batch(fs, "/file_a", sub_names, sub_types, 2), 0);
+	ASSERT_LT(fs_remove_batch(NULL, "/", missing, 1), 0);
+
+	// 8
+	uint8_t data[BLOCK_SIZE_BYTES * 2];
+	memset(data, 0x4C, sizeof(data));
+	size_t used = block_store_get_used_blocks(fs->BlockStore_whole);
+	ASSERT_EQ(fs_create(fs, "/linked", FS_REGULAR), 0);
+	fd = fs_open(fs, "/linked");
+	ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t) sizeof(data));
+	ASSERT_EQ(fs_link(fs, "/linked", "/alias"), 0);
+	const char *both[] = {"linked", "alias"};
+	ASSERT_EQ(fs_remove_batch(fs, "/", both, 2), 0);
+	ASSERT_LT(fs_close(fs, fd), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+
+	fs_unmount(fs);
+}
+
+/*
+   int fs_snapshot(FS_t *fs, const char *name);
+   FS_t *fs_mount_snapshot(const char *path, const char *name);
+   int fs_snapshot_delete(FS_t *fs, const char *name);
+   1. Normal, snapshot, then overwrite/remove/create on the live FS; the snapshot still sees the old tree and data
+   2. Error, snapshot mount is read only
+   3. Error, duplicate / bad names, unknown snapshot
+   4. Normal, delete the snapshot, live FS unaffected
+ */
+TEST(m_tests, snapshot)
+{
+	const char *test_fname = "m_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+
+	uint8_t old_data[BLOCK_SIZE_BYTES * 2];
+	uint8_t new_data[BLOCK_SIZE_BYTES * 2];
+	uint8_t check[BLOCK_SIZE_BYTES * 2];
+	memset(old_data, 0x0D, sizeof(old_data));
+	memset(new_data, 0x4E, sizeof(new_data));
+
+	ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/dir/file", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/gone", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/dir/file");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, old_data, sizeof(old_data)), (ssize_t) sizeof(old_data));
+
+	// 1
+	ASSERT_EQ(fs_snapshot(fs, "monday"), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 100, FS_SEEK_SET), 100);
+	ASSERT_EQ(fs_write(fs, fd, new_data, BLOCK_SIZE_BYTES), BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_remove(fs, "/gone"), 0);
+	ASSERT_EQ(fs_create(fs, "/dir/new", FS_REGULAR), 0);
+
+	// 3
+	ASSERT_LT(fs_snapshot(fs, "monday"), 0);
+	ASSERT_LT(fs_snapshot(fs, ""), 0);
+	ASSERT_LT(fs_snapshot(fs, "a_name_that_is_much_too_long_for_it"), 0);
+	ASSERT_LT(fs_snapshot(NULL, "tuesday"), 0);
+	ASSERT_LT(fs_snapshot_delete(fs, "sunday"), 0);
+	fs_unmount(fs);
+	ASSERT_EQ(fs_mount_snapshot(test_fname, "sunday"), nullptr);
+
+	FS *snap = fs_mount_snapshot(test_fname, "monday");
+	ASSERT_NE(snap, nullptr);
+	fd = fs_open(snap, "/dir/file");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(snap, fd, check, sizeof(check)), (ssize_t) sizeof(check));
+	ASSERT_EQ(memcmp(check, old_data, sizeof(check)), 0);
+	ASSERT_GE(fs_open(snap, "/gone"), 0);
+	ASSERT_LT(fs_open(snap, "/dir/new"), 0);
+
+	// 2
+	ASSERT_LT(fs_create(snap, "/nope", FS_REGULAR), 0);
+	ASSERT_LT(fs_write(snap, fd, new_data, 10), 0);
+	ASSERT_LT(fs_remove(snap, "/gone"), 0);
+	ASSERT_LT(fs_snapshot(snap, "again"), 0);
+	fs_unmount(snap);
+
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/dir/file");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t) sizeof(check));
+	ASSERT_EQ(memcmp(check, old_data, 100), 0);
+	ASSERT_EQ(memcmp(check + 100, new_data, BLOCK_SIZE_BYTES), 0);
+	ASSERT_EQ(memcmp(check + 100 + BLOCK_SIZE_BYTES, old_data, BLOCK_SIZE_BYTES - 100), 0);
+	ASSERT_LT(fs_open(fs, "/gone"), 0);
+
+	// 4
+	ASSERT_EQ(fs_snapshot_delete(fs, "monday"), 0);
+	ASSERT_LT(fs_snapshot_delete(fs, "monday"), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t) sizeof(check));
+	ASSERT_EQ(memcmp(check + 100, new_data, BLOCK_SIZE_BYTES), 0);
+	ASSERT_EQ(fs_snapshot(fs, "monday"), 0);
+	fs_unmount(fs);
+}
+
+/*
+   int fs_dedup_enable(FS_t *fs);
+   void fs_dedup_disable(FS_t *fs);
+   1. Normal, a second file with the same blocks takes no new data blocks and reads back the same
+   2. Normal, overwriting a shared block leaves the other file alone, rewriting it back shares again
+   3. Normal, enabling indexes data written while dedup was off
+   4. Normal, removing the files gives every data block back
+   5. Error, NULL FS
+   6. Error/Normal, a snapshot that would give a shared block too many owners is refused and
+      leaves the image sound, a smaller one works and deleting it keeps every file intact
+ */
+TEST(n_tests, dedup)
+{
+	const char *test_fname = "n_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+
+	uint8_t data[BLOCK_SIZE_BYTES * 8];
+	uint8_t other[BLOCK_SIZE_BYTES];
+	uint8_t check[BLOCK_SIZE_BYTES * 8];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(i / BLOCK_SIZE_BYTES * 31 + i % 251);
+	}
+	memset(other, 0x6F, sizeof(other));
+
+	ASSERT_EQ(fs_create(fs, "/plain", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/a", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/b", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/c", FS_REGULAR), 0);
+	size_t baseline = block_store_get_used_blocks(fs->BlockStore_whole);
+	int fd_plain = fs_open(fs, "/plain");
+	ASSERT_EQ(fs_write(fs, fd_plain, data, BLOCK_SIZE_BYTES * 4), BLOCK_SIZE_BYTES * 4);
+
+	// 3
+	ASSERT_EQ(fs_dedup_enable(fs), 0);
+	ASSERT_EQ(fs_dedup_enable(fs), 0);
+	size_t used = block_store_get_used_blocks(fs->BlockStore_whole);
+	int fd_a = fs_open(fs, "/a");
+	ASSERT_EQ(fs_write(fs, fd_a, data, BLOCK_SIZE_BYTES * 4), BLOCK_SIZE_BYTES * 4);
+	ASSERT_LE(block_store_get_used_blocks(fs->BlockStore_whole), used + 16);	// at most the refcount table
+
+	// 1
+	ASSERT_EQ(fs_write(fs, fd_a, data + BLOCK_SIZE_BYTES * 4, BLOCK_SIZE_BYTES * 4), BLOCK_SIZE_BYTES * 4);
+	used = block_store_get_used_blocks(fs->BlockStore_whole);
+	int fd_b = fs_open(fs, "/b");
+	ASSERT_EQ(fs_write(fs, fd_b, data, sizeof(data)), (ssize_t) sizeof(data));
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used + 1);	// only b's indirect block
+	ASSERT_EQ(fs_seek(fs, fd_b, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_b, check, sizeof(check)), (ssize_t) sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+
+	// 2
+	ASSERT_EQ(fs_seek(fs, fd_b, BLOCK_SIZE_BYTES, FS_SEEK_SET), BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_write(fs, fd_b, other, sizeof(other)), (ssize_t) sizeof(other));
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used + 2);
+	ASSERT_EQ(fs_seek(fs, fd_a, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_a, check, sizeof(check)), (ssize_t) sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_seek(fs, fd_b, BLOCK_SIZE_BYTES, FS_SEEK_SET), BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_write(fs, fd_b, data + BLOCK_SIZE_BYTES, BLOCK_SIZE_BYTES), BLOCK_SIZE_BYTES);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used + 1);
+	int fd_c = fs_open(fs, "/c");
+	ASSERT_EQ(fs_write(fs, fd_c, other, 100), 100);
+	ASSERT_EQ(fs_write(fs, fd_c, other, 100), 100);
+	ASSERT_EQ(fs_seek(fs, fd_c, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_c, check, 200), 200);
+	ASSERT_EQ(memcmp(check, other, 200), 0);
+
+	// 4
+	fs_dedup_disable(fs);
+	ASSERT_EQ(fs_remove(fs, "/a"), 0);
+	ASSERT_EQ(fs_remove(fs, "/b"), 0);
+	ASSERT_EQ(fs_seek(fs, fd_plain, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_plain, check, BLOCK_SIZE_BYTES * 4), BLOCK_SIZE_BYTES * 4);
+	ASSERT_EQ(memcmp(check, data, BLOCK_SIZE_BYTES * 4), 0);
+	ASSERT_EQ(fs_remove(fs, "/plain"), 0);
+	ASSERT_EQ(fs_remove(fs, "/c"), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), baseline + 16);
+
+	// 5
+	ASSERT_LT(fs_dedup_enable(NULL), 0);
+	fs_dedup_disable(NULL);
+
+	// 6
+	uint8_t same[BLOCK_SIZE_BYTES * 100];
+	for (size_t i = 0; i < sizeof(same); i++)
+	{
+		same[i] = (uint8_t)(i % BLOCK_SIZE_BYTES * 7);	// a hundred copies of one block
+	}
+	ASSERT_EQ(fs_dedup_enable(fs), 0);
+	ASSERT_EQ(fs_create(fs, "/d", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/e", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/f", FS_REGULAR), 0);
+	int fd_d = fs_open(fs, "/d");
+	int fd_e = fs_open(fs, "/e");
+	int fd_f = fs_open(fs, "/f");
+	ASSERT_EQ(fs_write(fs, fd_d, same, sizeof(same)), (ssize_t) sizeof(same));
+	ASSERT_EQ(fs_write(fs, fd_e, same, sizeof(same)), (ssize_t) sizeof(same));
+	ASSERT_EQ(fs_write(fs, fd_f, data, BLOCK_SIZE_BYTES * 2), BLOCK_SIZE_BYTES * 2);
+	used = block_store_get_used_blocks(fs->BlockStore_whole);
+	ASSERT_LT(fs_snapshot(fs, "crowded"), 0);	// 199 owners and 200 more
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+	ASSERT_EQ(fs_remove(fs, "/e"), 0);
+	ASSERT_EQ(fs_snapshot(fs, "roomy"), 0);
+	ASSERT_EQ(fs_seek(fs, fd_d, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_write(fs, fd_d, other, sizeof(other)), (ssize_t) sizeof(other));
+	ASSERT_EQ(fs_snapshot_delete(fs, "roomy"), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+	uint8_t back[BLOCK_SIZE_BYTES * 100];
+	ASSERT_EQ(fs_seek(fs, fd_d, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_d, back, sizeof(back)), (ssize_t) sizeof(back));
+	ASSERT_EQ(memcmp(back, other, sizeof(other)), 0);
+	ASSERT_EQ(memcmp(back + BLOCK_SIZE_BYTES, same + BLOCK_SIZE_BYTES, sizeof(same) - BLOCK_SIZE_BYTES), 0);
+	ASSERT_EQ(fs_seek(fs, fd_f, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_f, check, BLOCK_SIZE_BYTES * 2), BLOCK_SIZE_BYTES * 2);
+	ASSERT_EQ(memcmp(check, data, BLOCK_SIZE_BYTES * 2), 0);
+
+	fs_unmount(fs);
+}
+
+/*
+   int fs_set_compressed(FS_t *fs, const char *path, bool compressed);
+   1. Normal, compressible data takes far fewer blocks and reads back the same, also after a remount
+   2. Normal, overwrite inside a compressed group and append to the tail group
+   3. Normal, incompressible data falls back to plain blocks
+   4. Normal, removing a compressed file gives every block back
+   5. Error, directory, file that already holds data, missing file, NULL FS
+ */
+TEST(o_tests, compressed_file)
+{
+	const char *test_fname = "o_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+
+	const size_t size = BLOCK_SIZE_BYTES * 25 + 100;
+	vector<uint8_t> text(size);
+	vector<uint8_t> noise(BLOCK_SIZE_BYTES * 8);
+	vector<uint8_t> check(size);
+	const char *line = "the quick brown fox jumps over the lazy dog, again and again\n";
+	for (size_t i = 0; i < size; i++)
+	{
+		text[i] = line[i % strlen(line)];
+	}
+	uint32_t state = 7;
+	for (size_t i = 0; i < noise.size(); i++)
+	{
+		state = state * 1103515245 + 12345;
+		noise[i] = state >> 24;
+	}
+
+	ASSERT_EQ(fs_create(fs, "/text", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/noise", FS_REGULAR), 0);
+	ASSERT_EQ(fs_set_compressed(fs, "/text", true), 0);
+	ASSERT_EQ(fs_set_compressed(fs, "/noise", true), 0);
+	size_t baseline = block_store_get_used_blocks(fs->BlockStore_whole);
+
+	// 1
+	int fd = fs_open(fs, "/text");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, text.data(), size), (ssize_t) size);
+	ASSERT_LT(block_store_get_used_blocks(fs->BlockStore_whole) - baseline, (size_t) 10);
+	fs_unmount(fs);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/text");
+	ASSERT_EQ(fs_read(fs, fd, check.data(), size + 10), (ssize_t) size);
+	ASSERT_EQ(memcmp(check.data(), text.data(), size), 0);
+
+	// 2
+	ASSERT_EQ(fs_seek(fs, fd, 40000, FS_SEEK_SET), 40000);
+	ASSERT_EQ(fs_write(fs, fd, "0123456789", 10), 10);
+	memcpy(text.data() + 40000, "0123456789", 10);
+	ASSERT_EQ(fs_seek(fs, fd, size, FS_SEEK_SET), (off_t) size);
+	ASSERT_EQ(fs_write(fs, fd, "tail", 4), 4);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, check.data(), size), (ssize_t) size);
+	ASSERT_EQ(memcmp(check.data(), text.data(), size), 0);
+	ASSERT_EQ(fs_read(fs, fd, check.data(), 10), 4);
+	ASSERT_EQ(memcmp(check.data(), "tail", 4), 0);
+
+	// 3
+	size_t used = block_store_get_used_blocks(fs->BlockStore_whole);
+	int fd_noise = fs_open(fs, "/noise");
+	ASSERT_EQ(fs_write(fs, fd_noise, noise.data(), noise.size()), (ssize_t) noise.size());
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used + 8 + 1);	// plain blocks and the indirect block
+	ASSERT_EQ(fs_seek(fs, fd_noise, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_noise, check.data(), noise.size()), (ssize_t) noise.size());
+	ASSERT_EQ(memcmp(check.data(), noise.data(), noise.size()), 0);
+
+	// 5
+	ASSERT_LT(fs_set_compressed(fs, "/text", false), 0);
+	ASSERT_LT(fs_set_compressed(fs, "/", true), 0);
+	ASSERT_LT(fs_set_compressed(fs, "/nope", true), 0);
+	ASSERT_LT(fs_set_compressed(NULL, "/text", true), 0);
+
+	// 4
+	ASSERT_EQ(fs_remove(fs, "/text"), 0);
+	ASSERT_EQ(fs_remove(fs, "/noise"), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), baseline);
+
+	fs_unmount(fs);
+}
+
+/*
+   Inline data (FS_INODE_INLINE)
+   1. Normal, files of up to FS_INLINE_MAX bytes take no data block and read back the same, also after a remount
+   2. Normal, growing past FS_INLINE_MAX moves the data to a block
+   3. Normal, a snapshot keeps the inline data it was taken with
+   4. Normal, removing inline files frees nothing but their inodes
+ */
+TEST(p_tests, inline_data)
+{
+	const char *test_fname = "p_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+
+	uint8_t data[FS_INLINE_MAX + 10];
+	uint8_t check[FS_INLINE_MAX + 10];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(i * 7 + 1);
+	}
+	ASSERT_EQ(fs_create(fs, "/a", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/b", FS_REGULAR), 0);
+	int fd_a = fs_open(fs, "/a");
+	int fd_b = fs_open(fs, "/b");
+	ASSERT_GE(fd_a, 0);
+	ASSERT_GE(fd_b, 0);
+
+	// 1
+	ASSERT_EQ(fs_write(fs, fd_a, data, 40), 40);
+	size_t used = block_store_get_used_blocks(fs->BlockStore_whole);	// includes the inline area now
+	ASSERT_EQ(fs_write(fs, fd_b, data, 10), 10);
+	ASSERT_EQ(fs_write(fs, fd_b, data + 10, 20), 20);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+	fs_unmount(fs);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd_a = fs_open(fs, "/a");
+	fd_b = fs_open(fs, "/b");
+	ASSERT_EQ(fs_read(fs, fd_a, check, sizeof(check)), 40);
+	ASSERT_EQ(memcmp(check, data, 40), 0);
+	ASSERT_EQ(fs_read(fs, fd_b, check, sizeof(check)), 30);
+	ASSERT_EQ(memcmp(check, data, 30), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+
+	// 3
+	ASSERT_EQ(fs_snapshot(fs, "before"), 0);
+	used = block_store_get_used_blocks(fs->BlockStore_whole);
+
+	// 2
+	ASSERT_EQ(fs_seek(fs, fd_a, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_write(fs, fd_a, data + 1, FS_INLINE_MAX), FS_INLINE_MAX);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+	ASSERT_EQ(fs_write(fs, fd_b, data + 30, 40), 40);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used + 1);
+	ASSERT_EQ(fs_seek(fs, fd_a, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_a, check, sizeof(check)), FS_INLINE_MAX);
+	ASSERT_EQ(memcmp(check, data + 1, FS_INLINE_MAX), 0);
+	ASSERT_EQ(fs_seek(fs, fd_b, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_b, check, sizeof(check)), 70);
+	ASSERT_EQ(memcmp(check, data, 70), 0);
+	fs_unmount(fs);
+
+	// 3
+	FS *snap = fs_mount_snapshot(test_fname, "before");
+	ASSERT_NE(snap, nullptr);
+	fd_a = fs_open(snap, "/a");
+	ASSERT_EQ(fs_read(snap, fd_a, check, sizeof(check)), 40);
+	ASSERT_EQ(memcmp(check, data, 40), 0);
+	fs_unmount(snap);
+
+	// 4
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_snapshot_delete(fs, "before"), 0);
+	used = block_store_get_used_blocks(fs->BlockStore_whole);
+	ASSERT_EQ(fs_remove(fs, "/a"), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+	ASSERT_EQ(fs_remove(fs, "/b"), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used - 1);
+	fs_unmount(fs);
+}
+
+/*
+   fsd server and client (FS_server.h, FS_client.h)
+   1. Normal, a batch of open/write/read/get_dir runs in order in one round trip
+   2. Normal, the single calls match their fs_* counterparts
+   3. Error, descriptors of the FS or of another connection cannot be used
+   4. Normal, disconnecting closes what the connection left open
+ */
+TEST(q_tests, server_client)
+{
+	const char *test_fname = "q_tests.FS";
+	const char *socket_name = "q_tests.sock";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+	int local_fd = fs_open(fs, "/file");
+	ASSERT_GE(local_fd, 0);
+	fs_server_t *server = fs_server_start(fs, socket_name, 2);
+	ASSERT_NE(server, nullptr);
+	fs_client_t *client = fs_client_connect(socket_name);
+	ASSERT_NE(client, nullptr);
+
+	// 1
+	int fd = fs_client_open(client, "/file");
+	ASSERT_GE(fd, 0);
+	uint8_t data[3000];
+	uint8_t check[3000];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(i * 13 + 5);
+	}
+	fs_client_req_t batch[4] = {
+		{FS_REQ_WRITE, fd, NULL, data, sizeof(data), 0, NULL},
+		{FS_REQ_OPEN, -1, "/file", NULL, 0, 0, NULL},
+		{FS_REQ_GET_DIR, -1, "/", NULL, 0, 0, NULL},
+		{FS_REQ_OPEN, -1, "/missing", NULL, 0, 0, NULL},
+	};
+	ASSERT_EQ(fs_client_batch(client, batch, 4), 0);
+	ASSERT_EQ(batch[0].result, (ssize_t)sizeof(data));
+	int second_fd = (int)batch[1].result;
+	ASSERT_GE(second_fd, 0);
+	ASSERT_EQ(batch[2].result, 2);
+	ASSERT_NE(batch[2].entries, nullptr);
+	ASSERT_EQ(dyn_array_size(batch[2].entries), (size_t)2);
+	dyn_array_destroy(batch[2].entries);
+	ASSERT_LT(batch[3].result, 0);
+	ASSERT_EQ(batch[3].entries, nullptr);
+
+	// 2
+	ASSERT_EQ(fs_client_read(client, second_fd, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_client_read(client, second_fd, check, sizeof(check)), 0);
+	dyn_array_t *entries = fs_client_get_dir(client, "/dir");
+	ASSERT_NE(entries, nullptr);
+	ASSERT_EQ(dyn_array_size(entries), (size_t)0);
+	dyn_array_destroy(entries);
+	ASSERT_EQ(fs_client_get_dir(client, "/file"), nullptr);
+	ASSERT_EQ(fs_client_close(client, second_fd), 0);
+	ASSERT_LT(fs_client_close(client, second_fd), 0);
+
+	// 3
+	ASSERT_LT(fs_client_read(client, local_fd, check, 10), 0);
+	ASSERT_LT(fs_client_write(client, local_fd, data, 10), 0);
+	fs_client_t *other = fs_client_connect(socket_name);
+	ASSERT_NE(other, nullptr);
+	ASSERT_LT(fs_client_read(other, fd, check, 10), 0);
+	ASSERT_LT(fs_client_close(other, fd), 0);
+	fs_client_disconnect(other);
+	ASSERT_EQ(fs_client_connect("q_tests.nope"), nullptr);
+
+	// 4
+	fs_client_disconnect(client);
+	for (int i = 0; i < 200 && block_store_sub_test(fs->BlockStore_fd, fd); i++)
+	{
+		usleep(10000);
+	}
+	ASSERT_FALSE(block_store_sub_test(fs->BlockStore_fd, fd));
+	ASSERT_TRUE(block_store_sub_test(fs->BlockStore_fd, local_fd));
+
+	fs_server_stop(server);
+	ASSERT_NE(access(socket_name, F_OK), 0);
+	fs_unmount(fs);
+}
+
+/*
+   fs_get_stats
+   1. Normal, every call is counted once on its own entry point, with the time it took
+   2. Normal, the I/O counters move with the work done
+   3. Normal, reading a compressed group twice is a cache miss and then a hit
+   4. Error, bad parameters
+ */
+TEST(r_tests, stats)
+{
+	const char *test_fname = "r_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fs_stats_t before, after;
+	if (fs_get_stats(fs, &before) < 0)
+	{
+		fs_unmount(fs);
+		return;		// built with FS_NO_STATS
+	}
+	ASSERT_EQ(before.call[FS_CALL_FORMAT].calls, (uint64_t)1);
+	ASSERT_EQ(before.call[FS_CALL_CREATE].calls, (uint64_t)0);
+
+	// 1
+	uint8_t data[BLOCK_SIZE_BYTES * 8];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(i % 251);
+	}
+	ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+	ASSERT_LT(fs_create(fs, "/file", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/file");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, data, 100), 100);
+	ASSERT_EQ(fs_get_stats(fs, &after), 0);
+	ASSERT_EQ(after.call[FS_CALL_CREATE].calls, (uint64_t)2);
+	ASSERT_EQ(after.call[FS_CALL_OPEN].calls, (uint64_t)1);
+	ASSERT_EQ(after.call[FS_CALL_WRITE].calls, (uint64_t)1);
+	ASSERT_EQ(after.call[FS_CALL_SEEK].calls, (uint64_t)1);
+	ASSERT_EQ(after.call[FS_CALL_READ].calls, (uint64_t)1);
+	ASSERT_EQ(after.call[FS_CALL_REMOVE].calls, (uint64_t)0);
+	ASSERT_GT(after.call[FS_CALL_WRITE].ns, (uint64_t)0);
+	ASSERT_STREQ(fs_call_name(FS_CALL_GET_DIR), "get_dir");
+	ASSERT_STREQ(fs_call_name(FS_CALL_COUNT), "?");
+
+	// 2
+	ASSERT_GE(after.block_writes - before.block_writes, (uint64_t)8);
+	ASSERT_GE(after.block_reads - before.block_reads, (uint64_t)1);
+	ASSERT_GT(after.inode_reads, before.inode_reads);
+	ASSERT_GT(after.inode_writes, before.inode_writes);
+	ASSERT_GE(after.bitmap_scans - before.bitmap_scans, (uint64_t)4);	// inode, parent block, fd, one run for the 8 data blocks
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// 3
+	ASSERT_EQ(fs_create(fs, "/packed", FS_REGULAR), 0);
+	ASSERT_EQ(fs_set_compressed(fs, "/packed", true), 0);
+	fd = fs_open(fs, "/packed");
+	ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_get_stats(fs, &before), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, data, 100), 100);
+	ASSERT_EQ(fs_read(fs, fd, data, 100), 100);
+	ASSERT_EQ(fs_get_stats(fs, &after), 0);
+	ASSERT_EQ(after.cache_misses - before.cache_misses, (uint64_t)1);
+	ASSERT_EQ(after.cache_hits - before.cache_hits, (uint64_t)1);
+	ASSERT_EQ(after.call[FS_CALL_SET_COMPRESSED].calls, (uint64_t)1);
+	fs_unmount(fs);
+
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_get_stats(fs, &after), 0);
+	ASSERT_EQ(after.call[FS_CALL_MOUNT].calls, (uint64_t)1);
+	ASSERT_EQ(after.call[FS_CALL_READ].calls, (uint64_t)0);
+
+	// 4
+	ASSERT_LT(fs_get_stats(NULL, &after), 0);
+	ASSERT_LT(fs_get_stats(fs, NULL), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. interleaved appends to two files take no blocks until the files are closed
+	2. each file then gets one contiguous run and reads back intact
+	3. a write before the end of the buffered data flushes it first
+	4. removing a file with buffered appends leaves no blocks behind
+	5. on a nearly full FS, other writes cannot take the blocks a buffered append was promised
+*/
+TEST(s_tests, delayed_allocation)
+{
+	const char *test_fname = "s_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+
+	uint8_t data[BLOCK_SIZE_BYTES * 3];
+	uint8_t check[BLOCK_SIZE_BYTES * 3];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(i % 253);
+	}
+	ASSERT_EQ(fs_create(fs, "/a", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/b", FS_REGULAR), 0);
+	int fd_a = fs_open(fs, "/a");
+	int fd_b = fs_open(fs, "/b");
+	ASSERT_GE(fd_a, 0);
+	ASSERT_GE(fd_b, 0);
+	size_t baseline = block_store_get_used_blocks(fs->BlockStore_whole);
+
+	// 1
+	for (size_t i = 0; i < 3; i++)
+	{
+		ASSERT_EQ(fs_write(fs, fd_a, data + i * BLOCK_SIZE_BYTES, BLOCK_SIZE_BYTES), BLOCK_SIZE_BYTES);
+		ASSERT_EQ(fs_write(fs, fd_b, data + i * BLOCK_SIZE_BYTES, BLOCK_SIZE_BYTES), BLOCK_SIZE_BYTES);
+	}
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), baseline);
+	ASSERT_EQ(fs_close(fs, fd_a), 0);
+	ASSERT_EQ(fs_close(fs, fd_b), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), baseline + 6);
+
+	// 2
+	for (size_t inode_number = 1; inode_number <= 2; inode_number++)
+	{
+		inode_t inode;
+		ASSERT_EQ(block_store_inode_read(fs->BlockStore_inode, inode_number, &inode), (size_t) inode_size);
+		ASSERT_EQ(inode.fileSize, sizeof(data));
+		ASSERT_EQ(inode.directPointer[1], inode.directPointer[0] + 1);
+		ASSERT_EQ(inode.directPointer[2], inode.directPointer[0] + 2);
+	}
+	fd_a = fs_open(fs, "/a");
+	ASSERT_EQ(fs_read(fs, fd_a, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+
+	// 3
+	ASSERT_EQ(fs_write(fs, fd_a, data, BLOCK_SIZE_BYTES), BLOCK_SIZE_BYTES);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), baseline + 6);
+	ASSERT_EQ(fs_seek(fs, fd_a, 10, FS_SEEK_SET), 10);
+	ASSERT_EQ(fs_write(fs, fd_a, data, 10), 10);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), baseline + 7);
+	ASSERT_EQ(fs_seek(fs, fd_a, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_a, check, 20), 20);
+	ASSERT_EQ(memcmp(check, data, 10), 0);
+	ASSERT_EQ(memcmp(check + 10, data, 10), 0);
+	ASSERT_EQ(fs_close(fs, fd_a), 0);
+
+	// 4
+	ASSERT_EQ(fs_create(fs, "/c", FS_REGULAR), 0);
+	int fd_c = fs_open(fs, "/c");
+	ASSERT_GE(fd_c, 0);
+	ASSERT_EQ(fs_write(fs, fd_c, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_remove(fs, "/c"), 0);
+	ASSERT_EQ(fs_remove(fs, "/b"), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), baseline + 4);
+
+	// 5
+	while (block_store_get_free_blocks(fs->BlockStore_whole) > 62)
+	{
+		ASSERT_NE(block_store_allocate(fs->BlockStore_whole), SIZE_MAX);
+	}
+	vector<uint8_t> big(50 * BLOCK_SIZE_BYTES), other(20 * BLOCK_SIZE_BYTES, 0x5a), back(50 * BLOCK_SIZE_BYTES);
+	for (size_t i = 0; i < big.size(); i++)
+	{
+		big[i] = (uint8_t)(i % 251);
+	}
+	ASSERT_EQ(fs_create(fs, "/d", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/e", FS_REGULAR), 0);
+	int fd_d = fs_open(fs, "/d");
+	int fd_e = fs_open(fs, "/e");
+	ASSERT_EQ(fs_write(fs, fd_d, big.data(), big.size()), (ssize_t)big.size());
+	ASSERT_EQ(fs_seek(fs, fd_e, BLOCK_SIZE_BYTES, FS_SEEK_SET), BLOCK_SIZE_BYTES);	// not an append, so not buffered
+	ssize_t written = fs_write(fs, fd_e, other.data(), other.size());
+	ASSERT_GE(written, 0);
+	ASSERT_LT(written, (ssize_t)other.size());
+	ASSERT_EQ(fs_seek(fs, fd_d, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_d, back.data(), back.size()), (ssize_t)back.size());
+	ASSERT_TRUE(back == big);
+	ASSERT_EQ(fs_seek(fs, fd_e, BLOCK_SIZE_BYTES, FS_SEEK_SET), BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_read(fs, fd_e, back.data(), written), written);
+	ASSERT_EQ(memcmp(back.data(), other.data(), written), 0);
+	ASSERT_EQ(fs_close(fs, fd_d), 0);
+	ASSERT_EQ(fs_close(fs, fd_e), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. seek from each whence, clamped to BOF, the descriptors of one file move on their own
+	2. a write past EOF leaves a hole that reads as zeros
+	3. reads and writes across the direct/indirect and indirect/double indirect boundaries
+	4. errors: closed descriptor, bad whence
+	5. a write past EOF of a compressed file leaves whole groups and the rest of the last one as zeros
+*/
+TEST(t_tests, cursor)
+{
+	const char *test_fname = "t_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+	int fd_one = fs_open(fs, "/file");
+	int fd_two = fs_open(fs, "/file");
+	ASSERT_GE(fd_one, 0);
+	ASSERT_GE(fd_two, 0);
+
+	uint8_t data[BLOCK_SIZE_BYTES * 2];
+	uint8_t check[BLOCK_SIZE_BYTES * 2];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(i % 249 + 1);
+	}
+
+	// 1
+	ASSERT_EQ(fs_write(fs, fd_one, data, 1000), 1000);
+	ASSERT_EQ(fs_seek(fs, fd_one, 0, FS_SEEK_CUR), 1000);
+	ASSERT_EQ(fs_seek(fs, fd_two, 0, FS_SEEK_CUR), 0);
+	ASSERT_EQ(fs_seek(fs, fd_two, -100, FS_SEEK_END), 900);
+	ASSERT_EQ(fs_seek(fs, fd_two, 50, FS_SEEK_CUR), 950);
+	ASSERT_EQ(fs_seek(fs, fd_two, -5000, FS_SEEK_CUR), 0);
+	ASSERT_EQ(fs_seek(fs, fd_one, 10, FS_SEEK_SET), 10);
+	ASSERT_EQ(fs_read(fs, fd_one, check, 20), 20);
+	ASSERT_EQ(memcmp(check, data + 10, 20), 0);
+	ASSERT_EQ(fs_seek(fs, fd_two, 0, FS_SEEK_CUR), 0);
+
+	// 2
+	ASSERT_EQ(fs_seek(fs, fd_one, 3 * BLOCK_SIZE_BYTES + 5, FS_SEEK_SET), 3 * BLOCK_SIZE_BYTES + 5);
+	ASSERT_EQ(fs_write(fs, fd_one, data, 10), 10);
+	ASSERT_EQ(fs_seek(fs, fd_one, 0, FS_SEEK_END), 3 * BLOCK_SIZE_BYTES + 15);
+	ASSERT_EQ(fs_seek(fs, fd_one, 2000, FS_SEEK_SET), 2000);
+	ASSERT_EQ(fs_read(fs, fd_one, check, sizeof(check)), (ssize_t)sizeof(check));
+	for (size_t i = 0; i < sizeof(check); i++)
+	{
+		ASSERT_EQ(check[i], 0);
+	}
+	ASSERT_EQ(fs_seek(fs, fd_one, 3 * BLOCK_SIZE_BYTES, FS_SEEK_SET), 3 * BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_read(fs, fd_one, check, 100), 15);
+	ASSERT_EQ(check[4], 0);
+	ASSERT_EQ(memcmp(check + 5, data, 10), 0);
+
+	// 3
+	off_t boundaries[] = { 6 * BLOCK_SIZE_BYTES, (off_t)(6 + 2048) * BLOCK_SIZE_BYTES };
+	for (off_t boundary : boundaries)
+	{
+		off_t start = boundary - BLOCK_SIZE_BYTES / 2;
+		ASSERT_EQ(fs_seek(fs, fd_two, start, FS_SEEK_SET), start);
+		ASSERT_EQ(fs_write(fs, fd_two, data, sizeof(data)), (ssize_t)sizeof(data));
+		ASSERT_EQ(fs_seek(fs, fd_two, 0, FS_SEEK_CUR), start + (off_t)sizeof(data));
+		ASSERT_EQ(fs_seek(fs, fd_one, start, FS_SEEK_SET), start);
+		ASSERT_EQ(fs_read(fs, fd_one, check, sizeof(check)), (ssize_t)sizeof(check));
+		ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	}
+	ASSERT_EQ(fs_close(fs, fd_two), 0);
+	fs_unmount(fs);
+
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd_one = fs_open(fs, "/file");
+	ASSERT_EQ(fs_seek(fs, fd_one, boundaries[1] - BLOCK_SIZE_BYTES / 2, FS_SEEK_SET), boundaries[1] - BLOCK_SIZE_BYTES / 2);
+	ASSERT_EQ(fs_read(fs, fd_one, check, sizeof(check) + 10), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+
+	// 4
+	ASSERT_LT(fs_seek(fs, fd_two, 0, FS_SEEK_SET), 0);
+	ASSERT_LT(fs_read(fs, fd_two, check, 1), 0);
+	ASSERT_LT(fs_write(fs, fd_two, data, 1), 0);
+	ASSERT_LT(fs_seek(fs, fd_one, 0, (seek_t) 3), 0);
+
+	// 5
+	ASSERT_EQ(fs_create(fs, "/packed", FS_REGULAR), 0);
+	ASSERT_EQ(fs_set_compressed(fs, "/packed", true), 0);
+	int fd_packed = fs_open(fs, "/packed");
+	ASSERT_EQ(fs_write(fs, fd_packed, data, 5), 5);
+	ASSERT_EQ(fs_seek(fs, fd_packed, 24 * BLOCK_SIZE_BYTES, FS_SEEK_SET), 24 * BLOCK_SIZE_BYTES);	// three groups on
+	ASSERT_EQ(fs_write(fs, fd_packed, data, 5), 5);
+	ASSERT_EQ(fs_seek(fs, fd_packed, 0, FS_SEEK_SET), 0);
+	std::vector<uint8_t> packed(24 * BLOCK_SIZE_BYTES + 5);
+	ASSERT_EQ(fs_read(fs, fd_packed, packed.data(), packed.size()), (ssize_t)packed.size());
+	ASSERT_EQ(memcmp(packed.data(), data, 5), 0);
+	for (size_t i = 5; i < 24 * BLOCK_SIZE_BYTES; i++)
+	{
+		ASSERT_EQ(packed[i], 0);
+	}
+	ASSERT_EQ(memcmp(packed.data() + 24 * BLOCK_SIZE_BYTES, data, 5), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. a second open of a file shares the first one's inode, the cursors stay separate
+	2. writes through one descriptor, in the indirect range too, are seen through the other
+	3. closing one descriptor leaves the other working
+	4. removing the file closes every descriptor on it and no other
+*/
+TEST(u_tests, open_file_table)
+{
+	const char *test_fname = "u_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/hot", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/other", FS_REGULAR), 0);
+
+	uint8_t data[BLOCK_SIZE_BYTES];
+	uint8_t check[BLOCK_SIZE_BYTES];
+	memset(data, 0x5A, sizeof(data));
+
+	// 1
+	fs_stats_t before, middle, after;
+	bool stats = fs_get_stats(fs, &before) == 0;
+	int fd_one = fs_open(fs, "/hot");
+	ASSERT_GE(fd_one, 0);
+	fs_get_stats(fs, &middle);
+	int fd_two = fs_open(fs, "/hot");
+	ASSERT_GE(fd_two, 0);
+	ASSERT_NE(fd_one, fd_two);
+	fs_get_stats(fs, &after);
+	if (stats)
+	{
+		// the second open only reads the directories on the path
+		ASSERT_EQ(after.inode_reads - middle.inode_reads, middle.inode_reads - before.inode_reads - 1);
+	}
+	int fd_other = fs_open(fs, "/other");
+	ASSERT_GE(fd_other, 0);
+
+	// 2
+	for (size_t i = 0; i < 8; i++)
+	{
+		ASSERT_EQ(fs_write(fs, fd_one, data, sizeof(data)), (ssize_t)sizeof(data));
+	}
+	ASSERT_EQ(fs_seek(fs, fd_two, 7 * BLOCK_SIZE_BYTES, FS_SEEK_SET), 7 * BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_read(fs, fd_two, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	memset(data, 0xA5, sizeof(data));
+	ASSERT_EQ(fs_seek(fs, fd_one, 7 * BLOCK_SIZE_BYTES, FS_SEEK_SET), 7 * BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_write(fs, fd_one, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_write(fs, fd_one, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_read(fs, fd_two, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_seek(fs, fd_two, 0, FS_SEEK_END), 9 * BLOCK_SIZE_BYTES);
+
+	// 3
+	ASSERT_EQ(fs_close(fs, fd_one), 0);
+	ASSERT_LT(fs_close(fs, fd_one), 0);
+	ASSERT_EQ(fs_seek(fs, fd_two, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd_two, check, 10), 10);
+	fd_one = fs_open(fs, "/hot");
+	ASSERT_GE(fd_one, 0);
+
+	// 4
+	ASSERT_EQ(fs_remove(fs, "/hot"), 0);
+	ASSERT_LT(fs_read(fs, fd_one, check, 10), 0);
+	ASSERT_LT(fs_read(fs, fd_two, check, 10), 0);
+	ASSERT_LT(fs_close(fs, fd_two), 0);
+	ASSERT_EQ(fs_write(fs, fd_other, data, 10), 10);
+	ASSERT_EQ(fs_close(fs, fd_other), 0);
+	ASSERT_LT(fs_open(fs, "/hot"), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. files grown a block at a time in turn are fragmented, a file in one piece is not
+	2. fs_defrag keeps to its budget and makes progress on every call
+	3. once it is done every file is one run with its data intact and no blocks leaked
+	4. errors: NULL FS, a directory, a missing file
+*/
+TEST(v_tests, defrag)
+{
+	const char *test_fname = "v_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	const char *names[] = { "/a", "/b", "/c" };
+	uint8_t data[BLOCK_SIZE_BYTES];
+	uint8_t check[BLOCK_SIZE_BYTES];
+	for (const char *name : names)
+	{
+		ASSERT_EQ(fs_create(fs, name, FS_REGULAR), 0);
+	}
+	// appends get their blocks on close, so reopening for every block interleaves the files
+	for (size_t i = 0; i < 12; i++)
+	{
+		for (size_t f = 0; f < 3; f++)
+		{
+			int fd = fs_open(fs, names[f]);
+			ASSERT_GE(fd, 0);
+			ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), (off_t)(i * BLOCK_SIZE_BYTES));
+			memset(data, (int)(f * 16 + i), sizeof(data));
+			ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+			ASSERT_EQ(fs_close(fs, fd), 0);
+		}
+	}
+	ASSERT_EQ(fs_create(fs, "/whole", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/whole");
+	for (size_t i = 0; i < 3; i++)
+	{
+		ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+	}
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// 1
+	fs_frag_t frag;
+	ASSERT_EQ(fs_fragmentation(fs, "/a", &frag), 0);
+	ASSERT_EQ(frag.blocks, (size_t)12);
+	ASSERT_EQ(frag.extents, (size_t)12);
+	ASSERT_DOUBLE_EQ(frag.score, 1.0);
+	ASSERT_EQ(fs_fragmentation(fs, "/whole", &frag), 0);
+	ASSERT_EQ(frag.extents, (size_t)1);
+	ASSERT_DOUBLE_EQ(frag.score, 0.0);
+	size_t used = block_store_get_used_blocks(fs->BlockStore_whole);
+
+	// 2
+	fs_stats_t before, after;
+	bool stats = fs_get_stats(fs, &before) == 0;
+	ssize_t moved = 0;
+	ssize_t moved_total = 0;
+	size_t calls = 0;
+	while ((moved = fs_defrag(fs, 8)) > 0)
+	{
+		moved_total += moved;
+		ASSERT_LT(++calls, (size_t)100);
+		if (stats)
+		{
+			ASSERT_EQ(fs_get_stats(fs, &after), 0);
+			ASSERT_LE(after.block_reads + after.block_writes - before.block_reads - before.block_writes, (uint64_t)8 + 4);
+			before = after;
+		}
+	}
+	ASSERT_EQ(moved, 0);
+	ASSERT_GE(moved_total, 24);	// the first file may already sit at the front
+
+	// 3
+	for (size_t f = 0; f < 3; f++)
+	{
+		ASSERT_EQ(fs_fragmentation(fs, names[f], &frag), 0);
+		ASSERT_EQ(frag.blocks, (size_t)12);
+		ASSERT_EQ(frag.extents, (size_t)1);
+		fd = fs_open(fs, names[f]);
+		for (size_t i = 0; i < 12; i++)
+		{
+			memset(data, (int)(f * 16 + i), sizeof(data));
+			ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t)sizeof(check));
+			ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+		}
+		ASSERT_EQ(fs_close(fs, fd), 0);
+	}
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+	ASSERT_EQ(fs_defrag(fs, 100), 0);
+
+	// 4
+	ASSERT_LT(fs_defrag(NULL, 10), 0);
+	ASSERT_LT(fs_fragmentation(NULL, "/a", &frag), 0);
+	ASSERT_LT(fs_fragmentation(fs, "/", &frag), 0);
+	ASSERT_LT(fs_fragmentation(fs, "/nope", &frag), 0);
+	ASSERT_LT(fs_fragmentation(fs, "/a", NULL), 0);
+	fs_unmount(fs);
+}
+
+
+/*
+	1. an FS with directories, links, a snapshot and a file reaching its double indirect block checks clean, on one thread or several
+	2. removing one of two names keeps the file, removing a file that big gives back every block
+	3. a leaked block, a block missing from the bitmap, a bad pointer, wrong owner and link counts and an orphan are found, then repaired
+	4. errors: NULL FS, repairing a mounted snapshot
+*/
+TEST(w_tests, check)
+{
+	const char *test_fname = "w_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	uint8_t data[BLOCK_SIZE_BYTES];
+	memset(data, 0x5a, sizeof(data));
+	ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);	// inode 1
+	ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/dir/small", FS_REGULAR), 0);
+	ASSERT_EQ(fs_link(fs, "/file", "/dir/again"), 0);
+	int fd = fs_open(fs, "/file");
+	ASSERT_GE(fd, 0);
+	for (size_t i = 0; i < 4; i++)
+	{
+		ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+	}
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fd = fs_open(fs, "/dir/small");
+	ASSERT_EQ(fs_write(fs, fd, data, 10), 10);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_snapshot(fs, "before"), 0);
+	fd = fs_open(fs, "/file");
+	ASSERT_EQ(fs_write(fs, fd, "changed", 7), 7);	// one block copied, the rest still shared
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// 1
+	size_t used = block_store_get_used_blocks(fs->BlockStore_whole);
+	ASSERT_EQ(fs_create(fs, "/big", FS_REGULAR), 0);
+	fd = fs_open(fs, "/big");
+	for (size_t i = 0; i < 6 + 2048 + 10; i++)
+	{
+		ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+	}
+	fs_check_t report;
+	ASSERT_EQ(fs_check(fs, 1, false, &report), 0);
+	ASSERT_EQ(report.inodes, (size_t)(5 + 4));	// the snapshot has all but /big
+	ASSERT_GT(report.blocks, (size_t)(6 + 2048 + 10 + 3));
+	ASSERT_EQ(report.repaired, (size_t)0);
+	ASSERT_EQ(fs_check(fs, 0, false, &report), 0);
+	ASSERT_EQ(fs_check(fs, 4, true, NULL), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// 2
+	ASSERT_EQ(fs_remove(fs, "/big"), 0);
+	ASSERT_EQ(block_store_get_used_blocks(fs->BlockStore_whole), used);
+	ASSERT_EQ(fs_remove(fs, "/dir/again"), 0);
+	fd = fs_open(fs, "/file");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_check(fs, 2, false, NULL), 0);
+	ASSERT_EQ(fs_link(fs, "/file", "/dir/again"), 0);
+
+	// 3
+	ASSERT_EQ(fs_create(fs, "/orphan", FS_REGULAR), 0);	// inode 4
+	fd = fs_open(fs, "/orphan");
+	ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	inode_t root, file, orphan;
+	block_store_inode_read(fs->BlockStore_inode, 0, &root);
+	block_store_inode_read(fs->BlockStore_inode, 1, &file);
+	block_store_inode_read(fs->BlockStore_inode, 4, &orphan);
+	ASSERT_EQ(orphan.fileType, 'r');
+	ASSERT_NE(orphan.directPointer[0], 0);
+	root.vacantFile--;	// /file, /dir, then /orphan, which drops off the end
+	root.fileSize -= 6 + strlen("orphan");
+	block_store_inode_write(fs->BlockStore_inode, 0, &root);
+	size_t leaked = block_store_allocate(fs->BlockStore_whole);
+	ASSERT_NE(leaked, SIZE_MAX);
+	size_t shared = file.directPointer[3];	// the snapshot has it too
+	file.directPointer[3] = 2;	// the inode table
+	file.linkCount = 5;
+	block_store_inode_write(fs->BlockStore_inode, 1, &file);
+	block_store_release(fs->BlockStore_whole, file.directPointer[1]);
+	ASSERT_EQ(fs_check(fs, 3, false, &report), 6);
+	ASSERT_EQ(report.leaked, (size_t)1);
+	ASSERT_EQ(report.unmarked, (size_t)1);
+	ASSERT_EQ(report.bad_pointers, (size_t)1);
+	ASSERT_EQ(report.refcounts, (size_t)1);	// the block that lost a pointer has one owner less
+	ASSERT_EQ(report.link_counts, (size_t)1);
+	ASSERT_EQ(report.orphans, (size_t)1);
+	ASSERT_EQ(report.repaired, (size_t)0);
+	ASSERT_EQ(fs_check(fs, 3, true, &report), 6 + 1);	// the orphan's block is a leak once it is freed
+	ASSERT_EQ(report.repaired, (size_t)(6 + 1));
+	ASSERT_EQ(fs_check(fs, 3, false, &report), 0);
+	ASSERT_FALSE(block_store_sub_test(fs->BlockStore_whole, leaked));
+	ASSERT_TRUE(block_store_sub_test(fs->BlockStore_whole, shared));
+	ASSERT_TRUE(block_store_sub_test(fs->BlockStore_whole, file.directPointer[1]));
+	ASSERT_FALSE(block_store_sub_test(fs->BlockStore_inode, 4));
+	block_store_inode_read(fs->BlockStore_inode, 1, &file);
+	ASSERT_EQ(file.linkCount, (size_t)2);
+	ASSERT_EQ(file.directPointer[3], 0);
+	fd = fs_open(fs, "/file");
+	uint8_t check[BLOCK_SIZE_BYTES];
+	ASSERT_EQ(fs_seek(fs, fd, BLOCK_SIZE_BYTES, FS_SEEK_SET), (off_t)BLOCK_SIZE_BYTES);
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_unmount(fs);
+
+	// 4
+	ASSERT_LT(fs_check(NULL, 1, false, &report), 0);
+	fs = fs_mount_snapshot(test_fname, "before");
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_check(fs, 2, false, &report), 0);
+	ASSERT_LT(fs_check(fs, 2, true, &report), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. a directory holds as many short names as there are inodes, listed and found again after a remount
+	2. removing a name from the middle gives its bytes back, and the freed space is used again
+	3. the longest names still fit 31 to a block, a longer one is refused
+*/
+TEST(x_tests, directory_records)
+{
+	const char *test_fname = "x_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+
+	// 1
+	ASSERT_EQ(fs_create(fs, "/d", FS_DIRECTORY), 0);	// inode 1
+	char path[6 + 126 + 1];
+	for (int i = 0; i < 200; i++)
+	{
+		snprintf(path, sizeof(path), "/d/f%03d", i);
+		ASSERT_EQ(fs_create(fs, path, i % 10 == 0 ? FS_DIRECTORY : FS_REGULAR), 0);
+	}
+	inode_t dir;
+	block_store_inode_read(fs->BlockStore_inode, 1, &dir);
+	ASSERT_EQ(dir.vacantFile, (uint32_t)200);
+	ASSERT_EQ(dir.fileSize, (size_t)(200 * (6 + 4)));
+	ASSERT_EQ(fs_unmount(fs), 0);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	dyn_array_t *record_results = fs_get_dir(fs, "/d");
+	ASSERT_NE(record_results, nullptr);
+	ASSERT_EQ(dyn_array_size(record_results), 200u);
+	ASSERT_TRUE(find_in_directory(record_results, "f000"));
+	ASSERT_TRUE(find_in_directory(record_results, "f199"));
+	dyn_array_destroy(record_results);
+	ASSERT_EQ(fs_create(fs, "/d/f100/inside", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/d/f123");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// 2
+	ASSERT_EQ(fs_remove(fs, "/d/f057"), 0);
+	block_store_inode_read(fs->BlockStore_inode, 1, &dir);
+	ASSERT_EQ(dir.vacantFile, (uint32_t)199);
+	ASSERT_EQ(dir.fileSize, (size_t)(199 * (6 + 4)));
+	ASSERT_LT(fs_open(fs, "/d/f057"), 0);
+	fd = fs_open(fs, "/d/f058");	// the records after it moved down
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_create(fs, "/d/a_longer_name", FS_REGULAR), 0);
+	block_store_inode_read(fs->BlockStore_inode, 1, &dir);
+	ASSERT_EQ(dir.fileSize, (size_t)(199 * (6 + 4) + 6 + 13));
+	ASSERT_EQ(fs_check(fs, 2, false, NULL), 0);
+
+	// 3
+	ASSERT_EQ(fs_create(fs, "/long", FS_DIRECTORY), 0);
+	for (int i = 0; i < 31; i++)
+	{
+		snprintf(path, sizeof(path), "/long/%02d%0124d", i, 0);
+		ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+	}
+	snprintf(path, sizeof(path), "/long/%02d%0124d", 31, 0);
+	ASSERT_LT(fs_create(fs, path, FS_REGULAR), 0);
+	ASSERT_LT(fs_create(fs, "/long/x", FS_REGULAR), 0);	// 4 bytes left over
+	snprintf(path, sizeof(path), "/%0127d", 0);
+	ASSERT_LT(fs_create(fs, path, FS_REGULAR), 0);
+	snprintf(path, sizeof(path), "/long/%02d%0124d", 0, 0);
+	ASSERT_EQ(fs_remove(fs, path), 0);
+	ASSERT_EQ(fs_create(fs, "/long/x", FS_REGULAR), 0);
+	ASSERT_EQ(fs_check(fs, 2, false, NULL), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. fs_readdir gives every entry once in directory order, then keeps reporting the end
+	2. a listing resumed from its cookie after entries before it were removed and others added misses nothing
+	3. so does one whose last entry read was removed, and a cookie of 0 starts over
+	4. errors: a file, a missing directory, NULL arguments
+*/
+TEST(y_tests, readdir)
+{
+	const char *test_fname = "y_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/d", FS_DIRECTORY), 0);
+	const char *names[] = {"a", "bb", "ccc", "dddd", "e"};
+	for (const char *name : names)
+	{
+		char path[16];
+		snprintf(path, sizeof(path), "/d/%s", name);
+		ASSERT_EQ(fs_create(fs, path, strcmp(name, "ccc") == 0 ? FS_DIRECTORY : FS_REGULAR), 0);
+	}
+
+	// 1
+	fs_dir_t *dir = fs_opendir(fs, "/d");
+	ASSERT_NE(dir, nullptr);
+	ASSERT_EQ(fs_telldir(dir), 0u);
+	file_record_t entry;
+	for (const char *name : names)
+	{
+		ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+		ASSERT_STREQ(entry.name, name);
+		ASSERT_EQ(entry.type, strcmp(name, "ccc") == 0 ? FS_DIRECTORY : FS_REGULAR);
+	}
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 0);
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 0);
+	ASSERT_EQ(fs_closedir(dir), 0);
+	dyn_array_t *record_results = fs_get_dir(fs, "/d");
+	ASSERT_NE(record_results, nullptr);
+	ASSERT_EQ(dyn_array_size(record_results), 5u);
+	ASSERT_STREQ(((file_record_t *)dyn_array_at(record_results, 0))->name, "a");
+	dyn_array_destroy(record_results);
+
+	// 2
+	dir = fs_opendir(fs, "/d");
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+	uint64_t cookie = fs_telldir(dir);
+	ASSERT_NE(cookie, 0u);
+	ASSERT_EQ(fs_closedir(dir), 0);
+	ASSERT_EQ(fs_remove(fs, "/d/a"), 0);
+	ASSERT_EQ(fs_create(fs, "/d/f", FS_REGULAR), 0);
+	dir = fs_opendir(fs, "/d");
+	ASSERT_EQ(fs_seekdir(fs, dir, cookie), 0);
+	const char *rest[] = {"ccc", "dddd", "e", "f"};
+	for (const char *name : rest)
+	{
+		ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+		ASSERT_STREQ(entry.name, name);
+	}
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 0);
+
+	// 3
+	ASSERT_EQ(fs_seekdir(fs, dir, 0), 0);
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+	ASSERT_STREQ(entry.name, "bb");
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+	cookie = fs_telldir(dir);
+	ASSERT_EQ(fs_remove(fs, "/d/ccc"), 0);
+	ASSERT_EQ(fs_seekdir(fs, dir, cookie), 0);
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+	ASSERT_STREQ(entry.name, "dddd");
+	ASSERT_EQ(fs_remove(fs, "/d/bb"), 0);
+	ASSERT_EQ(fs_seekdir(fs, dir, fs_telldir(dir)), 0);
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+	ASSERT_STREQ(entry.name, "e");
+	ASSERT_EQ(fs_seekdir(fs, dir, 0), 0);
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+	ASSERT_STREQ(entry.name, "dddd");
+	ASSERT_EQ(fs_closedir(dir), 0);
+
+	// 4
+	ASSERT_EQ(fs_opendir(fs, "/d/e"), nullptr);
+	ASSERT_EQ(fs_opendir(fs, "/nope"), nullptr);
+	ASSERT_EQ(fs_opendir(fs, "d"), nullptr);
+	ASSERT_EQ(fs_opendir(NULL, "/d"), nullptr);
+	ASSERT_EQ(fs_opendir(fs, NULL), nullptr);
+	dir = fs_opendir(fs, "/");
+	ASSERT_NE(dir, nullptr);
+	ASSERT_LT(fs_readdir(NULL, dir, &entry), 0);
+	ASSERT_LT(fs_readdir(fs, dir, NULL), 0);
+	ASSERT_LT(fs_readdir(fs, NULL, &entry), 0);
+	ASSERT_LT(fs_seekdir(fs, NULL, 0), 0);
+	ASSERT_EQ(fs_closedir(dir), 0);
+	ASSERT_LT(fs_closedir(NULL), 0);
+	fs_unmount(fs);
+}
+
+// what the z_tests walk callback saw, from however many threads
+struct walk_seen
+{
+	pthread_mutex_t lock;
+	vector<string> paths;
+	size_t bytes;
+	size_t deepest;
+	const char *prune;	// name whose directory is not entered
+	size_t stop_after;	// entries to take before stopping the walk
+};
+
+static int walk_record(const fs_walk_entry_t *entry, void *arg)
+{
+	walk_seen *seen = (walk_seen *)arg;
+	pthread_mutex_lock(&seen->lock);
+	seen->paths.push_back(entry->path);
+	seen->bytes += entry->size;
+	seen->deepest = entry->depth > seen->deepest ? entry->depth : seen->deepest;
+	bool stop = seen->paths.size() == seen->stop_after;
+	pthread_mutex_unlock(&seen->lock);
+	if (stop)
+	{
+		return -1;
+	}
+	return seen->prune != NULL && strcmp(entry->name, seen->prune) == 0 ? FS_WALK_PRUNE : 0;
+}
+
+/*
+	1. every entry is reported once with its path, a directory linked twice is entered once
+	2. the parallel walk reports the same entries, sizes add up with FS_WALK_SIZE
+	3. a pruned directory is not entered, a walk can start below the root and be stopped
+	4. errors: a file, a missing directory, NULL FS or callback
+*/
+TEST(z_tests, walk)
+{
+	const char *test_fname = "z_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/f", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/a", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/a/g", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/a/b", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/a/b/h", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/a/b/c", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_link(fs, "/a/b", "/linked"), 0);
+	char data[300];
+	memset(data, 'w', sizeof(data));
+	int fd = fs_open(fs, "/f");
+	ASSERT_EQ(fs_write(fs, fd, data, 100), 100);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fd = fs_open(fs, "/a/b/h");
+	ASSERT_EQ(fs_write(fs, fd, data, 300), 300);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// 1
+	walk_seen seen;
+	pthread_mutex_init(&seen.lock, NULL);
+	seen.bytes = seen.deepest = seen.stop_after = 0;
+	seen.prune = NULL;
+	ASSERT_EQ(fs_walk(fs, "/", walk_record, &seen, 0), 7);
+	ASSERT_EQ(seen.paths.size(), 7u);
+	std::sort(seen.paths.begin(), seen.paths.end());
+	vector<string> serial = seen.paths;
+	ASSERT_EQ(serial[0], "/a");
+	ASSERT_EQ(serial[1], "/a/b");
+	ASSERT_EQ(serial[2], "/a/g");
+	ASSERT_EQ(serial[3], "/f");
+	ASSERT_EQ(serial[4], "/linked");
+	ASSERT_TRUE((serial[5] == "/a/b/c" && serial[6] == "/a/b/h") || (serial[5] == "/linked/c" && serial[6] == "/linked/h"));
+	ASSERT_EQ(seen.deepest, serial[5] == "/a/b/c" ? 3u : 2u);
+	ASSERT_EQ(seen.bytes, 0u);
+
+	// 2
+	seen.paths.clear();
+	ASSERT_EQ(fs_walk(fs, "/", walk_record, &seen, FS_WALK_PARALLEL | FS_WALK_SIZE), 7);
+	ASSERT_EQ(seen.bytes, 100u + 300u + 3 * 2 * (6 + 1));	// and the records of /a, /a/b and /linked
+	std::sort(seen.paths.begin(), seen.paths.end());
+	ASSERT_EQ(seen.paths.size(), 7u);
+	for (size_t i = 0; i < 5; i++)
+	{
+		ASSERT_EQ(seen.paths[i], serial[i]);
+	}
+
+	// 3
+	seen.paths.clear();
+	seen.prune = "a";
+	ASSERT_EQ(fs_walk(fs, "/", walk_record, &seen, 0), 5);	// /a/b is still reached as /linked
+	seen.paths.clear();
+	ASSERT_EQ(fs_walk(fs, "/", walk_record, &seen, FS_WALK_PARALLEL), 5);
+	seen.prune = "linked";
+	seen.paths.clear();
+	ASSERT_EQ(fs_walk(fs, "/", walk_record, &seen, 0), 7);	// and the other way round
+	seen.prune = NULL;
+	seen.paths.clear();
+	ASSERT_EQ(fs_walk(fs, "/a/b/", walk_record, &seen, 0), 2);
+	std::sort(seen.paths.begin(), seen.paths.end());
+	ASSERT_EQ(seen.paths[0], "/a/b/c");
+	ASSERT_EQ(seen.paths[1], "/a/b/h");
+	ASSERT_EQ(fs_walk(fs, "/a/b/c", walk_record, &seen, 0), 0);
+	seen.paths.clear();
+	seen.stop_after = 3;
+	ASSERT_LT(fs_walk(fs, "/", walk_record, &seen, 0), 0);
+	ASSERT_EQ(seen.paths.size(), 3u);
+	seen.stop_after = 0;
+
+	// 4
+	ASSERT_LT(fs_walk(fs, "/f", walk_record, &seen, 0), 0);
+	ASSERT_LT(fs_walk(fs, "/nope", walk_record, &seen, 0), 0);
+	ASSERT_LT(fs_walk(NULL, "/", walk_record, &seen, 0), 0);
+	ASSERT_LT(fs_walk(fs, "/", NULL, &seen, 0), 0);
+	pthread_mutex_destroy(&seen.lock);
+	fs_unmount(fs);
+}
+
+/*
+	1. a new file and directory report their type, size, one link, default mode and creation time
+	2. fs_fstat and fs_stat see writes through an open descriptor, links are counted
+	3. fs_chmod sets the mode, and it and the timestamps survive a remount
+	4. errors: missing file, bad descriptor, NULL arguments, mode out of range
+*/
+TEST(aa_tests, stat)
+{
+	const char *test_fname = "aa_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(sizeof(inode_t), (size_t)inode_size);
+	time_t before = time(NULL);
+	ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+
+	// 1
+	fs_stat_t st;
+	ASSERT_EQ(fs_stat(fs, "/file", &st), 0);
+	ASSERT_EQ(st.type, FS_REGULAR);
+	ASSERT_EQ(st.size, 0u);
+	ASSERT_EQ(st.links, 1u);
+	ASSERT_EQ(st.mode, FS_MODE_FILE);
+	ASSERT_GE(st.created, before);
+	ASSERT_LE(st.created, time(NULL));
+	ASSERT_EQ(st.modified, st.created);
+	size_t file_inode = st.inode;
+	ASSERT_EQ(fs_stat(fs, "/dir", &st), 0);
+	ASSERT_EQ(st.type, FS_DIRECTORY);
+	ASSERT_EQ(st.mode, FS_MODE_DIRECTORY);
+	ASSERT_NE(st.inode, file_inode);
+	ASSERT_EQ(fs_stat(fs, "/", &st), 0);
+	ASSERT_EQ(st.inode, 0u);
+	ASSERT_EQ(st.size, (size_t)(6 + 4 + 6 + 3));	// the records of file and dir
+
+	// 2
+	int fd = fs_open(fs, "/file");
+	ASSERT_GE(fd, 0);
+	char data[5000];
+	memset(data, 's', sizeof(data));
+	ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_fstat(fs, fd, &st), 0);
+	ASSERT_EQ(st.size, sizeof(data));
+	ASSERT_EQ(st.inode, file_inode);
+	ASSERT_GE(st.modified, st.created);
+	ASSERT_EQ(fs_stat(fs, "/file", &st), 0);
+	ASSERT_EQ(st.size, sizeof(data));
+	ASSERT_EQ(fs_link(fs, "/file", "/dir/again"), 0);
+	ASSERT_EQ(fs_fstat(fs, fd, &st), 0);
+	ASSERT_EQ(st.links, 2u);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_remove(fs, "/file"), 0);
+	ASSERT_EQ(fs_stat(fs, "/dir/again", &st), 0);
+	ASSERT_EQ(st.links, 1u);
+	ASSERT_EQ(st.size, sizeof(data));
+
+	// 3
+	ASSERT_EQ(fs_chmod(fs, "/dir/again", 0600), 0);
+	ASSERT_EQ(fs_chmod(fs, "/dir", 0), 0);
+	fs_stat_t kept;
+	ASSERT_EQ(fs_stat(fs, "/dir/again", &kept), 0);
+	ASSERT_EQ(kept.mode, 0600);
+	ASSERT_EQ(fs_unmount(fs), 0);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_stat(fs, "/dir/again", &st), 0);
+	ASSERT_EQ(st.mode, 0600);
+	ASSERT_EQ(st.size, kept.size);
+	ASSERT_EQ(st.created, kept.created);
+	ASSERT_EQ(st.modified, kept.modified);
+	ASSERT_EQ(fs_stat(fs, "/dir", &st), 0);
+	ASSERT_EQ(st.mode, 0);
+
+	// 4
+	ASSERT_LT(fs_stat(fs, "/file", &st), 0);
+	ASSERT_LT(fs_stat(fs, "/dir/again", NULL), 0);
+	ASSERT_LT(fs_stat(NULL, "/dir", &st), 0);
+	ASSERT_LT(fs_stat(fs, NULL, &st), 0);
+	ASSERT_LT(fs_fstat(fs, 3, &st), 0);
+	ASSERT_LT(fs_fstat(fs, -1, &st), 0);
+	fd = fs_open(fs, "/dir/again");
+	ASSERT_LT(fs_fstat(fs, fd, NULL), 0);
+	ASSERT_LT(fs_fstat(NULL, fd, &st), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_LT(fs_chmod(fs, "/dir/again", 010000), 0);
+	ASSERT_LT(fs_chmod(fs, "/nope", 0644), 0);
+	ASSERT_LT(fs_chmod(NULL, "/dir", 0644), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. a rename within a directory keeps the file and its place among the entries, whatever the new name's length
+	2. it rewrites the one directory block; open descriptors carry on
+	3. moves across directories, also through a linked directory, keep the file
+	4. errors: taken name, a directory below itself (also through a link), root, relative and missing paths, full directory
+*/
+TEST(ab_tests, rename)
+{
+	const char *test_fname = "ab_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/d", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/d/x", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/d/y", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/d/z", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/d/y");
+	ASSERT_EQ(fs_write(fs, fd, "payload", 7), 7);
+
+	// 1
+	ASSERT_EQ(fs_move(fs, "/d/y", "/d/a_much_longer_name"), 0);
+	ASSERT_EQ(fs_move(fs, "/d/a_much_longer_name", "/d/w"), 0);
+	ASSERT_LT(fs_open(fs, "/d/y"), 0);
+	fs_dir_t *dir = fs_opendir(fs, "/d");
+	file_record_t entry;
+	const char *order[] = {"x", "w", "z"};
+	for (const char *name : order)
+	{
+		ASSERT_EQ(fs_readdir(fs, dir, &entry), 1);
+		ASSERT_STREQ(entry.name, name);
+	}
+	ASSERT_EQ(fs_readdir(fs, dir, &entry), 0);
+	fs_closedir(dir);
+	fs_stat_t st;
+	ASSERT_EQ(fs_stat(fs, "/d", &st), 0);
+	ASSERT_EQ(st.size, (size_t)(3 * (6 + 1)));
+
+	// 2
+	fs_stats_t before, after;
+	if (fs_get_stats(fs, &before) == 0)
+	{
+		ASSERT_EQ(fs_move(fs, "/d/w", "/d/v"), 0);
+		ASSERT_EQ(fs_get_stats(fs, &after), 0);
+		ASSERT_EQ(after.block_writes - before.block_writes, (uint64_t)1);
+	}
+	else
+	{
+		ASSERT_EQ(fs_move(fs, "/d/w", "/d/v"), 0);	// built with FS_NO_STATS
+	}
+	ASSERT_EQ(fs_write(fs, fd, "!", 1), 1);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fd = fs_open(fs, "/d/v");
+	char check[8] = {0};
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), 8);
+	ASSERT_EQ(memcmp(check, "payload!", 8), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// 3
+	ASSERT_EQ(fs_create(fs, "/p", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/p/q", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/p/q/r", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/p/q/s", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_move(fs, "/d/v", "/p/q/r/v"), 0);
+	ASSERT_EQ(fs_move(fs, "/p/q/r/v", "/p/q/s/moved"), 0);
+	ASSERT_EQ(fs_link(fs, "/p/q", "/alias"), 0);
+	ASSERT_EQ(fs_move(fs, "/alias/s/moved", "/p/q/s/renamed"), 0);	// the same directory by two names
+	ASSERT_EQ(fs_stat(fs, "/p/q/s", &st), 0);
+	ASSERT_EQ(st.size, (size_t)(6 + 7));
+	fd = fs_open(fs, "/alias/s/renamed");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), 8);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_move(fs, "/p/q/r", "/d/r"), 0);
+	ASSERT_EQ(fs_create(fs, "/d/r/inside", FS_REGULAR), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+
+	// 4
+	ASSERT_LT(fs_move(fs, "/d/x", "/d/z"), 0);
+	ASSERT_LT(fs_move(fs, "/d/x", "/d/x"), 0);
+	ASSERT_LT(fs_move(fs, "/p", "/p/q/s/p"), 0);
+	ASSERT_LT(fs_move(fs, "/p/q", "/alias/s/q"), 0);
+	ASSERT_LT(fs_move(fs, "/p/q", "/p/q"), 0);
+	ASSERT_LT(fs_move(fs, "/", "/d/root"), 0);
+	ASSERT_LT(fs_move(fs, "/d/x", "/"), 0);
+	ASSERT_LT(fs_move(fs, "d/x", "/d/y"), 0);
+	ASSERT_LT(fs_move(fs, "/d/x", "d/y"), 0);
+	ASSERT_LT(fs_move(fs, "/d/x", "/nope/x"), 0);
+	ASSERT_LT(fs_move(fs, "/d/x", "/d/z/x"), 0);
+	ASSERT_LT(fs_move(fs, "/nope/x", "/d/y"), 0);
+	char long_path[6 + 126 + 1];
+	ASSERT_EQ(fs_create(fs, "/full", FS_DIRECTORY), 0);
+	for (int i = 0; i < 40; i++)	// 40 records of 6 + 96 bytes leave 16 of the block
+	{
+		snprintf(long_path, sizeof(long_path), "/full/%02d%094d", i, 0);
+		ASSERT_EQ(fs_create(fs, long_path, FS_REGULAR), 0);
+	}
+	ASSERT_LT(fs_move(fs, "/d/x", "/full/x0000000000000000"), 0);
+	char longer_path[6 + 126 + 1];
+	snprintf(long_path, sizeof(long_path), "/full/%02d%094d", 0, 0);
+	snprintf(longer_path, sizeof(longer_path), "/full/%02d%0124d", 0, 1);
+	ASSERT_LT(fs_move(fs, long_path, longer_path), 0);
+	ASSERT_GE(fs_open(fs, long_path), 0);
+	ASSERT_GE(fs_open(fs, "/d/x"), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. a view shows the bytes fs_read would, inline, one run of blocks, with holes and compressed alike
+	2. a file in one run is viewed without a block read; the R/W position stays and the view outlives the descriptor
+	3. errors: empty or past-EOF ranges, bad descriptors, views fs_mmap did not give
+*/
+TEST(ac_tests, mmap)
+{
+	const char *test_fname = "ac_tests.FS";
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	static uint8_t data[16 * 4096];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(i * 7 + i / 4096);
+	}
+	static uint8_t text[16 * 4096];
+	for (size_t i = 0; i < sizeof(text); i++)
+	{
+		text[i] = "to be or not to be "[i % 19];
+	}
+
+	// 1
+	ASSERT_EQ(fs_create(fs, "/small", FS_REGULAR), 0);
+	int small = fs_open(fs, "/small");
+	ASSERT_EQ(fs_write(fs, small, data, 100), 100);
+	const uint8_t *view = (const uint8_t *)fs_mmap(fs, small, 10, 90);
+	ASSERT_NE(view, nullptr);
+	ASSERT_EQ(memcmp(view, data + 10, 90), 0);
+	ASSERT_EQ(fs_munmap(fs, view, 90), 0);
+
+	ASSERT_EQ(fs_create(fs, "/run", FS_REGULAR), 0);
+	int run = fs_open(fs, "/run");
+	ASSERT_EQ(fs_write(fs, run, data, 6 * 4096), 6 * 4096);
+	view = (const uint8_t *)fs_mmap(fs, run, 4000, 5 * 4096);
+	ASSERT_NE(view, nullptr);
+	ASSERT_EQ(memcmp(view, data + 4000, 5 * 4096), 0);
+	ASSERT_EQ(fs_munmap(fs, view, 5 * 4096), 0);
+
+	ASSERT_EQ(fs_create(fs, "/holes", FS_REGULAR), 0);
+	int holes = fs_open(fs, "/holes");
+	ASSERT_EQ(fs_write(fs, holes, data, 4096), 4096);
+	ASSERT_EQ(fs_seek(fs, holes, 3 * 4096, FS_SEEK_SET), 3 * 4096);
+	ASSERT_EQ(fs_write(fs, holes, data + 3 * 4096, 4096), 4096);
+	view = (const uint8_t *)fs_mmap(fs, holes, 0, 4 * 4096);
+	ASSERT_NE(view, nullptr);
+	uint8_t expect[4 * 4096] = {0};
+	ASSERT_EQ(fs_seek(fs, holes, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, holes, expect, sizeof(expect)), (ssize_t)sizeof(expect));
+	ASSERT_EQ(memcmp(view, expect, sizeof(expect)), 0);
+	ASSERT_EQ(view[2 * 4096], 0);
+	ASSERT_EQ(fs_munmap(fs, view, 4 * 4096), 0);
+
+	ASSERT_EQ(fs_create(fs, "/text", FS_REGULAR), 0);
+	ASSERT_EQ(fs_set_compressed(fs, "/text", true), 0);
+	int packed = fs_open(fs, "/text");
+	ASSERT_EQ(fs_write(fs, packed, text, sizeof(text)), (ssize_t)sizeof(text));
+	view = (const uint8_t *)fs_mmap(fs, packed, 5000, 9 * 4096);
+	ASSERT_NE(view, nullptr);
+	ASSERT_EQ(memcmp(view, text + 5000, 9 * 4096), 0);
+	ASSERT_EQ(fs_munmap(fs, view, 9 * 4096), 0);
+
+	// 2
+	fs_frag_t frag;
+	ASSERT_EQ(fs_fragmentation(fs, "/run", &frag), 0);
+	fs_stats_t before, after;
+	if (frag.extents == 1 && fs_get_stats(fs, &before) == 0)
+	{
+		view = (const uint8_t *)fs_mmap(fs, run, 0, 6 * 4096);
+		ASSERT_EQ(fs_get_stats(fs, &after), 0);
+		ASSERT_EQ(after.block_reads, before.block_reads);
+		ASSERT_EQ(memcmp(view, data, 6 * 4096), 0);
+		ASSERT_EQ(fs_munmap(fs, view, 6 * 4096), 0);
+	}
+	ASSERT_EQ(fs_seek(fs, run, 0, FS_SEEK_CUR), 6 * 4096);
+	view = (const uint8_t *)fs_mmap(fs, holes, 3 * 4096, 4096);
+	ASSERT_NE(view, nullptr);
+	ASSERT_EQ(fs_close(fs, holes), 0);
+	ASSERT_EQ(memcmp(view, data + 3 * 4096, 4096), 0);
+	ASSERT_EQ(fs_munmap(fs, view, 4096), 0);
+
+	// 3
+	ASSERT_EQ(fs_mmap(fs, run, 0, 0), nullptr);
+	ASSERT_EQ(fs_mmap(fs, run, 6 * 4096 - 10, 11), nullptr);
+	ASSERT_EQ(fs_mmap(fs, run, 6 * 4096 + 1, 1), nullptr);
+	ASSERT_EQ(fs_mmap(fs, holes, 0, 1), nullptr);
+	ASSERT_EQ(fs_mmap(fs, -1, 0, 1), nullptr);
+	ASSERT_EQ(fs_mmap(NULL, run, 0, 1), nullptr);
+	ASSERT_LT(fs_munmap(fs, NULL, 1), 0);
+	ASSERT_LT(fs_munmap(NULL, data, 1), 0);
+	ASSERT_EQ(fs_close(fs, small), 0);
+	ASSERT_EQ(fs_close(fs, run), 0);
+	ASSERT_EQ(fs_close(fs, packed), 0);
+	fs_unmount(fs);
+}
+
+/*
+	1. fs_format keeps the block store layout, fs_format_layout takes either
+	2. the table layout runs files and directories, and hands out every descriptor once
+	3. the layout is kept in the image for fs_mount and fs_mount_snapshot
+	4. errors: unknown layouts, no FS
+*/
+TEST(ad_tests, layout)
+{
+	const char *test_fname = "ad_tests.FS";
+
+	// 1
+	FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_get_layout(fs), FS_LAYOUT_BLOCK_STORE);
+	fs_unmount(fs);
+	fs = fs_mount(test_fname);
+	ASSERT_EQ(fs_get_layout(fs), FS_LAYOUT_BLOCK_STORE);
+	fs_unmount(fs);
+	fs = fs_format_layout(test_fname, FS_LAYOUT_TABLE);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_get_layout(fs), FS_LAYOUT_TABLE);
+
+	// 2
+	ASSERT_EQ(fs_create(fs, "/d", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/d/file", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/d/gone", FS_REGULAR), 0);
+	ASSERT_EQ(fs_link(fs, "/d/file", "/alias"), 0);
+	ASSERT_EQ(fs_remove(fs, "/d/gone"), 0);
+	ASSERT_EQ(fs_create(fs, "/d/again", FS_REGULAR), 0);	// takes the inode /d/gone gave back
+	fs_stat_t st;
+	ASSERT_EQ(fs_stat(fs, "/d/again", &st), 0);
+	ASSERT_EQ(st.inode, (size_t)3);
+	ASSERT_EQ(fs_stat(fs, "/alias", &st), 0);
+	ASSERT_EQ(st.links, (size_t)2);
+	int fds[256];
+	for (int i = 0; i < 256; i++)
+	{
+		fds[i] = fs_open(fs, "/d/file");
+		ASSERT_EQ(fds[i], i);
+	}
+	ASSERT_LT(fs_open(fs, "/alias"), 0);
+	ASSERT_EQ(fs_write(fs, fds[7], "table", 5), 5);
+	ASSERT_EQ(fs_close(fs, fds[100]), 0);
+	ASSERT_LT(fs_close(fs, fds[100]), 0);
+	ASSERT_EQ(fs_open(fs, "/alias"), 100);
+	char check[5];
+	ASSERT_EQ(fs_read(fs, 100, check, sizeof(check)), 5);
+	ASSERT_EQ(memcmp(check, "table", 5), 0);
+	for (int i = 0; i < 256; i++)
+	{
+		ASSERT_EQ(fs_close(fs, fds[i]), 0);
+	}
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+
+	// 3
+	ASSERT_EQ(fs_snapshot(fs, "before"), 0);
+	ASSERT_EQ(fs_remove(fs, "/alias"), 0);
+	ASSERT_EQ(fs_unmount(fs), 0);
+	fs = fs_mount(test_fname);
+	ASSERT_EQ(fs_get_layout(fs), FS_LAYOUT_TABLE);
+	ASSERT_LT(fs_stat(fs, "/alias", &st), 0);
+	int fd = fs_open(fs, "/d/file");
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), 5);
+	ASSERT_EQ(memcmp(check, "table", 5), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+	fs_unmount(fs);
+	fs = fs_mount_snapshot(test_fname, "before");
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_get_layout(fs), FS_LAYOUT_TABLE);
+	ASSERT_EQ(fs_stat(fs, "/alias", &st), 0);
+	ASSERT_LT(fs_create(fs, "/new", FS_REGULAR), 0);
+	fs_unmount(fs);
+
+	// 4
+	ASSERT_EQ(fs_format_layout(test_fname, FS_LAYOUT_COUNT), nullptr);
+	ASSERT_EQ(fs_format_layout(NULL, FS_LAYOUT_TABLE), nullptr);
+	ASSERT_EQ(fs_get_layout(NULL), FS_LAYOUT_COUNT);
+}
+
+/*
+	1. a committed transaction is in the image even when the process dies without fs_unmount,
+	   an open one is not
+	2. a torn journal beside the image is dropped at fs_mount
+	3. fs_txn_abort undoes creates, writes, moves and removes, and closes descriptors opened since
+	4. errors: nested transactions, commit or abort with none open, mounted snapshots
+	5. a whole journal left by a commit that died part way into the image is written in at
+	   fs_mount and removed
+*/
+TEST(ae_tests, txn)
+{
+	const char *test_fname = "ae_tests.FS";
+	const char *journal_fname = "ae_tests.FS.journal";
+	char data[3 * 4096];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (char)(i * 7 + i / 4096);
+	}
+
+	// 1
+	remove(test_fname);
+	pid_t child = fork();
+	ASSERT_GE(child, 0);
+	if (child == 0)
+	{
+		// no asserts past the fork, the exit status says how far it got; no fs_unmount either
+		int fd;
+		fs_stats_t before, after;
+		FS *fs = fs_format(test_fname);
+		if (fs == NULL || fs_txn_begin(fs) != 0 || fs_create(fs, "/first", FS_REGULAR) != 0 || fs_txn_commit(fs) != 0)
+			_exit(1);
+		if (fs_get_stats(fs, &before) != 0 || fs_txn_begin(fs) != 0 || fs_create(fs, "/d", FS_DIRECTORY) != 0
+			|| fs_create(fs, "/d/second", FS_REGULAR) != 0 || (fd = fs_open(fs, "/d/second")) < 0
+			|| fs_write(fs, fd, data, sizeof(data)) != (ssize_t)sizeof(data) || fs_txn_commit(fs) != 0
+			|| fs_get_stats(fs, &after) != 0 || after.syncs - before.syncs != 2)
+			_exit(2);
+		if (fs_txn_begin(fs) != 0 || fs_create(fs, "/third", FS_REGULAR) != 0 || fs_remove(fs, "/first") != 0)
+			_exit(3);
+		_exit(0);
+	}
+	int status;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+	ASSERT_NE(access(test_fname, F_OK), -1);
+	ASSERT_EQ(access(journal_fname, F_OK), -1);
+	FS *fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fs_stat_t st;
+	ASSERT_EQ(fs_stat(fs, "/first", &st), 0);
+	ASSERT_LT(fs_stat(fs, "/third", &st), 0);
+	int fd = fs_open(fs, "/d/second");
+	ASSERT_GE(fd, 0);
+	char check[sizeof(data)];
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+	fs_unmount(fs);
+
+	// 2
+	FILE *torn = fopen(journal_fname, "wb");
+	ASSERT_NE(torn, nullptr);
+	ASSERT_EQ(fwrite(data, 1, 1000, torn), (size_t)1000);
+	fclose(torn);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(access(journal_fname, F_OK), -1);
+	ASSERT_EQ(fs_stat(fs, "/first", &st), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+
+	// 3
+	int before = fs_open(fs, "/d/second");
+	ASSERT_GE(before, 0);
+	ASSERT_EQ(fs_txn_begin(fs), 0);
+	ASSERT_EQ(fs_create(fs, "/new", FS_REGULAR), 0);
+	int during = fs_open(fs, "/new");
+	ASSERT_GE(during, 0);
+	ASSERT_EQ(fs_write(fs, during, data, sizeof(data)), (ssize_t)sizeof(data));
+	ASSERT_EQ(fs_write(fs, before, "changed", 7), 7);
+	ASSERT_EQ(fs_move(fs, "/first", "/d/moved"), 0);
+	ASSERT_EQ(fs_remove(fs, "/d/moved"), 0);
+	ASSERT_EQ(fs_txn_abort(fs), 0);
+	ASSERT_LT(fs_close(fs, during), 0);
+	ASSERT_LT(fs_stat(fs, "/new", &st), 0);
+	ASSERT_LT(fs_stat(fs, "/d/moved", &st), 0);
+	ASSERT_EQ(fs_stat(fs, "/first", &st), 0);
+	ASSERT_EQ(fs_seek(fs, before, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, before, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_close(fs, before), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+	ASSERT_EQ(fs_txn_begin(fs), 0);
+	ASSERT_EQ(fs_create(fs, "/kept", FS_REGULAR), 0);
+	ASSERT_EQ(fs_txn_commit(fs), 0);
+	ASSERT_EQ(access(journal_fname, F_OK), -1);
+
+	// 4
+	ASSERT_LT(fs_txn_commit(fs), 0);
+	ASSERT_LT(fs_txn_abort(fs), 0);
+	ASSERT_EQ(fs_txn_begin(fs), 0);
+	ASSERT_LT(fs_txn_begin(fs), 0);
+	ASSERT_EQ(fs_txn_abort(fs), 0);
+	ASSERT_EQ(fs_snapshot(fs, "snap"), 0);
+	fs_unmount(fs);
+	fs = fs_mount_snapshot(test_fname, "snap");
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_stat(fs, "/kept", &st), 0);
+	ASSERT_LT(fs_txn_begin(fs), 0);
+	fs_unmount(fs);
+	ASSERT_LT(fs_txn_begin(NULL), 0);
+	ASSERT_LT(fs_txn_commit(NULL), 0);
+	ASSERT_LT(fs_txn_abort(NULL), 0);
+
+	// 5
+	child = fork();
+	ASSERT_GE(child, 0);
+	if (child == 0)
+	{
+		// a file size limit lets the journal down but stops the image writes past 16 MiB, the
+		// free block map at the end among them, so the commit stops where a crash could
+		FS *crashing = fs_mount(test_fname);
+		struct rlimit limit = {16 << 20, 16 << 20};
+		signal(SIGXFSZ, SIG_IGN);
+		if (crashing == NULL || setrlimit(RLIMIT_FSIZE, &limit) != 0 || fs_txn_begin(crashing) != 0
+			|| fs_create(crashing, "/replayed", FS_REGULAR) != 0 || (fd = fs_open(crashing, "/replayed")) < 0
+			|| fs_write(crashing, fd, data, sizeof(data)) != (ssize_t)sizeof(data) || fs_txn_commit(crashing) != 0)
+			_exit(1);
+		_exit(0);
+	}
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+	ASSERT_NE(access(journal_fname, F_OK), -1);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(access(journal_fname, F_OK), -1);
+	fd = fs_open(fs, "/replayed");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, check, sizeof(check)), (ssize_t)sizeof(check));
+	ASSERT_EQ(memcmp(check, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_stat(fs, "/kept", &st), 0);
+	ASSERT_EQ(fs_check(fs, 1, false, NULL), 0);
+	fs_unmount(fs);
+}
 
 int main(int argc, char **argv) 
 {